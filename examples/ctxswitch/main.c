@@ -0,0 +1,96 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *
+ *  This file is part of PRS.
+ *
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  portableruntimesystem@gmail.com
+ */
+
+/*
+ * Measures the cost of a voluntary context switch. Two tasks of the same priority yield to each other, and the cycles
+ * per switch are compared with those of a yield that has no other task to switch to. Voluntary switches only restore
+ * the callee-saved registers of the task that is switched to: build PRS with PRS_CONTEXT_FULL_RESTORE defined, e.g.
+ * CFLAGS=-DPRS_CONTEXT_FULL_RESTORE make prs.all, to have them go through the full restore path of interrupted tasks
+ * instead, and compare the two reports.
+ */
+
+#include <prs/pal/cycles.h>
+#include <pr.h>
+
+#define YIELD_COUNT                     200000
+#define ROUND_COUNT                     5
+#define TASK_PRIO                       10
+
+static volatile prs_bool_t s_stop;
+static volatile prs_bool_t s_partner_done;
+
+static void partner_entry(void* userdata)
+{
+    while (!s_stop) {
+        pr_yield();
+    }
+    s_partner_done = PRS_TRUE;
+}
+
+/* Returns the fewest cycles per yield of the current task over several rounds */
+static prs_cycles_t measure(void)
+{
+    prs_cycles_t best = (prs_cycles_t)-1;
+    for (int round = 0; round < ROUND_COUNT; ++round) {
+        const prs_cycles_t start = prs_cycles_now();
+        for (int i = 0; i < YIELD_COUNT; ++i) {
+            pr_yield();
+        }
+        const prs_cycles_t elapsed = prs_cycles_now() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best / YIELD_COUNT;
+}
+
+int pr_main(int argc, char* argv[])
+{
+    pr_task_set_prio(pr_task_get_current(), TASK_PRIO);
+
+    /* Alone at its priority, this task is resumed by each of its yields */
+    const prs_cycles_t alone = measure();
+
+    struct pr_task_create_params params = {
+        .stack_size = 16384,
+        .prio = TASK_PRIO,
+        .entry = partner_entry,
+        .sched_id = pr_sched_get_current()
+    };
+    PR_FATAL_WHEN(!pr_task_create(&params));
+
+    /* Each yield of this task now switches to the partner, whose own yield switches back */
+    const prs_cycles_t switching = measure() / 2;
+
+    s_stop = PRS_TRUE;
+    while (!s_partner_done) {
+        pr_yield();
+    }
+
+    pr_log("ctxswitch: %llu cycles per yield without a switch, %llu with a switch, %llu cycles per switch",
+        (unsigned long long)alone, (unsigned long long)switching,
+        (unsigned long long)(switching > alone ? switching - alone : 0));
+
+    pr_system_exit(0);
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *
+ *  This file is part of PRS.
+ *
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  portableruntimesystem@gmail.com
+ */
+
+/*
+ * Destroys an object and keeps its ID, then creates and destroys objects until the entry of the global object directory
+ * that held the object gives the same ID again. The stale ID must be rejected until then, and the ID must only come
+ * back after the count of reuses in object IDs wrapped around, which takes at least REUSE_PERIOD reuses of the entry.
+ */
+
+#include <pr.h>
+
+/* Number of reuses of an entry before its IDs come back, with the default PRS_MAX_GOD_ENTRIES */
+#define REUSE_PERIOD                    32768
+/* Objects that stay in use during the test, so that few entries are free and each one is reused often */
+#define HELD_OBJECTS                    960
+
+int pr_main(int argc, char* argv[])
+{
+    static pr_mutex_id_t held[HELD_OBJECTS];
+    for (int i = 0; i < HELD_OBJECTS; ++i) {
+        held[i] = pr_mutex_create();
+        PR_FATAL_WHEN(!held[i]);
+    }
+
+    const pr_mutex_id_t stale_id = pr_mutex_create();
+    PR_FATAL_WHEN(!stale_id);
+    pr_mutex_destroy(stale_id);
+
+    prs_uint64_t count = 0;
+    for (;;) {
+        const pr_mutex_id_t mutex_id = pr_mutex_create();
+        PR_FATAL_WHEN(!mutex_id);
+        /* The most significant bit of IDs is never set */
+        PR_FATAL_WHEN(mutex_id & 0x80000000);
+        ++count;
+        if (mutex_id == stale_id) {
+            /* Once the ID came back, it designates the new object */
+            PR_FATAL_WHEN(pr_mutex_try_lock(stale_id) != PR_OK);
+            pr_mutex_unlock(mutex_id);
+            pr_mutex_destroy(mutex_id);
+            break;
+        }
+        pr_mutex_destroy(mutex_id);
+        PR_FATAL_WHEN(pr_mutex_try_lock(stale_id) != PR_NOT_FOUND);
+    }
+    PR_FATAL_WHEN(count < REUSE_PERIOD);
+
+    for (int i = 0; i < HELD_OBJECTS; ++i) {
+        pr_mutex_destroy(held[i]);
+    }
+
+    pr_log("godwrap: ID 0x%08X came back after %u objects were created", stale_id, (unsigned)count);
+
+    pr_system_exit(0);
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *
+ *  This file is part of PRS.
+ *
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  portableruntimesystem@gmail.com
+ */
+
+/*
+ * Measures how late microsecond sleeps and message receive timeouts wake up, and reports the distribution of the
+ * lateness for several durations, from below the tick period to a few ticks.
+ */
+
+#include <pr.h>
+
+#define SAMPLE_COUNT                    200
+#define BUCKET_COUNT                    6
+
+union pr_msg {
+    pr_msg_id_t                         id;
+};
+
+/* Upper bounds of the lateness buckets, in microseconds, the last one being unbounded */
+static const prs_uint64_t s_bucket_limits[BUCKET_COUNT - 1] = { 10, 50, 100, 500, 1000 };
+
+static const int s_durations[] = { 50, 200, 700, 2500 };
+
+static void report(const char* name, int duration, prs_uint64_t* lateness)
+{
+    prs_uint_t buckets[BUCKET_COUNT] = { 0 };
+    prs_uint64_t sum = 0;
+    prs_uint64_t worst = 0;
+    for (int i = 0; i < SAMPLE_COUNT; ++i) {
+        int bucket = 0;
+        while (bucket < BUCKET_COUNT - 1 && lateness[i] >= s_bucket_limits[bucket]) {
+            ++bucket;
+        }
+        ++buckets[bucket];
+        sum += lateness[i];
+        if (lateness[i] > worst) {
+            worst = lateness[i];
+        }
+    }
+
+    pr_log("jitter: %s %d us: average %llu us, worst %llu us, "
+        "<10 us: %u, <50 us: %u, <100 us: %u, <500 us: %u, <1000 us: %u, more: %u", name, duration,
+        (unsigned long long)(sum / SAMPLE_COUNT), (unsigned long long)worst,
+        buckets[0], buckets[1], buckets[2], buckets[3], buckets[4], buckets[5]);
+}
+
+int pr_main(int argc, char* argv[])
+{
+    static prs_uint64_t lateness[SAMPLE_COUNT];
+
+    for (int d = 0; d < (int)(sizeof(s_durations) / sizeof(s_durations[0])); ++d) {
+        const int duration = s_durations[d];
+
+        for (int i = 0; i < SAMPLE_COUNT; ++i) {
+            const prs_uint64_t start = pr_time_get_us();
+            pr_sleep_us(duration);
+            lateness[i] = pr_time_get_us() - start - duration;
+        }
+        report("sleep", duration, lateness);
+
+        for (int i = 0; i < SAMPLE_COUNT; ++i) {
+            const prs_uint64_t start = pr_time_get_us();
+            union pr_msg* msg = pr_msg_recv_timeout_us(duration);
+            lateness[i] = pr_time_get_us() - start - duration;
+            PR_FATAL_WHEN(msg);
+        }
+        report("receive timeout", duration, lateness);
+    }
+
+    pr_system_exit(0);
+
+    return 0;
+}
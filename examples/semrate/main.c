@@ -0,0 +1,166 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *
+ *  This file is part of PRS.
+ *
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  portableruntimesystem@gmail.com
+ */
+
+/*
+ * Measures the throughput of semaphore waits and signals. Uncontended waits find a positive count and return
+ * immediately. Contended waits block: two tasks hand a count back and forth, then several tasks share a single count
+ * and keep it across a yield, so that the others wait for it.
+ */
+
+#include <prs/pal/atomic.h>
+#include <pr.h>
+
+#define UNCONTENDED_COUNT               1000000
+#define HANDOFF_COUNT                   50000
+#define SHARED_TASK_COUNT               4
+#define SHARED_COUNT                    20000
+#define TASK_PRIO                       10
+
+struct handoff {
+    pr_sem_id_t                         ping;
+    pr_sem_id_t                         pong;
+};
+
+/* The tasks may run on several workers at once */
+static PRS_ATOMIC prs_uint_t s_done;
+
+static pr_sem_id_t create_sem(prs_int_t initial_count)
+{
+    struct pr_sem_create_params params = {
+        .max_count = 1 << 30,
+        .initial_count = initial_count
+    };
+    const pr_sem_id_t sem_id = pr_sem_create(&params);
+    PR_FATAL_WHEN(!sem_id);
+    return sem_id;
+}
+
+static void create_task(void (*entry)(void*), void* userdata)
+{
+    struct pr_task_create_params params = {
+        .userdata = userdata,
+        .stack_size = 16384,
+        .prio = TASK_PRIO,
+        .entry = entry,
+        .sched_id = pr_sched_get_current()
+    };
+    PR_FATAL_WHEN(!pr_task_create(&params));
+}
+
+static void report(const char* name, prs_uint64_t count, prs_uint64_t start)
+{
+    const prs_uint64_t elapsed = pr_time_get_us() - start;
+    pr_log("semrate: %s, %llu ns per wait and signal", name, (unsigned long long)(elapsed * 1000 / count));
+}
+
+static void run_uncontended(void)
+{
+    const pr_sem_id_t sem_id = create_sem(1);
+
+    prs_uint64_t start = pr_time_get_us();
+    for (int i = 0; i < UNCONTENDED_COUNT; ++i) {
+        pr_sem_wait(sem_id);
+        pr_sem_signal(sem_id);
+    }
+    report("uncontended", UNCONTENDED_COUNT, start);
+
+    start = pr_time_get_us();
+    for (int i = 0; i < UNCONTENDED_COUNT; ++i) {
+        PR_FATAL_WHEN(pr_sem_wait_timeout(sem_id, 1000) != PR_OK);
+        pr_sem_signal(sem_id);
+    }
+    report("uncontended with timeout", UNCONTENDED_COUNT, start);
+
+    pr_sem_destroy(sem_id);
+}
+
+static void handoff_entry(void* userdata)
+{
+    const struct handoff* handoff = userdata;
+
+    for (int i = 0; i < HANDOFF_COUNT; ++i) {
+        pr_sem_wait(handoff->ping);
+        pr_sem_signal(handoff->pong);
+    }
+}
+
+static void run_handoff(void)
+{
+    struct handoff handoff = {
+        .ping = create_sem(0),
+        .pong = create_sem(0)
+    };
+    create_task(handoff_entry, &handoff);
+
+    const prs_uint64_t start = pr_time_get_us();
+    for (int i = 0; i < HANDOFF_COUNT; ++i) {
+        pr_sem_signal(handoff.ping);
+        pr_sem_wait(handoff.pong);
+    }
+    /* Each round trip has two waits and two signals */
+    report("contended handoff", HANDOFF_COUNT * 2, start);
+
+    pr_sem_destroy(handoff.ping);
+    pr_sem_destroy(handoff.pong);
+}
+
+static void shared_entry(void* userdata)
+{
+    const pr_sem_id_t sem_id = (pr_sem_id_t)(prs_uintptr_t)userdata;
+
+    for (int i = 0; i < SHARED_COUNT; ++i) {
+        pr_sem_wait(sem_id);
+        pr_yield();
+        pr_sem_signal(sem_id);
+    }
+    prs_pal_atomic_fetch_add(&s_done, 1);
+}
+
+static void run_shared(void)
+{
+    const pr_sem_id_t sem_id = create_sem(1);
+
+    prs_pal_atomic_store(&s_done, 0);
+    const prs_uint64_t start = pr_time_get_us();
+    for (int i = 0; i < SHARED_TASK_COUNT; ++i) {
+        create_task(shared_entry, (void*)(prs_uintptr_t)sem_id);
+    }
+    while (prs_pal_atomic_load(&s_done) < SHARED_TASK_COUNT) {
+        pr_yield();
+    }
+    report("contended by several tasks", SHARED_TASK_COUNT * SHARED_COUNT, start);
+
+    pr_sem_destroy(sem_id);
+}
+
+int pr_main(int argc, char* argv[])
+{
+    pr_task_set_prio(pr_task_get_current(), TASK_PRIO);
+
+    run_uncontended();
+    run_handoff();
+    run_shared();
+
+    pr_system_exit(0);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *
+ *  This file is part of PRS.
+ *
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  portableruntimesystem@gmail.com
+ */
+
+/*
+ * Runs CPU-bound worker tasks on the scheduler of the main task, and reports how long they take to complete. When PRS
+ * is built with PRS_SCHED_DEFAULT set to PRS_SCHED_SWSTEAL, all the cores share that scheduler and the tasks are
+ * spread over their workers, so the run takes about the time of a single task times the number of tasks divided by the
+ * number of cores.
+ */
+
+#include <pr.h>
+
+#define TASK_COUNT                      16
+#define TASK_ROUNDS                     200
+#define ROUND_ITERATIONS                100000
+
+union pr_msg {
+    pr_msg_id_t                         id;
+};
+
+static volatile prs_uint_t s_sink;
+
+static void task_entry(void* userdata)
+{
+    const pr_task_id_t parent_id = (pr_task_id_t)(prs_uintptr_t)userdata;
+
+    prs_uint_t value = 0;
+    for (int round = 0; round < TASK_ROUNDS; ++round) {
+        for (int i = 0; i < ROUND_ITERATIONS; ++i) {
+            value = value * 31 + i;
+        }
+        /* Give the other workers a chance to steal the tasks that are queued behind this one */
+        pr_yield();
+    }
+    s_sink = value;
+
+    union pr_msg* msg = pr_msg_alloc(0, sizeof(*msg));
+    pr_msg_send(parent_id, msg);
+}
+
+int pr_main(int argc, char* argv[])
+{
+    const prs_uint64_t start = pr_time_get_us();
+
+    for (int i = 0; i < TASK_COUNT; ++i) {
+        struct pr_task_create_params params = {
+            .userdata = (void*)(prs_uintptr_t)pr_task_get_current(),
+            .stack_size = 16384,
+            .prio = 10,
+            .entry = task_entry,
+            .sched_id = pr_sched_get_current()
+        };
+        const pr_task_id_t task_id = pr_task_create(&params);
+        PR_FATAL_WHEN(!task_id);
+    }
+
+    for (int i = 0; i < TASK_COUNT; ++i) {
+        union pr_msg* msg = pr_msg_recv();
+        pr_msg_free(msg);
+    }
+
+    pr_log("swsteal: %d tasks completed in %u ms", TASK_COUNT, (unsigned)((pr_time_get_us() - start) / 1000));
+
+    pr_system_exit(0);
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *
+ *  This file is part of PRS.
+ *
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  portableruntimesystem@gmail.com
+ */
+
+/*
+ * Measures how many short-lived tasks can be created, run and destroyed per second, when the tasks are named,
+ * anonymous, or anonymous and created in batches. The tasks are created in waves, and the stacks of each wave are
+ * reused by the next one. The waves are not larger than the number of stacks that the stack caches keep in physical
+ * memory, PRS_STACK_CACHE_RESIDENT_STACKS, so that the stacks are reused without page faults.
+ */
+
+#include <string.h>
+
+#include <prs/pal/atomic.h>
+#include <pr.h>
+
+#define TASK_COUNT                      20000
+#define WAVE_SIZE                       16
+#define TASK_PRIO                       10
+
+/* The tasks may run on several workers at once */
+static PRS_ATOMIC prs_uint_t s_done;
+
+static void task_entry(void* userdata)
+{
+    prs_pal_atomic_fetch_add(&s_done, 1);
+}
+
+static void wait_wave(prs_uint_t count)
+{
+    /* The tasks have the priority of this task, so yielding lets them run */
+    while (prs_pal_atomic_load(&s_done) < count) {
+        pr_yield();
+    }
+}
+
+enum mode {
+    MODE_NAMED,
+    MODE_ANONYMOUS,
+    MODE_BATCH
+};
+
+static const char* s_mode_names[] = { "named", "anonymous", "anonymous batch" };
+
+static void run(enum mode mode, prs_size_t stack_size)
+{
+    struct pr_task_create_params params = {
+        .stack_size = stack_size,
+        .prio = TASK_PRIO,
+        .entry = task_entry,
+        .sched_id = pr_sched_get_current()
+    };
+    if (mode == MODE_NAMED) {
+        strcpy(params.name, "taskrate");
+    }
+
+    prs_pal_atomic_store(&s_done, 0);
+    const prs_uint64_t start = pr_time_get_us();
+    for (prs_uint_t created = 0; created < TASK_COUNT; created += WAVE_SIZE) {
+        if (mode == MODE_BATCH) {
+            pr_task_id_t task_ids[WAVE_SIZE];
+            PR_FATAL_WHEN(pr_task_create_batch(&params, 0, WAVE_SIZE, task_ids) != WAVE_SIZE);
+        } else {
+            for (prs_uint_t i = 0; i < WAVE_SIZE; ++i) {
+                PR_FATAL_WHEN(!pr_task_create(&params));
+            }
+        }
+        wait_wave(created + WAVE_SIZE);
+    }
+    const prs_uint64_t elapsed = pr_time_get_us() - start;
+
+    pr_log("taskrate: %s, %u KiB stacks, %llu tasks per second", s_mode_names[mode], (unsigned)(stack_size / 1024),
+        (unsigned long long)(TASK_COUNT * 1000000ull / (elapsed ? elapsed : 1)));
+}
+
+int pr_main(int argc, char* argv[])
+{
+    pr_task_set_prio(pr_task_get_current(), TASK_PRIO);
+
+    run(MODE_NAMED, 16384);
+    run(MODE_ANONYMOUS, 16384);
+    run(MODE_BATCH, 16384);
+    run(MODE_NAMED, 65536);
+
+    pr_system_exit(0);
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *
+ *  This file is part of PRS.
+ *
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  portableruntimesystem@gmail.com
+ */
+
+/*
+ * Measures the request/response latency between two tasks, first without timeouts, then with receive timeouts that are
+ * armed and canceled on every message because the response always arrives long before they expire.
+ */
+
+#include <pr.h>
+
+#define REQUEST_COUNT                   50000
+#define TIMEOUT_TICKS                   1000
+#define TIMEOUT_US                      1000000
+
+enum mode {
+    MODE_NO_TIMEOUT,
+    MODE_TIMEOUT,
+    MODE_TIMEOUT_US
+};
+
+union pr_msg {
+    pr_msg_id_t                         id;
+};
+
+struct server_params {
+    pr_task_id_t                        client_id;
+    enum mode                           mode;
+};
+
+static union pr_msg* recv_msg(enum mode mode)
+{
+    union pr_msg* msg;
+    switch (mode) {
+    case MODE_TIMEOUT:
+        msg = pr_msg_recv_timeout(TIMEOUT_TICKS);
+        break;
+    case MODE_TIMEOUT_US:
+        msg = pr_msg_recv_timeout_us(TIMEOUT_US);
+        break;
+    default:
+        msg = pr_msg_recv();
+        break;
+    }
+    PR_FATAL_WHEN(!msg);
+    return msg;
+}
+
+static void server_entry(void* userdata)
+{
+    const struct server_params* params = userdata;
+
+    for (int i = 0; i < REQUEST_COUNT; ++i) {
+        union pr_msg* msg = recv_msg(params->mode);
+        pr_msg_send(params->client_id, msg);
+    }
+}
+
+static void run(const char* name, enum mode mode)
+{
+    struct server_params server_params = {
+        .client_id = pr_task_get_current(),
+        .mode = mode
+    };
+    struct pr_task_create_params params = {
+        .userdata = &server_params,
+        .stack_size = 16384,
+        .prio = 10,
+        .entry = server_entry,
+        .sched_id = pr_sched_get_current()
+    };
+    const pr_task_id_t server_id = pr_task_create(&params);
+    PR_FATAL_WHEN(!server_id);
+
+    union pr_msg* msg = pr_msg_alloc(0, sizeof(*msg));
+    const prs_uint64_t start = pr_time_get_us();
+    for (int i = 0; i < REQUEST_COUNT; ++i) {
+        pr_msg_send(server_id, msg);
+        msg = recv_msg(mode);
+    }
+    const prs_uint64_t elapsed = pr_time_get_us() - start;
+    pr_msg_free(msg);
+
+    pr_log("timeout: %s, %llu ns per request", name, (unsigned long long)(elapsed * 1000 / REQUEST_COUNT));
+}
+
+int pr_main(int argc, char* argv[])
+{
+    run("no timeout", MODE_NO_TIMEOUT);
+    run("timeout in ticks", MODE_TIMEOUT);
+    run("timeout in microseconds", MODE_TIMEOUT_US);
+
+    pr_system_exit(0);
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *
+ *  This file is part of PRS.
+ *
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  portableruntimesystem@gmail.com
+ */
+
+/*
+ * Measures how long a high priority task takes to run once it is woken up by a message, while the workers of its
+ * scheduler are busy with low priority tasks. One more worker is kept busy at each step, so the latency is reported as
+ * the number of running workers grows, up to the number of cores.
+ */
+
+#include <prs/pal/atomic.h>
+#include <prs/systeminfo.h>
+#include <pr.h>
+
+#define PING_COUNT                      20000
+#define WAITER_PRIO                     2
+#define MAIN_PRIO                       5
+#define BUSY_PRIO                       20
+
+union pr_msg {
+    pr_msg_id_t                         id;
+};
+
+static volatile prs_bool_t s_stop;
+/* The busy tasks run on several workers at once */
+static PRS_ATOMIC prs_uint_t s_busy_running;
+
+static void busy_entry(void* userdata)
+{
+    prs_pal_atomic_fetch_add(&s_busy_running, 1);
+    while (!s_stop) {
+    }
+    prs_pal_atomic_fetch_sub(&s_busy_running, 1);
+}
+
+static void waiter_entry(void* userdata)
+{
+    const pr_task_id_t parent_id = (pr_task_id_t)(prs_uintptr_t)userdata;
+
+    for (;;) {
+        union pr_msg* msg = pr_msg_recv();
+        if (msg->id) {
+            pr_msg_free(msg);
+            break;
+        }
+        pr_msg_send(parent_id, msg);
+    }
+}
+
+static pr_task_id_t create_task(void (*entry)(void*), pr_task_prio_t prio, void* userdata)
+{
+    struct pr_task_create_params params = {
+        .userdata = userdata,
+        .stack_size = 16384,
+        .prio = prio,
+        .entry = entry,
+        .sched_id = pr_sched_get_current()
+    };
+    const pr_task_id_t task_id = pr_task_create(&params);
+    PR_FATAL_WHEN(!task_id);
+    return task_id;
+}
+
+int pr_main(int argc, char* argv[])
+{
+    /* Run above the busy tasks, so that they cannot keep this task from running */
+    pr_task_set_prio(pr_task_get_current(), MAIN_PRIO);
+    pr_yield();
+
+    const pr_task_id_t waiter_id = create_task(waiter_entry, WAITER_PRIO, (void*)(prs_uintptr_t)pr_task_get_current());
+    const prs_int_t core_count = pr_systeminfo_get()->core_count;
+
+    for (prs_int_t busy = 0; busy < core_count; ++busy) {
+        if (busy) {
+            create_task(busy_entry, BUSY_PRIO, 0);
+        }
+
+        union pr_msg* msg = pr_msg_alloc(0, sizeof(*msg));
+        const prs_uint64_t start = pr_time_get_us();
+        for (int i = 0; i < PING_COUNT; ++i) {
+            pr_msg_send(waiter_id, msg);
+            msg = pr_msg_recv();
+        }
+        const prs_uint64_t elapsed = pr_time_get_us() - start;
+        pr_msg_free(msg);
+
+        /* Each round trip wakes up the waiter, then this task */
+        pr_log("wakeup: %d busy workers, %llu ns from wakeup to run", (int)busy,
+            (unsigned long long)(elapsed * 1000 / (PING_COUNT * 2)));
+    }
+
+    union pr_msg* msg = pr_msg_alloc(1, sizeof(*msg));
+    pr_msg_send(waiter_id, msg);
+
+    s_stop = PRS_TRUE;
+    while (prs_pal_atomic_load(&s_busy_running)) {
+        pr_sleep_ms(1);
+    }
+
+    pr_system_exit(0);
+
+    return 0;
+}
@@ -66,7 +66,8 @@ typedef enum pr_result {
     PR_ALREADY_EXISTS,
     PR_EMPTY,
     PR_LOCKED,
-    PR_TIMEOUT
+    PR_TIMEOUT,
+    PR_FULL
 } pr_result_t;
 
 /**
@@ -89,12 +90,46 @@ PR_EXPORT pr_int_flag_t pr_int_disable(void);
  */
 PR_EXPORT void pr_int_enable(void);
 
+/**
+ * \brief
+ *  Safepoint of the current task, as returned by \ref pr_safepoint_get. It points to the preemption request word of
+ *  the worker running the task, and remains valid for the lifetime of the task even if it moves to another worker.
+ */
+typedef const volatile int* const volatile* pr_safepoint_t;
+
+/**
+ * \brief
+ *  Returns the safepoint of the current task, to be polled with \ref PR_SAFEPOINT.
+ */
+PR_EXPORT pr_safepoint_t pr_safepoint_get(void);
+
+/**
+ * \brief
+ *  Yields the current task if a preemption request is pending. Prefer \ref PR_SAFEPOINT, which only calls this
+ *  function when needed.
+ */
+PR_EXPORT void pr_safepoint(void);
+
+/**
+ * \brief
+ *  Polls the safepoint \p sp returned by \ref pr_safepoint_get, and yields the current task if a preemption request is
+ *  pending. This is cheap enough to be used on loop back-edges, so that long running loops can be preempted without
+ *  a signal when \ref PRS_SAFEPOINT is defined.
+ */
+#define PR_SAFEPOINT(sp)                do { if (**(sp)) { pr_safepoint(); } } while (0)
+
 /**
  * \brief
  *  Type that contains elapsed ticks since PRS was started.
  */
 typedef PRS_TICKS_TYPE pr_ticks_t;
 
+/**
+ * \brief
+ *  Timeout value that waits without a time limit.
+ */
+#define PR_TIMEOUT_INFINITE             ((pr_ticks_t)-1)
+
 /**
  * \brief
  *  Returns the number of ticks elapsed since PRS was started.
@@ -107,6 +142,12 @@ PR_EXPORT pr_ticks_t pr_ticks_get(void);
  */
 PR_EXPORT pr_ticks_t pr_ticks_per_second(void);
 
+/**
+ * \brief
+ *  Returns the number of microseconds elapsed since PRS was started.
+ */
+PR_EXPORT prs_uint64_t pr_time_get_us(void);
+
 /**
  * \brief
  *  Allocate process memory. This is memory that should not be accessed by other dynamically loaded PRS executables.
@@ -165,12 +206,26 @@ typedef prs_object_id_t pr_task_id_t;
  */
 typedef PRS_TASK_PRIO_TYPE pr_task_prio_t;
 
+/**
+ * \brief
+ *  Behavior of a bounded task message queue when it is full.
+ */
+typedef enum pr_msgq_full_policy {
+    /** \brief Senders wait until the task makes room in its message queue. The task itself drops its messages. */
+    PR_MSGQ_FULL_BLOCK = 0,
+    /** \brief Messages are dropped and counted. */
+    PR_MSGQ_FULL_DROP
+} pr_msgq_full_policy_t;
+
 /**
  * \brief
  *  Task creation parameters.
  */
 struct pr_task_create_params {
-    /** \brief The task name that can be used to locate the task with \ref pr_task_find. */
+    /**
+     * \brief The task name that can be used to locate the task with \ref pr_task_find. Empty for an anonymous task,
+     * which is cheaper to create but cannot be located.
+     */
     char                                name[PRS_MAX_TASK_NAME];
     /** \brief Data that is passed as a parameter to the entry point of the task. */
     void*                               userdata;
@@ -182,6 +237,14 @@ struct pr_task_create_params {
     void                                (*entry)(void* userdata);
     /** \brief Scheduler on which the task will run. */
     pr_sched_id_t                       sched_id;
+    /** \brief Maximum number of messages queued for the task. Zero if the message queue is unbounded. */
+    prs_uint_t                          msgq_capacity;
+    /** \brief Behavior of \ref pr_msg_send when the message queue of the task is full. */
+    pr_msgq_full_policy_t               msgq_full_policy;
+    /** \brief Relative deadline of each job of the task, in ticks. Zero if the task has no deadline. */
+    pr_ticks_t                          deadline;
+    /** \brief Minimum number of ticks between two job releases of the task. Zero if the task is not periodic. */
+    pr_ticks_t                          period;
 };
 
 /**
@@ -206,7 +269,9 @@ PR_EXPORT pr_result_t pr_task_get_prio(pr_task_id_t task_id, pr_task_prio_t* pri
  * \brief
  *  Sets the priority of the specified task.
  * \note
- *  It is not possible to set the priority of a task other than the currently executing task.
+ *  When the task is not the currently executing task, schedulers that cannot move a ready task to another priority
+ *  apply the change the next time the task is made ready. While the task holds mutexes, a higher priority inherited
+ *  from the tasks waiting for them is kept until it releases its last mutex.
  */
 PR_EXPORT pr_result_t pr_task_set_prio(pr_task_id_t task_id, pr_task_prio_t prio);
 
@@ -216,6 +281,57 @@ PR_EXPORT pr_result_t pr_task_set_prio(pr_task_id_t task_id, pr_task_prio_t prio
  */
 PR_EXPORT prs_size_t pr_task_get_stack_size(pr_task_id_t task_id);
 
+/**
+ * \brief
+ *  Stack usage of a task returned by \ref pr_task_get_stack_usage.
+ */
+struct pr_task_stack_usage {
+    /** \brief Size of the stack that is committed to memory. */
+    prs_size_t                          committed_size;
+    /** \brief Deepest stack usage that was observed, in bytes. */
+    prs_size_t                          high_water;
+    /** \brief Number of times the stack was grown because it overflowed its committed size. */
+    prs_uint_t                          grows;
+};
+
+/**
+ * \brief
+ *  Returns the stack usage of the specified task.
+ * \note
+ *  Unless PRS is built with PRS_STACK_SCAN, the high-water mark is sampled when the task is switched out and when its
+ *  stack grows, so the actual peak usage may be slightly higher.
+ */
+PR_EXPORT pr_result_t pr_task_get_stack_usage(pr_task_id_t task_id, struct pr_task_stack_usage* usage);
+
+/**
+ * \brief
+ *  Message queue statistics of a task returned by \ref pr_task_get_msgq_stats.
+ */
+struct pr_msgq_stats {
+    /** \brief Number of messages waiting in the queue. */
+    prs_uint_t                          depth;
+    /** \brief Largest number of messages that were waiting in the queue at once. */
+    prs_uint_t                          high_water;
+    /** \brief Maximum number of messages in the queue. Zero if the queue is unbounded. */
+    prs_uint_t                          capacity;
+    /** \brief Number of messages that were dropped because the queue was full. */
+    prs_uint64_t                        dropped;
+};
+
+/**
+ * \brief
+ *  Returns the message queue statistics of the specified task.
+ */
+PR_EXPORT pr_result_t pr_task_get_msgq_stats(pr_task_id_t task_id, struct pr_msgq_stats* stats);
+
+/**
+ * \brief
+ *  Returns the number of deadlines missed by the specified task.
+ * \note
+ *  Deadlines are only accounted for by deadline schedulers.
+ */
+PR_EXPORT prs_uint_t pr_task_get_deadline_misses(pr_task_id_t task_id);
+
 /**
  * \brief
  *  Create the task as specified by the parameters.
@@ -226,6 +342,25 @@ PR_EXPORT prs_size_t pr_task_get_stack_size(pr_task_id_t task_id);
  */
 PR_EXPORT pr_task_id_t pr_task_create(struct pr_task_create_params* task_create_params);
 
+/**
+ * \brief
+ *  Creates multiple tasks that share the same parameters, except for their userdata.
+ * \param task_create_params
+ *  The parameters of the tasks. Its userdata is used when \p userdata is \p null.
+ * \param userdata
+ *  Array of \p count userdata, one for each task, or \p null.
+ * \param count
+ *  Number of tasks to create.
+ * \param task_ids
+ *  Receives the task object IDs of the created tasks.
+ * \return
+ *  Returns the number of tasks that were created, which is less than \p count if a task creation failed.
+ * \note
+ *  Creating tasks in a batch is cheaper than calling \ref pr_task_create repeatedly, especially for anonymous tasks.
+ */
+PR_EXPORT prs_uint_t pr_task_create_batch(struct pr_task_create_params* task_create_params, void* const* userdata,
+    prs_uint_t count, pr_task_id_t* task_ids);
+
 /**
  * \brief
  *  Returns the task object ID corresponding to the specified name.
@@ -275,9 +410,44 @@ PR_EXPORT void pr_msg_free(union pr_msg* msg);
  *  Task object ID specifying the task to send the message to.
  * \param msg
  *  Message to send.
+ * \note
+ *  If the message queue of the task is bounded and full, the call waits until there is room in the queue, or the
+ *  message is dropped, depending on the \ref pr_msgq_full_policy_t of the task. A task that sends a message to itself
+ *  never waits, since it would be the one to make room. A message that is dropped, or that is sent to a task that does
+ *  not exist, is freed.
  */
 PR_EXPORT void pr_msg_send(pr_task_id_t task_id, union pr_msg* msg);
 
+/**
+ * \brief
+ *  Send the message to the specified task, unless its message queue is full.
+ * \param task_id
+ *  Task object ID specifying the task to send the message to.
+ * \param msg
+ *  Message to send.
+ * \return
+ *  \ref PR_OK if the message was sent, \ref PR_FULL if the message queue of the task is full,
+ *  \ref PR_INVALID_STATE if the task is being destroyed and its full message queue is closed, or \ref PR_NOT_FOUND if
+ *  the task does not exist. Unless the message was sent, it still belongs to the caller.
+ */
+PR_EXPORT pr_result_t pr_msg_try_send(pr_task_id_t task_id, union pr_msg* msg);
+
+/**
+ * \brief
+ *  Send multiple messages to the specified task at once. The messages are queued with a single operation, in the order
+ *  in which they appear in \p msgs, and the task is woken up at most once.
+ * \param task_id
+ *  Task object ID specifying the task to send the messages to.
+ * \param msgs
+ *  Messages to send.
+ * \param count
+ *  Number of messages to send.
+ * \note
+ *  Bounded message queues apply their \ref pr_msgq_full_policy_t to the batch as in \ref pr_msg_send. The messages that
+ *  are not sent are freed.
+ */
+PR_EXPORT void pr_msg_send_batch(pr_task_id_t task_id, union pr_msg* const* msgs, prs_uint_t count);
+
 /**
  * \brief
  *  Receive a message from the currently executing task's message queue. If no message is currently waiting in the
@@ -287,6 +457,22 @@ PR_EXPORT void pr_msg_send(pr_task_id_t task_id, union pr_msg* msg);
  */
 PR_EXPORT union pr_msg* pr_msg_recv(void);
 
+/**
+ * \brief
+ *  Receive multiple messages from the currently executing task's message queue at once. If no message is currently
+ *  waiting in the queue, wait for the specified time until a message is sent from another task, then receive all the
+ *  messages that are waiting, up to \p max_count.
+ * \param msgs
+ *  Receives the messages, oldest first.
+ * \param max_count
+ *  Maximum number of messages to receive.
+ * \param ticks
+ *  Number of ticks to wait for a message to be received, or \ref PR_TIMEOUT_INFINITE to wait without a time limit.
+ * \return
+ *  Number of messages that were received, which is zero if a timeout occurred.
+ */
+PR_EXPORT prs_uint_t pr_msg_recv_batch(union pr_msg** msgs, prs_uint_t max_count, pr_ticks_t ticks);
+
 /**
  * \brief
  *  Receive a message from the currently executing task's message queue using the specified filter. If no message is
@@ -309,6 +495,17 @@ PR_EXPORT union pr_msg* pr_msg_recv_filter(pr_msg_id_t* filter);
  */
 PR_EXPORT union pr_msg* pr_msg_recv_timeout(pr_ticks_t ticks);
 
+/**
+ * \brief
+ *  Receive a message from the currently executing task's message queue. If no message is currently waiting in the
+ *  queue, wait for the specified time until a message is sent from another task.
+ * \param us
+ *  Number of microseconds to wait for a message to be received.
+ * \return
+ *  The received message.
+ */
+PR_EXPORT union pr_msg* pr_msg_recv_timeout_us(int us);
+
 /**
  * \brief
  *  Receive a message from the currently executing task's message queue using the specified filter. If no message is
@@ -322,6 +519,19 @@ PR_EXPORT union pr_msg* pr_msg_recv_timeout(pr_ticks_t ticks);
  */
 PR_EXPORT union pr_msg* pr_msg_recv_filter_timeout(pr_msg_id_t* filter, pr_ticks_t ticks);
 
+/**
+ * \brief
+ *  Receive a message from the currently executing task's message queue using the specified filter. If no message is
+ *  currently waiting in the queue, wait for the specified time until a message is sent from another task.
+ * \param filter
+ *  Filter to use.
+ * \param us
+ *  Number of microseconds to wait for a message to be received.
+ * \return
+ *  The received message.
+ */
+PR_EXPORT union pr_msg* pr_msg_recv_filter_timeout_us(pr_msg_id_t* filter, int us);
+
 /**
  * \brief
  *  Returns the task object ID of the last task that sent the specified message.
@@ -383,6 +593,20 @@ PR_EXPORT void pr_sem_wait(pr_sem_id_t sem_id);
  */
 PR_EXPORT pr_result_t pr_sem_wait_timeout(pr_sem_id_t sem_id, pr_ticks_t timeout);
 
+/**
+ * \brief
+ *  Decrements the semaphore. If the semaphore count is below zero, wait in queue for the count to increment or for
+ *  the specified timeout to occur.
+ * \param sem_id
+ *  Semaphore object ID that specifies the semaphore to wait for.
+ * \param us
+ *  Time to wait, in microseconds.
+ * \return
+ *  \ref PR_TIMEOUT if the timeout occurred.
+ *  \ref PR_OK if the semaphore was signaled before the timeout.
+ */
+PR_EXPORT pr_result_t pr_sem_wait_timeout_us(pr_sem_id_t sem_id, int us);
+
 /**
  * \brief
  *  Increments the semaphore and signals a waiting task if the count was negative.
@@ -391,6 +615,379 @@ PR_EXPORT pr_result_t pr_sem_wait_timeout(pr_sem_id_t sem_id, pr_ticks_t timeout
  */
 PR_EXPORT void pr_sem_signal(pr_sem_id_t sem_id);
 
+/**
+ * \brief
+ *  Mutex object ID.
+ */
+typedef prs_object_id_t pr_mutex_id_t;
+
+/**
+ * \brief
+ *  Create a mutex.
+ * \return
+ *  Returns the mutex object ID of the created mutex, or zero if the mutex creation failed.
+ * \note
+ *  Tasks that wait for the mutex raise the priority of the task that holds it to their own priority, until it releases
+ *  the last mutex that it holds. This bounds the time during which a task can be delayed by lower priority tasks.
+ */
+PR_EXPORT pr_mutex_id_t pr_mutex_create(void);
+
+/**
+ * \brief
+ *  Destroy the mutex.
+ */
+PR_EXPORT void pr_mutex_destroy(pr_mutex_id_t mutex_id);
+
+/**
+ * \brief
+ *  Locks the mutex. If it is locked by another task, wait until it is unlocked.
+ * \param mutex_id
+ *  Mutex object ID that specifies the mutex to lock.
+ * \return
+ *  \ref PR_OK if the mutex was locked.
+ *  \ref PR_INVALID_STATE if the mutex was already locked by the currently executing task.
+ *  \ref PR_NOT_FOUND if the mutex does not exist.
+ */
+PR_EXPORT pr_result_t pr_mutex_lock(pr_mutex_id_t mutex_id);
+
+/**
+ * \brief
+ *  Locks the mutex if it is not locked.
+ * \param mutex_id
+ *  Mutex object ID that specifies the mutex to lock.
+ * \return
+ *  \ref PR_OK if the mutex was locked.
+ *  \ref PR_LOCKED if the mutex is locked by a task.
+ *  \ref PR_NOT_FOUND if the mutex does not exist.
+ */
+PR_EXPORT pr_result_t pr_mutex_try_lock(pr_mutex_id_t mutex_id);
+
+/**
+ * \brief
+ *  Unlocks the mutex, and hands it off to the highest priority task waiting for it.
+ * \param mutex_id
+ *  Mutex object ID that specifies the mutex to unlock.
+ * \return
+ *  \ref PR_OK if the mutex was unlocked.
+ *  \ref PR_INVALID_STATE if the mutex is not locked by the currently executing task.
+ *  \ref PR_NOT_FOUND if the mutex does not exist.
+ */
+PR_EXPORT pr_result_t pr_mutex_unlock(pr_mutex_id_t mutex_id);
+
+/**
+ * \brief
+ *  Reader-writer lock object ID.
+ */
+typedef prs_object_id_t pr_rwlock_id_t;
+
+/**
+ * \brief
+ *  Create a reader-writer lock.
+ * \return
+ *  Returns the reader-writer lock object ID of the created lock, or zero if the lock creation failed.
+ * \note
+ *  Readers are counted per worker, so that tasks that only read do not contend with each other. When a writer unlocks
+ *  the lock, the readers that are waiting get it before the next writer.
+ */
+PR_EXPORT pr_rwlock_id_t pr_rwlock_create(void);
+
+/**
+ * \brief
+ *  Destroy the reader-writer lock.
+ */
+PR_EXPORT void pr_rwlock_destroy(pr_rwlock_id_t rwlock_id);
+
+/**
+ * \brief
+ *  Locks the reader-writer lock for reading. If a writer holds or waits for the lock, wait until it unlocks it.
+ * \param rwlock_id
+ *  Reader-writer lock object ID that specifies the lock to lock.
+ */
+PR_EXPORT void pr_rwlock_read_lock(pr_rwlock_id_t rwlock_id);
+
+/**
+ * \brief
+ *  Locks the reader-writer lock for reading if no writer holds or waits for it.
+ * \param rwlock_id
+ *  Reader-writer lock object ID that specifies the lock to lock.
+ * \return
+ *  \ref PR_OK if the lock was locked for reading.
+ *  \ref PR_LOCKED if a writer holds or waits for the lock.
+ *  \ref PR_NOT_FOUND if the lock does not exist.
+ */
+PR_EXPORT pr_result_t pr_rwlock_try_read_lock(pr_rwlock_id_t rwlock_id);
+
+/**
+ * \brief
+ *  Unlocks the reader-writer lock that was locked for reading.
+ * \param rwlock_id
+ *  Reader-writer lock object ID that specifies the lock to unlock.
+ */
+PR_EXPORT void pr_rwlock_read_unlock(pr_rwlock_id_t rwlock_id);
+
+/**
+ * \brief
+ *  Locks the reader-writer lock for writing. Wait until the other writers and all the readers unlock it.
+ * \param rwlock_id
+ *  Reader-writer lock object ID that specifies the lock to lock.
+ * \return
+ *  \ref PR_OK if the lock was locked for writing.
+ *  \ref PR_INVALID_STATE if the lock was already locked for writing by the currently executing task.
+ *  \ref PR_NOT_FOUND if the lock does not exist.
+ */
+PR_EXPORT pr_result_t pr_rwlock_write_lock(pr_rwlock_id_t rwlock_id);
+
+/**
+ * \brief
+ *  Locks the reader-writer lock for writing if no other task holds it.
+ * \param rwlock_id
+ *  Reader-writer lock object ID that specifies the lock to lock.
+ * \return
+ *  \ref PR_OK if the lock was locked for writing.
+ *  \ref PR_LOCKED if the lock is held by readers or by a writer.
+ *  \ref PR_NOT_FOUND if the lock does not exist.
+ */
+PR_EXPORT pr_result_t pr_rwlock_try_write_lock(pr_rwlock_id_t rwlock_id);
+
+/**
+ * \brief
+ *  Unlocks the reader-writer lock that was locked for writing.
+ * \param rwlock_id
+ *  Reader-writer lock object ID that specifies the lock to unlock.
+ * \return
+ *  \ref PR_OK if the lock was unlocked.
+ *  \ref PR_INVALID_STATE if the lock is not locked for writing by the currently executing task.
+ *  \ref PR_NOT_FOUND if the lock does not exist.
+ */
+PR_EXPORT pr_result_t pr_rwlock_write_unlock(pr_rwlock_id_t rwlock_id);
+
+/**
+ * \brief
+ *  Condition variable object ID.
+ */
+typedef prs_object_id_t pr_cond_id_t;
+
+/**
+ * \brief
+ *  Create a condition variable.
+ * \return
+ *  Returns the condition variable object ID of the created condition variable, or zero if the creation failed.
+ */
+PR_EXPORT pr_cond_id_t pr_cond_create(void);
+
+/**
+ * \brief
+ *  Destroy the condition variable.
+ */
+PR_EXPORT void pr_cond_destroy(pr_cond_id_t cond_id);
+
+/**
+ * \brief
+ *  Unlocks the mutex and waits for the condition variable to be signaled, then locks the mutex again.
+ * \param cond_id
+ *  Condition variable object ID that specifies the condition variable to wait for.
+ * \param mutex_id
+ *  Mutex object ID that specifies the mutex, which must be locked by the currently executing task.
+ * \return
+ *  \ref PR_OK if the condition variable was signaled.
+ *  \ref PR_INVALID_STATE if the mutex is not locked by the currently executing task.
+ *  \ref PR_NOT_FOUND if the condition variable or the mutex does not exist.
+ */
+PR_EXPORT pr_result_t pr_cond_wait(pr_cond_id_t cond_id, pr_mutex_id_t mutex_id);
+
+/**
+ * \brief
+ *  Unlocks the mutex and waits for the condition variable to be signaled or for the specified timeout to occur, then
+ *  locks the mutex again.
+ * \param cond_id
+ *  Condition variable object ID that specifies the condition variable to wait for.
+ * \param mutex_id
+ *  Mutex object ID that specifies the mutex, which must be locked by the currently executing task.
+ * \param timeout
+ *  Time to wait, in ticks.
+ * \return
+ *  \ref PR_OK if the condition variable was signaled before the timeout.
+ *  \ref PR_TIMEOUT if the timeout occurred.
+ *  \ref PR_INVALID_STATE if the mutex is not locked by the currently executing task.
+ *  \ref PR_NOT_FOUND if the condition variable or the mutex does not exist.
+ */
+PR_EXPORT pr_result_t pr_cond_wait_timeout(pr_cond_id_t cond_id, pr_mutex_id_t mutex_id, pr_ticks_t timeout);
+
+/**
+ * \brief
+ *  Unlocks the mutex and waits for the condition variable to be signaled or for the specified timeout to occur, then
+ *  locks the mutex again.
+ * \param cond_id
+ *  Condition variable object ID that specifies the condition variable to wait for.
+ * \param mutex_id
+ *  Mutex object ID that specifies the mutex, which must be locked by the currently executing task.
+ * \param us
+ *  Time to wait, in microseconds.
+ * \return
+ *  \ref PR_OK if the condition variable was signaled before the timeout.
+ *  \ref PR_TIMEOUT if the timeout occurred.
+ *  \ref PR_INVALID_STATE if the mutex is not locked by the currently executing task.
+ *  \ref PR_NOT_FOUND if the condition variable or the mutex does not exist.
+ */
+PR_EXPORT pr_result_t pr_cond_wait_timeout_us(pr_cond_id_t cond_id, pr_mutex_id_t mutex_id, int us);
+
+/**
+ * \brief
+ *  Wakes up the task that has been waiting the longest for the condition variable, if any.
+ * \param cond_id
+ *  Condition variable object ID that specifies the condition variable to signal.
+ */
+PR_EXPORT void pr_cond_signal(pr_cond_id_t cond_id);
+
+/**
+ * \brief
+ *  Wakes up all the tasks that are waiting for the condition variable.
+ * \param cond_id
+ *  Condition variable object ID that specifies the condition variable to signal.
+ */
+PR_EXPORT void pr_cond_broadcast(pr_cond_id_t cond_id);
+
+/**
+ * \brief
+ *  Event flags object ID.
+ */
+typedef prs_object_id_t pr_flags_id_t;
+
+/**
+ * \brief
+ *  Set of event flags.
+ */
+typedef prs_uint32_t pr_flags_t;
+
+/** \brief Waits until any of the flags of the mask is set. */
+#define PR_FLAGS_WAIT_ANY               0x0
+/** \brief Waits until all the flags of the mask are set. */
+#define PR_FLAGS_WAIT_ALL               0x1
+/** \brief Clears the flags of the mask that were set when the wait succeeds. */
+#define PR_FLAGS_CLEAR                  0x2
+
+/**
+ * \brief
+ *  Create an event flags group.
+ * \param initial_value
+ *  Flags that are initially set.
+ * \return
+ *  Returns the event flags object ID of the created group, or zero if the creation failed.
+ */
+PR_EXPORT pr_flags_id_t pr_flags_create(pr_flags_t initial_value);
+
+/**
+ * \brief
+ *  Destroy the event flags group.
+ */
+PR_EXPORT void pr_flags_destroy(pr_flags_id_t flags_id);
+
+/**
+ * \brief
+ *  Sets flags, and wakes up the tasks that are waiting for them.
+ * \param flags_id
+ *  Event flags object ID that specifies the group.
+ * \param mask
+ *  Flags to set.
+ * \return
+ *  \ref PR_OK if the flags were set.
+ *  \ref PR_NOT_FOUND if the group does not exist.
+ */
+PR_EXPORT pr_result_t pr_flags_set(pr_flags_id_t flags_id, pr_flags_t mask);
+
+/**
+ * \brief
+ *  Clears flags.
+ * \param flags_id
+ *  Event flags object ID that specifies the group.
+ * \param mask
+ *  Flags to clear.
+ * \return
+ *  \ref PR_OK if the flags were cleared.
+ *  \ref PR_NOT_FOUND if the group does not exist.
+ */
+PR_EXPORT pr_result_t pr_flags_clear(pr_flags_id_t flags_id, pr_flags_t mask);
+
+/**
+ * \brief
+ *  Returns the flags that are set, or zero if the group does not exist.
+ * \param flags_id
+ *  Event flags object ID that specifies the group.
+ */
+PR_EXPORT pr_flags_t pr_flags_get(pr_flags_id_t flags_id);
+
+/**
+ * \brief
+ *  Waits until any or all of the flags of the mask are set.
+ * \param flags_id
+ *  Event flags object ID that specifies the group.
+ * \param mask
+ *  Flags to wait for.
+ * \param options
+ *  \ref PR_FLAGS_WAIT_ANY or \ref PR_FLAGS_WAIT_ALL, optionally combined with \ref PR_FLAGS_CLEAR.
+ * \param timeout
+ *  Time to wait, in ticks, or \ref PR_TIMEOUT_INFINITE to wait without a time limit.
+ * \param value
+ *  Receives the flags of the mask that were set. Can be \p null.
+ * \return
+ *  \ref PR_OK if the flags were set.
+ *  \ref PR_TIMEOUT if the timeout occurred.
+ *  \ref PR_NOT_FOUND if the group does not exist.
+ */
+PR_EXPORT pr_result_t pr_flags_wait(pr_flags_id_t flags_id, pr_flags_t mask, prs_uint32_t options, pr_ticks_t timeout,
+    pr_flags_t* value);
+
+/**
+ * \brief
+ *  Types of objects that can be waited for by \ref pr_wait_any.
+ */
+typedef enum pr_wait_type {
+    /** \brief A message is in the queue of the current task. The message is not received. */
+    PR_WAIT_MSG = 0,
+    /** \brief The semaphore can be decremented, which \ref pr_wait_any does. */
+    PR_WAIT_SEM,
+    /** \brief The event flags match the mask, as specified by the options. */
+    PR_WAIT_FLAGS
+} pr_wait_type_t;
+
+/**
+ * \brief
+ *  Object waited for by \ref pr_wait_any.
+ */
+struct pr_wait_object {
+    /** \brief Type of the object. */
+    pr_wait_type_t                      type;
+    /** \brief Object ID of the semaphore or of the event flags group. Ignored for \ref PR_WAIT_MSG. */
+    prs_object_id_t                     id;
+    /** \brief Flags to wait for, for \ref PR_WAIT_FLAGS. */
+    pr_flags_t                          mask;
+    /** \brief Options of the wait, for \ref PR_WAIT_FLAGS, as for \ref pr_flags_wait. */
+    prs_uint32_t                        options;
+    /** \brief Receives the flags of the mask that were set, for \ref PR_WAIT_FLAGS. */
+    pr_flags_t                          value;
+};
+
+/**
+ * \brief
+ *  Waits until any of the objects is ready, without polling: the task is woken up by the first object that becomes
+ *  ready.
+ * \param objects
+ *  Objects to wait for. When many objects are ready, the first one in the array is chosen.
+ * \param count
+ *  Number of objects, up to \ref PRS_MAX_WAIT_OBJECTS. Only one of them can be \ref PR_WAIT_MSG.
+ * \param timeout
+ *  Time to wait, in ticks, or \ref PR_TIMEOUT_INFINITE to wait without a time limit.
+ * \param index
+ *  Receives the index of the object that is ready.
+ * \return
+ *  \ref PR_OK if an object is ready.
+ *  \ref PR_TIMEOUT if the timeout occurred.
+ *  \ref PR_INVALID_STATE if the number of objects is invalid.
+ *  \ref PR_NOT_FOUND if an object does not exist.
+ */
+PR_EXPORT pr_result_t pr_wait_any(struct pr_wait_object* objects, prs_uint_t count, pr_ticks_t timeout,
+    prs_uint_t* index);
+
 /**
  * \brief
  *  Yield the current task so that the scheduler can choose another one to execute (if need be).
@@ -412,6 +1009,8 @@ PR_EXPORT void pr_sleep_ms(int ms);
 /**
  * \brief
  *  Stop the current task execution for the number of microseconds specified.
+ * \note
+ *  The sleep is not rounded to the system tick: the clock is programmed for its exact expiry.
  */
 PR_EXPORT void pr_sleep_us(int us);
 
@@ -528,6 +1127,16 @@ PR_EXPORT int pr_atexit(void (*function)(void));
  */
 PR_EXPORT void pr_system_exit(int status);
 
+/**
+ * \brief
+ *  Sets the number of CPU cycles during which idle workers spin, waiting for a task to become ready, before they put
+ *  their thread to sleep. Spinning longer lowers the latency of tasks that are woken up from other cores, at the cost
+ *  of CPU time when the system is idle.
+ * \param cycles
+ *  Number of cycles. Zero puts idle workers to sleep right away.
+ */
+PR_EXPORT void pr_system_set_idle_spin(prs_uint64_t cycles);
+
 /**
  * \brief
  *  Returns the system information.
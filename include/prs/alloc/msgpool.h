@@ -0,0 +1,75 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+
+/**
+ * \file
+ * \brief
+ *  This file contains the message pool declarations.
+ */
+
+#ifndef _PRS_ALLOC_MSGPOOL_H
+#define _PRS_ALLOC_MSGPOOL_H
+
+#include <prs/types.h>
+
+struct prs_msgpool;
+
+/**
+ * \brief
+ *  Message pool creation parameters.
+ */
+struct prs_msgpool_create_params {
+    /** \brief Maximum number of free blocks of each size class kept in the pool before returning them to the slabs. */
+    prs_uint_t                          max_blocks;
+};
+
+/**
+ * \brief
+ *  Message pool statistics returned by \ref prs_msgpool_get_stats.
+ */
+struct prs_msgpool_stats {
+    /** \brief Number of blocks allocated from the pool. */
+    prs_uint64_t                        allocs;
+    /** \brief Number of allocations too large for the size classes, which went to the general purpose allocator. */
+    prs_uint64_t                        large_allocs;
+    /** \brief Number of blocks freed to the pool by its owner. */
+    prs_uint64_t                        local_frees;
+    /** \brief Number of blocks freed by the owner of this pool that belonged to other pools. */
+    prs_uint64_t                        remote_frees;
+    /** \brief Number of blocks freed by other pools that were taken back by this pool. */
+    prs_uint64_t                        reclaims;
+    /** \brief Number of times the pool had to take blocks from the slabs. */
+    prs_uint64_t                        refills;
+    /** \brief Number of times the pool returned blocks to the slabs. */
+    prs_uint64_t                        flushes;
+};
+
+struct prs_msgpool* prs_msgpool_create(struct prs_msgpool_create_params* params);
+void prs_msgpool_destroy(struct prs_msgpool* pool);
+
+void* prs_msgpool_alloc(struct prs_msgpool* pool, prs_size_t size);
+void prs_msgpool_free(struct prs_msgpool* pool, void* ptr);
+
+void prs_msgpool_get_stats(struct prs_msgpool* pool, struct prs_msgpool_stats* stats);
+
+#endif /* _PRS_ALLOC_MSGPOOL_H */
@@ -0,0 +1,76 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains the slab allocator declarations.
+ */
+
+#ifndef _PRS_ALLOC_SLAB_H
+#define _PRS_ALLOC_SLAB_H
+
+#include <prs/types.h>
+
+struct prs_slab;
+struct prs_slab_cache;
+
+/**
+ * \brief
+ *  Slab creation parameters.
+ */
+struct prs_slab_create_params {
+    /** \brief Size of the objects allocated from the slab. */
+    prs_size_t                          object_size;
+    /** \brief Alignment of the objects. Must be a power of 2. */
+    prs_size_t                          object_align;
+    /** \brief Number of objects carved from each chunk of memory allocated by the slab. */
+    prs_uint_t                          chunk_objects;
+};
+
+/**
+ * \brief
+ *  Slab cache creation parameters.
+ */
+struct prs_slab_cache_create_params {
+    /** \brief Slab that the cache allocates from and frees to. */
+    struct prs_slab*                    slab;
+    /** \brief Maximum number of free objects kept in the cache. */
+    prs_uint_t                          max_objects;
+};
+
+struct prs_slab* prs_slab_create(struct prs_slab_create_params* params);
+void prs_slab_destroy(struct prs_slab* slab);
+prs_size_t prs_slab_get_object_size(struct prs_slab* slab);
+
+prs_uint_t prs_slab_alloc_batch(struct prs_slab* slab, void** objects, prs_uint_t count);
+void prs_slab_free_batch(struct prs_slab* slab, void** objects, prs_uint_t count);
+void* prs_slab_alloc(struct prs_slab* slab);
+void prs_slab_free(struct prs_slab* slab, void* object);
+
+struct prs_slab_cache* prs_slab_cache_create(struct prs_slab_cache_create_params* params);
+void prs_slab_cache_destroy(struct prs_slab_cache* cache);
+
+void* prs_slab_cache_alloc(struct prs_slab_cache* cache);
+void prs_slab_cache_free(struct prs_slab_cache* cache, void* object);
+
+#endif /* _PRS_ALLOC_SLAB_H */
@@ -31,10 +31,50 @@
 
 #include <prs/types.h>
 
+struct prs_stack_cache;
+
+/**
+ * \brief
+ *  Stack cache creation parameters.
+ */
+struct prs_stack_cache_create_params {
+    /** \brief Maximum number of stacks kept in the cache (high watermark). */
+    prs_uint_t                          max_stacks;
+    /** \brief Number of cached stacks whose pages are kept in physical memory (low watermark). */
+    prs_uint_t                          resident_stacks;
+    /** \brief If the pages of the stacks are touched before they are handed out. */
+    prs_bool_t                          prefault;
+};
+
+/**
+ * \brief
+ *  Stack cache statistics returned by \ref prs_stack_cache_get_stats.
+ */
+struct prs_stack_cache_stats {
+    /** \brief Number of stacks allocated from the cache. */
+    prs_uint64_t                        hits;
+    /** \brief Number of stacks that had to be created because the cache had none of the requested size. */
+    prs_uint64_t                        misses;
+    /** \brief Number of stacks destroyed because the cache was full. */
+    prs_uint64_t                        releases;
+    /** \brief Number of stacks whose pages were discarded when they were cached. */
+    prs_uint64_t                        trims;
+    /** \brief Number of stacks currently in the cache. */
+    prs_uint_t                          count;
+};
+
 void* prs_stack_create(prs_size_t size, prs_size_t* available_size);
 void prs_stack_destroy(void* stack);
 
 prs_bool_t prs_stack_grow(void* stack, prs_size_t old_size, void* failed_ptr, prs_size_t* new_size);
+prs_size_t prs_stack_shrink(void* stack, prs_size_t old_size, void* keep_ptr);
 prs_bool_t prs_stack_address_in_range(void* stack, void* address);
+prs_size_t prs_stack_scan_usage(void* stack, prs_size_t size);
+
+struct prs_stack_cache* prs_stack_cache_create(struct prs_stack_cache_create_params* params);
+void prs_stack_cache_destroy(struct prs_stack_cache* cache);
+void* prs_stack_cache_alloc(struct prs_stack_cache* cache, prs_size_t size, prs_size_t* available_size);
+void prs_stack_cache_free(struct prs_stack_cache* cache, void* stack, prs_size_t size);
+void prs_stack_cache_get_stats(struct prs_stack_cache* cache, struct prs_stack_cache_stats* stats);
 
 #endif /* _PRS_ALLOC_STACK_H */
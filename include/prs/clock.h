@@ -33,6 +33,8 @@
 #include <prs/result.h>
 #include <prs/ticks.h>
 
+struct prs_worker;
+
 /**
  * \brief
  *  This structure provides the clock module's parameters that should be passed to \ref prs_clock_init.
@@ -53,7 +55,12 @@ struct prs_clock_init_params {
 prs_result_t prs_clock_init(struct prs_clock_init_params* params);
 void prs_clock_uninit(void);
 
-struct prs_timer* prs_clock_timer(void);
+prs_result_t prs_clock_add_worker(struct prs_worker* worker);
+void prs_clock_remove_worker(struct prs_worker* worker);
+
 prs_ticks_t prs_clock_get(void);
+prs_uint64_t prs_clock_get_ns(void);
+void prs_clock_request(prs_ticks_t ticks);
+void prs_clock_request_ns(prs_uint64_t ns);
 
 #endif /* _PRS_CLOCK_H */
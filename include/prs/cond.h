@@ -0,0 +1,49 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains condition variable declarations.
+ */
+
+#ifndef _PRS_COND_H
+#define _PRS_COND_H
+
+#include <prs/mutex.h>
+#include <prs/object.h>
+#include <prs/result.h>
+#include <prs/ticks.h>
+#include <prs/types.h>
+
+struct prs_cond;
+
+struct prs_cond* prs_cond_create(void);
+void prs_cond_destroy(struct prs_cond* cond);
+
+prs_result_t prs_cond_wait(struct prs_cond* cond, struct prs_mutex* mutex);
+prs_result_t prs_cond_wait_timeout(struct prs_cond* cond, struct prs_mutex* mutex, prs_ticks_t timeout);
+prs_result_t prs_cond_wait_timeout_ns(struct prs_cond* cond, struct prs_mutex* mutex, prs_uint64_t timeout_ns);
+void prs_cond_signal(struct prs_cond* cond);
+void prs_cond_broadcast(struct prs_cond* cond);
+
+#endif /* _PRS_COND_H */
@@ -69,6 +69,42 @@
  */
 //#define PRS_FUNCTION_TRACES
 
+/**
+ * \def PRS_TICKLESS
+ * \brief
+ *  When defined, the clock does not interrupt the system at every tick. The clock interrupt is rather programmed for
+ *  the next timer expiry or scheduler time slice, so that idle systems are not woken up needlessly.
+ */
+//#define PRS_TICKLESS
+
+/**
+ * \def PRS_SAFEPOINT
+ * \brief
+ *  When defined, workers are not interrupted by a signal as soon as their running task must be preempted. Instead, a
+ *  preemption request is posted to the worker and the task yields by itself at its next safepoint: PR API calls,
+ *  \ref pr_int_enable and loop back-edges instrumented with \ref PR_SAFEPOINT. The worker is only interrupted by a
+ *  signal when the task does not reach a safepoint within \ref PRS_SAFEPOINT_GRACE_NS.
+ */
+//#define PRS_SAFEPOINT
+
+/**
+ * \brief
+ *  Time, in nanoseconds, that a task has to reach a safepoint before its worker is interrupted by a signal, when
+ *  \ref PRS_SAFEPOINT is defined. Unless the clock is tickless, the grace period is rounded up to the next tick.
+ */
+#if !defined(PRS_SAFEPOINT_GRACE_NS)
+#define PRS_SAFEPOINT_GRACE_NS          100000
+#endif /* !PRS_SAFEPOINT_GRACE_NS */
+
+/**
+ * \def PRS_CONTEXT_FULL_RESTORE
+ * \brief
+ *  When defined, the contexts saved by voluntary switches are restored through the same path as the contexts of
+ *  interrupted tasks, which reloads all the registers rather than only the callee-saved ones. This is only meant to
+ *  measure the cycles saved by the shorter path, see the ctxswitch example.
+ */
+//#define PRS_CONTEXT_FULL_RESTORE
+
 /**
  * \brief
  *  Maximum number of CPUs in the system. If the actual number of CPUs is higher than this value, it is clamped to it.
@@ -129,13 +165,62 @@
  */
 #define PRS_HZ                          1000
 
+/** \brief Value of \ref PRS_SCHED_DEFAULT that creates a single worker priority scheduler per core */
+#define PRS_SCHED_SWPRIO                1
+/** \brief Value of \ref PRS_SCHED_DEFAULT that creates a single worker earliest deadline first scheduler per core */
+#define PRS_SCHED_EDF                   2
+/** \brief Value of \ref PRS_SCHED_DEFAULT that creates a single work-stealing priority scheduler for all the cores */
+#define PRS_SCHED_SWSTEAL               3
+
+/**
+ * \brief
+ *  Schedulers created at initialization, on which the initial tasks and the applications run
+ */
+#if !defined(PRS_SCHED_DEFAULT)
+#define PRS_SCHED_DEFAULT               PRS_SCHED_SWPRIO
+#endif /* !PRS_SCHED_DEFAULT */
+
 /**
  * \brief
- *  Maximum number of objects that may be allocated simultaneously
+ *  Time quantum, in ticks, of the priority schedulers created at initialization. A task that runs for that many ticks
+ *  is rotated behind the other ready tasks of the same priority. Zero disables time slicing.
+ */
+#if !defined(PRS_SCHED_QUANTUM)
+#define PRS_SCHED_QUANTUM               0
+#endif /* !PRS_SCHED_QUANTUM */
+
+/**
+ * \brief
+ *  Initial number of cycles, as measured by \ref prs_cycles_now, during which an idle worker spins before its thread
+ *  is parked. A worker woken up while it spins resumes without any system call. Zero disables spinning, which is
+ *  always the case on single core systems. The value can be changed at run time with \ref pr_system_set_idle_spin.
+ */
+#if !defined(PRS_WORKER_IDLE_SPIN_CYCLES)
+#define PRS_WORKER_IDLE_SPIN_CYCLES     20000
+#endif /* !PRS_WORKER_IDLE_SPIN_CYCLES */
+
+/**
+ * \brief
+ *  Maximum number of objects that may be registered simultaneously in the global object directory, which grows up to
+ *  this size as objects are created. The tables that index objects, such as the process address ranges and the name
+ *  resolvers of tasks and schedulers, are sized from it.
+ * \note
+ *  Must be a power of 2. Each doubling takes one bit from the count of reuses in object IDs, which halves the number of
+ *  reuses of an entry before one of its IDs comes back.
+ */
+#if !defined(PRS_MAX_GOD_ENTRIES)
+#define PRS_MAX_GOD_ENTRIES             65536
+#endif /* !PRS_MAX_GOD_ENTRIES */
+
+/**
+ * \brief
+ *  Number of entries by which the global object directory grows
  * \note
  *  Must be a power of 2
  */
-#define PRS_MAX_OBJECTS                 4096
+#if !defined(PRS_GOD_CHUNK_ENTRIES)
+#define PRS_GOD_CHUNK_ENTRIES           1024
+#endif /* !PRS_GOD_CHUNK_ENTRIES */
 
 /**
  * \brief
@@ -143,11 +228,140 @@
  */
 #define PRS_MAX_STACK_SIZE              (1*1024*1024)
 
+/**
+ * \brief
+ *  Maximum number of task stacks that each worker keeps in its stack cache for reuse. Stacks freed when the cache is
+ *  full are unmapped. Zero disables the cache.
+ */
+#if !defined(PRS_STACK_CACHE_MAX_STACKS)
+#define PRS_STACK_CACHE_MAX_STACKS      64
+#endif /* !PRS_STACK_CACHE_MAX_STACKS */
+
+/**
+ * \brief
+ *  Number of stacks in a worker's stack cache whose pages are kept in physical memory. The pages of the stacks cached
+ *  beyond that number are discarded, except for the top page.
+ */
+#if !defined(PRS_STACK_CACHE_RESIDENT_STACKS)
+#define PRS_STACK_CACHE_RESIDENT_STACKS 16
+#endif /* !PRS_STACK_CACHE_RESIDENT_STACKS */
+
+/**
+ * \def PRS_STACK_CACHE_PREFAULT
+ * \brief
+ *  When defined, the pages of the stacks handed out by the stack caches are touched beforehand, so that tasks do not
+ *  take page faults on the committed part of their stacks.
+ */
+//#define PRS_STACK_CACHE_PREFAULT
+
+/**
+ * \def PRS_STACK_SCAN
+ * \brief
+ *  When defined, the stack usage of tasks is also measured by scanning their stacks for the deepest word that was
+ *  written to. Stacks handed out by the stack caches are then zeroed, which makes task creation more expensive. When
+ *  not defined, the stack usage is sampled at each context switch and at each stack growth.
+ */
+//#define PRS_STACK_SCAN
+
+/**
+ * \def PRS_STACK_RECLAIM
+ * \brief
+ *  When defined, the process service periodically uncommits the stack pages of blocked tasks that lie below their
+ *  current stack pointer, releasing the memory of stacks that grew and are now mostly unused.
+ */
+//#define PRS_STACK_RECLAIM
+
+/**
+ * \brief
+ *  Minimum number of bytes that must be reclaimable from the stack of a blocked task for it to be shrunk. This keeps
+ *  tasks that only briefly use more stack than they currently do from repeatedly growing and shrinking their stacks.
+ */
+#if !defined(PRS_STACK_RECLAIM_MIN_SIZE)
+#define PRS_STACK_RECLAIM_MIN_SIZE      16384
+#endif /* !PRS_STACK_RECLAIM_MIN_SIZE */
+
+/**
+ * \brief
+ *  Number of tasks carved from each chunk of memory allocated by the task slab. Each task takes a single slab object
+ *  that holds its task structure, register context and message queue.
+ */
+#if !defined(PRS_TASK_SLAB_CHUNK_TASKS)
+#define PRS_TASK_SLAB_CHUNK_TASKS       64
+#endif /* !PRS_TASK_SLAB_CHUNK_TASKS */
+
+/**
+ * \brief
+ *  Maximum number of free task objects that each worker keeps in its task cache before returning them to the task
+ *  slab.
+ */
+#if !defined(PRS_TASK_CACHE_MAX_TASKS)
+#define PRS_TASK_CACHE_MAX_TASKS        32
+#endif /* !PRS_TASK_CACHE_MAX_TASKS */
+
+/**
+ * \brief
+ *  Size of the smallest blocks of the message pools, header included. Messages are allocated from blocks whose size is
+ *  this size times a power of 2. Must be a power of 2.
+ */
+#if !defined(PRS_MSGPOOL_MIN_BLOCK_SIZE)
+#define PRS_MSGPOOL_MIN_BLOCK_SIZE      128
+#endif /* !PRS_MSGPOOL_MIN_BLOCK_SIZE */
+
+/**
+ * \brief
+ *  Number of block size classes of the message pools. Messages that do not fit in the largest class are allocated
+ *  from the general purpose allocator.
+ */
+#if !defined(PRS_MSGPOOL_CLASSES)
+#define PRS_MSGPOOL_CLASSES             6
+#endif /* !PRS_MSGPOOL_CLASSES */
+
+/**
+ * \brief
+ *  Maximum number of free blocks of each size class that each worker keeps in its message pool before returning half
+ *  of them to the shared slabs.
+ */
+#if !defined(PRS_MSGPOOL_MAX_BLOCKS)
+#define PRS_MSGPOOL_MAX_BLOCKS          128
+#endif /* !PRS_MSGPOOL_MAX_BLOCKS */
+
+/**
+ * \brief
+ *  Size of the chunks of memory allocated by the slabs that back the message pools.
+ */
+#if !defined(PRS_MSGPOOL_SLAB_CHUNK_SIZE)
+#define PRS_MSGPOOL_SLAB_CHUNK_SIZE     (64*1024)
+#endif /* !PRS_MSGPOOL_SLAB_CHUNK_SIZE */
+
+/**
+ * \brief
+ *  Number of buckets of the message ID index of each message queue, which lets receives filtered by message ID skip
+ *  the messages with other IDs. Must be a power of 2.
+ */
+#if !defined(PRS_MSGQ_INDEX_BUCKETS)
+#define PRS_MSGQ_INDEX_BUCKETS          16
+#endif /* !PRS_MSGQ_INDEX_BUCKETS */
+
+/**
+ * \brief
+ *  Number of cycles, as measured by \ref prs_cycles_now, during which a task spins to lock a mutex that is owned by a
+ *  task running on another worker, before it blocks. Spinning never happens on single core systems.
+ */
+#if !defined(PRS_MUTEX_SPIN_CYCLES)
+#define PRS_MUTEX_SPIN_CYCLES           4000
+#endif /* !PRS_MUTEX_SPIN_CYCLES */
+
+/**
+ * \brief
+ *  Maximum number of objects that a task can wait for at once with \ref prs_wait_any
+ */
+#define PRS_MAX_WAIT_OBJECTS            16
+
 /**
  * \brief
  *  Maximum number of entries in the global pointer directory
  */
-#define PRS_MAX_GPD_ENTRIES             (PRS_MAX_OBJECTS * 4)
+#define PRS_MAX_GPD_ENTRIES             16384
 
 /**
  * \brief
@@ -0,0 +1,62 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains event flags declarations.
+ */
+
+#ifndef _PRS_FLAGS_H
+#define _PRS_FLAGS_H
+
+#include <prs/object.h>
+#include <prs/result.h>
+#include <prs/ticks.h>
+#include <prs/types.h>
+
+struct prs_flags;
+struct prs_wait_list;
+
+/** \brief Type containing a set of event flags. */
+typedef prs_uint32_t prs_flags_t;
+
+/** \brief Waits until all the flags of the mask are set, instead of any of them. */
+#define PRS_FLAGS_WAIT_ALL              0x1
+/** \brief Clears the flags of the mask that were set when the wait succeeds. */
+#define PRS_FLAGS_CLEAR                 0x2
+
+struct prs_flags* prs_flags_create(prs_flags_t initial_value);
+void prs_flags_destroy(struct prs_flags* flags);
+
+prs_flags_t prs_flags_set(struct prs_flags* flags, prs_flags_t mask);
+prs_flags_t prs_flags_clear(struct prs_flags* flags, prs_flags_t mask);
+prs_flags_t prs_flags_get(struct prs_flags* flags);
+prs_bool_t prs_flags_try_wait(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options, prs_flags_t* value);
+prs_result_t prs_flags_wait(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options, prs_flags_t* value);
+prs_result_t prs_flags_wait_timeout(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options,
+    prs_ticks_t timeout, prs_flags_t* value);
+prs_result_t prs_flags_wait_timeout_ns(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options,
+    prs_uint64_t timeout_ns, prs_flags_t* value);
+struct prs_wait_list* prs_flags_get_wait_list(struct prs_flags* flags);
+
+#endif /* _PRS_FLAGS_H */
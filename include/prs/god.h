@@ -38,8 +38,10 @@
  *  Global object directory creation parameters.
  */
 struct prs_god_create_params {
-    /** \brief Maximum simultaneous number of entries in the global object directory. */
+    /** \brief Maximum simultaneous number of entries in the global object directory. Must be a power of 2. */
     prs_size_t                          max_entries;
+    /** \brief Number of entries by which the global object directory grows. Must be a power of 2. */
+    prs_size_t                          chunk_entries;
 };
 
 prs_result_t prs_god_create(struct prs_god_create_params* params);
@@ -55,6 +57,7 @@ prs_result_t prs_god_try_unlock_final(prs_object_id_t id);
 
 prs_result_t prs_god_object_destroy(prs_object_id_t id);
 
+void prs_god_foreach(struct prs_object_ops* ops, void (*fct)(void* userdata, void* object), void* userdata);
 void prs_god_print(void* userdata, void (*fct)(void*, const char*, ...));
 
 #endif /* _PRS_GOD_H */
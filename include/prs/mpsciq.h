@@ -44,12 +44,17 @@ struct prs_mpsciq_node {
 
 struct prs_mpsciq_create_params {
     prs_size_t                          node_offset;
+    /* Pre-allocated and zeroed memory area that the queue can use, as large as prs_mpsciq_struct_size returns */
+    void*                               area;
 };
 
+prs_size_t prs_mpsciq_struct_size(void);
+
 struct prs_mpsciq* prs_mpsciq_create(struct prs_mpsciq_create_params* params);
 void prs_mpsciq_destroy(struct prs_mpsciq* mpsciq);
 
 void prs_mpsciq_push(struct prs_mpsciq* mpsciq, struct prs_mpsciq_node* node);
+void prs_mpsciq_push_batch(struct prs_mpsciq* mpsciq, void* const* elements, prs_uint_t count);
 void prs_mpsciq_remove(struct prs_mpsciq* mpsciq, struct prs_mpsciq_node* node);
 
 struct prs_mpsciq_node* prs_mpsciq_begin(struct prs_mpsciq* mpsciq);
@@ -46,6 +46,18 @@ struct prs_msg {
     prs_task_id_t                       owner;
     /** \brief Last sender of the message. */
     prs_task_id_t                       sender;
+    /**
+     * \brief
+     *  Next message with another ID in the same bucket of the message ID index of the receiving message queue. Only
+     *  valid for the oldest message of each ID.
+     */
+    struct prs_msg*                     index_next;
+    /** \brief Next message with the same ID in the message ID index of the receiving message queue. */
+    struct prs_msg*                     index_same;
+    /** \brief Youngest message with the same ID. Only valid for the oldest message of each ID. */
+    struct prs_msg*                     index_tail;
+    /** \brief Arrival order of the message in the index of the receiving message queue. */
+    prs_uint_t                          index_seq;
     /** \brief Data (payload) of the message. The data may extend beyond this field. */
     prs_uint8_t                         data[PRS_PAL_POINTER_SIZE];
 };
@@ -54,5 +66,7 @@ struct prs_msg {
 #define PRS_MSG_OVERHEAD                (offsetof(struct prs_msg, data))
 /** \brief Returns the message header from the message payload. */
 #define PRS_MSG_FROM_DATA(data)         ((struct prs_msg*)((prs_uint8_t*)data - PRS_MSG_OVERHEAD))
+/** \brief Returns the ID of a message. */
+#define PRS_MSG_GET_ID(msg)             (*(prs_msg_id_t*)(msg)->data)
 
 #endif /* _PRS_MSG_H */
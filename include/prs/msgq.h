@@ -34,10 +34,28 @@
 #include <prs/ticks.h>
 #include <prs/types.h>
 
+struct prs_event;
 struct prs_msgq_filter;
 struct prs_msgq;
 struct prs_msg;
 
+/**
+ * \brief
+ *  Message ID, stored at the beginning of the payload of every message.
+ */
+typedef prs_uint32_t prs_msg_id_t;
+
+/**
+ * \brief
+ *  What senders do when they send a message to a bounded message queue that is full.
+ */
+enum prs_msgq_full_policy {
+    /** \brief Senders wait until the receiver makes room in the queue. The receiver itself drops its messages. */
+    PRS_MSGQ_FULL_BLOCK = 0,
+    /** \brief Messages are dropped and counted. */
+    PRS_MSGQ_FULL_DROP
+};
+
 /**
  * \brief
  *  Message queue creation parameters.
@@ -49,6 +67,31 @@ struct prs_msgq_create_params {
      *  (GPD) is used.
      */
     struct prs_pd*                      pd;
+    /**
+     * \brief
+     *  Pre-allocated and zeroed memory area that the message queue can use. It must be as large as
+     *  \ref prs_msgq_struct_size returns. When \p null, the message queue is allocated.
+     */
+    void*                               area;
+    /** \brief Maximum number of messages in the queue. Zero if the queue is unbounded. */
+    prs_uint_t                          capacity;
+    /** \brief What senders do when the queue is full. */
+    enum prs_msgq_full_policy           full_policy;
+};
+
+/**
+ * \brief
+ *  Message queue statistics returned by \ref prs_msgq_get_stats.
+ */
+struct prs_msgq_stats {
+    /** \brief Number of messages in the queue. */
+    prs_uint_t                          depth;
+    /** \brief Largest number of messages that were in the queue at once. */
+    prs_uint_t                          high_water;
+    /** \brief Maximum number of messages in the queue. Zero if the queue is unbounded. */
+    prs_uint_t                          capacity;
+    /** \brief Number of messages that were dropped because the queue was full. */
+    prs_uint64_t                        dropped;
 };
 
 /**
@@ -58,16 +101,32 @@ struct prs_msgq_create_params {
  */
 typedef prs_bool_t (*prs_msgq_filter_function_t)(void* userdata, struct prs_msg* msg);
 
+prs_size_t prs_msgq_struct_size(void);
+
 struct prs_msgq* prs_msgq_create(struct prs_msgq_create_params* params);
 void prs_msgq_destroy(struct prs_msgq* msgq);
+void prs_msgq_close(struct prs_msgq* msgq);
+void prs_msgq_get_stats(struct prs_msgq* msgq, struct prs_msgq_stats* stats);
+prs_bool_t prs_msgq_empty(struct prs_msgq* msgq);
+struct prs_msgq_filter* prs_msgq_watch(struct prs_msgq* msgq, struct prs_event* event);
+void prs_msgq_unwatch(struct prs_msgq* msgq, struct prs_msgq_filter* filter);
 
-void prs_msgq_send(struct prs_msgq* msgq, struct prs_msg* msg);
+prs_result_t prs_msgq_send(struct prs_msgq* msgq, struct prs_msg* msg);
+prs_result_t prs_msgq_try_send(struct prs_msgq* msgq, struct prs_msg* msg);
+prs_uint_t prs_msgq_send_batch(struct prs_msgq* msgq, struct prs_msg* const* msgs, prs_uint_t count);
 
 struct prs_msg* prs_msgq_recv(struct prs_msgq* msgq);
+prs_uint_t prs_msgq_recv_batch(struct prs_msgq* msgq, struct prs_msg** msgs, prs_uint_t max_count);
 struct prs_msg* prs_msgq_recv_timeout(struct prs_msgq* msgq, prs_ticks_t timeout);
+struct prs_msg* prs_msgq_recv_timeout_ns(struct prs_msgq* msgq, prs_uint64_t timeout_ns);
 struct prs_msg* prs_msgq_recv_filter(struct prs_msgq* msgq, void* userdata, prs_size_t userdata_size,
     prs_msgq_filter_function_t function);
 struct prs_msg* prs_msgq_recv_filter_timeout(struct prs_msgq* msgq, void* userdata, prs_size_t userdata_size,
     prs_msgq_filter_function_t function, prs_ticks_t timeout);
+struct prs_msg* prs_msgq_recv_filter_timeout_ns(struct prs_msgq* msgq, void* userdata, prs_size_t userdata_size,
+    prs_msgq_filter_function_t function, prs_uint64_t timeout_ns);
+struct prs_msg* prs_msgq_recv_ids(struct prs_msgq* msgq, const prs_msg_id_t* ids);
+struct prs_msg* prs_msgq_recv_ids_timeout(struct prs_msgq* msgq, const prs_msg_id_t* ids, prs_ticks_t timeout);
+struct prs_msg* prs_msgq_recv_ids_timeout_ns(struct prs_msgq* msgq, const prs_msg_id_t* ids, prs_uint64_t timeout_ns);
 
 #endif /* _PRS_MSGQ_H */
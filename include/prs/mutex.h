@@ -0,0 +1,49 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains mutex declarations.
+ */
+
+#ifndef _PRS_MUTEX_H
+#define _PRS_MUTEX_H
+
+#include <prs/object.h>
+#include <prs/result.h>
+#include <prs/types.h>
+
+struct prs_mutex;
+struct prs_task;
+
+struct prs_mutex* prs_mutex_create(void);
+void prs_mutex_destroy(struct prs_mutex* mutex);
+
+prs_result_t prs_mutex_lock(struct prs_mutex* mutex);
+prs_result_t prs_mutex_try_lock(struct prs_mutex* mutex);
+prs_result_t prs_mutex_unlock(struct prs_mutex* mutex);
+prs_bool_t prs_mutex_is_owner(struct prs_mutex* mutex);
+
+void prs_mutex_requeue(struct prs_task* task);
+
+#endif /* _PRS_MUTEX_H */
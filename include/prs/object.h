@@ -37,6 +37,12 @@
  */
 #define PRS_OBJECT_ID_INVALID           ((prs_object_id_t)0)
 
+/**
+ * \brief
+ *  Largest object ID. The most significant bit of object IDs is never set, so that it can be used as a flag.
+ */
+#define PRS_OBJECT_ID_MAX               ((prs_object_id_t)0x7FFFFFFF)
+
 /**
  * \brief
  *  Standard PRS object operations. These operations are used by the global object directory.
@@ -60,5 +66,13 @@ typedef prs_object_id_t prs_sched_id_t;
 typedef prs_object_id_t prs_worker_id_t;
 /** \brief Semaphore object ID type. */
 typedef prs_object_id_t prs_sem_id_t;
+/** \brief Mutex object ID type. */
+typedef prs_object_id_t prs_mutex_id_t;
+/** \brief Reader-writer lock object ID type. */
+typedef prs_object_id_t prs_rwlock_id_t;
+/** \brief Condition variable object ID type. */
+typedef prs_object_id_t prs_cond_id_t;
+/** \brief Event flags object ID type. */
+typedef prs_object_id_t prs_flags_id_t;
 
 #endif /* _PRS_OBJECT_H */
@@ -64,10 +64,13 @@
 
 #if PRS_PAL_ARCH == PRS_PAL_ARCH_X86
     #define PRS_PAL_ARCH_NAME           "x86"
+    #define PRS_PAL_CACHE_LINE_SIZE     64
 #elif PRS_PAL_ARCH == PRS_PAL_ARCH_AMD64
     #define PRS_PAL_ARCH_NAME           "amd64"
+    #define PRS_PAL_CACHE_LINE_SIZE     64
 #elif PRS_PAL_ARCH == PRS_PAL_ARCH_ARM
     #define PRS_PAL_ARCH_NAME           "arm"
+    #define PRS_PAL_CACHE_LINE_SIZE     32
 #endif
 
 /**
@@ -115,4 +118,15 @@
     #define PRS_PAL_ARCH_NAME /* doxygen */
 #endif
 
+/**
+ * \def PRS_PAL_CACHE_LINE_SIZE
+ * \brief
+ *  Defines the size of a cache line in the current architecture, in bytes. Data that is written concurrently by
+ *  multiple workers should be padded to this size.
+ */
+#if !defined(PRS_PAL_CACHE_LINE_SIZE)
+    #error PRS_PAL_CACHE_LINE_SIZE is not defined
+    #define PRS_PAL_CACHE_LINE_SIZE /* doxygen */
+#endif
+
 #endif /* _PRS_PAL_ARCH_H */
@@ -45,6 +45,20 @@ struct prs_pal_context* prs_pal_context_alloc(void);
  */
 void prs_pal_context_free(struct prs_pal_context* context);
 
+/**
+ * \brief
+ *  Returns the size of the memory area required by \ref prs_pal_context_init.
+ */
+prs_size_t prs_pal_context_struct_size(void);
+
+/**
+ * \brief
+ *  Initializes a context in a pre-allocated memory area, which must not be freed with \ref prs_pal_context_free.
+ * \param area
+ *  Zeroed memory area, 16-byte aligned and as large as \ref prs_pal_context_struct_size returns.
+ */
+struct prs_pal_context* prs_pal_context_init(void* area);
+
 /**
  * \brief
  *  Copies a context.
@@ -116,4 +130,12 @@ prs_bool_t prs_pal_context_is_using_stack(struct prs_pal_context* context, void*
  */
 void* prs_pal_context_get_ip(struct prs_pal_context* context);
 
+/**
+ * \brief
+ *  Returns the value of the stack pointer in \p context.
+ * \param context
+ *  Context to get the stack pointer from.
+ */
+void* prs_pal_context_get_sp(struct prs_pal_context* context);
+
 #endif /* _PRS_PAL_CONTEXT_H */
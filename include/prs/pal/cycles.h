@@ -71,6 +71,15 @@ static PRS_INLINE prs_cycles_t prs_cycles_now(void)
     return (prs_uint64_t)lo | ((prs_uint64_t)hi << 32);
 }
 
+/**
+ * \brief
+ *  Hints the CPU that the caller is spinning on a memory location, in between calls to \ref prs_cycles_now.
+ */
+static PRS_INLINE void prs_cycles_pause(void)
+{
+    __asm__ __volatile__ ("pause" ::: "memory");
+}
+
 #endif /* PRS_PAL_COMPILER == PRS_PAL_COMPILER_GCC */
 
 #endif /* PRS_PAL_ARCH == PRS_PAL_ARCH_X86 || PRS_PAL_ARCH == PRS_PAL_ARCH_AMD64 */
@@ -0,0 +1,60 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains the PAL futex declarations.
+ *
+ *  A futex lets a thread sleep until another thread changes a 32-bit word and wakes it up. The word itself identifies
+ *  the sleeping threads, so there is no kernel object to create, and \ref prs_pal_futex_wait returns right away when
+ *  the word no longer holds the expected value, so that a wake-up that happens before the thread sleeps is not lost.
+ */
+
+#ifndef _PRS_PAL_FUTEX_H
+#define _PRS_PAL_FUTEX_H
+
+#include <prs/pal/atomic.h>
+#include <prs/types.h>
+
+/**
+ * \brief
+ *  Puts the calling thread to sleep while a word holds the specified value.
+ * \param word
+ *  Word to wait on.
+ * \param value
+ *  Value that the word holds when the thread may go to sleep.
+ * \note
+ *  The function may also return spuriously, e.g. when the thread is interrupted by a signal: callers must check the
+ *  word again.
+ */
+void prs_pal_futex_wait(PRS_ATOMIC prs_uint32_t* word, prs_uint32_t value);
+
+/**
+ * \brief
+ *  Wakes up one of the threads that sleep on a word, if any.
+ * \param word
+ *  Word that the threads wait on.
+ */
+void prs_pal_futex_wake(PRS_ATOMIC prs_uint32_t* word);
+
+#endif /* _PRS_PAL_FUTEX_H */
@@ -120,6 +120,17 @@ void prs_pal_mem_commit(void* ptr, prs_size_t size, prs_pal_mem_flags_t flags);
  */
 void prs_pal_mem_uncommit(void* ptr, prs_size_t size);
 
+/**
+ * \brief
+ *  Discards the contents of committed virtual memory, so that its physical memory can be reclaimed by the operating
+ *  system. The memory stays committed and can be accessed again, but its contents are undefined.
+ * \param ptr
+ *  Area of memory that was allocated by \ref prs_pal_mem_map and committed with \ref prs_pal_mem_commit.
+ * \param size
+ *  Number of bytes to discard. Must be a multiple of the operating system's page size.
+ */
+void prs_pal_mem_discard(void* ptr, prs_size_t size);
+
 /**
  * \brief
  *  Locks virtual memory into physical memory.
@@ -27,6 +27,9 @@
  *
  *  The programmable interrupt timer (PIT) is an operating system facility that is used to generate periodic function
  *  calls at precise intervals.
+ *
+ *  A PIT can also be created in one-shot mode, in which case it only calls its callback once each time it is armed
+ *  with \ref prs_pal_pit_arm. Expiry times are expressed in the time base of \ref prs_pal_pit_get_time.
  */
 
 #ifndef _PRS_PAL_PIT_H
@@ -42,8 +45,14 @@ struct prs_pal_pit;
  *  This structure provides the PAL PIT's parameters that should be passed to \ref prs_pal_pit_create.
  */
 struct prs_pal_pit_create_params {
-    /** \brief Period, in ticks, at which the call to \p callback should be made. */
+    /** \brief Period, in ticks, at which the call to \p callback should be made. Unused in one-shot mode. */
     prs_ticks_t                         period;
+    /**
+     * \brief
+     *  If the PIT should be created in one-shot mode. In that mode, the PIT is initially disarmed, and \p callback is
+     *  only called once for each call to \ref prs_pal_pit_arm.
+     */
+    prs_bool_t                          one_shot;
 
     /**
      * \brief
@@ -74,4 +83,23 @@ struct prs_pal_pit* prs_pal_pit_create(struct prs_pal_pit_create_params* params)
  */
 void prs_pal_pit_destroy(struct prs_pal_pit* pal_pit);
 
+/**
+ * \brief
+ *  Arms a one-shot programmable interrupt timer, replacing its previous expiry time.
+ * \param pal_pit
+ *  PIT created in one-shot mode.
+ * \param expiry
+ *  Absolute expiry time, in nanoseconds, as returned by \ref prs_pal_pit_get_time. If the expiry time is already
+ *  past, the callback is called as soon as possible.
+ * \note
+ *  This function may be called from any thread, as well as from the PIT callback itself.
+ */
+void prs_pal_pit_arm(struct prs_pal_pit* pal_pit, prs_uint64_t expiry);
+
+/**
+ * \brief
+ *  Returns the current value of the monotonic clock used by one-shot PITs, in nanoseconds.
+ */
+prs_uint64_t prs_pal_pit_get_time(void);
+
 #endif /* _PRS_PAL_PIT_H */
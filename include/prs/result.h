@@ -46,7 +46,8 @@ typedef enum prs_result {
     PRS_ALREADY_EXISTS,
     PRS_EMPTY,
     PRS_LOCKED,
-    PRS_TIMEOUT
+    PRS_TIMEOUT,
+    PRS_FULL
 } prs_result_t;
 
 #endif /* _PRS_RESULT_H */
@@ -0,0 +1,49 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains reader-writer lock declarations.
+ */
+
+#ifndef _PRS_RWLOCK_H
+#define _PRS_RWLOCK_H
+
+#include <prs/object.h>
+#include <prs/result.h>
+#include <prs/types.h>
+
+struct prs_rwlock;
+
+struct prs_rwlock* prs_rwlock_create(void);
+void prs_rwlock_destroy(struct prs_rwlock* rwlock);
+
+void prs_rwlock_read_lock(struct prs_rwlock* rwlock);
+prs_result_t prs_rwlock_try_read_lock(struct prs_rwlock* rwlock);
+void prs_rwlock_read_unlock(struct prs_rwlock* rwlock);
+
+prs_result_t prs_rwlock_write_lock(struct prs_rwlock* rwlock);
+prs_result_t prs_rwlock_try_write_lock(struct prs_rwlock* rwlock);
+prs_result_t prs_rwlock_write_unlock(struct prs_rwlock* rwlock);
+
+#endif /* _PRS_RWLOCK_H */
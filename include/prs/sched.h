@@ -51,9 +51,16 @@ struct prs_sched_data {
      * \brief
      *  List of \ref prs_sched_worker structures assigned to this scheduler.
      * \note
-     *  Only one worker per scheduler is currently supported.
+     *  Schedulers that support more than one worker must implement \ref prs_sched_ops::add_worker. Tasks running on
+     *  such schedulers may resume their execution on a different worker after each scheduling point.
      */
     struct prs_dllist*                  workers;
+    /**
+     * \brief
+     *  May be set by \ref prs_sched_ops::init when \ref prs_sched_ops::tick never needs to be called with the
+     *  parameters of the scheduler, so that the clock module does not call it at every tick.
+     */
+    prs_bool_t                          no_tick;
 };
 
 /**
@@ -67,6 +74,8 @@ struct prs_sched_worker {
     struct prs_sched_data*              sched_data;
     /** \brief Reference to the worker assigned to this scheduler. */
     struct prs_worker*                  worker;
+    /** \brief Private per-worker data that may be assigned by \ref prs_sched_ops::add_worker. */
+    void*                               userdata;
 };
 
 /**
@@ -93,6 +102,18 @@ struct prs_sched_ops {
      */
     prs_result_t                        (*uninit)(struct prs_sched_data* sched_data);
 
+    /**
+     * \brief
+     *  Adds a worker to the scheduler. This operation is optional and may be \p null.
+     *
+     *  This function is called for each PAL thread added to the scheduler with \ref prs_sched_add_thread, before the
+     *  scheduler is started. The worker itself is not yet created at this point.
+     * \param sched_worker
+     *  Worker instance for this scheduler. The \p userdata field may be filled with private per-worker scheduler
+     *  implementation data.
+     */
+    prs_result_t                        (*add_worker)(struct prs_sched_worker* sched_worker);
+
     /**
      * \brief
      *  Adds a task to the scheduler.
@@ -165,6 +186,51 @@ struct prs_sched_ops {
      *  Task that had its state changed.
      */
     prs_result_t                        (*ready)(struct prs_sched_data* sched_data, struct prs_task* task);
+
+    /**
+     * \brief
+     *  Notifies the scheduler that the priority of a task changed while it was not running on the calling worker. This
+     *  operation is optional and may be \p null, in which case the new priority is only taken into account the next
+     *  time the task is made ready.
+     * \param sched_data
+     *  Scheduler implementation data.
+     * \param task
+     *  Task that had its priority changed.
+     */
+    prs_result_t                        (*set_prio)(struct prs_sched_data* sched_data, struct prs_task* task);
+
+    /**
+     * \brief
+     *  Notifies the scheduler that a system tick elapsed. This operation is optional and may be \p null.
+     *
+     *  This function is called by the clock module at every system tick, from the clock's context rather than from
+     *  one of the scheduler's workers. The scheduler implementation may interrupt its workers, e.g. to enforce time
+     *  slices.
+     * \param sched_data
+     *  Scheduler implementation data.
+     * \param now
+     *  Current system tick, as returned by \ref prs_clock_get.
+     * \return
+     *  The number of ticks after which the operation must be called again, or zero if it does not need to be called.
+     *  This is only used when the clock is tickless. Otherwise, the operation is called at every tick.
+     */
+    prs_ticks_t                         (*tick)(struct prs_sched_data* sched_data, prs_ticks_t now);
+
+    /**
+     * \brief
+     *  Returns if a task of the specified priority would preempt a task running on one of the scheduler's workers, or
+     *  be executed by an idle one, were it made ready now. This operation is optional and may be \p null, in which
+     *  case it is assumed to return \ref PRS_TRUE.
+     *
+     *  This function is called from the clock's context when the timer of one of the scheduler's workers has expiries
+     *  to process. The worker is only interrupted to process them when this function returns \ref PRS_TRUE. Otherwise,
+     *  it processes them at its next scheduling point, and the \p ready operation then makes the usual decision.
+     * \param sched_data
+     *  Scheduler implementation data.
+     * \param prio
+     *  Highest priority among the tasks that may be made ready.
+     */
+    prs_bool_t                          (*preempts)(struct prs_sched_data* sched_data, prs_task_prio_t prio);
 };
 
 /**
@@ -194,12 +260,16 @@ prs_result_t prs_sched_remove_task(prs_sched_id_t id, prs_task_id_t task_id);
 
 void prs_sched_schedule(void);
 prs_result_t prs_sched_ready(struct prs_task* task);
+prs_result_t prs_sched_set_prio(struct prs_task* task);
 void prs_sched_yield(void);
 
 void prs_sched_sleep(prs_ticks_t ticks);
+void prs_sched_sleep_ns(prs_uint64_t ns);
 
 void prs_sched_block(void);
 
+prs_ticks_t prs_sched_tick(prs_ticks_t now);
+
 prs_object_id_t prs_sched_find(const char* name);
 struct prs_sched* prs_sched_find_and_lock(const char* name);
 
@@ -30,6 +30,21 @@
 #define _PRS_SCHED_SWPRIO_H
 
 #include <prs/sched.h>
+#include <prs/ticks.h>
+
+/**
+ * \brief
+ *  Single worker priority scheduler parameters, passed through \ref prs_sched_create_params::userdata. The userdata
+ *  may be \p null, in which case default values are used.
+ */
+struct prs_sched_swprio_params {
+    /**
+     * \brief
+     *  Maximum number of ticks that a task may run before being rotated behind the ready tasks of the same priority.
+     *  Zero disables time slicing, in which case a task runs until it blocks or a higher priority task is ready.
+     */
+    prs_ticks_t                         quantum;
+};
 
 /**
  * \brief
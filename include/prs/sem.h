@@ -35,6 +35,7 @@
 #include <prs/types.h>
 
 struct prs_sem;
+struct prs_wait_list;
 
 /**
  * \brief
@@ -52,7 +53,10 @@ void prs_sem_destroy(struct prs_sem* sem);
 
 void prs_sem_wait(struct prs_sem* sem);
 prs_result_t prs_sem_wait_timeout(struct prs_sem* sem, prs_ticks_t timeout);
+prs_result_t prs_sem_wait_timeout_ns(struct prs_sem* sem, prs_uint64_t timeout_ns);
 void prs_sem_signal(struct prs_sem* sem);
+prs_bool_t prs_sem_try_wait(struct prs_sem* sem);
+struct prs_wait_list* prs_sem_get_wait_list(struct prs_sem* sem);
 
 
 #endif /* _PRS_SEM_H */
@@ -30,14 +30,16 @@
 #define _PRS_TASK_H
 
 #include <prs/config.h>
-#include <prs/msgq.h>
-#include <prs/result.h>
-#include <prs/sched.h>
 #include <prs/types.h>
 
-/** \brief Task priority type. */
+/** \brief Task priority type. Defined first, as the scheduler declarations that are included below use it. */
 typedef PRS_TASK_PRIO_TYPE prs_task_prio_t;
 
+#include <prs/msgq.h>
+#include <prs/result.h>
+#include <prs/sched.h>
+#include <prs/ticks.h>
+
 struct prs_task;
 
 /**
@@ -45,7 +47,10 @@ struct prs_task;
  *  Task creation parameters.
  */
 struct prs_task_create_params {
-    /** \brief Name of the task which can then be found through \ref prs_task_find. */
+    /**
+     * \brief Name of the task which can then be found through \ref prs_task_find. Empty for an anonymous task, which
+     * is cheaper to create and destroy but cannot be found by name.
+     */
     char                                name[PRS_MAX_TASK_NAME];
     /** \brief Userdata that will be passed as a parameter to the entry point. */
     void*                               userdata;
@@ -55,6 +60,41 @@ struct prs_task_create_params {
     prs_task_prio_t                     prio;
     /** \brief Entry point of the task. */
     void                                (*entry)(void* userdata);
+    /** \brief Maximum number of messages in the message queue of the task. Zero if the queue is unbounded. */
+    prs_uint_t                          msgq_capacity;
+    /** \brief What senders do when the message queue of the task is full. */
+    enum prs_msgq_full_policy           msgq_full_policy;
+    /**
+     * \brief Relative deadline of each job of the task, in ticks. Zero if the task has no deadline. May be unused if
+     * the scheduler of the task does not support deadlines.
+     */
+    prs_ticks_t                         deadline;
+    /** \brief Minimum number of ticks between the releases of two jobs of the task. Zero if the task is not periodic. */
+    prs_ticks_t                         period;
+};
+
+/**
+ * \brief
+ *  Stack usage of a task returned by \ref prs_task_get_stack_usage.
+ */
+struct prs_task_stack_usage {
+    /** \brief Size of the stack that is committed to memory. */
+    prs_size_t                          committed_size;
+    /** \brief Deepest stack usage that was observed, in bytes. */
+    prs_size_t                          high_water;
+    /** \brief Number of times the stack was grown because it overflowed its committed size. */
+    prs_uint_t                          grows;
+};
+
+/**
+ * \brief
+ *  Results of a stack reclaim pass returned by \ref prs_task_reclaim_stacks.
+ */
+struct prs_task_stack_reclaim_stats {
+    /** \brief Number of task stacks that were shrunk. */
+    prs_uint_t                          reclaims;
+    /** \brief Number of bytes of stack memory that were uncommitted. */
+    prs_size_t                          reclaimed_size;
 };
 
 struct prs_task* prs_task_create(struct prs_task_create_params* params);
@@ -67,6 +107,13 @@ prs_result_t prs_task_get_userdata(struct prs_task* task, void** userdata);
 
 prs_task_prio_t prs_task_get_prio(struct prs_task* task);
 void prs_task_set_prio(struct prs_task* task, prs_task_prio_t prio);
+void prs_task_set_base_prio(struct prs_task* task, prs_task_prio_t prio);
+
+prs_uint_t prs_task_get_deadline_misses(struct prs_task* task);
+
+void prs_task_get_stack_usage(struct prs_task* task, struct prs_task_stack_usage* usage);
+void prs_task_get_msgq_stats(struct prs_task* task, struct prs_msgq_stats* stats);
+void prs_task_reclaim_stacks(struct prs_task_stack_reclaim_stats* stats);
 
 prs_task_id_t prs_task_get_id(struct prs_task* task);
 struct prs_task* prs_task_current(void);
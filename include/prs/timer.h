@@ -36,14 +36,34 @@
 struct prs_timer;
 struct prs_timer_entry;
 
-struct prs_timer* prs_timer_create(void);
+/**
+ * \brief
+ *  Timer creation parameters.
+ */
+struct prs_timer_create_params {
+    /** \brief Userdata passed to \ref notify. */
+    void*                               userdata;
+    /**
+     * \brief
+     *  Called by \ref prs_timer_poll, from the clock's context, when the owner of the timer must call
+     *  \ref prs_timer_tick. \p prio is the highest priority among the tasks that wait for a timeout of the timer, as
+     *  it was when they queued it, or \ref PRS_MAX_TASK_PRIO when there is none.
+     */
+    void                                (*notify)(void* userdata, prs_task_prio_t prio);
+};
+
+struct prs_timer* prs_timer_create(struct prs_timer_create_params* params);
 void prs_timer_destroy(struct prs_timer* timer);
 
 struct prs_timer_entry* prs_timer_queue(struct prs_timer* timer, struct prs_event* event, prs_event_type_t event_type,
     prs_ticks_t timeout);
+struct prs_timer_entry* prs_timer_queue_ns(struct prs_timer* timer, struct prs_event* event,
+    prs_event_type_t event_type, prs_uint64_t timeout_ns);
 prs_ticks_t prs_timer_get_start(struct prs_timer_entry* entry);
+prs_uint64_t prs_timer_get_start_ns(struct prs_timer_entry* entry);
 void prs_timer_cancel(struct prs_timer* timer, struct prs_timer_entry* entry);
 
 void prs_timer_tick(struct prs_timer* timer);
+prs_bool_t prs_timer_poll(struct prs_timer* timer, prs_ticks_t now, prs_uint64_t now_ns);
 
 #endif /* _PRS_TIMER_H */
@@ -0,0 +1,94 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains the declarations of the waits on multiple objects.
+ */
+
+#ifndef _PRS_WAIT_H
+#define _PRS_WAIT_H
+
+#include <prs/pal/atomic.h>
+#include <prs/idllist.h>
+#include <prs/result.h>
+#include <prs/ticks.h>
+#include <prs/types.h>
+
+struct prs_event;
+struct prs_wait_list;
+
+/**
+ * \brief
+ *  Registration of a waiting task in the wait list of an object.
+ */
+struct prs_wait_watch {
+    /** \brief Node in the wait list. */
+    struct prs_idllist_node             node;
+    /** \brief Event of the waiting task, until the object signals it or the watch is removed. */
+    struct prs_event* PRS_ATOMIC        event;
+};
+
+/**
+ * \brief
+ *  Types of objects that can be waited for by \ref prs_wait_any.
+ */
+enum prs_wait_type {
+    /** \brief Message queue of the current task. Ready when it is not empty. The message is not received. */
+    PRS_WAIT_TYPE_MSGQ = 0,
+    /** \brief Semaphore. Ready when its count is positive, in which case it is decremented. */
+    PRS_WAIT_TYPE_SEM,
+    /** \brief Event flags. Ready when the flags match the mask, as specified by the options. */
+    PRS_WAIT_TYPE_FLAGS
+};
+
+/**
+ * \brief
+ *  Object waited for by \ref prs_wait_any.
+ */
+struct prs_wait_object {
+    /** \brief Type of the object. */
+    enum prs_wait_type                  type;
+    /** \brief The object, whose structure depends on \p type. */
+    void*                               object;
+    /** \brief Flags to wait for, when \p type is \ref PRS_WAIT_TYPE_FLAGS. */
+    prs_uint32_t                        mask;
+    /** \brief Wait options, when \p type is \ref PRS_WAIT_TYPE_FLAGS. */
+    prs_uint32_t                        options;
+    /** \brief Receives the flags that matched the mask, when \p type is \ref PRS_WAIT_TYPE_FLAGS. */
+    prs_uint32_t                        value;
+};
+
+struct prs_wait_list* prs_wait_list_create(void);
+void prs_wait_list_destroy(struct prs_wait_list* list);
+void prs_wait_list_add(struct prs_wait_list* list, struct prs_wait_watch* watch, struct prs_event* event);
+void prs_wait_list_remove(struct prs_wait_list* list, struct prs_wait_watch* watch);
+void prs_wait_list_notify(struct prs_wait_list* list);
+
+prs_result_t prs_wait_any(struct prs_wait_object* objects, prs_uint_t count, prs_uint_t* index);
+prs_result_t prs_wait_any_timeout(struct prs_wait_object* objects, prs_uint_t count, prs_ticks_t timeout,
+    prs_uint_t* index);
+prs_result_t prs_wait_any_timeout_ns(struct prs_wait_object* objects, prs_uint_t count, prs_uint64_t timeout_ns,
+    prs_uint_t* index);
+
+#endif /* _PRS_WAIT_H */
@@ -33,6 +33,10 @@
 #include <prs/sched.h>
 #include <prs/task.h>
 
+struct prs_msgpool;
+struct prs_slab_cache;
+struct prs_stack_cache;
+struct prs_timer;
 struct prs_worker;
 
 /**
@@ -50,6 +54,30 @@ struct prs_worker_ops {
      */
     prs_bool_t                          (*get_next)(void* userdata, struct prs_task* current_task,
                                             struct prs_task** next_task);
+
+    /**
+     * \brief
+     *  This function is called from the clock's context when the worker's timer has expiries to process, to know if the
+     *  worker must be interrupted to process them right away.
+     *
+     *  This function has the same characteristics as \ref prs_sched_ops::preempts.
+     * \see
+     *  \ref prs_sched_ops::preempts
+     */
+    prs_bool_t                          (*preempts)(void* userdata, prs_task_prio_t prio);
+};
+
+/**
+ * \brief
+ *  Worker statistics returned by \ref prs_worker_get_stats.
+ */
+struct prs_worker_stats {
+    /** \brief Number of times the worker was woken up while spinning in idle mode. */
+    prs_uint64_t                        spin_hits;
+    /** \brief Number of times the worker suspended its thread in idle mode. */
+    prs_uint64_t                        parks;
+    /** \brief Number of times the worker was interrupted by a signal to preempt its running task. */
+    prs_uint64_t                        signals;
 };
 
 /**
@@ -72,6 +100,8 @@ prs_result_t prs_worker_stop(struct prs_worker* worker);
 prs_result_t prs_worker_join(struct prs_worker* worker);
 prs_result_t prs_worker_interrupt(struct prs_worker* worker);
 prs_result_t prs_worker_signal(struct prs_worker* worker);
+void prs_worker_poll(struct prs_worker* worker, prs_ticks_t now, prs_uint64_t now_ns);
+void prs_worker_clear_safepoint(struct prs_worker* worker);
 
 prs_bool_t prs_worker_int_disable(struct prs_worker* worker);
 void prs_worker_int_enable(struct prs_worker* worker);
@@ -82,6 +112,13 @@ void prs_worker_schedule(struct prs_worker* worker);
 struct prs_worker* prs_worker_current(void);
 struct prs_task* prs_worker_get_current_task(struct prs_worker* worker);
 prs_task_id_t prs_worker_get_current_task_id(struct prs_worker* worker);
+struct prs_timer* prs_worker_get_timer(struct prs_worker* worker);
+struct prs_stack_cache* prs_worker_get_stack_cache(struct prs_worker* worker);
+struct prs_slab_cache* prs_worker_get_task_cache(struct prs_worker* worker);
+struct prs_msgpool* prs_worker_get_msgpool(struct prs_worker* worker);
+void prs_worker_set_idle_spin_cycles(prs_uint64_t cycles);
+void prs_worker_get_stats(struct prs_worker* worker, struct prs_worker_stats* stats);
+prs_uint_t prs_worker_get_index(struct prs_worker* worker);
 void* prs_worker_get_userdata(struct prs_worker* worker);
 
 void prs_worker_restore_context(struct prs_worker* worker, struct prs_pal_context* context);
@@ -0,0 +1,347 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+
+/**
+ * \file
+ * \brief
+ *  This file contains the message pool definitions.
+ *
+ *  A message pool hands out the memory of messages without going through the general purpose allocator. Blocks are
+ *  sorted in size classes that are powers of 2, starting at \ref PRS_MSGPOOL_MIN_BLOCK_SIZE. Each size class is backed
+ *  by a slab that is shared by all pools, and a pool keeps a list of free blocks per size class in front of it. A pool
+ *  is not thread-safe: it is meant to be owned by a single worker, which allocates the messages of its tasks from it.
+ *
+ *  Every block starts with a small header that records the pool it was allocated from. When a block is freed to
+ *  another pool than its own, which happens when a message is received and freed on another worker than the one that
+ *  allocated it, the block is pushed to a lock-free list of remote blocks of its owning pool. The owner takes back
+ *  all of its remote blocks at once when its own list of free blocks runs empty, so that the blocks of each worker
+ *  stay with that worker instead of accumulating where messages are consumed.
+ *
+ *  Allocations that are too large for the size classes go to the general purpose allocator.
+ */
+
+#include <prs/alloc/msgpool.h>
+#include <prs/alloc/slab.h>
+#include <prs/pal/atomic.h>
+#include <prs/pal/bitops.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/config.h>
+#include <prs/error.h>
+
+#define PRS_MSGPOOL_LARGE               ((prs_uint_t)-1)
+
+/* Number of blocks moved at once between a pool and a slab */
+#define PRS_MSGPOOL_BATCH_BLOCKS        16
+
+/* Precedes the memory returned by the pool */
+struct prs_msgpool_block {
+    union {
+        /* Pool that allocated the block, while it is allocated */
+        struct prs_msgpool*             pool;
+        /* Next free block, while it is in a list of free blocks */
+        struct prs_msgpool_block*       next;
+    };
+    prs_uint_t                          size_class;
+};
+
+/* Keeps the memory returned to the user aligned as if it came from the general purpose allocator */
+#define PRS_MSGPOOL_BLOCK_OVERHEAD      (prs_bitops_align_size(sizeof(struct prs_msgpool_block), \
+                                            2 * sizeof(void*)))
+
+struct prs_msgpool_class {
+    struct prs_msgpool_block*           blocks;
+    prs_uint_t                          count;
+    /* Blocks of this pool freed by other pools */
+    struct prs_msgpool_block* PRS_ATOMIC
+                                        remote_blocks;
+};
+
+struct prs_msgpool {
+    struct prs_msgpool_class            classes[PRS_MSGPOOL_CLASSES];
+    prs_uint_t                          max_blocks;
+
+    /* Only written by the owner, but may be read from anywhere */
+    PRS_ATOMIC prs_uint64_t             allocs;
+    PRS_ATOMIC prs_uint64_t             large_allocs;
+    PRS_ATOMIC prs_uint64_t             local_frees;
+    PRS_ATOMIC prs_uint64_t             remote_frees;
+    PRS_ATOMIC prs_uint64_t             reclaims;
+    PRS_ATOMIC prs_uint64_t             refills;
+    PRS_ATOMIC prs_uint64_t             flushes;
+};
+
+#define PRS_MSGPOOL_ADD(pool, field, n) \
+    prs_pal_atomic_store(&(pool)->field, prs_pal_atomic_load(&(pool)->field) + (n))
+
+static struct prs_slab* s_prs_msgpool_slabs[PRS_MSGPOOL_CLASSES];
+static prs_int_t s_prs_msgpool_min_shift = 0;
+
+static void prs_msgpool_init_slabs(void)
+{
+    if (s_prs_msgpool_slabs[0]) {
+        return;
+    }
+
+    s_prs_msgpool_min_shift = prs_bitops_hsb_uint(PRS_MSGPOOL_MIN_BLOCK_SIZE);
+    for (prs_uint_t i = 0; i < PRS_MSGPOOL_CLASSES; ++i) {
+        const prs_size_t block_size = (prs_size_t)PRS_MSGPOOL_MIN_BLOCK_SIZE << i;
+        const prs_uint_t chunk_blocks = (prs_uint_t)(PRS_MSGPOOL_SLAB_CHUNK_SIZE / block_size);
+        struct prs_slab_create_params slab_params = {
+            .object_size = block_size,
+            .object_align = 2 * sizeof(void*),
+            .chunk_objects = chunk_blocks ? chunk_blocks : 1
+        };
+        s_prs_msgpool_slabs[i] = prs_slab_create(&slab_params);
+        PRS_FATAL_WHEN(!s_prs_msgpool_slabs[i]);
+    }
+}
+
+static prs_uint_t prs_msgpool_get_size_class(prs_size_t size)
+{
+    const prs_size_t block_size = PRS_MSGPOOL_BLOCK_OVERHEAD + size;
+    if (block_size <= PRS_MSGPOOL_MIN_BLOCK_SIZE) {
+        return 0;
+    }
+    const prs_uint_t size_class = prs_bitops_hsb_uint((prs_uint_t)(block_size - 1)) - s_prs_msgpool_min_shift + 1;
+    return size_class < PRS_MSGPOOL_CLASSES ? size_class : PRS_MSGPOOL_LARGE;
+}
+
+static void prs_msgpool_flush(struct prs_msgpool* pool, prs_uint_t size_class, prs_uint_t count)
+{
+    struct prs_msgpool_class* class = &pool->classes[size_class];
+    PRS_ASSERT(count <= class->count);
+
+    void* objects[PRS_MSGPOOL_BATCH_BLOCKS];
+    while (count) {
+        prs_uint_t batch = 0;
+        while (batch < PRS_MSGPOOL_BATCH_BLOCKS && batch < count) {
+            struct prs_msgpool_block* block = class->blocks;
+            class->blocks = block->next;
+            objects[batch++] = block;
+        }
+        prs_slab_free_batch(s_prs_msgpool_slabs[size_class], objects, batch);
+        class->count -= batch;
+        count -= batch;
+    }
+}
+
+static prs_bool_t prs_msgpool_refill(struct prs_msgpool* pool, prs_uint_t size_class)
+{
+    struct prs_msgpool_class* class = &pool->classes[size_class];
+    PRS_ASSERT(!class->blocks);
+
+    /* Take back the blocks freed by other pools before going to the slab */
+    struct prs_msgpool_block* block = prs_pal_atomic_exchange(&class->remote_blocks, 0);
+    if (block) {
+        class->blocks = block;
+        prs_uint_t count = 0;
+        for (; block; block = block->next) {
+            ++count;
+        }
+        class->count = count;
+        PRS_MSGPOOL_ADD(pool, reclaims, count);
+        return PRS_TRUE;
+    }
+
+    void* objects[PRS_MSGPOOL_BATCH_BLOCKS];
+    const prs_uint_t count = prs_slab_alloc_batch(s_prs_msgpool_slabs[size_class], objects, PRS_MSGPOOL_BATCH_BLOCKS);
+    for (prs_uint_t i = 0; i < count; ++i) {
+        block = objects[i];
+        block->next = class->blocks;
+        class->blocks = block;
+    }
+    class->count = count;
+    PRS_MSGPOOL_ADD(pool, refills, 1);
+    return count > 0;
+}
+
+static void prs_msgpool_free_remote(struct prs_msgpool_block* block)
+{
+    struct prs_msgpool* owner = block->pool;
+    if (!owner) {
+        prs_slab_free(s_prs_msgpool_slabs[block->size_class], block);
+        return;
+    }
+
+    struct prs_msgpool_class* class = &owner->classes[block->size_class];
+    struct prs_msgpool_block* next = prs_pal_atomic_load(&class->remote_blocks);
+    do {
+        block->next = next;
+    } while (!prs_pal_atomic_compare_exchange_weak(&class->remote_blocks, &next, block));
+}
+
+/**
+ * \brief
+ *  Creates a message pool.
+ * \param params
+ *  Message pool parameters.
+ * \see
+ *  prs_msgpool_create_params
+ */
+struct prs_msgpool* prs_msgpool_create(struct prs_msgpool_create_params* params)
+{
+    PRS_PRECONDITION(params);
+    PRS_PRECONDITION(params->max_blocks > 0);
+
+    prs_msgpool_init_slabs();
+
+    struct prs_msgpool* pool = prs_pal_malloc_zero(sizeof(*pool));
+    PRS_ERROR_IF (!pool) {
+        return 0;
+    }
+
+    pool->max_blocks = params->max_blocks;
+
+    return pool;
+}
+
+/**
+ * \brief
+ *  Destroys a message pool. The free blocks it holds are returned to the slabs.
+ * \param pool
+ *  Message pool to destroy.
+ * \note
+ *  Blocks allocated from the pool must not be freed after the pool is destroyed.
+ */
+void prs_msgpool_destroy(struct prs_msgpool* pool)
+{
+    PRS_PRECONDITION(pool);
+
+    for (prs_uint_t i = 0; i < PRS_MSGPOOL_CLASSES; ++i) {
+        struct prs_msgpool_class* class = &pool->classes[i];
+        prs_msgpool_flush(pool, i, class->count);
+        if (prs_pal_atomic_load(&class->remote_blocks)) {
+            prs_msgpool_refill(pool, i);
+            prs_msgpool_flush(pool, i, class->count);
+        }
+    }
+    prs_pal_free(pool);
+}
+
+/**
+ * \brief
+ *  Allocates memory from a message pool.
+ * \param pool
+ *  Message pool to allocate from. When \p null, the memory is allocated directly from the shared slabs.
+ * \param size
+ *  Size of the memory to allocate.
+ * \return
+ *  The allocated memory, or \p null if memory is exhausted.
+ */
+void* prs_msgpool_alloc(struct prs_msgpool* pool, prs_size_t size)
+{
+    prs_msgpool_init_slabs();
+
+    struct prs_msgpool_block* block;
+    const prs_uint_t size_class = prs_msgpool_get_size_class(size);
+    if (size_class == PRS_MSGPOOL_LARGE) {
+        block = prs_pal_malloc(PRS_MSGPOOL_BLOCK_OVERHEAD + size);
+        if (!block) {
+            return 0;
+        }
+        if (pool) {
+            PRS_MSGPOOL_ADD(pool, large_allocs, 1);
+        }
+    } else if (pool) {
+        struct prs_msgpool_class* class = &pool->classes[size_class];
+        if (!class->blocks && !prs_msgpool_refill(pool, size_class)) {
+            return 0;
+        }
+        block = class->blocks;
+        class->blocks = block->next;
+        --class->count;
+        PRS_MSGPOOL_ADD(pool, allocs, 1);
+    } else {
+        block = prs_slab_alloc(s_prs_msgpool_slabs[size_class]);
+        if (!block) {
+            return 0;
+        }
+    }
+
+    block->pool = pool;
+    block->size_class = size_class;
+    return (prs_uint8_t*)block + PRS_MSGPOOL_BLOCK_OVERHEAD;
+}
+
+/**
+ * \brief
+ *  Frees memory allocated from a message pool.
+ * \param pool
+ *  Message pool of the caller, which does not have to be the pool that allocated the memory. When \p null, the memory
+ *  is returned to the pool that allocated it, or to the shared slabs.
+ * \param ptr
+ *  Memory to free.
+ */
+void prs_msgpool_free(struct prs_msgpool* pool, void* ptr)
+{
+    PRS_PRECONDITION(ptr);
+
+    struct prs_msgpool_block* block = (struct prs_msgpool_block*)((prs_uint8_t*)ptr - PRS_MSGPOOL_BLOCK_OVERHEAD);
+    const prs_uint_t size_class = block->size_class;
+    if (size_class == PRS_MSGPOOL_LARGE) {
+        prs_pal_free(block);
+        return;
+    }
+    PRS_ASSERT(size_class < PRS_MSGPOOL_CLASSES);
+
+    if (!pool || block->pool != pool) {
+        if (pool) {
+            PRS_MSGPOOL_ADD(pool, remote_frees, 1);
+        }
+        prs_msgpool_free_remote(block);
+        return;
+    }
+
+    struct prs_msgpool_class* class = &pool->classes[size_class];
+    if (class->count >= pool->max_blocks) {
+        prs_msgpool_flush(pool, size_class, class->count - pool->max_blocks / 2);
+        PRS_MSGPOOL_ADD(pool, flushes, 1);
+    }
+    block->next = class->blocks;
+    class->blocks = block;
+    ++class->count;
+    PRS_MSGPOOL_ADD(pool, local_frees, 1);
+}
+
+/**
+ * \brief
+ *  Returns the statistics of a message pool.
+ * \param pool
+ *  Message pool to get the statistics from.
+ * \param stats
+ *  Receives the statistics.
+ */
+void prs_msgpool_get_stats(struct prs_msgpool* pool, struct prs_msgpool_stats* stats)
+{
+    PRS_PRECONDITION(pool);
+    PRS_PRECONDITION(stats);
+
+    stats->allocs = prs_pal_atomic_load(&pool->allocs);
+    stats->large_allocs = prs_pal_atomic_load(&pool->large_allocs);
+    stats->local_frees = prs_pal_atomic_load(&pool->local_frees);
+    stats->remote_frees = prs_pal_atomic_load(&pool->remote_frees);
+    stats->reclaims = prs_pal_atomic_load(&pool->reclaims);
+    stats->refills = prs_pal_atomic_load(&pool->refills);
+    stats->flushes = prs_pal_atomic_load(&pool->flushes);
+}
@@ -0,0 +1,334 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains the slab allocator definitions.
+ *
+ *  The slab allocator hands out fixed-size objects carved from large chunks of memory, so that objects that are
+ *  allocated and freed often do not go through the general purpose allocator. Freed objects are kept in a free list
+ *  and reused; chunks are only released when the slab is destroyed. The slab is protected by a spinlock.
+ *
+ *  A slab cache (\ref prs_slab_cache_create) keeps a small array of free objects in front of a slab so that most
+ *  allocations and frees do not take the slab's lock. When it runs empty or full, it moves half of its capacity from
+ *  or to the slab in one batch. A slab cache is not thread-safe: it is meant to be owned by a single worker. Objects
+ *  can be freed to any cache of the slab, regardless of the cache that allocated them.
+ */
+
+#include <prs/alloc/slab.h>
+#include <prs/pal/bitops.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/error.h>
+#include <prs/spinlock.h>
+
+/* Free objects are linked through their first bytes */
+struct prs_slab_free_object {
+    struct prs_slab_free_object*        next;
+};
+
+struct prs_slab_chunk {
+    struct prs_slab_chunk*              next;
+};
+
+struct prs_slab {
+    struct prs_spinlock*                lock;
+
+    prs_size_t                          object_size;
+    prs_size_t                          object_align;
+    prs_uint_t                          chunk_objects;
+
+    struct prs_slab_chunk*              chunks;
+    struct prs_slab_free_object*        free_objects;
+
+    /* Part of the last chunk that was not carved into objects yet */
+    prs_uintptr_t                       carve_ptr;
+    prs_uint_t                          carve_count;
+};
+
+struct prs_slab_cache {
+    struct prs_slab*                    slab;
+    prs_uint_t                          max_objects;
+    prs_uint_t                          count;
+    void*                               objects[1];
+};
+
+static prs_bool_t prs_slab_add_chunk(struct prs_slab* slab)
+{
+    /* Leave room for the chunk header and for aligning the first object */
+    const prs_size_t size = sizeof(struct prs_slab_chunk) + slab->object_align + slab->object_size * slab->chunk_objects;
+    struct prs_slab_chunk* chunk = prs_pal_malloc(size);
+    if (!chunk) {
+        return PRS_FALSE;
+    }
+
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+
+    slab->carve_ptr = prs_bitops_align_size((prs_uintptr_t)(chunk + 1), slab->object_align);
+    slab->carve_count = slab->chunk_objects;
+    return PRS_TRUE;
+}
+
+/**
+ * \brief
+ *  Creates a slab.
+ * \param params
+ *  Slab parameters.
+ * \see
+ *  prs_slab_create_params
+ */
+struct prs_slab* prs_slab_create(struct prs_slab_create_params* params)
+{
+    PRS_PRECONDITION(params);
+    PRS_PRECONDITION(params->object_size >= sizeof(struct prs_slab_free_object));
+    PRS_PRECONDITION(prs_bitops_is_power_of_2(params->object_align));
+    PRS_PRECONDITION(params->chunk_objects > 0);
+
+    struct prs_slab* slab = prs_pal_malloc_zero(sizeof(*slab));
+    PRS_ERROR_IF (!slab) {
+        return 0;
+    }
+
+    slab->lock = prs_spinlock_create();
+    slab->object_size = prs_bitops_align_size(params->object_size, params->object_align);
+    slab->object_align = params->object_align;
+    slab->chunk_objects = params->chunk_objects;
+
+    return slab;
+}
+
+/**
+ * \brief
+ *  Destroys a slab and releases its memory. Objects that are still allocated from the slab become invalid.
+ * \param slab
+ *  Slab to destroy.
+ */
+void prs_slab_destroy(struct prs_slab* slab)
+{
+    PRS_PRECONDITION(slab);
+
+    struct prs_slab_chunk* chunk = slab->chunks;
+    while (chunk) {
+        struct prs_slab_chunk* next = chunk->next;
+        prs_pal_free(chunk);
+        chunk = next;
+    }
+
+    prs_spinlock_destroy(slab->lock);
+    prs_pal_free(slab);
+}
+
+/**
+ * \brief
+ *  Returns the size of the objects allocated from a slab.
+ * \param slab
+ *  Slab to get the object size from.
+ */
+prs_size_t prs_slab_get_object_size(struct prs_slab* slab)
+{
+    return slab->object_size;
+}
+
+/**
+ * \brief
+ *  Allocates multiple objects from a slab at once.
+ * \param slab
+ *  Slab to allocate from.
+ * \param objects
+ *  Receives the allocated objects.
+ * \param count
+ *  Number of objects to allocate.
+ * \return
+ *  Number of objects that were allocated, which is less than \p count when memory is exhausted.
+ */
+prs_uint_t prs_slab_alloc_batch(struct prs_slab* slab, void** objects, prs_uint_t count)
+{
+    PRS_PRECONDITION(slab);
+    PRS_PRECONDITION(objects);
+
+    prs_uint_t allocated = 0;
+
+    prs_spinlock_lock(slab->lock);
+    while (allocated < count) {
+        struct prs_slab_free_object* object = slab->free_objects;
+        if (object) {
+            slab->free_objects = object->next;
+            objects[allocated++] = object;
+            continue;
+        }
+
+        if (!slab->carve_count && !prs_slab_add_chunk(slab)) {
+            break;
+        }
+        objects[allocated++] = (void*)slab->carve_ptr;
+        slab->carve_ptr += slab->object_size;
+        --slab->carve_count;
+    }
+    prs_spinlock_unlock(slab->lock);
+
+    return allocated;
+}
+
+/**
+ * \brief
+ *  Frees multiple objects to a slab at once.
+ * \param slab
+ *  Slab to free to.
+ * \param objects
+ *  Objects to free.
+ * \param count
+ *  Number of objects to free.
+ */
+void prs_slab_free_batch(struct prs_slab* slab, void** objects, prs_uint_t count)
+{
+    PRS_PRECONDITION(slab);
+    PRS_PRECONDITION(objects);
+
+    if (!count) {
+        return;
+    }
+
+    /* Link the objects together before taking the lock */
+    for (prs_uint_t i = 0; i < count - 1; ++i) {
+        struct prs_slab_free_object* object = objects[i];
+        object->next = objects[i + 1];
+    }
+    struct prs_slab_free_object* last = objects[count - 1];
+
+    prs_spinlock_lock(slab->lock);
+    last->next = slab->free_objects;
+    slab->free_objects = objects[0];
+    prs_spinlock_unlock(slab->lock);
+}
+
+/**
+ * \brief
+ *  Allocates an object from a slab.
+ * \param slab
+ *  Slab to allocate from.
+ * \return
+ *  The allocated object, or \p null if memory is exhausted.
+ */
+void* prs_slab_alloc(struct prs_slab* slab)
+{
+    void* object;
+    return prs_slab_alloc_batch(slab, &object, 1) ? object : 0;
+}
+
+/**
+ * \brief
+ *  Frees an object to a slab.
+ * \param slab
+ *  Slab to free to.
+ * \param object
+ *  Object to free.
+ */
+void prs_slab_free(struct prs_slab* slab, void* object)
+{
+    prs_slab_free_batch(slab, &object, 1);
+}
+
+/**
+ * \brief
+ *  Creates a slab cache.
+ * \param params
+ *  Slab cache parameters.
+ * \see
+ *  prs_slab_cache_create_params
+ */
+struct prs_slab_cache* prs_slab_cache_create(struct prs_slab_cache_create_params* params)
+{
+    PRS_PRECONDITION(params);
+    PRS_PRECONDITION(params->slab);
+    PRS_PRECONDITION(params->max_objects > 0);
+
+    struct prs_slab_cache* cache = prs_pal_malloc_zero(sizeof(*cache) + sizeof(void*) * (params->max_objects - 1));
+    PRS_ERROR_IF (!cache) {
+        return 0;
+    }
+
+    cache->slab = params->slab;
+    cache->max_objects = params->max_objects;
+
+    return cache;
+}
+
+/**
+ * \brief
+ *  Destroys a slab cache. The objects it holds are returned to its slab.
+ * \param cache
+ *  Slab cache to destroy.
+ */
+void prs_slab_cache_destroy(struct prs_slab_cache* cache)
+{
+    PRS_PRECONDITION(cache);
+
+    prs_slab_free_batch(cache->slab, cache->objects, cache->count);
+    prs_pal_free(cache);
+}
+
+/**
+ * \brief
+ *  Allocates an object from a slab cache, refilling it from its slab when it is empty.
+ * \param cache
+ *  Slab cache to allocate from.
+ * \return
+ *  The allocated object, or \p null if memory is exhausted.
+ */
+void* prs_slab_cache_alloc(struct prs_slab_cache* cache)
+{
+    PRS_PRECONDITION(cache);
+
+    if (!cache->count) {
+        const prs_uint_t refill = (cache->max_objects + 1) / 2;
+        cache->count = prs_slab_alloc_batch(cache->slab, cache->objects, refill);
+        if (!cache->count) {
+            return 0;
+        }
+    }
+
+    return cache->objects[--cache->count];
+}
+
+/**
+ * \brief
+ *  Frees an object to a slab cache, flushing half of it to its slab when it is full.
+ * \param cache
+ *  Slab cache to free to.
+ * \param object
+ *  Object to free. Must have been allocated from the slab of the cache.
+ */
+void prs_slab_cache_free(struct prs_slab_cache* cache, void* object)
+{
+    PRS_PRECONDITION(cache);
+    PRS_PRECONDITION(object);
+
+    if (cache->count == cache->max_objects) {
+        const prs_uint_t flush = (cache->max_objects + 1) / 2;
+        cache->count -= flush;
+        prs_slab_free_batch(cache->slab, &cache->objects[cache->count], flush);
+    }
+
+    cache->objects[cache->count++] = object;
+}
@@ -32,11 +32,22 @@
  *  stack using \ref prs_stack_grow. Growing the stack consists in committing more pages of memory.
  *
  *  The maximum stack size is defined by the \ref PRS_MAX_STACK_SIZE macro.
+ *
+ *  Creating and destroying stacks costs system calls to map and unmap their memory, as well as page faults when they
+ *  are first used. A stack cache (\ref prs_stack_cache_create) keeps destroyed stacks around so that they can be
+ *  reused. Cached stacks are sorted by committed size, in lists of stacks that have at least 2^n committed pages.
+ *  When the cache holds more than a number of stacks, the pages of the stacks that are added to it are discarded,
+ *  except for the top page, which holds the bookkeeping of the cache. A stack cache is not thread-safe: it is meant
+ *  to be owned by a single worker.
  */
 
+#include <string.h>
+
 #include <prs/alloc/stack.h>
 #include <prs/pal/arch.h>
+#include <prs/pal/atomic.h>
 #include <prs/pal/bitops.h>
+#include <prs/pal/malloc.h>
 #include <prs/pal/mem.h>
 #include <prs/pal/os.h>
 #include <prs/config.h>
@@ -68,6 +79,31 @@
 #define PRS_STACK_EXTRA_PAGES           0
 #endif
 
+#define PRS_STACK_CACHE_CLASSES         (sizeof(prs_uint_t) * 8)
+
+/* Written at the top of a cached stack, in the top page which is never discarded */
+struct prs_stack_cache_entry {
+    struct prs_stack_cache_entry*       next;
+    prs_size_t                          size;
+    prs_bool_t                          trimmed;
+};
+
+struct prs_stack_cache {
+    struct prs_stack_cache_entry*       lists[PRS_STACK_CACHE_CLASSES];
+
+    prs_size_t                          page_size;
+    prs_uint_t                          max_stacks;
+    prs_uint_t                          resident_stacks;
+    prs_bool_t                          prefault;
+
+    /* Only written by the owner, but may be read from anywhere */
+    PRS_ATOMIC prs_uint64_t             hits;
+    PRS_ATOMIC prs_uint64_t             misses;
+    PRS_ATOMIC prs_uint64_t             releases;
+    PRS_ATOMIC prs_uint64_t             trims;
+    PRS_ATOMIC prs_uint_t               count;
+};
+
 /**
  * \brief
  *  Creates a stack.
@@ -189,6 +225,53 @@ prs_bool_t prs_stack_grow(void* stack, prs_size_t old_size, void* failed_ptr, pr
     return PRS_TRUE;
 }
 
+/**
+ * \brief
+ *  Shrinks a stack by uncommitting the pages that are below an address, so that their physical memory is released.
+ * \param stack
+ *  Stack to shrink. Must be a value returned by \ref prs_stack_create.
+ * \param old_size
+ *  Current stack size. Must be a value obtained from \ref prs_stack_create or \ref prs_stack_grow.
+ * \param keep_ptr
+ *  Lowest address of the stack that must remain accessible.
+ * \return
+ *  New stack size, which is \p old_size if the stack could not be shrunk.
+ * \note
+ *  The stack must not be in use while it is shrunk. Accessing the pages that were uncommitted raises a stack overflow
+ *  exception, after which the stack can be grown again with \ref prs_stack_grow.
+ */
+prs_size_t prs_stack_shrink(void* stack, prs_size_t old_size, void* keep_ptr)
+{
+    PRS_PRECONDITION(stack);
+    PRS_PRECONDITION(prs_stack_address_in_range(stack, keep_ptr));
+
+    const prs_size_t page_size = prs_pal_os_get_page_size();
+    const prs_size_t required_size = (prs_uintptr_t)stack - (prs_uintptr_t)keep_ptr;
+    const prs_size_t new_size = prs_bitops_align_size(required_size, page_size);
+    if (new_size >= old_size) {
+        return old_size;
+    }
+
+    void* old_limit = (void*)((prs_uintptr_t)stack - old_size);
+    const prs_size_t shrink_size = old_size - new_size;
+
+#if PRS_PAL_OS == PRS_PAL_OS_WINDOWS
+    /* Move the extra pages and the guard page right below the new limit */
+    const prs_size_t extra_size = page_size * (1 + PRS_STACK_EXTRA_PAGES);
+    void* stack_limit = (void*)((prs_uintptr_t)stack - new_size);
+    void* stack_extra = (void*)((prs_uintptr_t)stack_limit - extra_size);
+    void* stack_guard = (void*)((prs_uintptr_t)stack_limit - page_size);
+    prs_pal_mem_uncommit((void*)((prs_uintptr_t)old_limit - extra_size), shrink_size);
+    prs_pal_mem_commit(stack_extra, page_size * PRS_STACK_EXTRA_PAGES, PRS_PAL_MEM_FLAG_READ | PRS_PAL_MEM_FLAG_WRITE);
+    prs_pal_mem_commit(stack_guard, page_size, PRS_PAL_MEM_FLAG_GUARD | PRS_PAL_MEM_FLAG_READ | PRS_PAL_MEM_FLAG_WRITE);
+#else
+    prs_pal_mem_discard(old_limit, shrink_size);
+    prs_pal_mem_uncommit(old_limit, shrink_size);
+#endif /* PRS_PAL_OS_WINDOWS */
+
+    return new_size;
+}
+
 /**
  * \brief
  *  Returns if the provided address is within the specified stack's range.
@@ -204,3 +287,194 @@ prs_bool_t prs_stack_address_in_range(void* stack, void* address)
     const prs_uintptr_t end = (prs_uintptr_t)stack;
     return (ptr >= start && ptr < end);
 }
+
+/**
+ * \brief
+ *  Scans a stack for the deepest word that is not zero.
+ * \param stack
+ *  Stack to scan. Must be a value returned by \ref prs_stack_create.
+ * \param size
+ *  Size of the stack that is committed to memory.
+ * \return
+ *  Number of bytes between the end of the stack and the deepest word that is not zero.
+ * \note
+ *  The result is only meaningful for stacks that were zeroed when they were handed out, which stacks fresh from
+ *  \ref prs_stack_create are.
+ */
+prs_size_t prs_stack_scan_usage(void* stack, prs_size_t size)
+{
+    PRS_PRECONDITION(stack);
+
+    const prs_uintptr_t* ptr = (const prs_uintptr_t*)((prs_uintptr_t)stack - size);
+    const prs_uintptr_t* end = stack;
+    while (ptr < end && !*ptr) {
+        ++ptr;
+    }
+    return (prs_uintptr_t)end - (prs_uintptr_t)ptr;
+}
+
+static void prs_stack_prefault(void* stack, prs_size_t size, prs_size_t page_size)
+{
+    for (prs_size_t offset = page_size; offset <= size; offset += page_size) {
+        *(volatile char*)((prs_uintptr_t)stack - offset) = 0;
+    }
+}
+
+#define PRS_STACK_CACHE_INC(cache, field) \
+    prs_pal_atomic_store(&(cache)->field, prs_pal_atomic_load(&(cache)->field) + 1)
+
+/**
+ * \brief
+ *  Creates a stack cache.
+ * \param params
+ *  Stack cache parameters.
+ * \see
+ *  prs_stack_cache_create_params
+ */
+struct prs_stack_cache* prs_stack_cache_create(struct prs_stack_cache_create_params* params)
+{
+    PRS_PRECONDITION(params);
+
+    struct prs_stack_cache* cache = prs_pal_malloc_zero(sizeof(*cache));
+    PRS_ERROR_IF (!cache) {
+        return 0;
+    }
+
+    cache->page_size = prs_pal_os_get_page_size();
+    cache->max_stacks = params->max_stacks;
+    cache->resident_stacks = params->resident_stacks;
+    cache->prefault = params->prefault;
+
+    return cache;
+}
+
+/**
+ * \brief
+ *  Destroys a stack cache, along with the stacks it holds.
+ * \param cache
+ *  Stack cache to destroy.
+ */
+void prs_stack_cache_destroy(struct prs_stack_cache* cache)
+{
+    PRS_PRECONDITION(cache);
+
+    for (prs_uint_t i = 0; i < PRS_STACK_CACHE_CLASSES; ++i) {
+        struct prs_stack_cache_entry* entry = cache->lists[i];
+        while (entry) {
+            struct prs_stack_cache_entry* next = entry->next;
+            prs_stack_destroy(entry + 1);
+            entry = next;
+        }
+    }
+
+    prs_pal_free(cache);
+}
+
+/**
+ * \brief
+ *  Allocates a stack from a stack cache, or creates one if the cache has none of the requested size.
+ * \param cache
+ *  Stack cache to allocate from.
+ * \param size
+ *  Initial requested size of the stack.
+ * \param available_size
+ *  Actual stack size that is committed to memory.
+ * \return
+ *  Pointer to the end of the stack.
+ * \note
+ *  The \p available_size parameter may be larger than the requested size aligned to the system's page size, when
+ *  the stack is reused from a task that grew it.
+ */
+void* prs_stack_cache_alloc(struct prs_stack_cache* cache, prs_size_t size, prs_size_t* available_size)
+{
+    PRS_PRECONDITION(cache);
+    PRS_PRECONDITION(size > 0);
+
+    const prs_uint_t pages = (prs_uint_t)(prs_bitops_align_size(size, cache->page_size) / cache->page_size);
+    const prs_uint_t first_class = prs_bitops_hsb_uint(pages) + (prs_bitops_is_power_of_2(pages) ? 0 : 1);
+    for (prs_uint_t i = first_class; i < PRS_STACK_CACHE_CLASSES; ++i) {
+        struct prs_stack_cache_entry* entry = cache->lists[i];
+        if (entry) {
+            cache->lists[i] = entry->next;
+            prs_pal_atomic_store(&cache->count, prs_pal_atomic_load(&cache->count) - 1);
+            PRS_STACK_CACHE_INC(cache, hits);
+
+            void* stack = entry + 1;
+            *available_size = entry->size;
+#if defined(PRS_STACK_SCAN)
+            memset((void*)((prs_uintptr_t)stack - entry->size), 0, entry->size);
+#else
+            if (entry->trimmed && cache->prefault) {
+                prs_stack_prefault(stack, entry->size, cache->page_size);
+            }
+#endif /* PRS_STACK_SCAN */
+            return stack;
+        }
+    }
+
+    PRS_STACK_CACHE_INC(cache, misses);
+    void* stack = prs_stack_create(size, available_size);
+    if (stack && cache->prefault) {
+        prs_stack_prefault(stack, *available_size, cache->page_size);
+    }
+    return stack;
+}
+
+/**
+ * \brief
+ *  Returns a stack to a stack cache. The stack is destroyed if the cache is full.
+ * \param cache
+ *  Stack cache to return the stack to.
+ * \param stack
+ *  Stack to return. Must be a value returned by \ref prs_stack_create or \ref prs_stack_cache_alloc.
+ * \param size
+ *  Size of the stack that is committed to memory, as last returned by \ref prs_stack_create,
+ *  \ref prs_stack_cache_alloc or \ref prs_stack_grow.
+ */
+void prs_stack_cache_free(struct prs_stack_cache* cache, void* stack, prs_size_t size)
+{
+    PRS_PRECONDITION(cache);
+    PRS_PRECONDITION(stack);
+    PRS_PRECONDITION(size >= cache->page_size);
+
+    const prs_uint_t count = prs_pal_atomic_load(&cache->count);
+    if (count >= cache->max_stacks) {
+        PRS_STACK_CACHE_INC(cache, releases);
+        prs_stack_destroy(stack);
+        return;
+    }
+
+    struct prs_stack_cache_entry* entry = (struct prs_stack_cache_entry*)stack - 1;
+    entry->size = size;
+    entry->trimmed = PRS_FALSE;
+    if (count >= cache->resident_stacks && size > cache->page_size) {
+        PRS_STACK_CACHE_INC(cache, trims);
+        prs_pal_mem_discard((void*)((prs_uintptr_t)stack - size), size - cache->page_size);
+        entry->trimmed = PRS_TRUE;
+    }
+
+    const prs_uint_t class = prs_bitops_hsb_uint((prs_uint_t)(size / cache->page_size));
+    entry->next = cache->lists[class];
+    cache->lists[class] = entry;
+    prs_pal_atomic_store(&cache->count, count + 1);
+}
+
+/**
+ * \brief
+ *  Returns the statistics of a stack cache.
+ * \param cache
+ *  Stack cache to get the statistics from.
+ * \param stats
+ *  Receives the statistics.
+ */
+void prs_stack_cache_get_stats(struct prs_stack_cache* cache, struct prs_stack_cache_stats* stats)
+{
+    PRS_PRECONDITION(cache);
+    PRS_PRECONDITION(stats);
+
+    stats->hits = prs_pal_atomic_load(&cache->hits);
+    stats->misses = prs_pal_atomic_load(&cache->misses);
+    stats->releases = prs_pal_atomic_load(&cache->releases);
+    stats->trims = prs_pal_atomic_load(&cache->trims);
+    stats->count = prs_pal_atomic_load(&cache->count);
+}
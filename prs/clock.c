@@ -25,23 +25,39 @@
  * \brief
  *  This file contains the clock module definitions.
  *  The clock module is responsible for providing the clock tick through \ref prs_clock_get and calling the timer
- *  module.
+ *  and scheduler modules.
+ *
+ *  Workers are registered with \ref prs_clock_add_worker. At every tick, the clock polls them through
+ *  \ref prs_worker_poll, which polls their timers and notifies the workers that have expiries to process. The expiries
+ *  themselves are processed by the workers, so that the clock never signals events on behalf of other cores.
+ *
+ *  When \ref PRS_TICKLESS is defined, the clock does not generate an interrupt at every tick. Instead, the PIT is
+ *  programmed as a one-shot for the next tick at which the timer or scheduler modules have work to do, which they
+ *  request through \ref prs_clock_request. The current tick is then derived from the PIT's monotonic time source
+ *  whenever \ref prs_clock_get is called.
+ *
+ *  Otherwise, the PIT is still programmed as a one-shot, for the beginning of each tick, so that ticks do not drift.
+ *
+ *  \ref prs_clock_get_ns provides a nanosecond time base for high resolution timers. In both modes, the PIT is
+ *  programmed earlier than the next tick when one of them expires in between, through \ref prs_clock_request_ns, in
+ *  which case the workers are polled without advancing the tick.
  */
 
 #include <prs/pal/atomic.h>
+#include <prs/pal/cycles.h>
 #include <prs/pal/malloc.h>
 #include <prs/pal/pit.h>
 #include <prs/assert.h>
 #include <prs/clock.h>
 #include <prs/error.h>
-#include <prs/timer.h>
+#include <prs/sched.h>
 #include <prs/result.h>
 #include <prs/rtc.h>
 #include <prs/spinlock.h>
+#include <prs/worker.h>
 
 struct prs_clock {
     struct prs_pal_pit*                 pit;
-    struct prs_timer*                   timer;
 
     void*                               userdata;
     void                                (*callback)(void* userdata);
@@ -49,8 +65,38 @@ struct prs_clock {
     struct prs_spinlock*                spinlock;
 };
 
+#define PRS_CLOCK_NS_PER_TICK           (1000000000 / (PRS_HZ))
+
+/* Workers polled at every tick */
+#define PRS_CLOCK_MAX_WORKERS           PRS_MAX_CPU
+static struct prs_worker* PRS_ATOMIC s_prs_clock_workers[PRS_CLOCK_MAX_WORKERS];
+/* Incremented when a poll pass over the workers begins and ends: odd while a pass is in progress */
+static PRS_ATOMIC prs_uint_t s_prs_clock_poll_seq;
+
 static struct prs_clock* s_prs_clock = 0;
+/* PIT time at which the clock was initialized */
+static prs_uint64_t s_prs_clock_start;
+/* PIT time at which the PIT is armed to expire, or zero when it is not armed */
+static PRS_ATOMIC prs_uint64_t s_prs_clock_expiry;
+static PRS_ATOMIC prs_bool_t s_prs_clock_running;
+#if !defined(PRS_TICKLESS)
 static PRS_ATOMIC prs_ticks_t s_prs_ticks;
+#endif /* !PRS_TICKLESS */
+
+static void prs_clock_arm(prs_uint64_t expiry);
+
+static void prs_clock_poll_workers(prs_ticks_t now)
+{
+    const prs_uint64_t now_ns = prs_clock_get_ns();
+    prs_pal_atomic_fetch_add(&s_prs_clock_poll_seq, 1);
+    for (prs_uint_t i = 0; i < PRS_CLOCK_MAX_WORKERS; ++i) {
+        struct prs_worker* worker = prs_pal_atomic_load(&s_prs_clock_workers[i]);
+        if (worker) {
+            prs_worker_poll(worker, now, now_ns);
+        }
+    }
+    prs_pal_atomic_fetch_add(&s_prs_clock_poll_seq, 1);
+}
 
 static void prs_clock_entry(void* userdata)
 {
@@ -62,8 +108,31 @@ static void prs_clock_entry(void* userdata)
         PRS_FATAL("Double clock entry");
     }
 
-    prs_pal_atomic_fetch_add(&s_prs_ticks, 1);
-    prs_timer_tick(clock->timer);
+    /*
+     * Forget the previous expiry: the next one is computed below from the timer and scheduler modules, which also
+     * account for the requests that were made up until now.
+     */
+    prs_pal_atomic_store(&s_prs_clock_expiry, 0);
+
+#if defined(PRS_TICKLESS)
+    const prs_ticks_t now = prs_clock_get();
+    prs_clock_poll_workers(now);
+    const prs_ticks_t next = prs_sched_tick(now);
+    if (next) {
+        prs_clock_request(next);
+    }
+#else
+    /* The PIT may also have expired between two ticks for a high resolution request */
+    const prs_ticks_t now = (prs_ticks_t)(prs_clock_get_ns() / PRS_CLOCK_NS_PER_TICK);
+    const prs_bool_t ticked = PRS_BOOL(prs_pal_atomic_exchange(&s_prs_ticks, now) != now);
+    prs_clock_poll_workers(now);
+    if (ticked) {
+        prs_sched_tick(now);
+    }
+    if (prs_pal_atomic_load(&s_prs_clock_running)) {
+        prs_clock_arm(s_prs_clock_start + ((prs_uint64_t)now + 1) * PRS_CLOCK_NS_PER_TICK);
+    }
+#endif /* PRS_TICKLESS */
 
     prs_spinlock_unlock(clock->spinlock);
 }
@@ -88,13 +157,11 @@ prs_result_t prs_clock_init(struct prs_clock_init_params* params)
         goto cleanup;
     }
 
+    s_prs_clock_start = prs_pal_pit_get_time();
+    prs_pal_atomic_store(&s_prs_clock_expiry, 0);
+#if !defined(PRS_TICKLESS)
     prs_pal_atomic_store(&s_prs_ticks, 0);
-
-    clock->timer = prs_timer_create();
-    PRS_ERROR_IF (!clock->timer) {
-        result = PRS_UNKNOWN;
-        goto cleanup;
-    }
+#endif /* !PRS_TICKLESS */
 
     clock->spinlock = prs_spinlock_create();
     PRS_ERROR_IF (!clock->spinlock) {
@@ -104,6 +171,7 @@ prs_result_t prs_clock_init(struct prs_clock_init_params* params)
 
     struct prs_pal_pit_create_params pit_params = {
         .period = PRS_TICKS_FROM_US(1000000 * 1 / PRS_HZ),
+        .one_shot = PRS_TRUE,
         .use_current_thread = params->use_current_thread,
         .affinity = params->affinity,
         .prio = params->prio,
@@ -117,6 +185,10 @@ prs_result_t prs_clock_init(struct prs_clock_init_params* params)
     }
 
     s_prs_clock = clock;
+    prs_pal_atomic_store(&s_prs_clock_running, PRS_TRUE);
+#if !defined(PRS_TICKLESS)
+    prs_clock_arm(s_prs_clock_start + PRS_CLOCK_NS_PER_TICK);
+#endif /* !PRS_TICKLESS */
 
     return PRS_OK;
 
@@ -137,22 +209,61 @@ void prs_clock_uninit(void)
 {
     PRS_PRECONDITION(s_prs_clock);
     struct prs_clock* clock = s_prs_clock;
+    prs_pal_atomic_store(&s_prs_clock_running, PRS_FALSE);
     prs_pal_pit_destroy(clock->pit);
     prs_spinlock_destroy(clock->spinlock);
-    /* Do not destroy the timer here, as it can be used by remaining tasks that are still running */
-    //prs_timer_destroy(clock->timer);
     //prs_pal_free(clock);
 }
 
 /**
  * \brief
- *  Returns the global \ref prs_timer instance.
+ *  Registers a worker so that it is polled at every tick.
+ * \param worker
+ *  Worker to register.
  */
-struct prs_timer* prs_clock_timer(void)
+prs_result_t prs_clock_add_worker(struct prs_worker* worker)
 {
-    PRS_PRECONDITION(s_prs_clock);
-    struct prs_clock* clock = s_prs_clock;
-    return clock->timer;
+    PRS_PRECONDITION(worker);
+
+    for (prs_uint_t i = 0; i < PRS_CLOCK_MAX_WORKERS; ++i) {
+        struct prs_worker* expected = 0;
+        if (prs_pal_atomic_compare_exchange_strong(&s_prs_clock_workers[i], &expected, worker)) {
+            return PRS_OK;
+        }
+    }
+
+    return PRS_OUT_OF_MEMORY;
+}
+
+/**
+ * \brief
+ *  Unregisters a worker that was registered with \ref prs_clock_add_worker.
+ * \param worker
+ *  Worker to unregister.
+ * \note
+ *  When this function returns, the clock is no longer polling the worker, which can then be destroyed.
+ */
+void prs_clock_remove_worker(struct prs_worker* worker)
+{
+    PRS_PRECONDITION(worker);
+
+    for (prs_uint_t i = 0; i < PRS_CLOCK_MAX_WORKERS; ++i) {
+        struct prs_worker* expected = worker;
+        if (prs_pal_atomic_compare_exchange_strong(&s_prs_clock_workers[i], &expected, 0)) {
+            break;
+        }
+    }
+
+    /*
+     * A poll pass that was in progress may have loaded the worker before it was unregistered: wait for it to end. The
+     * clock's spinlock cannot be used here, as the clock may interrupt this thread when it uses the current thread.
+     */
+    const prs_uint_t seq = prs_pal_atomic_load(&s_prs_clock_poll_seq);
+    if (seq & 1) {
+        while (prs_pal_atomic_load(&s_prs_clock_poll_seq) == seq) {
+            prs_cycles_pause();
+        }
+    }
 }
 
 /**
@@ -163,5 +274,94 @@ struct prs_timer* prs_clock_timer(void)
  */
 prs_ticks_t prs_clock_get(void)
 {
+#if defined(PRS_TICKLESS)
+    const prs_uint64_t start = s_prs_clock_start;
+    if (!start) {
+        return 0;
+    }
+    return (prs_ticks_t)((prs_pal_pit_get_time() - start) / PRS_CLOCK_NS_PER_TICK);
+#else
     return prs_pal_atomic_load(&s_prs_ticks);
+#endif /* PRS_TICKLESS */
+}
+
+/**
+ * \brief
+ *  Returns the number of nanoseconds elapsed since \ref prs_clock_init was called.
+ * \note
+ *  Unlike \ref prs_clock_get, the value is read from the PIT's monotonic time source on every call.
+ *  This function is safe to be called in an interruptible section.
+ */
+prs_uint64_t prs_clock_get_ns(void)
+{
+    const prs_uint64_t start = s_prs_clock_start;
+    if (!start) {
+        return 0;
+    }
+    return prs_pal_pit_get_time() - start;
+}
+
+static void prs_clock_arm(prs_uint64_t expiry)
+{
+    struct prs_clock* clock = s_prs_clock;
+
+    prs_uint64_t armed_expiry = prs_pal_atomic_load(&s_prs_clock_expiry);
+    do {
+        if (armed_expiry && armed_expiry <= expiry) {
+            return;
+        }
+    } while (!prs_pal_atomic_compare_exchange_weak(&s_prs_clock_expiry, &armed_expiry, expiry));
+
+    /*
+     * Other requests or the clock itself may have changed the expiry before we programmed the PIT, in which case the
+     * PIT could be left with our own expiry. Program it again until it matches the last recorded expiry.
+     */
+    for (;;) {
+        prs_pal_pit_arm(clock->pit, expiry);
+        armed_expiry = prs_pal_atomic_load(&s_prs_clock_expiry);
+        if (!armed_expiry || armed_expiry == expiry) {
+            break;
+        }
+        expiry = armed_expiry;
+    }
+}
+
+/**
+ * \brief
+ *  Requests the clock to call the timer and scheduler modules after the specified number of ticks.
+ * \param ticks
+ *  Number of ticks, from the current tick, after which the clock must call the other modules.
+ * \note
+ *  When the clock is not tickless, this function has no effect since the other modules are called at every tick.
+ *  This function is safe to be called from any thread, as well as from the clock itself.
+ */
+void prs_clock_request(prs_ticks_t ticks)
+{
+#if defined(PRS_TICKLESS)
+    if (!prs_pal_atomic_load(&s_prs_clock_running)) {
+        return;
+    }
+
+    /* Expire at the beginning of the requested tick */
+    const prs_uint64_t start = s_prs_clock_start;
+    const prs_uint64_t elapsed_ticks = (prs_pal_pit_get_time() - start) / PRS_CLOCK_NS_PER_TICK;
+    prs_clock_arm(start + (elapsed_ticks + ticks) * PRS_CLOCK_NS_PER_TICK);
+#endif /* PRS_TICKLESS */
+}
+
+/**
+ * \brief
+ *  Requests the clock to call the timer and scheduler modules when the specified time is reached.
+ * \param ns
+ *  Time, in nanoseconds as returned by \ref prs_clock_get_ns, at which the clock must call the other modules.
+ * \note
+ *  This function is safe to be called from any thread, as well as from the clock itself.
+ */
+void prs_clock_request_ns(prs_uint64_t ns)
+{
+    if (!prs_pal_atomic_load(&s_prs_clock_running)) {
+        return;
+    }
+
+    prs_clock_arm(s_prs_clock_start + ns);
 }
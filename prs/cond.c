@@ -0,0 +1,318 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains condition variable definitions.
+ *
+ *  A waiting task is blocked and queued through the wait node embedded in its \ref prs_task before it unlocks the
+ *  mutex, so that a signal sent right after the unlock cannot be missed. Like for the semaphore, the timed waits give
+ *  an event to the timer, and the task that gets unblocked by its timeout finds out that it is still queued.
+ */
+
+#include <stddef.h>
+
+#include <prs/pal/atomic.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/cond.h>
+#include <prs/error.h>
+#include <prs/event.h>
+#include <prs/god.h>
+#include <prs/idllist.h>
+#include <prs/rtc.h>
+#include <prs/sched.h>
+#include <prs/spinlock.h>
+#include <prs/timer.h>
+#include <prs/worker.h>
+
+#include "task.h"
+
+#define PRS_COND_EVENT_TYPE_SIGNAL      1
+#define PRS_COND_EVENT_TYPE_TIMEOUT     2
+
+struct prs_cond {
+    prs_cond_id_t                       id;
+    struct prs_spinlock*                lock;
+    struct prs_idllist*                 waitq;
+};
+
+static void prs_cond_object_destroy(void* object)
+{
+    prs_cond_destroy(object);
+}
+
+static void prs_cond_object_free(void* object)
+{
+    struct prs_cond* cond = object;
+
+    if (cond->waitq) {
+        prs_idllist_destroy(cond->waitq);
+    }
+    if (cond->lock) {
+        prs_spinlock_destroy(cond->lock);
+    }
+    prs_pal_free(cond);
+}
+
+static void prs_cond_object_print(void* object, void* userdata, void (*fct)(void*, const char*, ...))
+{
+    struct prs_cond* cond = object;
+
+    fct(userdata, "Cond id=%u waiting=%u\n",
+        cond->id,
+        (unsigned)prs_idllist_size(cond->waitq));
+}
+
+static struct prs_object_ops s_prs_cond_object_ops = {
+    .destroy = prs_cond_object_destroy,
+    .free = prs_cond_object_free,
+    .print = prs_cond_object_print
+};
+
+/**
+ * \brief
+ *  Creates a condition variable.
+ */
+struct prs_cond* prs_cond_create(void)
+{
+    struct prs_cond* cond = prs_pal_malloc_zero(sizeof(*cond));
+    if (!cond) {
+        goto cleanup;
+    }
+
+    cond->lock = prs_spinlock_create();
+
+    struct prs_idllist_create_params idllist_params = {
+        .node_offset = offsetof(struct prs_task, wait_node.node)
+    };
+    cond->waitq = prs_idllist_create(&idllist_params);
+    if (!cond->waitq) {
+        goto cleanup;
+    }
+
+    cond->id = prs_god_alloc_and_lock(cond, &s_prs_cond_object_ops);
+    if (cond->id == PRS_OBJECT_ID_INVALID) {
+        goto cleanup;
+    }
+
+    return cond;
+
+cleanup:
+
+    if (cond) {
+        prs_cond_object_free(cond);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief
+ *  Destroys a condition variable.
+ * \param cond
+ *  Condition variable to destroy.
+ */
+void prs_cond_destroy(struct prs_cond* cond)
+{
+    prs_god_unlock(cond->id);
+}
+
+static void prs_cond_enqueue(struct prs_cond* cond, struct prs_task* task, prs_task_token_t token)
+{
+    /* The reference is released by whoever removes the task from the wait queue */
+    void* object = prs_god_lock(task->id);
+    PRS_ASSERT(object == task);
+
+    prs_spinlock_lock(cond->lock);
+    task->wait_node.token = token;
+    task->wait_node.queued = PRS_TRUE;
+    prs_idllist_insert_before(cond->waitq, 0, &task->wait_node.node);
+    prs_spinlock_unlock(cond->lock);
+}
+
+static prs_bool_t prs_cond_dequeue(struct prs_cond* cond, struct prs_task* task)
+{
+    prs_spinlock_lock(cond->lock);
+    const prs_bool_t queued = task->wait_node.queued;
+    if (queued) {
+        prs_idllist_remove(cond->waitq, &task->wait_node.node);
+        task->wait_node.queued = PRS_FALSE;
+    }
+    prs_spinlock_unlock(cond->lock);
+
+    if (queued) {
+        prs_god_unlock(task->id);
+    }
+    return queued;
+}
+
+static prs_bool_t prs_cond_signal_once(struct prs_cond* cond)
+{
+    prs_spinlock_lock(cond->lock);
+    struct prs_idllist_node* node = prs_idllist_begin(cond->waitq);
+    if (!node) {
+        prs_spinlock_unlock(cond->lock);
+        return PRS_FALSE;
+    }
+    struct prs_task* task = prs_idllist_get_data(cond->waitq, node);
+    prs_idllist_remove(cond->waitq, node);
+    task->wait_node.queued = PRS_FALSE;
+    const prs_task_token_t token = task->wait_node.token;
+    prs_spinlock_unlock(cond->lock);
+
+    /* If the task was already unblocked by its timeout, the token does not match and this has no effect */
+    const prs_task_id_t task_id = task->id;
+    prs_task_unblock(task, token, PRS_COND_EVENT_TYPE_SIGNAL);
+    prs_god_unlock(task_id);
+    return PRS_TRUE;
+}
+
+static prs_result_t prs_cond_wait_internal(struct prs_cond* cond, struct prs_mutex* mutex, prs_uint64_t timeout,
+    prs_bool_t timed, prs_bool_t high_res)
+{
+    PRS_RTC_IF (!prs_mutex_is_owner(mutex)) {
+        return PRS_INVALID_STATE;
+    }
+
+    struct prs_worker* worker = prs_worker_current();
+    PRS_ASSERT(worker);
+    struct prs_task* task = prs_worker_get_current_task(worker);
+    PRS_ASSERT(task);
+
+    struct prs_event* timer_event = 0;
+    if (timed) {
+        /* The event is only referenced by the timer, the condition variable unblocks the task directly */
+        timer_event = prs_event_create(task, 1);
+        PRS_FATAL_WHEN(!timer_event);
+        prs_cond_enqueue(cond, task, prs_pal_atomic_load(&task->state));
+    } else {
+        prs_cond_enqueue(cond, task, prs_task_block(task));
+    }
+
+    /* Only the owner can unlock the mutex, so it is still locked by the current task */
+    prs_mutex_unlock(mutex);
+
+    prs_bool_t timed_out = PRS_FALSE;
+    if (timed) {
+        struct prs_timer* timer = prs_worker_get_timer(worker);
+        struct prs_timer_entry* timer_entry = high_res ?
+            prs_timer_queue_ns(timer, timer_event, PRS_COND_EVENT_TYPE_TIMEOUT, timeout) :
+            prs_timer_queue(timer, timer_event, PRS_COND_EVENT_TYPE_TIMEOUT, (prs_ticks_t)timeout);
+        PRS_ASSERT(timer_entry);
+        prs_sched_schedule();
+        prs_timer_cancel(timer, timer_entry);
+
+        /* The task was signaled if a signaling task removed it from the wait queue */
+        timed_out = prs_cond_dequeue(cond, task);
+    } else {
+        prs_sched_schedule();
+    }
+
+    prs_mutex_lock(mutex);
+    return timed_out ? PRS_TIMEOUT : PRS_OK;
+}
+
+/**
+ * \brief
+ *  Unlocks the mutex and waits for the condition variable to be signaled, then locks the mutex again.
+ * \param cond
+ *  Condition variable to wait for.
+ * \param mutex
+ *  Mutex that is locked by the current task.
+ * \return
+ *  \ref PRS_OK if the condition variable was signaled.
+ *  \ref PRS_INVALID_STATE if the mutex is not locked by the current task.
+ */
+prs_result_t prs_cond_wait(struct prs_cond* cond, struct prs_mutex* mutex)
+{
+    return prs_cond_wait_internal(cond, mutex, 0, PRS_FALSE, PRS_FALSE);
+}
+
+/**
+ * \brief
+ *  Unlocks the mutex and waits for the condition variable to be signaled or for the specified timeout to occur, then
+ *  locks the mutex again.
+ * \param cond
+ *  Condition variable to wait for.
+ * \param mutex
+ *  Mutex that is locked by the current task.
+ * \param timeout
+ *  Time to wait, in ticks.
+ * \return
+ *  \ref PRS_OK if the condition variable was signaled before the timeout.
+ *  \ref PRS_TIMEOUT if the timeout occurred.
+ *  \ref PRS_INVALID_STATE if the mutex is not locked by the current task.
+ */
+prs_result_t prs_cond_wait_timeout(struct prs_cond* cond, struct prs_mutex* mutex, prs_ticks_t timeout)
+{
+    return prs_cond_wait_internal(cond, mutex, timeout, PRS_TRUE, PRS_FALSE);
+}
+
+/**
+ * \brief
+ *  Unlocks the mutex and waits for the condition variable to be signaled or for the specified high resolution timeout
+ *  to occur, then locks the mutex again.
+ * \param cond
+ *  Condition variable to wait for.
+ * \param mutex
+ *  Mutex that is locked by the current task.
+ * \param timeout_ns
+ *  Time to wait, in nanoseconds.
+ * \return
+ *  \ref PRS_OK if the condition variable was signaled before the timeout.
+ *  \ref PRS_TIMEOUT if the timeout occurred.
+ *  \ref PRS_INVALID_STATE if the mutex is not locked by the current task.
+ */
+prs_result_t prs_cond_wait_timeout_ns(struct prs_cond* cond, struct prs_mutex* mutex, prs_uint64_t timeout_ns)
+{
+    return prs_cond_wait_internal(cond, mutex, timeout_ns, PRS_TRUE, PRS_TRUE);
+}
+
+/**
+ * \brief
+ *  Wakes up the task that has been waiting the longest for the condition variable, if any.
+ * \param cond
+ *  Condition variable to signal.
+ */
+void prs_cond_signal(struct prs_cond* cond)
+{
+    prs_cond_signal_once(cond);
+}
+
+/**
+ * \brief
+ *  Wakes up all the tasks that are waiting for the condition variable.
+ * \param cond
+ *  Condition variable to signal.
+ */
+void prs_cond_broadcast(struct prs_cond* cond)
+{
+    /* Tasks that start waiting during the broadcast are not woken up */
+    prs_spinlock_lock(cond->lock);
+    prs_size_t count = prs_idllist_size(cond->waitq);
+    prs_spinlock_unlock(cond->lock);
+
+    while (count-- && prs_cond_signal_once(cond)) {
+    }
+}
@@ -139,7 +139,9 @@ static enum prs_excp_result prs_excp_default_handler(enum prs_excp_type excp, vo
             /* Is it the current worker's stack? */
             if (task && prs_stack_address_in_range(task->stack, extra)) {
                 const prs_bool_t grown = prs_stack_grow(task->stack, task->stack_size, extra, &task->stack_size);
-                if (!grown) {
+                if (grown) {
+                    prs_task_grew_stack(task, extra);
+                } else {
                     result = PRS_EXCP_RESULT_EXIT;
                 }
             } else {
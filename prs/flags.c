@@ -0,0 +1,298 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains event flags definitions.
+ *
+ *  An event flags group is a 32-bit word. Tasks set and clear flags atomically, and other tasks wait until any or all
+ *  of the flags of a mask are set. The waits go through \ref prs_wait_any, so a task can wait for flags together with
+ *  messages and semaphores.
+ */
+
+#include <prs/pal/atomic.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/flags.h>
+#include <prs/god.h>
+#include <prs/wait.h>
+
+struct prs_flags {
+    prs_flags_id_t                      id;
+    PRS_ATOMIC prs_flags_t              value;
+    struct prs_wait_list*               watchers;
+};
+
+static void prs_flags_object_destroy(void* object)
+{
+    prs_flags_destroy(object);
+}
+
+static void prs_flags_object_free(void* object)
+{
+    struct prs_flags* flags = object;
+
+    if (flags->watchers) {
+        prs_wait_list_destroy(flags->watchers);
+    }
+    prs_pal_free(flags);
+}
+
+static void prs_flags_object_print(void* object, void* userdata, void (*fct)(void*, const char*, ...))
+{
+    struct prs_flags* flags = object;
+
+    fct(userdata, "Flags id=%u value=0x%08x\n",
+        flags->id,
+        (unsigned)prs_pal_atomic_load(&flags->value));
+}
+
+static struct prs_object_ops s_prs_flags_object_ops = {
+    .destroy = prs_flags_object_destroy,
+    .free = prs_flags_object_free,
+    .print = prs_flags_object_print
+};
+
+/**
+ * \brief
+ *  Creates an event flags group.
+ * \param initial_value
+ *  Flags that are initially set.
+ */
+struct prs_flags* prs_flags_create(prs_flags_t initial_value)
+{
+    struct prs_flags* flags = prs_pal_malloc_zero(sizeof(*flags));
+    if (!flags) {
+        goto cleanup;
+    }
+
+    flags->watchers = prs_wait_list_create();
+    if (!flags->watchers) {
+        goto cleanup;
+    }
+
+    flags->id = prs_god_alloc_and_lock(flags, &s_prs_flags_object_ops);
+    if (flags->id == PRS_OBJECT_ID_INVALID) {
+        goto cleanup;
+    }
+
+    prs_pal_atomic_store(&flags->value, initial_value);
+
+    return flags;
+
+cleanup:
+
+    if (flags) {
+        prs_flags_object_free(flags);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief
+ *  Destroys an event flags group.
+ * \param flags
+ *  Event flags group to destroy.
+ */
+void prs_flags_destroy(struct prs_flags* flags)
+{
+    prs_god_unlock(flags->id);
+}
+
+/**
+ * \brief
+ *  Sets flags, and wakes up the tasks that are waiting for flags of the group.
+ * \param flags
+ *  Event flags group.
+ * \param mask
+ *  Flags to set.
+ * \return
+ *  The flags that were set before.
+ */
+prs_flags_t prs_flags_set(struct prs_flags* flags, prs_flags_t mask)
+{
+    const prs_flags_t previous = prs_pal_atomic_fetch_or(&flags->value, mask);
+    if (mask & ~previous) {
+        prs_wait_list_notify(flags->watchers);
+    }
+    return previous;
+}
+
+/**
+ * \brief
+ *  Clears flags.
+ * \param flags
+ *  Event flags group.
+ * \param mask
+ *  Flags to clear.
+ * \return
+ *  The flags that were set before.
+ */
+prs_flags_t prs_flags_clear(struct prs_flags* flags, prs_flags_t mask)
+{
+    return prs_pal_atomic_fetch_and(&flags->value, ~mask);
+}
+
+/**
+ * \brief
+ *  Returns the flags that are set.
+ * \param flags
+ *  Event flags group.
+ */
+prs_flags_t prs_flags_get(struct prs_flags* flags)
+{
+    return prs_pal_atomic_load(&flags->value);
+}
+
+/**
+ * \brief
+ *  Checks if the flags match the mask, without waiting.
+ * \param flags
+ *  Event flags group.
+ * \param mask
+ *  Flags to check.
+ * \param options
+ *  \ref PRS_FLAGS_WAIT_ALL to require all the flags of the mask, and \ref PRS_FLAGS_CLEAR to clear the flags that
+ *  matched.
+ * \param value
+ *  Receives the flags of the mask that were set, when they match.
+ * \return
+ *  \p true if the flags match the mask.
+ */
+prs_bool_t prs_flags_try_wait(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options, prs_flags_t* value)
+{
+    prs_flags_t current = prs_pal_atomic_load(&flags->value);
+    for (;;) {
+        const prs_flags_t matched = current & mask;
+        const prs_bool_t match = (options & PRS_FLAGS_WAIT_ALL) ? PRS_BOOL(matched == mask) : PRS_BOOL(matched);
+        if (!match) {
+            return PRS_FALSE;
+        }
+        if (!(options & PRS_FLAGS_CLEAR) ||
+            prs_pal_atomic_compare_exchange_weak(&flags->value, &current, current & ~matched)) {
+            if (value) {
+                *value = matched;
+            }
+            return PRS_TRUE;
+        }
+    }
+}
+
+static prs_result_t prs_flags_wait_internal(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options,
+    prs_uint64_t timeout, prs_bool_t use_timeout, prs_bool_t high_res, prs_flags_t* value)
+{
+    struct prs_wait_object object = {
+        .type = PRS_WAIT_TYPE_FLAGS,
+        .object = flags,
+        .mask = mask,
+        .options = options
+    };
+    prs_uint_t index;
+    const prs_result_t result = !use_timeout ? prs_wait_any(&object, 1, &index) :
+        high_res ? prs_wait_any_timeout_ns(&object, 1, timeout, &index) :
+        prs_wait_any_timeout(&object, 1, (prs_ticks_t)timeout, &index);
+    if (result == PRS_OK && value) {
+        *value = object.value;
+    }
+    return result;
+}
+
+/**
+ * \brief
+ *  Waits until the flags match the mask.
+ * \param flags
+ *  Event flags group.
+ * \param mask
+ *  Flags to wait for.
+ * \param options
+ *  \ref PRS_FLAGS_WAIT_ALL to wait for all the flags of the mask, and \ref PRS_FLAGS_CLEAR to clear the flags that
+ *  matched.
+ * \param value
+ *  Receives the flags of the mask that were set. Can be \p null.
+ * \return
+ *  \ref PRS_OK if the flags matched.
+ */
+prs_result_t prs_flags_wait(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options, prs_flags_t* value)
+{
+    return prs_flags_wait_internal(flags, mask, options, 0, PRS_FALSE, PRS_FALSE, value);
+}
+
+/**
+ * \brief
+ *  Waits until the flags match the mask or until the timeout occurs.
+ * \param flags
+ *  Event flags group.
+ * \param mask
+ *  Flags to wait for.
+ * \param options
+ *  \ref PRS_FLAGS_WAIT_ALL to wait for all the flags of the mask, and \ref PRS_FLAGS_CLEAR to clear the flags that
+ *  matched.
+ * \param timeout
+ *  Time to wait, in ticks.
+ * \param value
+ *  Receives the flags of the mask that were set. Can be \p null.
+ * \return
+ *  \ref PRS_OK if the flags matched.
+ *  \ref PRS_TIMEOUT if the timeout occurred.
+ */
+prs_result_t prs_flags_wait_timeout(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options,
+    prs_ticks_t timeout, prs_flags_t* value)
+{
+    return prs_flags_wait_internal(flags, mask, options, timeout, PRS_TRUE, PRS_FALSE, value);
+}
+
+/**
+ * \brief
+ *  Waits until the flags match the mask or until the high resolution timeout occurs.
+ * \param flags
+ *  Event flags group.
+ * \param mask
+ *  Flags to wait for.
+ * \param options
+ *  \ref PRS_FLAGS_WAIT_ALL to wait for all the flags of the mask, and \ref PRS_FLAGS_CLEAR to clear the flags that
+ *  matched.
+ * \param timeout_ns
+ *  Time to wait, in nanoseconds.
+ * \param value
+ *  Receives the flags of the mask that were set. Can be \p null.
+ * \return
+ *  \ref PRS_OK if the flags matched.
+ *  \ref PRS_TIMEOUT if the timeout occurred.
+ */
+prs_result_t prs_flags_wait_timeout_ns(struct prs_flags* flags, prs_flags_t mask, prs_uint32_t options,
+    prs_uint64_t timeout_ns, prs_flags_t* value)
+{
+    return prs_flags_wait_internal(flags, mask, options, timeout_ns, PRS_TRUE, PRS_TRUE, value);
+}
+
+/**
+ * \brief
+ *  Returns the wait list of the event flags group, which is notified when flags are set.
+ * \param flags
+ *  Event flags group.
+ */
+struct prs_wait_list* prs_flags_get_wait_list(struct prs_flags* flags)
+{
+    return flags->watchers;
+}
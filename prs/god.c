@@ -25,9 +25,9 @@
  * \brief
  *  This file contains the global object directory definitions.
  *
- *  The global object directory (GOD) is a fixed size table which contains IDs and references to registered objects.
- *  The goal of the GOD is to provide simultaneous access to objects from multiple workers and providing general
- *  functionality such as destructors and unique IDs.
+ *  The global object directory (GOD) is a table which contains IDs and references to registered objects. The goal of
+ *  the GOD is to provide simultaneous access to objects from multiple workers and providing general functionality such
+ *  as destructors and unique IDs.
  *
  *  Once an object is created, it can be registered with \ref prs_god_alloc_and_lock to obtain a unique ID. The ID can
  *  then be used with \ref prs_god_lock and \ref prs_god_unlock to acquire and release references to the object.
@@ -35,27 +35,45 @@
  *  The caller of \ref prs_god_alloc_and_lock must also provide a set of generic functions. The most important function
  *  is the one to free the object once its reference count reaches zero.
  *
+ *  The table is made of chunks of entries. It starts with one chunk, and a new chunk is allocated when no entry is free,
+ *  up to the maximum number of entries. Chunks are never moved nor freed before the GOD is destroyed, so an object ID
+ *  always designates the same entry: the low bits of the ID are the index of the entry, and the high bits count how
+ *  many times the entry was reused, so that stale IDs are not mistaken for the new object. Looking up an entry only
+ *  reads the pointer to its chunk.
+ *
+ *  IDs are at most \ref PRS_OBJECT_ID_MAX, so the reuse count has 31 bits minus the bits of the index: 15 bits with
+ *  the default 65536 entries. The count wraps around, and an entry gives the same ID again after it was reused 32768
+ *  times. An ID that is kept without a reference while its entry is reused that many times designates the new object,
+ *  so code that must not act on another object keeps a reference with \ref prs_god_lock.
+ *
+ *  Entries are allocated by scanning the table from a cursor. Each worker has its own cursor, on its own cache line,
+ *  and the cursors start at different places in the table, so workers that create objects at the same time do not
+ *  write to the same memory.
+ *
  * \note
  *  Only one GOD can exist at any time.
  */
 
+#include <prs/pal/arch.h>
 #include <prs/pal/atomic.h>
 #include <prs/pal/bitops.h>
 #include <prs/pal/malloc.h>
 #include <prs/assert.h>
+#include <prs/config.h>
 #include <prs/error.h>
 #include <prs/god.h>
 #include <prs/rtc.h>
+#include <prs/worker.h>
 
 #define PRS_GOD_HEADER_BITS             (sizeof(prs_god_entry_header_t) * 8)
 #define PRS_GOD_ID_BITS                 32
 #define PRS_GOD_INDEX_MASK              (((prs_god_entry_header_t)1 << PRS_GOD_ID_BITS) - 1)
 #define PRS_GOD_NONID_BITS              (PRS_GOD_HEADER_BITS - PRS_GOD_ID_BITS)
 #define PRS_GOD_HEADER_ID               ((((prs_god_entry_header_t)1 << PRS_GOD_ID_BITS) - 1) << PRS_GOD_NONID_BITS)
-#define PRS_GOD_HEADER_RESERVED         0x0000000000004000
-#define PRS_GOD_HEADER_USED             0x0000000000002000
-#define PRS_GOD_HEADER_DELETE_MARK      0x0000000000001000
-#define PRS_GOD_HEADER_REFCNT           0x0000000000000FFF
+#define PRS_GOD_HEADER_RESERVED         0x0000000080000000
+#define PRS_GOD_HEADER_USED             0x0000000040000000
+#define PRS_GOD_HEADER_DELETE_MARK      0x0000000020000000
+#define PRS_GOD_HEADER_REFCNT           0x000000001FFFFFFF
 #define PRS_GOD_TEST_FLAG(header, flag) ((header) & (flag))
 #define PRS_GOD_GET_ID(flags)           (((flags) & PRS_GOD_HEADER_ID) >> PRS_GOD_NONID_BITS)
 #define PRS_GOD_SET_ID(id)              ((prs_god_entry_header_t)(id) << PRS_GOD_NONID_BITS)
@@ -70,11 +88,22 @@ struct prs_god_entry {
     struct prs_object_ops*              ops;
 };
 
+/* Allocation cursor of the workers that share an index */
+struct prs_god_cursor {
+    PRS_ATOMIC prs_god_index_t          next;
+    char                                padding[PRS_PAL_CACHE_LINE_SIZE - sizeof(prs_god_index_t)];
+};
+
 struct prs_god {
-    struct prs_god_entry*               entries;
+    struct prs_god_entry* PRS_ATOMIC*   chunks;
+    prs_god_index_t                     max_chunks;
+    prs_god_index_t                     chunk_shift;
+    prs_god_index_t                     chunk_mask;
     prs_god_index_t                     max_entries;
     prs_god_index_t                     max_entries_mask;
-    PRS_ATOMIC prs_god_index_t          write_index;
+    /* Number of entries in the allocated chunks, which only grows */
+    PRS_ATOMIC prs_god_index_t          entries;
+    struct prs_god_cursor               cursors[PRS_MAX_CPU];
 };
 
 static struct prs_god* s_god = 0;
@@ -90,7 +119,37 @@ static struct prs_god_entry* prs_god_get_entry(struct prs_god* god, prs_object_i
     PRS_PRECONDITION(god);
     PRS_PRECONDITION(god->max_entries_mask > 0);
     const prs_god_index_t index = id & god->max_entries_mask;
-    return &god->entries[index];
+    struct prs_god_entry* chunk = prs_pal_atomic_load(&god->chunks[index >> god->chunk_shift]);
+    if (!chunk) {
+        /* The ID is invalid, since its entry was never allocated */
+        return 0;
+    }
+    return &chunk[index & god->chunk_mask];
+}
+
+/* Allocates the chunk that follows the first entries of the table. Returns false if the table cannot grow. */
+static prs_bool_t prs_god_grow(struct prs_god* god, prs_god_index_t entries)
+{
+    const prs_god_index_t chunk_index = entries >> god->chunk_shift;
+    if (chunk_index >= god->max_chunks) {
+        return PRS_FALSE;
+    }
+
+    if (!prs_pal_atomic_load(&god->chunks[chunk_index])) {
+        struct prs_god_entry* chunk = prs_pal_malloc_zero(sizeof(*chunk) << god->chunk_shift);
+        if (!chunk) {
+            return PRS_FALSE;
+        }
+        /* Another worker may be growing the table at the same time */
+        struct prs_god_entry* expected = 0;
+        if (!prs_pal_atomic_compare_exchange_strong(&god->chunks[chunk_index], &expected, chunk)) {
+            prs_pal_free(chunk);
+        }
+    }
+
+    prs_god_index_t expected_entries = entries;
+    prs_pal_atomic_compare_exchange_strong(&god->entries, &expected_entries, entries + god->chunk_mask + 1);
+    return PRS_TRUE;
 }
 
 /**
@@ -104,6 +163,9 @@ prs_result_t prs_god_create(struct prs_god_create_params* params)
     PRS_PRECONDITION(!s_god);
     PRS_PRECONDITION(params);
     PRS_PRECONDITION(prs_bitops_is_power_of_2(params->max_entries));
+    PRS_PRECONDITION(prs_bitops_is_power_of_2(params->chunk_entries));
+    PRS_PRECONDITION(params->chunk_entries <= params->max_entries);
+    PRS_PRECONDITION(params->max_entries <= (prs_size_t)PRS_OBJECT_ID_MAX);
 
     prs_result_t result = PRS_OK;
     struct prs_god* god = prs_pal_malloc_zero(sizeof(*god));
@@ -112,17 +174,30 @@ prs_result_t prs_god_create(struct prs_god_create_params* params)
         goto cleanup;
     }
 
-    god->entries = prs_pal_malloc_zero(sizeof(*god->entries) * params->max_entries);
-    if (!god->entries) {
+    god->max_entries = (prs_god_index_t)params->max_entries;
+    god->max_entries_mask = god->max_entries - 1;
+    god->max_chunks = (prs_god_index_t)(params->max_entries / params->chunk_entries);
+    god->chunk_shift = (prs_god_index_t)prs_bitops_lsb_uint(params->chunk_entries);
+    god->chunk_mask = (prs_god_index_t)params->chunk_entries - 1;
+
+    god->chunks = prs_pal_malloc_zero(sizeof(*god->chunks) * god->max_chunks);
+    if (!god->chunks) {
         result = PRS_OUT_OF_MEMORY;
         goto cleanup;
     }
 
-    god->max_entries = params->max_entries;
-    god->max_entries_mask = god->max_entries - 1;
-    prs_pal_atomic_store(&god->write_index, 1);
+    if (!prs_god_grow(god, 0)) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    /* Spread the cursors over the first chunk */
+    for (prs_uint_t i = 0; i < PRS_MAX_CPU; ++i) {
+        prs_pal_atomic_store(&god->cursors[i].next, (prs_god_index_t)((params->chunk_entries * i) / PRS_MAX_CPU));
+    }
 
-    prs_pal_atomic_store(&god->entries->header, PRS_GOD_HEADER_RESERVED | PRS_GOD_HEADER_USED);
+    /* The first entry is never allocated, since its ID would be invalid */
+    prs_pal_atomic_store(&god->chunks[0][0].header, PRS_GOD_HEADER_RESERVED | PRS_GOD_HEADER_USED);
 
     s_god = god;
 
@@ -130,10 +205,10 @@ prs_result_t prs_god_create(struct prs_god_create_params* params)
 
     cleanup:
 
-    if (god->entries) {
-        prs_pal_free(god->entries);
-    }
     if (god) {
+        if (god->chunks) {
+            prs_pal_free(god->chunks);
+        }
         prs_pal_free(god);
     }
     return result;
@@ -146,10 +221,31 @@ prs_result_t prs_god_create(struct prs_god_create_params* params)
 void prs_god_destroy(void)
 {
     struct prs_god* god = prs_god_get();
-    prs_pal_free(god->entries);
+    for (prs_god_index_t i = 0; i < god->max_chunks; ++i) {
+        struct prs_god_entry* chunk = prs_pal_atomic_load(&god->chunks[i]);
+        if (chunk) {
+            prs_pal_free(chunk);
+        }
+    }
+    prs_pal_free(god->chunks);
     prs_pal_free(god);
 }
 
+/* IDs keep the index of their entry in their low bits, and count the reuses of the entry in their high bits */
+static prs_object_id_t prs_god_next_id(struct prs_god* god, prs_god_entry_header_t header, prs_god_index_t index)
+{
+    const prs_object_id_t previous = PRS_GOD_GET_ID(header);
+    const prs_object_id_t reuses = ((previous & ~god->max_entries_mask) + god->max_entries) & PRS_OBJECT_ID_MAX;
+    return reuses | index;
+}
+
+static prs_god_index_t prs_god_get_cursor_index(void)
+{
+    /* Objects are also created before the workers start */
+    struct prs_worker* worker = prs_worker_current();
+    return worker ? (prs_god_index_t)prs_worker_get_index(worker) : 0;
+}
+
 /**
  * \brief
  *  Registers an object into the GOD and sets its reference counter to one.
@@ -164,46 +260,48 @@ void prs_god_destroy(void)
 prs_object_id_t prs_god_alloc_and_lock(void* object, struct prs_object_ops* ops)
 {
     struct prs_god* god = prs_god_get();
+    struct prs_god_cursor* cursor = &god->cursors[prs_god_get_cursor_index()];
 
-    struct prs_god_entry* entry;
-    prs_god_entry_header_t new_header;
+    for (;;) {
+        const prs_god_index_t entries = prs_pal_atomic_load(&god->entries);
+        /* The cursor may be one past the end of the table */
+        const prs_god_index_t start = prs_pal_atomic_load(&cursor->next);
+
+        for (prs_god_index_t i = 0; i < entries; ++i) {
+            prs_god_index_t index = start + i;
+            if (index >= entries) {
+                index -= entries;
+            }
+            struct prs_god_entry* entry = prs_god_get_entry(god, index);
 
-    const prs_god_index_t write_index = prs_pal_atomic_load(&god->write_index);
-    const prs_god_index_t end = write_index + god->max_entries;
+            prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
+            if (PRS_GOD_TEST_FLAG(header, PRS_GOD_HEADER_RESERVED)) {
+                continue;
+            }
 
-    for (prs_god_index_t i = write_index; i < end; ++i) {
-        entry = prs_god_get_entry(god, i);
+            /* The new ID always differs from the previous ID of the entry, which avoids ABA scenarios */
+            const prs_object_id_t id = prs_god_next_id(god, header, index);
+            prs_god_entry_header_t new_header = PRS_GOD_SET_ID(id) | PRS_GOD_HEADER_RESERVED | 1;
+            if (!prs_pal_atomic_compare_exchange_strong(&entry->header, &header, new_header)) {
+                continue;
+            }
 
-        prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
-        if (PRS_GOD_TEST_FLAG(header, PRS_GOD_HEADER_RESERVED)) {
-            continue;
-        }
+            prs_pal_atomic_store(&cursor->next, index + 1);
 
-        /*
-         * Very unlikely scenario: the ID is the same. If we accept to allocate a new entry with the same entry that
-         * existed before, we are possibly enabling an ABA scenario.
-         * Note: this will happen every time for the first object ever allocated, because memory will be zeroed.
-         */
-        if (PRS_GOD_GET_ID(header) == i) {
-            continue;
-        }
+            entry->object = object;
+            entry->ops = ops;
+            new_header |= PRS_GOD_HEADER_USED;
+            prs_pal_atomic_store(&entry->header, new_header);
 
-        new_header = PRS_GOD_SET_ID(i) | PRS_GOD_HEADER_RESERVED | 1;
-        if (!prs_pal_atomic_compare_exchange_strong(&entry->header, &header, new_header)) {
-            continue;
+            return id;
         }
 
-        prs_pal_atomic_store(&god->write_index, i + 1);
-
-        entry->object = object;
-        entry->ops = ops;
-        new_header |= PRS_GOD_HEADER_USED;
-        prs_pal_atomic_store(&entry->header, new_header);
-
-        return i;
+        /* No entry is free: add a chunk, and continue from its first entry */
+        if (!prs_god_grow(god, entries)) {
+            return PRS_OBJECT_ID_INVALID;
+        }
+        prs_pal_atomic_store(&cursor->next, entries);
     }
-
-    return PRS_OBJECT_ID_INVALID;
 }
 
 static void prs_god_free(prs_object_id_t id)
@@ -214,6 +312,7 @@ static void prs_god_free(prs_object_id_t id)
 
     struct prs_god* god = prs_god_get();
     struct prs_god_entry* entry = prs_god_get_entry(god, id);
+    PRS_ASSERT(entry);
 
     prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
 
@@ -257,6 +356,7 @@ void* prs_god_find(prs_object_id_t id)
 
     struct prs_god* god = prs_god_get();
     struct prs_god_entry* entry = prs_god_get_entry(god, id);
+    PRS_ASSERT(entry);
 
 #if defined(PRS_ASSERTIONS)
     const prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
@@ -275,6 +375,9 @@ static struct prs_god_entry* prs_god_lock_entry(prs_object_id_t id)
 
     struct prs_god* god = prs_god_get();
     struct prs_god_entry* entry = prs_god_get_entry(god, id);
+    if (!entry) {
+        return 0;
+    }
 
     prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
     prs_god_entry_header_t new_header;
@@ -331,6 +434,9 @@ void prs_god_unlock(prs_object_id_t id)
 
     struct prs_god* god = prs_god_get();
     struct prs_god_entry* entry = prs_god_get_entry(god, id);
+    PRS_RTC_IF (!entry) {
+        return;
+    }
 
     prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
     prs_god_entry_header_t new_header;
@@ -376,6 +482,9 @@ prs_result_t prs_god_try_unlock_final(prs_object_id_t id)
 
     struct prs_god* god = prs_god_get();
     struct prs_god_entry* entry = prs_god_get_entry(god, id);
+    PRS_RTC_IF (!entry) {
+        return PRS_NOT_FOUND;
+    }
 
     prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
     prs_god_entry_header_t new_header;
@@ -427,6 +536,42 @@ prs_result_t prs_god_object_destroy(prs_object_id_t id)
     }
 }
 
+/**
+ * \brief
+ *  Calls a function for each object of a given type in the GOD. Each object is locked while the function is called.
+ * \param ops
+ *  Operations that the objects were allocated with, which identify their type.
+ * \param fct
+ *  Function to call for each object.
+ * \param userdata
+ *  Data that will be passed to \p fct as the first parameter.
+ */
+void prs_god_foreach(struct prs_object_ops* ops, void (*fct)(void* userdata, void* object), void* userdata)
+{
+    PRS_PRECONDITION(ops);
+    PRS_PRECONDITION(fct);
+
+    struct prs_god* god = prs_god_get();
+    const prs_god_index_t entries = prs_pal_atomic_load(&god->entries);
+    for (prs_god_index_t i = 1; i < entries; ++i) {
+        struct prs_god_entry* entry = prs_god_get_entry(god, i);
+
+        prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
+        if (!PRS_GOD_TEST_FLAG(header, PRS_GOD_HEADER_USED)) {
+            continue;
+        }
+
+        const prs_object_id_t id = PRS_GOD_GET_ID(header);
+        struct prs_god_entry* locked_entry = prs_god_lock_entry(id);
+        if (locked_entry) {
+            if (locked_entry->ops == ops) {
+                fct(userdata, locked_entry->object);
+            }
+            prs_god_unlock(id);
+        }
+    }
+}
+
 /**
  * \brief
  *  Print information about all the objects in the GOD.
@@ -440,7 +585,8 @@ void prs_god_print(void* userdata, void (*fct)(void*, const char*, ...))
     PRS_PRECONDITION(fct);
 
     struct prs_god* god = prs_god_get();
-    for (prs_god_index_t i = 1; i < god->max_entries; ++i) {
+    const prs_god_index_t entries = prs_pal_atomic_load(&god->entries);
+    for (prs_god_index_t i = 1; i < entries; ++i) {
         struct prs_god_entry* entry = prs_god_get_entry(god, i);
 
         prs_god_entry_header_t header = prs_pal_atomic_load(&entry->header);
@@ -451,7 +597,7 @@ void prs_god_print(void* userdata, void (*fct)(void*, const char*, ...))
         const prs_object_id_t id = PRS_GOD_GET_ID(entry->header);
         fct(userdata, "Entry id=%u, refcnt=%u flags=0x%08X%08X\n",
             id,
-            PRS_GOD_TEST_FLAG(header, PRS_GOD_HEADER_REFCNT),
+            (unsigned int)PRS_GOD_TEST_FLAG(header, PRS_GOD_HEADER_REFCNT),
             (unsigned int)(header >> 32), (unsigned int)header);
 
         struct prs_god_entry* locked_entry = prs_god_lock_entry(id);
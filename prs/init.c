@@ -32,7 +32,8 @@
  *       -# Initializing the log module.
  *       -# Initializing the exception module.
  *       -# Initializing the clock module.
- *       -# Starting one scheduler per core, unless specified otherwise.
+ *       -# Starting one scheduler per core, or one scheduler shared by all the cores, of the kind selected by
+ *          \ref PRS_SCHED_DEFAULT, unless specified otherwise.
  *       -# Starting the \p init1 task in the PRS environment.
  *    - \p init1: This is code contained in the \ref prs_init1_task function in the PRS environment. This stage is
  *      responsible for:
@@ -50,8 +51,10 @@
 #include <prs/pal/os.h>
 #include <prs/pal/thread.h>
 #include <prs/pal/wls.h>
+#include <prs/sched/edf.h>
 #include <prs/sched/swcoop.h>
 #include <prs/sched/swprio.h>
+#include <prs/sched/swsteal.h>
 #include <prs/svc/log.h>
 #include <prs/svc/proc.h>
 #include <prs/svc/proc.msg>
@@ -84,6 +87,15 @@
 
 //#define PRS_PRINT_OBJECTS_ON_EXIT
 
+/* Name of the scheduler created for each core, from the core index */
+#if PRS_SCHED_DEFAULT == PRS_SCHED_EDF
+#define PRS_INIT_SCHED_NAME             "edf%d"
+#elif PRS_SCHED_DEFAULT == PRS_SCHED_SWSTEAL
+#define PRS_INIT_SCHED_NAME             "swsteal%d"
+#else
+#define PRS_INIT_SCHED_NAME             "swprio%d"
+#endif
+
 static prs_size_t s_prs_core_count = 0;
 static prs_sched_id_t s_prs_scheduler_ids[PRS_MAX_CPU];
 static PRS_ATOMIC prs_bool_t s_prs_uninit;
@@ -93,11 +105,40 @@ static PRS_ATOMIC int s_prs_exit_status = 0;
 
 static void prs_uninit_final(prs_sched_id_t except_id);
 
+/* Creates the scheduler selected by PRS_SCHED_DEFAULT for the specified core */
+static prs_sched_id_t prs_init_sched_create(int core)
+{
+#if PRS_SCHED_DEFAULT == PRS_SCHED_EDF
+    struct prs_sched_create_params sched_params = {
+        .userdata = 0,
+        .ops = *prs_sched_edf_ops()
+    };
+#elif PRS_SCHED_DEFAULT == PRS_SCHED_SWSTEAL
+    struct prs_sched_create_params sched_params = {
+        .userdata = 0,
+        .ops = *prs_sched_swsteal_ops()
+    };
+#else
+    struct prs_sched_swprio_params swprio_params = {
+        .quantum = PRS_SCHED_QUANTUM
+    };
+    struct prs_sched_create_params sched_params = {
+        .userdata = &swprio_params,
+        .ops = *prs_sched_swprio_ops()
+    };
+#endif
+    prs_str_printf(sched_params.name, sizeof(sched_params.name), PRS_INIT_SCHED_NAME, core);
+    prs_sched_id_t sched_id;
+    const prs_result_t result = prs_sched_create(&sched_params, &sched_id);
+    PRS_FATAL_WHEN(result != PRS_OK);
+    return sched_id;
+}
+
 static prs_sched_id_t prs_find_last_sched(void)
 {
     for (int i = PRS_MAX_CPU - 1; i >= 0; --i) {
         char sched_name[PRS_MAX_SCHED_NAME];
-        snprintf(sched_name, sizeof(sched_name), "swprio%d", i);
+        snprintf(sched_name, sizeof(sched_name), PRS_INIT_SCHED_NAME, i);
         const prs_sched_id_t sched_id = prs_sched_find(sched_name);
         if (sched_id) {
             return sched_id;
@@ -184,7 +225,8 @@ int prs_init(struct prs_init_params* params)
     printf("init0 started\n");
 
     struct prs_god_create_params god_params = {
-        .max_entries = PRS_MAX_OBJECTS
+        .max_entries = PRS_MAX_GOD_ENTRIES,
+        .chunk_entries = PRS_GOD_CHUNK_ENTRIES
     };
     result = prs_god_create(&god_params);
     PRS_FATAL_WHEN(result != PRS_OK);
@@ -223,6 +265,7 @@ int prs_init(struct prs_init_params* params)
     prs_log_print("Core count: %u", s_prs_core_count);
 
     prs_bool_t first = PRS_TRUE;
+    prs_sched_id_t shared_sched_id = PRS_OBJECT_ID_INVALID;
     for (int i = 0; i < s_prs_core_count; ++i) {
         if (!(params->core_mask & (1 << i))) {
             s_prs_scheduler_ids[i] = PRS_OBJECT_ID_INVALID;
@@ -239,15 +282,17 @@ int prs_init(struct prs_init_params* params)
         struct prs_pal_thread* pal_thread = prs_pal_thread_create(&pal_main_thread_params);
         PRS_FATAL_WHEN(!pal_thread);
 
-        struct prs_sched_create_params sched_params = {
-            .userdata = 0,
-            .ops = *prs_sched_swprio_ops()
-        };
-        prs_str_printf(sched_params.name, sizeof(sched_params.name), "swprio%d", i);
-        prs_sched_id_t sched_id;
-        result = prs_sched_create(&sched_params, &sched_id);
-        PRS_FATAL_WHEN(result != PRS_OK);
-        s_prs_scheduler_ids[i] = sched_id;
+        prs_sched_id_t sched_id = shared_sched_id;
+        if (sched_id == PRS_OBJECT_ID_INVALID) {
+            sched_id = prs_init_sched_create(i);
+            s_prs_scheduler_ids[i] = sched_id;
+#if PRS_SCHED_DEFAULT == PRS_SCHED_SWSTEAL
+            /* The workers of all the cores are added to the scheduler created for the first one */
+            shared_sched_id = sched_id;
+#endif
+        } else {
+            s_prs_scheduler_ids[i] = PRS_OBJECT_ID_INVALID;
+        }
 
         if (pal_main_thread_params.from_current) {
             prs_pal_atomic_store(&s_prs_main_sched_id, sched_id);
@@ -279,11 +324,11 @@ int prs_init(struct prs_init_params* params)
     prs_pal_atomic_store(&s_prs_uninit, PRS_FALSE);
 
     for (int i = s_prs_core_count - 1; i >= 0; --i) {
-        if (!(params->core_mask & (1 << i))) {
+        const prs_sched_id_t sched_id = s_prs_scheduler_ids[i];
+        if (sched_id == PRS_OBJECT_ID_INVALID) {
             continue;
         }
 
-        const prs_sched_id_t sched_id = s_prs_scheduler_ids[i];
         result = prs_sched_start(sched_id);
         PRS_FATAL_WHEN(result != PRS_OK);
     }
@@ -50,17 +50,33 @@ struct prs_mpsciq {
     struct prs_mpsciq_node*             reverse_head;
 
     prs_size_t                          node_offset;
+
+    void*                               area;
 };
 
+/**
+ * \brief
+ *  Returns the size of the \ref prs_mpsciq structure.
+ */
+prs_size_t prs_mpsciq_struct_size(void)
+{
+    return sizeof(struct prs_mpsciq);
+}
+
 /**
  * \brief
  *  Create the queue.
  */
 struct prs_mpsciq* prs_mpsciq_create(struct prs_mpsciq_create_params* params)
 {
-    struct prs_mpsciq* mpsciq = prs_pal_malloc_zero(sizeof(*mpsciq));
-    if (!mpsciq) {
-        return 0;
+    struct prs_mpsciq* mpsciq = params->area;
+    if (mpsciq) {
+        mpsciq->area = params->area;
+    } else {
+        mpsciq = prs_pal_malloc_zero(sizeof(*mpsciq));
+        if (!mpsciq) {
+            return 0;
+        }
     }
 
     mpsciq->node_offset = params->node_offset;
@@ -75,7 +91,9 @@ struct prs_mpsciq* prs_mpsciq_create(struct prs_mpsciq_create_params* params)
 void prs_mpsciq_destroy(struct prs_mpsciq* mpsciq)
 {
     /* Note: we cannot free the entries in the list, we can only assume that they have been taken care of by the user */
-    prs_pal_free(mpsciq);
+    if (!mpsciq->area) {
+        prs_pal_free(mpsciq);
+    }
 }
 
 #if defined(PRS_MPSCIQ_INTEGRITY_CHECK)
@@ -186,6 +204,58 @@ void prs_mpsciq_push(struct prs_mpsciq* mpsciq, struct prs_mpsciq_node* node)
     }
 }
 
+/**
+ * \brief
+ *  Push multiple elements in the queue at once. The elements are linked together before being published with a single
+ *  atomic operation, so that the consumer sees either none or all of them.
+ * \param mpsciq
+ *  Queue to push into.
+ * \param elements
+ *  Elements to push, from oldest to youngest.
+ * \param count
+ *  Number of elements to push.
+ */
+void prs_mpsciq_push_batch(struct prs_mpsciq* mpsciq, void* const* elements, prs_uint_t count)
+{
+    PRS_PRECONDITION(mpsciq);
+    PRS_PRECONDITION(elements);
+
+    struct prs_mpsciq_node* first = 0;
+    struct prs_mpsciq_node* last = 0;
+    for (prs_uint_t i = 0; i < count; ++i) {
+        struct prs_mpsciq_node* node = (struct prs_mpsciq_node*)((char*)elements[i] + mpsciq->node_offset);
+
+        PRS_RTC_IF (node->next) {
+            continue;
+        }
+        PRS_RTC_IF (node->prev) {
+            continue;
+        }
+
+#if defined(DEBUG)
+        PRS_RTC_IF (node->mpsciq) {
+            continue;
+        }
+        node->mpsciq = mpsciq;
+#endif /* defined(DEBUG) */
+
+        if (last) {
+            node->next = last;
+        } else {
+            first = node;
+        }
+        last = node;
+    }
+
+    if (!first) {
+        return;
+    }
+
+    first->next = prs_pal_atomic_load(&mpsciq->head);
+    while (!prs_pal_atomic_compare_exchange_weak(&mpsciq->head, &first->next, last)) {
+    }
+}
+
 /**
  * \brief
  *  Removes the specified element from the queue.
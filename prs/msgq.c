@@ -38,15 +38,30 @@
  *
  *  Sending a message through \ref prs_msgq_send is always non-blocking, unless the message recipient is run by the
  *  same scheduler and has a higher priority.
+ *
+ *  The receiver keeps an index of the queued messages by message ID: a small hash table whose buckets list the oldest
+ *  message of each ID, which in turn heads the list of the messages with that ID in their order of arrival. Messages
+ *  are added to the index by the receiver when it searches the queue, so the index needs no synchronization with the
+ *  senders. Receives filtered by message ID (\ref prs_msgq_recv_ids) only
+ *  look at the buckets of the requested IDs instead of scanning the whole queue. Other filters still scan the queue.
+ *
+ *  A message queue can be bounded by a capacity. Senders reserve a place in the queue before pushing their message.
+ *  When the queue is full, they either drop their message or wait on a semaphore that the receiver signals when it
+ *  removes messages from the queue, depending on the policy of the queue. Closing the queue (\ref prs_msgq_close)
+ *  releases the waiting senders. Senders that cannot wait, because they are not running in a task or because they are
+ *  the receiver itself and would never be woken up, drop their message even when the policy is to wait.
  */
 
 #include <stddef.h>
 #include <string.h>
 
+#include <prs/pal/arch.h>
 #include <prs/pal/atomic.h>
+#include <prs/pal/bitops.h>
 #include <prs/pal/malloc.h>
 #include <prs/assert.h>
 #include <prs/clock.h>
+#include <prs/config.h>
 #include <prs/error.h>
 #include <prs/gpd.h>
 #include <prs/log.h>
@@ -56,6 +71,7 @@
 #include <prs/pd.h>
 #include <prs/result.h>
 #include <prs/rtc.h>
+#include <prs/sem.h>
 #include <prs/task.h>
 #include <prs/ticks.h>
 #include <prs/timer.h>
@@ -79,8 +95,28 @@ struct prs_msgq {
     struct prs_mpsciq*                  queue;
     struct prs_pd*                      pd;
     PRS_ATOMIC prs_pd_id_t              filter_id;
+
+    prs_uint_t                          capacity;
+    enum prs_msgq_full_policy           full_policy;
+    PRS_ATOMIC prs_uint_t               depth;
+    PRS_ATOMIC prs_uint_t               high_water;
+    PRS_ATOMIC prs_uint64_t             dropped;
+    /* Senders wait on the semaphore when the queue is full */
+    struct prs_sem*                     space_sem;
+    PRS_ATOMIC prs_uint_t               space_waiters;
+    PRS_ATOMIC prs_bool_t               closed;
+
+    /* Youngest message that was added to the index; all the older messages of the queue are indexed as well */
+    struct prs_mpsciq_node*             indexed_node;
+    prs_uint_t                          index_seq;
+    struct prs_msg*                     index[PRS_MSGQ_INDEX_BUCKETS];
+
+    void*                               area;
 };
 
+/* The queue is followed by its mpsciq when it is created in a pre-allocated area */
+#define PRS_MSGQ_QUEUE_OFFSET           prs_bitops_align_size(sizeof(struct prs_msgq), PRS_PAL_POINTER_SIZE)
+
 static struct prs_msgq_filter* prs_msgq_filter_create(struct prs_msgq* msgq, void* userdata, prs_size_t userdata_size,
     prs_msgq_filter_function_t function)
 {
@@ -161,6 +197,16 @@ static prs_bool_t prs_msgq_free_event(struct prs_msgq_filter* filter, struct prs
     return PRS_BOOL(event_state & PRS_EVENT_STATE_SIGNALED);
 }
 
+/**
+ * \brief
+ *  Returns the size of the memory area required by \ref prs_msgq_create when \ref prs_msgq_create_params::area is
+ *  specified.
+ */
+prs_size_t prs_msgq_struct_size(void)
+{
+    return PRS_MSGQ_QUEUE_OFFSET + prs_mpsciq_struct_size();
+}
+
 /**
  * \brief
  *  Creates a message queue.
@@ -171,13 +217,19 @@ struct prs_msgq* prs_msgq_create(struct prs_msgq_create_params* params)
 {
     PRS_PRECONDITION(params);
 
-    struct prs_msgq* msgq = prs_pal_malloc_zero(sizeof(*msgq));
-    if (!msgq) {
-        goto cleanup;
+    struct prs_msgq* msgq = params->area;
+    if (msgq) {
+        msgq->area = params->area;
+    } else {
+        msgq = prs_pal_malloc_zero(sizeof(*msgq));
+        if (!msgq) {
+            goto cleanup;
+        }
     }
 
     struct prs_mpsciq_create_params mpsciq_params = {
-        .node_offset = offsetof(struct prs_msg, node)
+        .node_offset = offsetof(struct prs_msg, node),
+        .area = params->area ? (void*)((prs_uintptr_t)params->area + PRS_MSGQ_QUEUE_OFFSET) : 0
     };
     msgq->queue = prs_mpsciq_create(&mpsciq_params);
     if (!msgq->queue) {
@@ -192,6 +244,19 @@ struct prs_msgq* prs_msgq_create(struct prs_msgq_create_params* params)
         }
     }
 
+    msgq->capacity = params->capacity;
+    msgq->full_policy = params->full_policy;
+    if (msgq->capacity && msgq->full_policy == PRS_MSGQ_FULL_BLOCK) {
+        struct prs_sem_create_params sem_params = {
+            .max_count = (prs_int_t)msgq->capacity,
+            .initial_count = 0
+        };
+        msgq->space_sem = prs_sem_create(&sem_params);
+        if (!msgq->space_sem) {
+            goto cleanup;
+        }
+    }
+
     return msgq;
 
     cleanup:
@@ -200,7 +265,9 @@ struct prs_msgq* prs_msgq_create(struct prs_msgq_create_params* params)
         if (msgq->queue) {
             prs_mpsciq_destroy(msgq->queue);
         }
-        prs_pal_free(msgq);
+        if (!params->area) {
+            prs_pal_free(msgq);
+        }
     }
 
     return 0;
@@ -216,34 +283,134 @@ void prs_msgq_destroy(struct prs_msgq* msgq)
 {
     PRS_PRECONDITION(msgq);
 
+    if (msgq->space_sem) {
+        prs_sem_destroy(msgq->space_sem);
+    }
     prs_mpsciq_destroy(msgq->queue);
-    prs_pal_free(msgq);
+    if (!msgq->area) {
+        prs_pal_free(msgq);
+    }
 }
 
 /**
  * \brief
- *  Sends a message to the message queue.
+ *  Closes a message queue, when its receiver is about to be destroyed. The senders that are waiting for room in the
+ *  queue are released, and the messages sent to a full queue from then on are refused instead of waiting.
  * \param msgq
- *  Message queue to send the message to.
- * \param msg
- *  Message to send to the message queue.
+ *  Message queue to close.
  */
-void prs_msgq_send(struct prs_msgq* msgq, struct prs_msg* msg)
+void prs_msgq_close(struct prs_msgq* msgq)
 {
     PRS_PRECONDITION(msgq);
-    PRS_PRECONDITION(msg);
 
-    /*
-     * BUG: It is possible that by using the following algorithm, the message will already be consumed by the time we
-     * try to lock the filter. This means that we would signal a message that is not in the queue to the receiver.
-     *
-     * Locking the filter before the push presents the same issue: the filter might be empty or being destroyed, and
-     * the pushed message may not reach the next filter as it would be initialized during the push.
-     *
-     * The workaround for this issue is implemented in prs_msg_recv_internal().
-     */
-    prs_mpsciq_push(msgq->queue, &msg->node);
+    prs_pal_atomic_store(&msgq->closed, PRS_TRUE);
+    if (msgq->space_sem) {
+        /* Senders check the closed flag after registering as waiters, so none of them can be missed */
+        const prs_uint_t waiters = prs_pal_atomic_load(&msgq->space_waiters);
+        for (prs_uint_t i = 0; i < waiters; ++i) {
+            prs_sem_signal(msgq->space_sem);
+        }
+    }
+}
+
+/**
+ * \brief
+ *  Returns the statistics of a message queue.
+ * \param msgq
+ *  Message queue to get the statistics from.
+ * \param stats
+ *  Receives the statistics.
+ */
+void prs_msgq_get_stats(struct prs_msgq* msgq, struct prs_msgq_stats* stats)
+{
+    PRS_PRECONDITION(msgq);
+    PRS_PRECONDITION(stats);
+
+    stats->depth = prs_pal_atomic_load(&msgq->depth);
+    stats->high_water = prs_pal_atomic_load(&msgq->high_water);
+    stats->capacity = msgq->capacity;
+    stats->dropped = prs_pal_atomic_load(&msgq->dropped);
+}
+
+/* Reserves room for up to count messages in the queue, and returns the number of messages that fit */
+static prs_uint_t prs_msgq_reserve(struct prs_msgq* msgq, prs_uint_t count)
+{
+    prs_uint_t depth = prs_pal_atomic_load(&msgq->depth);
+    prs_uint_t reserved;
+    do {
+        reserved = count;
+        if (msgq->capacity) {
+            if (depth >= msgq->capacity) {
+                return 0;
+            }
+            if (msgq->capacity - depth < reserved) {
+                reserved = msgq->capacity - depth;
+            }
+        }
+    } while (!prs_pal_atomic_compare_exchange_weak(&msgq->depth, &depth, depth + reserved));
+
+    const prs_uint_t new_depth = depth + reserved;
+    prs_uint_t high_water = prs_pal_atomic_load(&msgq->high_water);
+    while (new_depth > high_water) {
+        if (prs_pal_atomic_compare_exchange_weak(&msgq->high_water, &high_water, new_depth)) {
+            break;
+        }
+    }
+
+    return reserved;
+}
+
+/* Called by the receiver for each message that it removes from the queue */
+static void prs_msgq_release(struct prs_msgq* msgq)
+{
+    prs_pal_atomic_fetch_sub(&msgq->depth, 1);
+    if (msgq->space_sem && prs_pal_atomic_load(&msgq->space_waiters)) {
+        prs_sem_signal(msgq->space_sem);
+    }
+}
+
+/* Returns whether the caller can wait for room in the queue: it must be a task other than the receiver */
+static prs_bool_t prs_msgq_can_wait(struct prs_msgq* msgq)
+{
+    if (msgq->full_policy == PRS_MSGQ_FULL_DROP) {
+        return PRS_FALSE;
+    }
+
+    struct prs_worker* worker = prs_worker_current();
+    if (!worker) {
+        return PRS_FALSE;
+    }
+    struct prs_task* task = prs_worker_get_current_task(worker);
+    return PRS_BOOL(task && task->msgq != msgq);
+}
+
+/* Waits until room for one message is reserved in the queue. Returns false if the queue was closed. */
+static prs_bool_t prs_msgq_wait_space(struct prs_msgq* msgq)
+{
+    PRS_ASSERT(msgq->space_sem);
 
+    for (;;) {
+        /*
+         * The receiver only signals the semaphore when it sees waiters, so we register before checking for room one
+         * last time. Signals that were meant for other waiters only cause another iteration.
+         */
+        prs_pal_atomic_fetch_add(&msgq->space_waiters, 1);
+        if (prs_msgq_reserve(msgq, 1)) {
+            prs_pal_atomic_fetch_sub(&msgq->space_waiters, 1);
+            return PRS_TRUE;
+        }
+        if (prs_pal_atomic_load(&msgq->closed)) {
+            prs_pal_atomic_fetch_sub(&msgq->space_waiters, 1);
+            return PRS_FALSE;
+        }
+        prs_sem_wait(msgq->space_sem);
+        prs_pal_atomic_fetch_sub(&msgq->space_waiters, 1);
+    }
+}
+
+/* Signals the receiver if one of the messages that were just pushed matches its filter */
+static void prs_msgq_notify(struct prs_msgq* msgq, struct prs_msg* const* msgs, prs_uint_t count)
+{
     struct prs_msgq_filter* filter = 0;
     const prs_pd_id_t filter_id = prs_pal_atomic_load(&msgq->filter_id);
     if (filter_id != PRS_PD_ID_INVALID) {
@@ -255,7 +422,9 @@ void prs_msgq_send(struct prs_msgq* msgq, struct prs_msg* msg)
         if (event) {
             prs_bool_t match = PRS_FALSE;
             if (filter->function) {
-                match = filter->function(filter->userdata, msg);
+                for (prs_uint_t i = 0; i < count && !match; ++i) {
+                    match = filter->function(filter->userdata, msgs[i]);
+                }
             } else {
                 match = PRS_TRUE;
             }
@@ -271,6 +440,125 @@ void prs_msgq_send(struct prs_msgq* msgq, struct prs_msg* msg)
     }
 }
 
+/**
+ * \brief
+ *  Sends a message to the message queue. When the queue is full, the message is either dropped or the caller waits
+ *  until there is room for it, depending on the policy of the queue. Callers that are not tasks, and the receiver of
+ *  the queue, never wait and drop the message instead.
+ * \param msgq
+ *  Message queue to send the message to.
+ * \param msg
+ *  Message to send to the message queue.
+ * \return
+ *  \ref PRS_OK if the message was sent.
+ *  \ref PRS_FULL if the message was dropped because the queue was full.
+ *  \ref PRS_INVALID_STATE if the queue was closed while waiting for room.
+ * \note
+ *  When the message is not sent, it still belongs to the caller.
+ */
+prs_result_t prs_msgq_send(struct prs_msgq* msgq, struct prs_msg* msg)
+{
+    PRS_PRECONDITION(msgq);
+    PRS_PRECONDITION(msg);
+
+    if (!prs_msgq_reserve(msgq, 1)) {
+        if (!prs_msgq_can_wait(msgq)) {
+            prs_pal_atomic_fetch_add(&msgq->dropped, 1);
+            return PRS_FULL;
+        }
+        if (!prs_msgq_wait_space(msgq)) {
+            return PRS_INVALID_STATE;
+        }
+    }
+
+    /*
+     * BUG: It is possible that by using the following algorithm, the message will already be consumed by the time we
+     * try to lock the filter. This means that we would signal a message that is not in the queue to the receiver.
+     *
+     * Locking the filter before the push presents the same issue: the filter might be empty or being destroyed, and
+     * the pushed message may not reach the next filter as it would be initialized during the push.
+     *
+     * The workaround for this issue is implemented in prs_msg_recv_internal().
+     */
+    prs_mpsciq_push(msgq->queue, &msg->node);
+
+    prs_msgq_notify(msgq, &msg, 1);
+
+    return PRS_OK;
+}
+
+/**
+ * \brief
+ *  Sends a message to the message queue if there is room for it, without waiting.
+ * \param msgq
+ *  Message queue to send the message to.
+ * \param msg
+ *  Message to send to the message queue.
+ * \return
+ *  \ref PRS_OK if the message was sent.
+ *  \ref PRS_FULL if the queue was full. The message still belongs to the caller and is not counted as dropped.
+ *  \ref PRS_INVALID_STATE if the queue was full and closed, so that it will never have room again.
+ */
+prs_result_t prs_msgq_try_send(struct prs_msgq* msgq, struct prs_msg* msg)
+{
+    PRS_PRECONDITION(msgq);
+    PRS_PRECONDITION(msg);
+
+    if (!prs_msgq_reserve(msgq, 1)) {
+        return prs_pal_atomic_load(&msgq->closed) ? PRS_INVALID_STATE : PRS_FULL;
+    }
+
+    /* Same issue as in prs_msgq_send() */
+    prs_mpsciq_push(msgq->queue, &msg->node);
+
+    prs_msgq_notify(msgq, &msg, 1);
+
+    return PRS_OK;
+}
+
+/**
+ * \brief
+ *  Sends multiple messages to the message queue at once. The messages that fit in the queue are pushed with a single
+ *  operation and the receiver is signaled at most once. When the queue is full, the remaining messages are either
+ *  dropped or the caller waits until there is room for them, depending on the policy of the queue.
+ * \param msgq
+ *  Message queue to send the messages to.
+ * \param msgs
+ *  Messages to send to the message queue, in the order in which they are received.
+ * \param count
+ *  Number of messages to send.
+ * \return
+ *  Number of messages that were sent, which are the first ones of \p msgs. The others still belong to the caller.
+ */
+prs_uint_t prs_msgq_send_batch(struct prs_msgq* msgq, struct prs_msg* const* msgs, prs_uint_t count)
+{
+    PRS_PRECONDITION(msgq);
+    PRS_PRECONDITION(msgs);
+
+    prs_uint_t sent = 0;
+    while (sent < count) {
+        prs_uint_t reserved = prs_msgq_reserve(msgq, count - sent);
+        if (!reserved) {
+            if (!prs_msgq_can_wait(msgq)) {
+                prs_pal_atomic_fetch_add(&msgq->dropped, count - sent);
+                break;
+            }
+            if (!prs_msgq_wait_space(msgq)) {
+                break;
+            }
+            reserved = 1;
+        }
+
+        /* Same issue as in prs_msgq_send() */
+        prs_mpsciq_push_batch(msgq->queue, (void* const*)&msgs[sent], reserved);
+
+        prs_msgq_notify(msgq, &msgs[sent], reserved);
+        sent += reserved;
+    }
+
+    return sent;
+}
+
 static void prs_msgq_filter_reset(struct prs_msgq* msgq, struct prs_msgq_filter* filter)
 {
     PRS_PRECONDITION(msgq);
@@ -289,13 +577,127 @@ static void prs_msgq_filter_set(struct prs_msgq* msgq, struct prs_msgq_filter* f
     prs_pal_atomic_store(&msgq->filter_id, filter->id);
 }
 
+/* Returns the oldest message with the specified ID, and the link to it */
+static struct prs_msg* prs_msgq_index_find(struct prs_msgq* msgq, prs_msg_id_t msg_id, struct prs_msg*** link)
+{
+    struct prs_msg** search = &msgq->index[msg_id & (PRS_MSGQ_INDEX_BUCKETS - 1)];
+    while (*search && PRS_MSG_GET_ID(*search) != msg_id) {
+        search = &(*search)->index_next;
+    }
+    if (link) {
+        *link = search;
+    }
+    return *search;
+}
+
+/* Adds the messages that arrived since the last call to the index, and returns the oldest message of the queue */
+static struct prs_mpsciq_node* prs_msgq_index_update(struct prs_msgq* msgq)
+{
+    /* prs_mpsciq_begin will build the 'prev' links in mpsciq that are required for calling prs_mpsciq_next */
+    struct prs_mpsciq_node* first = prs_mpsciq_begin(msgq->queue);
+    struct prs_mpsciq_node* node = msgq->indexed_node ? prs_mpsciq_next(msgq->queue, msgq->indexed_node) : first;
+    while (node) {
+        struct prs_msg* msg = prs_mpsciq_get_data(msgq->queue, node);
+        msg->index_same = 0;
+        msg->index_seq = ++msgq->index_seq;
+
+        struct prs_msg** link;
+        struct prs_msg* head = prs_msgq_index_find(msgq, PRS_MSG_GET_ID(msg), &link);
+        if (head) {
+            head->index_tail->index_same = msg;
+            head->index_tail = msg;
+        } else {
+            msg->index_next = 0;
+            msg->index_tail = msg;
+            *link = msg;
+        }
+
+        msgq->indexed_node = node;
+        node = prs_mpsciq_next(msgq->queue, node);
+    }
+    return first;
+}
+
+/* Removes a message, which must have been indexed, from the index and from the queue */
+static void prs_msgq_remove(struct prs_msgq* msgq, struct prs_msg* msg)
+{
+    if (&msg->node == msgq->indexed_node) {
+        msgq->indexed_node = prs_mpsciq_prev(msgq->queue, &msg->node);
+    }
+
+    struct prs_msg** link;
+    struct prs_msg* head = prs_msgq_index_find(msgq, PRS_MSG_GET_ID(msg), &link);
+    PRS_ASSERT(head);
+    if (head == msg) {
+        /* Messages are usually received in order, so the message is most often the oldest of its ID */
+        struct prs_msg* next = msg->index_same;
+        if (next) {
+            next->index_next = msg->index_next;
+            next->index_tail = msg->index_tail;
+            *link = next;
+        } else {
+            *link = msg->index_next;
+        }
+    } else {
+        struct prs_msg* prev = head;
+        while (prev->index_same != msg) {
+            PRS_ASSERT(prev->index_same);
+            prev = prev->index_same;
+        }
+        prev->index_same = msg->index_same;
+        if (head->index_tail == msg) {
+            head->index_tail = prev;
+        }
+    }
+
+    prs_mpsciq_remove(msgq->queue, &msg->node);
+    prs_msgq_release(msgq);
+}
+
+/* Filter function of the receives filtered by message ID, used by the senders */
+static prs_bool_t prs_msgq_ids_filter_function(void* userdata, struct prs_msg* msg)
+{
+    const prs_msg_id_t* ids = userdata;
+    const prs_msg_id_t msg_id = PRS_MSG_GET_ID(msg);
+
+    const prs_msg_id_t count = ids[0];
+    PRS_ASSERT(count > 0);
+    for (prs_msg_id_t i = 1; i <= count; ++i) {
+        if (ids[i] == msg_id) {
+            return PRS_TRUE;
+        }
+    }
+    return PRS_FALSE;
+}
+
+/* Returns the oldest message whose ID is one of the specified IDs, by looking only at the messages with these IDs */
+static struct prs_msg* prs_msgq_search_ids(struct prs_msgq* msgq, const prs_msg_id_t* ids)
+{
+    prs_msgq_index_update(msgq);
+
+    struct prs_msg* result = 0;
+    const prs_msg_id_t count = ids[0];
+    for (prs_msg_id_t i = 1; i <= count; ++i) {
+        struct prs_msg* msg = prs_msgq_index_find(msgq, ids[i], 0);
+        /* Sequence numbers may wrap around */
+        if (msg && (!result || (prs_int_t)(msg->index_seq - result->index_seq) < 0)) {
+            result = msg;
+        }
+    }
+
+    return result;
+}
+
 static struct prs_msg* prs_msgq_search(struct prs_msgq* msgq, void* userdata, prs_msgq_filter_function_t function,
     struct prs_mpsciq_node** hint)
 {
     PRS_PRECONDITION(msgq);
 
-    /* prs_mpsciq_begin will build the 'prev' links in mpsciq that are required for calling prs_mpsciq_next */
-    struct prs_mpsciq_node* node = prs_mpsciq_begin(msgq->queue);
+    if (function == prs_msgq_ids_filter_function) {
+        return prs_msgq_search_ids(msgq, userdata);
+    }
+
+    struct prs_mpsciq_node* node = prs_msgq_index_update(msgq);
     if (hint && *hint) {
         node = *hint;
     }
@@ -326,7 +728,7 @@ static struct prs_msg* prs_msgq_search(struct prs_msgq* msgq, void* userdata, pr
 }
 
 static struct prs_msg* prs_msgq_recv_internal(struct prs_msgq* msgq, void* userdata, prs_size_t userdata_size,
-    prs_msgq_filter_function_t function, prs_ticks_t timeout, prs_bool_t use_timeout)
+    prs_msgq_filter_function_t function, prs_uint64_t timeout, prs_bool_t use_timeout, prs_bool_t high_res)
 {
     PRS_PRECONDITION(msgq);
 
@@ -339,7 +741,8 @@ static struct prs_msg* prs_msgq_recv_internal(struct prs_msgq* msgq, void* userd
      * until a timeout occurs or a message is actually caught.
      */
 
-    prs_ticks_t wait_left = timeout;
+    /* Either in ticks or in nanoseconds, depending on high_res */
+    prs_uint64_t wait_left = timeout;
     while (!msg) {
         const prs_bool_t timeout_active = PRS_BOOL(use_timeout && wait_left > 0);
         if (use_timeout && !timeout_active) {
@@ -359,20 +762,26 @@ static struct prs_msg* prs_msgq_recv_internal(struct prs_msgq* msgq, void* userd
                 prs_sched_schedule();
             }
         } else {
+            struct prs_timer* timer = 0;
             struct prs_timer_entry* timer_entry = 0;
             if (timeout_active) {
-                timer_entry = prs_timer_queue(prs_clock_timer(), event, PRS_MSGQ_EVENT_TYPE_TIMEOUT, wait_left);
+                timer = prs_worker_get_timer(prs_worker_current());
+                timer_entry = high_res ?
+                    prs_timer_queue_ns(timer, event, PRS_MSGQ_EVENT_TYPE_TIMEOUT, wait_left) :
+                    prs_timer_queue(timer, event, PRS_MSGQ_EVENT_TYPE_TIMEOUT, (prs_ticks_t)wait_left);
                 PRS_ASSERT(timer_entry);
             }
             prs_sched_schedule();
             if (timeout_active) {
-                const prs_ticks_t diff = prs_clock_get() - prs_timer_get_start(timer_entry);
+                const prs_uint64_t diff = high_res ?
+                    prs_clock_get_ns() - prs_timer_get_start_ns(timer_entry) :
+                    (prs_ticks_t)(prs_clock_get() - prs_timer_get_start(timer_entry));
                 if (diff >= wait_left) {
                     wait_left = 0;
                 } else {
                     wait_left -= diff;
                 }
-                prs_timer_cancel(prs_clock_timer(), timer_entry);
+                prs_timer_cancel(timer, timer_entry);
             }
 
             struct prs_task* task = prs_task_current();
@@ -396,7 +805,7 @@ static struct prs_msg* prs_msgq_recv_internal(struct prs_msgq* msgq, void* userd
     }
 
     if (msg) {
-        prs_mpsciq_remove(msgq->queue, &msg->node);
+        prs_msgq_remove(msgq, msg);
     }
 
     PRS_POSTCONDITION(msg || use_timeout);
@@ -404,6 +813,63 @@ static struct prs_msg* prs_msgq_recv_internal(struct prs_msgq* msgq, void* userd
     return msg;
 }
 
+/**
+ * \brief
+ *  Returns whether the message queue is empty. Can only be called by the receiver.
+ * \param msgq
+ *  Message queue to check.
+ */
+prs_bool_t prs_msgq_empty(struct prs_msgq* msgq)
+{
+    PRS_PRECONDITION(msgq);
+
+    return PRS_BOOL(!prs_msgq_search(msgq, 0, 0, 0));
+}
+
+/**
+ * \brief
+ *  Makes the next message that is sent to the queue signal the specified event, until \ref prs_msgq_unwatch is
+ *  called. Can only be called by the receiver, when it is not already receiving or watching.
+ * \param msgq
+ *  Message queue to watch.
+ * \param event
+ *  Event to signal. The queue holds one reference on it until it signals it or until it is unwatched.
+ * \return
+ *  Filter that must be given to \ref prs_msgq_unwatch.
+ */
+struct prs_msgq_filter* prs_msgq_watch(struct prs_msgq* msgq, struct prs_event* event)
+{
+    PRS_PRECONDITION(msgq);
+    PRS_PRECONDITION(event);
+
+    struct prs_msgq_filter* filter = prs_msgq_filter_create(msgq, 0, 0, 0);
+    PRS_ASSERT(filter);
+    prs_pal_atomic_store(&filter->event, event);
+    prs_msgq_filter_set(msgq, filter);
+
+    return filter;
+}
+
+/**
+ * \brief
+ *  Stops watching the message queue. The reference on the event is released if it was not signaled.
+ * \param msgq
+ *  Message queue that is watched.
+ * \param filter
+ *  Filter that was returned by \ref prs_msgq_watch.
+ */
+void prs_msgq_unwatch(struct prs_msgq* msgq, struct prs_msgq_filter* filter)
+{
+    PRS_PRECONDITION(msgq);
+    PRS_PRECONDITION(filter);
+
+    struct prs_event* event = prs_pal_atomic_exchange(&filter->event, 0);
+    if (event) {
+        prs_event_unref(event);
+    }
+    prs_msgq_filter_reset(msgq, filter);
+}
+
 /**
  * \brief
  *  Receive a message from the message queue.
@@ -414,7 +880,7 @@ static struct prs_msg* prs_msgq_recv_internal(struct prs_msgq* msgq, void* userd
  */
 struct prs_msg* prs_msgq_recv(struct prs_msgq* msgq)
 {
-    return prs_msgq_recv_internal(msgq, 0, 0, 0, 0, PRS_FALSE);
+    return prs_msgq_recv_internal(msgq, 0, 0, 0, 0, PRS_FALSE, PRS_FALSE);
 }
 
 /**
@@ -429,7 +895,22 @@ struct prs_msg* prs_msgq_recv(struct prs_msgq* msgq)
  */
 struct prs_msg* prs_msgq_recv_timeout(struct prs_msgq* msgq, prs_ticks_t timeout)
 {
-    return prs_msgq_recv_internal(msgq, 0, 0, 0, timeout, PRS_TRUE);
+    return prs_msgq_recv_internal(msgq, 0, 0, 0, timeout, PRS_TRUE, PRS_FALSE);
+}
+
+/**
+ * \brief
+ *  Receive a message from the message queue with a high resolution timeout.
+ * \param msgq
+ *  Message queue to receive the message from.
+ * \param timeout_ns
+ *  Timeout in nanoseconds.
+ * \return
+ *  The received message, or \p null if a timeout occurred.
+ */
+struct prs_msg* prs_msgq_recv_timeout_ns(struct prs_msgq* msgq, prs_uint64_t timeout_ns)
+{
+    return prs_msgq_recv_internal(msgq, 0, 0, 0, timeout_ns, PRS_TRUE, PRS_TRUE);
 }
 
 /**
@@ -449,7 +930,7 @@ struct prs_msg* prs_msgq_recv_timeout(struct prs_msgq* msgq, prs_ticks_t timeout
 struct prs_msg* prs_msgq_recv_filter(struct prs_msgq* msgq, void* userdata, prs_size_t userdata_size,
     prs_msgq_filter_function_t function)
 {
-    return prs_msgq_recv_internal(msgq, userdata, userdata_size, function, 0, PRS_FALSE);
+    return prs_msgq_recv_internal(msgq, userdata, userdata_size, function, 0, PRS_FALSE, PRS_FALSE);
 }
 
 /**
@@ -471,5 +952,110 @@ struct prs_msg* prs_msgq_recv_filter(struct prs_msgq* msgq, void* userdata, prs_
 struct prs_msg* prs_msgq_recv_filter_timeout(struct prs_msgq* msgq, void* userdata, prs_size_t userdata_size,
     prs_msgq_filter_function_t function, prs_ticks_t timeout)
 {
-    return prs_msgq_recv_internal(msgq, userdata, userdata_size, function, timeout, PRS_TRUE);
+    return prs_msgq_recv_internal(msgq, userdata, userdata_size, function, timeout, PRS_TRUE, PRS_FALSE);
+}
+
+/**
+ * \brief
+ *  Receive a message from the message queue with a filter and with a high resolution timeout.
+ * \param msgq
+ *  Message queue to receive the message from.
+ * \param userdata
+ *  Pointer to data that will be passed to the filter function.
+ * \param userdata_size
+ *  Size of the data to be passed to the filter function.
+ * \param function
+ *  Filter function.
+ * \param timeout_ns
+ *  Timeout in nanoseconds.
+ * \return
+ *  The received message, or \p null if a timeout occurred.
+ */
+struct prs_msg* prs_msgq_recv_filter_timeout_ns(struct prs_msgq* msgq, void* userdata, prs_size_t userdata_size,
+    prs_msgq_filter_function_t function, prs_uint64_t timeout_ns)
+{
+    return prs_msgq_recv_internal(msgq, userdata, userdata_size, function, timeout_ns, PRS_TRUE, PRS_TRUE);
+}
+
+/**
+ * \brief
+ *  Receives the messages that are waiting in the message queue, without blocking.
+ * \param msgq
+ *  Message queue to receive the messages from.
+ * \param msgs
+ *  Receives the messages, oldest first.
+ * \param max_count
+ *  Maximum number of messages to receive.
+ * \return
+ *  Number of messages that were received.
+ */
+prs_uint_t prs_msgq_recv_batch(struct prs_msgq* msgq, struct prs_msg** msgs, prs_uint_t max_count)
+{
+    PRS_PRECONDITION(msgq);
+    PRS_PRECONDITION(msgs);
+
+    prs_uint_t count = 0;
+    struct prs_mpsciq_node* node = prs_msgq_index_update(msgq);
+    while (node && count < max_count) {
+        struct prs_mpsciq_node* next = prs_mpsciq_next(msgq->queue, node);
+        struct prs_msg* msg = prs_mpsciq_get_data(msgq->queue, node);
+        prs_msgq_remove(msgq, msg);
+        msgs[count++] = msg;
+        node = next;
+    }
+
+    return count;
+}
+
+/**
+ * \brief
+ *  Receive a message from the message queue whose ID is one of the specified IDs. Only the messages with these IDs are
+ *  looked at, through the message ID index of the queue.
+ * \param msgq
+ *  Message queue to receive the message from.
+ * \param ids
+ *  Number of IDs, followed by the IDs.
+ * \return
+ *  The received message. Cannot be \p null.
+ */
+struct prs_msg* prs_msgq_recv_ids(struct prs_msgq* msgq, const prs_msg_id_t* ids)
+{
+    return prs_msgq_recv_internal(msgq, (void*)ids, (ids[0] + 1) * sizeof(*ids), prs_msgq_ids_filter_function, 0,
+        PRS_FALSE, PRS_FALSE);
+}
+
+/**
+ * \brief
+ *  Receive a message from the message queue whose ID is one of the specified IDs, with a timeout.
+ * \param msgq
+ *  Message queue to receive the message from.
+ * \param ids
+ *  Number of IDs, followed by the IDs.
+ * \param timeout
+ *  Timeout in ticks.
+ * \return
+ *  The received message, or \p null if a timeout occurred.
+ */
+struct prs_msg* prs_msgq_recv_ids_timeout(struct prs_msgq* msgq, const prs_msg_id_t* ids, prs_ticks_t timeout)
+{
+    return prs_msgq_recv_internal(msgq, (void*)ids, (ids[0] + 1) * sizeof(*ids), prs_msgq_ids_filter_function,
+        timeout, PRS_TRUE, PRS_FALSE);
+}
+
+/**
+ * \brief
+ *  Receive a message from the message queue whose ID is one of the specified IDs, with a high resolution timeout.
+ * \param msgq
+ *  Message queue to receive the message from.
+ * \param ids
+ *  Number of IDs, followed by the IDs.
+ * \param timeout_ns
+ *  Timeout in nanoseconds.
+ * \return
+ *  The received message, or \p null if a timeout occurred.
+ */
+struct prs_msg* prs_msgq_recv_ids_timeout_ns(struct prs_msgq* msgq, const prs_msg_id_t* ids, prs_uint64_t timeout_ns)
+{
+    return prs_msgq_recv_internal(msgq, (void*)ids, (ids[0] + 1) * sizeof(*ids), prs_msgq_ids_filter_function,
+        timeout_ns, PRS_TRUE, PRS_TRUE);
 }
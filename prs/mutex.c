@@ -0,0 +1,533 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains mutex definitions.
+ *
+ *  The mutex word contains the object ID of the owning task. An uncontended lock or unlock is a single
+ *  compare-and-swap on that word. The word is wider than an object ID, so that its flags never collide with the bits of
+ *  an ID. When the mutex is owned by a task that is running on another worker, a locking task
+ *  spins for up to \ref PRS_MUTEX_SPIN_CYCLES before it blocks, since the owner is likely to release it soon.
+ *
+ *  Blocked tasks are queued by priority through the wait node embedded in their \ref prs_task, and the
+ *  \ref PRS_MUTEX_WAITERS flag is set in the mutex word so that the owner takes the slow path when it unlocks. The
+ *  mutex is then handed off directly to the highest priority waiter.
+ *
+ *  To bound priority inversion, a task that blocks raises the priority of the owner to its own priority when it is
+ *  higher. When the owner is itself waiting for another mutex, it is moved ahead in the wait queue of that mutex and the
+ *  priority of its owner is raised in turn, and so on along the chain of owners. The priority of an owner is only
+ *  raised while the lock of the mutex that it owns is held. Each time a task releases a mutex, its priority is
+ *  recomputed from its base priority and from the highest priority task still waiting for the mutexes that it holds,
+ *  with the locks of those mutexes held.
+ */
+
+#include <stddef.h>
+
+#include <prs/pal/atomic.h>
+#include <prs/pal/cycles.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/config.h>
+#include <prs/error.h>
+#include <prs/god.h>
+#include <prs/idllist.h>
+#include <prs/log.h>
+#include <prs/mutex.h>
+#include <prs/rtc.h>
+#include <prs/sched.h>
+#include <prs/spinlock.h>
+#include <prs/systeminfo.h>
+#include <prs/worker.h>
+
+#include "task.h"
+
+/** \brief Flag of the mutex word that is set while tasks are waiting for the mutex. */
+#define PRS_MUTEX_WAITERS               ((prs_mutex_word_t)1 << 32)
+/** \brief Bits of the mutex word that contain the object ID of the owning task. */
+#define PRS_MUTEX_OWNER                 ((prs_mutex_word_t)(prs_object_id_t)-1)
+
+typedef prs_uint64_t prs_mutex_word_t;
+
+#define PRS_MUTEX_EVENT_TYPE_UNLOCK     1
+
+struct prs_mutex {
+    prs_mutex_id_t                      id;
+    /* Object ID of the owning task and PRS_MUTEX_WAITERS, or zero when the mutex is not locked */
+    PRS_ATOMIC prs_mutex_word_t         owner;
+    struct prs_spinlock*                lock;
+    /* Waiting tasks, sorted by priority, then by arrival */
+    struct prs_idllist*                 waitq;
+    /* Next mutex held by the owner, only accessed by the owner */
+    struct prs_mutex*                   next_held;
+};
+
+static void prs_mutex_object_destroy(void* object)
+{
+    prs_mutex_destroy(object);
+}
+
+static void prs_mutex_object_free(void* object)
+{
+    struct prs_mutex* mutex = object;
+
+    if (mutex->waitq) {
+        prs_idllist_destroy(mutex->waitq);
+    }
+    if (mutex->lock) {
+        prs_spinlock_destroy(mutex->lock);
+    }
+    prs_pal_free(mutex);
+}
+
+static void prs_mutex_object_print(void* object, void* userdata, void (*fct)(void*, const char*, ...))
+{
+    struct prs_mutex* mutex = object;
+    const prs_mutex_word_t owner = prs_pal_atomic_load(&mutex->owner);
+
+    fct(userdata, "Mutex id=%u owner=%u waiters=%s\n",
+        mutex->id,
+        (prs_object_id_t)(owner & PRS_MUTEX_OWNER),
+        (owner & PRS_MUTEX_WAITERS) ? "yes" : "no");
+}
+
+static struct prs_object_ops s_prs_mutex_object_ops = {
+    .destroy = prs_mutex_object_destroy,
+    .free = prs_mutex_object_free,
+    .print = prs_mutex_object_print
+};
+
+/**
+ * \brief
+ *  Creates a mutex.
+ */
+struct prs_mutex* prs_mutex_create(void)
+{
+    PRS_STATIC_ASSERT(PRS_MUTEX_OWNER < PRS_MUTEX_WAITERS);
+
+    struct prs_mutex* mutex = prs_pal_malloc_zero(sizeof(*mutex));
+    if (!mutex) {
+        goto cleanup;
+    }
+
+    mutex->lock = prs_spinlock_create();
+
+    struct prs_idllist_create_params idllist_params = {
+        .node_offset = offsetof(struct prs_task, wait_node.node)
+    };
+    mutex->waitq = prs_idllist_create(&idllist_params);
+    if (!mutex->waitq) {
+        goto cleanup;
+    }
+
+    mutex->id = prs_god_alloc_and_lock(mutex, &s_prs_mutex_object_ops);
+    if (mutex->id == PRS_OBJECT_ID_INVALID) {
+        goto cleanup;
+    }
+
+    return mutex;
+
+cleanup:
+
+    if (mutex) {
+        prs_mutex_object_free(mutex);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief
+ *  Destroys a mutex.
+ * \param mutex
+ *  Mutex to destroy.
+ */
+void prs_mutex_destroy(struct prs_mutex* mutex)
+{
+    prs_god_unlock(mutex->id);
+}
+
+static prs_bool_t prs_mutex_try_acquire(struct prs_mutex* mutex, prs_task_id_t task_id)
+{
+    prs_mutex_word_t owner = 0;
+    return PRS_BOOL(prs_pal_atomic_compare_exchange_strong(&mutex->owner, &owner, task_id));
+}
+
+static prs_bool_t prs_mutex_spin(struct prs_mutex* mutex, prs_task_id_t task_id)
+{
+    /* The owner cannot release the mutex while we spin when there is no other core to run it */
+    if (prs_systeminfo_get()->core_count <= 1) {
+        return PRS_FALSE;
+    }
+
+    prs_bool_t acquired = PRS_FALSE;
+    prs_task_id_t spin_owner_id = PRS_OBJECT_ID_INVALID;
+    struct prs_task* spin_owner = 0;
+    const prs_cycles_t start = prs_cycles_now();
+    do {
+        const prs_mutex_word_t owner = prs_pal_atomic_load(&mutex->owner);
+        if (!owner) {
+            if (prs_mutex_try_acquire(mutex, task_id)) {
+                acquired = PRS_TRUE;
+                break;
+            }
+            continue;
+        }
+        if (owner & PRS_MUTEX_WAITERS) {
+            /* Other tasks are already waiting, get in line */
+            break;
+        }
+        if (owner != spin_owner_id) {
+            if (spin_owner) {
+                prs_god_unlock(spin_owner_id);
+            }
+            spin_owner_id = (prs_task_id_t)owner;
+            spin_owner = prs_god_lock(spin_owner_id);
+        }
+        if (!spin_owner || prs_task_get_state(spin_owner) != PRS_TASK_STATE_RUNNING) {
+            /* The owner is not making progress, so we would only waste the worker */
+            break;
+        }
+        prs_cycles_pause();
+    } while (prs_cycles_now() - start < PRS_MUTEX_SPIN_CYCLES);
+
+    if (spin_owner) {
+        prs_god_unlock(spin_owner_id);
+    }
+    return acquired;
+}
+
+/* Queues a task behind the waiters of the same or higher priority. Must be called with the lock of the mutex held. */
+static void prs_mutex_queue_waiter(struct prs_mutex* mutex, struct prs_task* task)
+{
+    struct prs_idllist_node* before = 0;
+    prs_idllist_foreach(mutex->waitq, node) {
+        struct prs_task* waiting_task = prs_idllist_get_data(mutex->waitq, node);
+        if (waiting_task->prio > task->prio) {
+            before = node;
+            break;
+        }
+    }
+    prs_idllist_insert_before(mutex->waitq, before, &task->wait_node.node);
+}
+
+/* Moves a waiting task to its place in the wait queue after its priority changed. Must be called with the lock held. */
+static void prs_mutex_requeue_waiter(struct prs_mutex* mutex, struct prs_task* task)
+{
+    prs_idllist_remove(mutex->waitq, &task->wait_node.node);
+    prs_mutex_queue_waiter(mutex, task);
+}
+
+/*
+ * Raises the priority of the owner of a mutex to the priority of a task waiting for it. When the owner is itself
+ * waiting for a mutex, it is moved ahead in the wait queue of that mutex, and the owner of that mutex is raised in turn.
+ * Must be called with the lock of the mutex held, which is released when this function returns. The lock of a single
+ * mutex is held at a time, so that walking the chain cannot deadlock with other tasks doing the same, and the walk
+ * stops at the first owner that already runs at the priority, which also ends it on deadlock cycles.
+ */
+static void prs_mutex_propagate_prio(struct prs_mutex* mutex, prs_task_prio_t prio)
+{
+    prs_mutex_id_t locked_mutex_id = PRS_OBJECT_ID_INVALID;
+    for (;;) {
+        const prs_task_id_t owner_id = (prs_task_id_t)(prs_pal_atomic_load(&mutex->owner) & PRS_MUTEX_OWNER);
+        struct prs_task* owner = prs_god_lock(owner_id);
+        prs_mutex_id_t next_mutex_id = PRS_OBJECT_ID_INVALID;
+        if (owner && prio < owner->prio) {
+            PRS_FTRACE("task %s (%u) inherits prio %u", owner->name, owner->id, prio);
+            prs_task_set_prio(owner, prio);
+            next_mutex_id = prs_pal_atomic_load(&owner->blocked_mutex_id);
+        }
+
+        prs_spinlock_unlock(mutex->lock);
+        if (locked_mutex_id) {
+            prs_god_unlock(locked_mutex_id);
+        }
+
+        struct prs_mutex* next_mutex = next_mutex_id ? prs_god_lock(next_mutex_id) : 0;
+        if (next_mutex) {
+            prs_spinlock_lock(next_mutex->lock);
+            /* The mutex may have been handed off to the owner in the meantime */
+            if (prs_pal_atomic_load(&owner->blocked_mutex_id) == next_mutex_id) {
+                prs_mutex_requeue_waiter(next_mutex, owner);
+            } else {
+                prs_spinlock_unlock(next_mutex->lock);
+                prs_god_unlock(next_mutex_id);
+                next_mutex = 0;
+            }
+        }
+
+        if (owner) {
+            prs_god_unlock(owner_id);
+        }
+        if (!next_mutex) {
+            break;
+        }
+
+        mutex = next_mutex;
+        locked_mutex_id = next_mutex_id;
+    }
+}
+
+static void prs_mutex_wait(struct prs_mutex* mutex, struct prs_task* task)
+{
+    prs_spinlock_lock(mutex->lock);
+
+    prs_mutex_word_t owner = prs_pal_atomic_load(&mutex->owner);
+    for (;;) {
+        if (!owner) {
+            /* The mutex is handed off to waiters, so it is never released while tasks are waiting */
+            PRS_ASSERT(prs_idllist_empty(mutex->waitq));
+            if (prs_mutex_try_acquire(mutex, task->id)) {
+                prs_spinlock_unlock(mutex->lock);
+                return;
+            }
+            owner = prs_pal_atomic_load(&mutex->owner);
+        } else if ((owner & PRS_MUTEX_WAITERS) ||
+            prs_pal_atomic_compare_exchange_weak(&mutex->owner, &owner, owner | PRS_MUTEX_WAITERS)) {
+            break;
+        }
+    }
+
+    /* The reference is released by the task that hands off the mutex */
+    void* object = prs_god_lock(task->id);
+    PRS_ASSERT(object == task);
+
+    task->wait_node.token = prs_task_block(task);
+    task->wait_node.queued = PRS_TRUE;
+    prs_pal_atomic_store(&task->blocked_mutex_id, mutex->id);
+    prs_mutex_queue_waiter(mutex, task);
+
+    /* The owner cannot restore its priority before it takes the lock to hand off the mutex */
+    prs_mutex_propagate_prio(mutex, task->prio);
+
+    prs_sched_schedule();
+
+    PRS_ASSERT((prs_pal_atomic_load(&mutex->owner) & PRS_MUTEX_OWNER) == task->id);
+}
+
+static void prs_mutex_handoff(struct prs_mutex* mutex)
+{
+    prs_spinlock_lock(mutex->lock);
+
+    struct prs_idllist_node* node = prs_idllist_begin(mutex->waitq);
+    PRS_ASSERT(node);
+    struct prs_task* task = prs_idllist_get_data(mutex->waitq, node);
+    prs_idllist_remove(mutex->waitq, node);
+    task->wait_node.queued = PRS_FALSE;
+    prs_pal_atomic_store(&task->blocked_mutex_id, PRS_OBJECT_ID_INVALID);
+    const prs_task_token_t token = task->wait_node.token;
+
+    struct prs_idllist_node* next_node = prs_idllist_begin(mutex->waitq);
+    if (next_node) {
+        prs_pal_atomic_store(&mutex->owner, (prs_mutex_word_t)task->id | PRS_MUTEX_WAITERS);
+        /* The new owner inherits the priority of the remaining waiters. This releases the lock of the mutex. */
+        const struct prs_task* next_task = prs_idllist_get_data(mutex->waitq, next_node);
+        prs_mutex_propagate_prio(mutex, next_task->prio);
+    } else {
+        prs_pal_atomic_store(&mutex->owner, task->id);
+        prs_spinlock_unlock(mutex->lock);
+    }
+
+    const prs_task_id_t task_id = task->id;
+    prs_task_unblock(task, token, PRS_MUTEX_EVENT_TYPE_UNLOCK);
+    prs_god_unlock(task_id);
+}
+
+static void prs_mutex_add_held(struct prs_task* task, struct prs_mutex* mutex)
+{
+    mutex->next_held = task->held_mutexes;
+    task->held_mutexes = mutex;
+    ++task->mutexes_held;
+}
+
+static void prs_mutex_remove_held(struct prs_task* task, struct prs_mutex* mutex)
+{
+    struct prs_mutex** held = &task->held_mutexes;
+    while (*held != mutex) {
+        PRS_ASSERT(*held);
+        held = &(*held)->next_held;
+    }
+    *held = mutex->next_held;
+    mutex->next_held = 0;
+    PRS_ASSERT(task->mutexes_held > 0);
+    --task->mutexes_held;
+}
+
+/*
+ * Recomputes the priority of the current task from its base priority and from the highest priority task waiting for
+ * each of the mutexes that it still holds. The locks of these mutexes are held together so that a task that starts
+ * waiting in the meantime cannot have its boost overwritten.
+ */
+static void prs_mutex_restore_prio(struct prs_task* task)
+{
+    if (task->prio == task->base_prio) {
+        return;
+    }
+
+    for (struct prs_mutex* mutex = task->held_mutexes; mutex; mutex = mutex->next_held) {
+        prs_spinlock_lock(mutex->lock);
+    }
+
+    prs_task_prio_t prio = task->base_prio;
+    for (struct prs_mutex* mutex = task->held_mutexes; mutex; mutex = mutex->next_held) {
+        struct prs_idllist_node* node = prs_idllist_begin(mutex->waitq);
+        if (node) {
+            const struct prs_task* waiting_task = prs_idllist_get_data(mutex->waitq, node);
+            if (waiting_task->prio < prio) {
+                prio = waiting_task->prio;
+            }
+        }
+    }
+    if (prio != task->prio) {
+        PRS_FTRACE("task %s (%u) returns to prio %u", task->name, task->id, prio);
+        prs_task_set_prio(task, prio);
+    }
+
+    for (struct prs_mutex* mutex = task->held_mutexes; mutex; mutex = mutex->next_held) {
+        prs_spinlock_unlock(mutex->lock);
+    }
+}
+
+/**
+ * \brief
+ *  Locks the mutex. If it is locked by another task, wait until it is handed off to the current task.
+ * \param mutex
+ *  Mutex to lock.
+ * \return
+ *  \ref PRS_OK if the mutex was locked.
+ *  \ref PRS_INVALID_STATE if the mutex was already locked by the current task.
+ */
+prs_result_t prs_mutex_lock(struct prs_mutex* mutex)
+{
+    struct prs_worker* worker = prs_worker_current();
+    PRS_ASSERT(worker);
+    struct prs_task* task = prs_worker_get_current_task(worker);
+    PRS_ASSERT(task);
+
+    if (!prs_mutex_try_acquire(mutex, task->id)) {
+        PRS_RTC_IF ((prs_pal_atomic_load(&mutex->owner) & PRS_MUTEX_OWNER) == task->id) {
+            return PRS_INVALID_STATE;
+        }
+        if (!prs_mutex_spin(mutex, task->id)) {
+            prs_mutex_wait(mutex, task);
+        }
+    }
+
+    prs_mutex_add_held(task, mutex);
+    return PRS_OK;
+}
+
+/**
+ * \brief
+ *  Locks the mutex if it is not locked.
+ * \param mutex
+ *  Mutex to lock.
+ * \return
+ *  \ref PRS_OK if the mutex was locked.
+ *  \ref PRS_LOCKED if the mutex is locked by a task.
+ */
+prs_result_t prs_mutex_try_lock(struct prs_mutex* mutex)
+{
+    struct prs_worker* worker = prs_worker_current();
+    PRS_ASSERT(worker);
+    struct prs_task* task = prs_worker_get_current_task(worker);
+    PRS_ASSERT(task);
+
+    if (!prs_mutex_try_acquire(mutex, task->id)) {
+        return PRS_LOCKED;
+    }
+
+    prs_mutex_add_held(task, mutex);
+    return PRS_OK;
+}
+
+/**
+ * \brief
+ *  Returns whether the mutex is locked by the current task.
+ * \param mutex
+ *  Mutex to check.
+ */
+prs_bool_t prs_mutex_is_owner(struct prs_mutex* mutex)
+{
+    struct prs_worker* worker = prs_worker_current();
+    PRS_ASSERT(worker);
+    struct prs_task* task = prs_worker_get_current_task(worker);
+    PRS_ASSERT(task);
+
+    return PRS_BOOL((prs_pal_atomic_load(&mutex->owner) & PRS_MUTEX_OWNER) == task->id);
+}
+
+/**
+ * \brief
+ *  Unlocks the mutex, and hands it off to the highest priority task waiting for it.
+ * \param mutex
+ *  Mutex to unlock.
+ * \return
+ *  \ref PRS_OK if the mutex was unlocked.
+ *  \ref PRS_INVALID_STATE if the mutex is not locked by the current task.
+ */
+prs_result_t prs_mutex_unlock(struct prs_mutex* mutex)
+{
+    struct prs_worker* worker = prs_worker_current();
+    PRS_ASSERT(worker);
+    struct prs_task* task = prs_worker_get_current_task(worker);
+    PRS_ASSERT(task);
+
+    prs_mutex_word_t owner = task->id;
+    if (!prs_pal_atomic_compare_exchange_strong(&mutex->owner, &owner, 0)) {
+        PRS_RTC_IF ((owner & PRS_MUTEX_OWNER) != task->id) {
+            return PRS_INVALID_STATE;
+        }
+        prs_mutex_handoff(mutex);
+    }
+
+    prs_mutex_remove_held(task, mutex);
+    prs_mutex_restore_prio(task);
+    return PRS_OK;
+}
+
+/**
+ * \brief
+ *  Moves a task that waits for a mutex to its place in the wait queue after its priority changed, and raises the
+ *  priority of the owner of the mutex to it.
+ * \param task
+ *  Task whose priority changed.
+ */
+void prs_mutex_requeue(struct prs_task* task)
+{
+    const prs_mutex_id_t mutex_id = prs_pal_atomic_load(&task->blocked_mutex_id);
+    struct prs_mutex* mutex = mutex_id ? prs_god_lock(mutex_id) : 0;
+    if (!mutex) {
+        return;
+    }
+
+    prs_spinlock_lock(mutex->lock);
+    /* The mutex may have been handed off to the task in the meantime */
+    if (prs_pal_atomic_load(&task->blocked_mutex_id) == mutex_id) {
+        prs_mutex_requeue_waiter(mutex, task);
+        prs_mutex_propagate_prio(mutex, task->prio);
+    } else {
+        prs_spinlock_unlock(mutex->lock);
+    }
+    prs_god_unlock(mutex_id);
+}
@@ -0,0 +1,48 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains the Linux futex definitions, which directly use the futex system call on process private words.
+ */
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <prs/pal/futex.h>
+#include <prs/error.h>
+
+void prs_pal_futex_wait(PRS_ATOMIC prs_uint32_t* word, prs_uint32_t value)
+{
+    const long error = syscall(SYS_futex, (void*)word, FUTEX_WAIT_PRIVATE, value, 0, 0, 0);
+    /* The word may have changed before the thread went to sleep, or a signal may have interrupted the wait */
+    PRS_ERROR_WHEN(error && errno != EAGAIN && errno != EINTR);
+}
+
+void prs_pal_futex_wake(PRS_ATOMIC prs_uint32_t* word)
+{
+    const long error = syscall(SYS_futex, (void*)word, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+    PRS_ERROR_WHEN(error < 0);
+}
@@ -35,10 +35,39 @@
 #include <prs/pal/malloc.h>
 #include <prs/pal/context.h>
 #include <prs/assert.h>
+#include <prs/config.h>
 #include <prs/error.h>
 
 #define PRS_CONTEXT_RED_ZONE_SIZE       128
 
+/*
+ * Set in uc_flags by prs_pal_context_swap when it saves a context, which is then known to only need its callee-saved
+ * registers restored. The kernel never sets this flag in the contexts it passes to signal handlers.
+ */
+#define PRS_CONTEXT_FLAG_VOLUNTARY      0x40000000UL
+/* Set in uc_flags by the Linux kernel when fpregs points to a complete XSAVE area rather than only an FXSAVE area */
+#define PRS_CONTEXT_FLAG_FP_XSTATE      0x1UL
+
+/*
+ * Software reserved bytes of the FXSAVE area, which the Linux kernel fills in signal frames to describe the XSAVE area
+ * that follows.
+ */
+#define PRS_CONTEXT_FPX_SW_BYTES_OFFSET 464
+#define PRS_CONTEXT_FP_XSTATE_MAGIC1    0x46505853U
+struct prs_pal_context_fpx_sw_bytes {
+    prs_uint32_t                        magic1;
+    prs_uint32_t                        extended_size;
+    prs_uint64_t                        xfeatures;
+    prs_uint32_t                        xstate_size;
+    prs_uint32_t                        padding[7];
+};
+
+/* The XSAVE header, containing the bitmap of the state components that are not in their initial state */
+#define PRS_CONTEXT_XSAVE_HEADER_OFFSET 512
+#define PRS_CONTEXT_XSAVE_ALIGN         64
+/* x87 and SSE state components, which are the only ones that the FXSAVE area holds */
+#define PRS_CONTEXT_XFEATURES_LEGACY    0x3ULL
+
 struct prs_pal_context {
     ucontext_t                          ucontext;
 
@@ -62,11 +91,52 @@ void prs_pal_context_free(struct prs_pal_context* context)
     prs_pal_free(context);
 }
 
+prs_size_t prs_pal_context_struct_size(void)
+{
+    return sizeof(struct prs_pal_context);
+}
+
+struct prs_pal_context* prs_pal_context_init(void* area)
+{
+    PRS_PRECONDITION(!((prs_uintptr_t)area & 0xF));
+    struct prs_pal_context* context = area;
+    context->ucontext.uc_mcontext.fpregs = &context->fpstate;
+    return context;
+}
+
 void prs_pal_context_copy(struct prs_pal_context* dst, struct prs_pal_context* src)
 {
     memcpy(&dst->ucontext, &src->ucontext, sizeof(dst->ucontext));
     memcpy(&dst->fpstate, src->ucontext.uc_mcontext.fpregs, sizeof(dst->fpstate));
     dst->ucontext.uc_mcontext.fpregs = &dst->fpstate;
+    /* Only the FXSAVE area is copied */
+    dst->ucontext.uc_flags &= ~PRS_CONTEXT_FLAG_FP_XSTATE;
+}
+
+/*
+ * Returns the size of the XSAVE area that must be kept along with a context interrupted by a signal, or zero when the
+ * FXSAVE area in struct prs_pal_context is enough. This is only the case when the interrupted code has left AVX and
+ * later state components in their initial state, so that tasks that never touch them do not pay for their size.
+ */
+static prs_size_t prs_pal_context_get_xsave_size(ucontext_t* ucontext)
+{
+    const char* fpregs = (const char*)ucontext->uc_mcontext.fpregs;
+    if (!(ucontext->uc_flags & PRS_CONTEXT_FLAG_FP_XSTATE) || !fpregs) {
+        return 0;
+    }
+
+    const struct prs_pal_context_fpx_sw_bytes* sw_bytes =
+        (const struct prs_pal_context_fpx_sw_bytes*)(fpregs + PRS_CONTEXT_FPX_SW_BYTES_OFFSET);
+    if (sw_bytes->magic1 != PRS_CONTEXT_FP_XSTATE_MAGIC1) {
+        return 0;
+    }
+
+    const prs_uint64_t xstate_bv = *(const prs_uint64_t*)(fpregs + PRS_CONTEXT_XSAVE_HEADER_OFFSET);
+    if (!(xstate_bv & ~PRS_CONTEXT_XFEATURES_LEGACY)) {
+        return 0;
+    }
+
+    return sw_bytes->xstate_size;
 }
 
 __asm__ (
@@ -124,7 +194,9 @@ static void prs_pal_context_add_internal(struct prs_pal_context* context, void (
      *      | Return address used for debugging             |       8 |
      *      +-----------------------------------------------+---------+
      *      | (optional) ucontext structure                 |       n |
-     *      | (optional) Alignment                          |     0-8 |
+     *      | (optional) Alignment                          |    0-15 |
+     *      | (optional) XSAVE area                         |       n |
+     *      | (optional) Alignment                          |    0-63 |
      *  ^   +-----------------------------------------------+---------+
      *      | (optional) Red Zone                           |     128 |
      *  ^   +-----------------------------------------------+---------+
@@ -134,6 +206,9 @@ static void prs_pal_context_add_internal(struct prs_pal_context* context, void (
      * rbp is a callee-saved register, so it is safe to use it to store the address on the stack for the context that
      * will be restored.
      *
+     * The XSAVE area is only copied when the context was interrupted with AVX or later state components in use. The
+     * copied context then points to it, and is restored with xrstor.
+     *
      */
     ucontext_t* ucontext = &context->ucontext;
 
@@ -143,14 +218,18 @@ static void prs_pal_context_add_internal(struct prs_pal_context* context, void (
     /* Find the new top of the stack */
     prs_uintptr_t sp = ucontext->uc_mcontext.gregs[REG_RSP];
 
-    prs_bool_t context_align = PRS_FALSE;
+    struct prs_pal_context* dstcontext = 0;
+    void* dstxsave = 0;
+    prs_size_t xsave_size = 0;
     if (ucontext->uc_mcontext.gregs[REG_RIP]) {
         sp -= PRS_CONTEXT_RED_ZONE_SIZE; /* Red Zone */
-        sp -= sizeof(*context);
-        context_align = PRS_BOOL(sp & 0xF);
-        if (context_align) {
-            sp -= sizeof(prs_uintptr_t);
+        xsave_size = prs_pal_context_get_xsave_size(ucontext);
+        if (xsave_size) {
+            sp = (sp - xsave_size) & ~(prs_uintptr_t)(PRS_CONTEXT_XSAVE_ALIGN - 1);
+            dstxsave = (void*)sp;
         }
+        sp = (sp - sizeof(*context)) & ~(prs_uintptr_t)0xF;
+        dstcontext = (struct prs_pal_context*)sp;
     }
 
     sp -= 2 * sizeof(prs_uintptr_t);
@@ -219,20 +298,28 @@ static void prs_pal_context_add_internal(struct prs_pal_context* context, void (
     *psp++ = (prs_uintptr_t)ucontext->uc_mcontext.gregs[REG_RBP];
     *psp++ = (prs_uintptr_t)ucontext->uc_mcontext.gregs[REG_RIP];
 
-    if (ucontext->uc_mcontext.gregs[REG_RIP]) {
+    if (dstcontext) {
+        PRS_ASSERT((struct prs_pal_context*)psp == dstcontext);
         /* Copy the context - we can't just memcpy() everything, as the context we received might be from a signal handler */
-        struct prs_pal_context* dstcontext = (struct prs_pal_context*)psp;
         memcpy(&dstcontext->ucontext, ucontext, sizeof(dstcontext->ucontext));
         dstcontext->ucontext.uc_mcontext.fpregs = &dstcontext->fpstate;
         if (ucontext->uc_mcontext.fpregs) {
             memcpy(&dstcontext->fpstate, ucontext->uc_mcontext.fpregs, sizeof(dstcontext->fpstate));
         }
-        psp += sizeof(*context) / sizeof(prs_uintptr_t);
-        psp += PRS_CONTEXT_RED_ZONE_SIZE / sizeof(prs_uintptr_t);
+        if (dstxsave) {
+            memcpy(dstxsave, ucontext->uc_mcontext.fpregs, xsave_size);
+            dstcontext->ucontext.uc_mcontext.fpregs = dstxsave;
+            dstcontext->ucontext.uc_flags |= PRS_CONTEXT_FLAG_FP_XSTATE;
+        } else {
+            dstcontext->ucontext.uc_flags &= ~PRS_CONTEXT_FLAG_FP_XSTATE;
+        }
     }
 
-    /* Final alignment */
-    PRS_ASSERT((greg_t)(psp + (context_align ? 1 : 0)) == ucontext->uc_mcontext.gregs[REG_RSP]);
+    /* The new stack frame needs its argument registers restored, so the full restore path must be used */
+    if (ucontext->uc_flags & PRS_CONTEXT_FLAG_VOLUNTARY) {
+        ucontext->uc_flags &= ~PRS_CONTEXT_FLAG_VOLUNTARY;
+        ucontext->uc_mcontext.gregs[REG_EFL] = 0;
+    }
 
     /* Set the new register values */
     ucontext->uc_mcontext.gregs[REG_RIP] = (greg_t)function;
@@ -290,8 +377,11 @@ void prs_pal_context_swap(struct prs_pal_context* save, struct prs_pal_context*
         "jz prs_pal_context_swap_restore\n"
 
         /* Save registers into the first context (save, rdi) */
-        /* It is not required to store additional registers as the caller of this function already has taken care of
-         * saving them according to the ABI. */
+        /*
+         * It is not required to store additional registers as the caller of this function already has taken care of
+         * saving them according to the ABI. This includes the flags and all of the xmm registers, which are not
+         * callee-saved in the System V ABI. Only the control bits of mxcsr must be preserved.
+         */
         "mov %%rsp, %c[rsp](%%rdi)\n"
         /*
          * Here, we cannot put the prs_pal_context_swap_return address directly in rax if we want to compile position-
@@ -307,18 +397,15 @@ void prs_pal_context_swap(struct prs_pal_context* save, struct prs_pal_context*
         "mov %%r13, %c[r13](%%rdi)\n"
         "mov %%r14, %c[r14](%%rdi)\n"
         "mov %%r15, %c[r15](%%rdi)\n"
-        "pushfq\n"
-        "pop %%rax\n"
-        "mov %%eax, %c[eflags](%%rdi)\n"
+#if defined(PRS_CONTEXT_FULL_RESTORE)
+        /* Leave the context untagged so that it goes through the full restore path, which also loads eflags */
+        "movq $0, %c[eflags](%%rdi)\n"
+#else
+        "orq %[voluntary], %c[flags](%%rdi)\n"
+#endif /* PRS_CONTEXT_FULL_RESTORE */
+        /* rdi is left pointing to the saved mxcsr, so that the restore code can tell if it must be reloaded */
         "mov %c[fpstate](%%rdi), %%rdi\n"
-        "movaps %%xmm8, %c[xmm8](%%rdi)\n"
-        "movaps %%xmm9, %c[xmm9](%%rdi)\n"
-        "movaps %%xmm10, %c[xmm10](%%rdi)\n"
-        "movaps %%xmm11, %c[xmm11](%%rdi)\n"
-        "movaps %%xmm12, %c[xmm12](%%rdi)\n"
-        "movaps %%xmm13, %c[xmm13](%%rdi)\n"
-        "movaps %%xmm14, %c[xmm14](%%rdi)\n"
-        "movaps %%xmm15, %c[xmm15](%%rdi)\n"
+        "stmxcsr %c[mxcsr](%%rdi)\n"
         :
         : [rsp] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_RSP])),
           [rip] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_RIP])),
@@ -328,16 +415,11 @@ void prs_pal_context_swap(struct prs_pal_context* save, struct prs_pal_context*
           [r13] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_R13])),
           [r14] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_R14])),
           [r15] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_R15])),
+          [flags] "e" (offsetof(ucontext_t, uc_flags)),
+          [voluntary] "e" (PRS_CONTEXT_FLAG_VOLUNTARY),
           [eflags] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_EFL])),
           [fpstate] "e" (offsetof(ucontext_t, uc_mcontext.fpregs)),
-          [xmm8] "e" (PRS_CONTEXT_XMM(8)),
-          [xmm9] "e" (PRS_CONTEXT_XMM(9)),
-          [xmm10] "e" (PRS_CONTEXT_XMM(10)),
-          [xmm11] "e" (PRS_CONTEXT_XMM(11)),
-          [xmm12] "e" (PRS_CONTEXT_XMM(12)),
-          [xmm13] "e" (PRS_CONTEXT_XMM(13)),
-          [xmm14] "e" (PRS_CONTEXT_XMM(14)),
-          [xmm15] "e" (PRS_CONTEXT_XMM(15))
+          [mxcsr] "e" (offsetof(struct _libc_fpstate, mxcsr))
         :
     );
 
@@ -348,11 +430,53 @@ void prs_pal_context_swap(struct prs_pal_context* save, struct prs_pal_context*
         "test %%rsi, %%rsi\n"
         "jz prs_pal_context_swap_return\n"
 
+        /*
+         * Contexts saved above only need their callee-saved registers restored. mxcsr is only reloaded when it differs
+         * from the one that was just saved, if any.
+         */
+        "testq %[voluntary], %c[flags](%%rsi)\n"
+        "jz prs_pal_context_swap_restore_full\n"
+        "mov %c[fpstate](%%rsi), %%rax\n"
+        "mov %c[mxcsr](%%rax), %%edx\n"
+        "test %%rdi, %%rdi\n"
+        "jz prs_pal_context_swap_restore_mxcsr\n"
+        "cmp %c[mxcsr](%%rdi), %%edx\n"
+        "je prs_pal_context_swap_restore_voluntary\n"
+        "prs_pal_context_swap_restore_mxcsr:\n"
+        "ldmxcsr %c[mxcsr](%%rax)\n"
+        "prs_pal_context_swap_restore_voluntary:\n"
+        "mov %c[rbp](%%rsi), %%rbp\n"
+        "mov %c[rbx](%%rsi), %%rbx\n"
+        "mov %c[r12](%%rsi), %%r12\n"
+        "mov %c[r13](%%rsi), %%r13\n"
+        "mov %c[r14](%%rsi), %%r14\n"
+        "mov %c[r15](%%rsi), %%r15\n"
+        /* The context might be stored on the stack: read rip before restoring rsp */
+        "mov %c[rip](%%rsi), %%rax\n"
+        "mov %c[rsp](%%rsi), %%rsp\n"
+        "jmp *%%rax\n"
+
+        "prs_pal_context_swap_restore_full:\n"
         /* Restore registers from the second context (restore, rsi) */
-        /* Because we do not know how this context was saved, we have to restore more registers than those above. */
+        /*
+         * This context was saved when the task was interrupted, or was built by prs_pal_context_make() or
+         * prs_pal_context_add(), so we have to restore more registers than those above.
+         */
         /* rip is pushed on the stack, and ret is used to jump to the restored context's last instruction. */
         /* Restore rsp only when we are done restoring because the context might be stored on the stack. */
         "mov %c[fpstate](%%rsi), %%rax\n"
+        /*
+         * When an XSAVE area was kept, xrstor restores the x87, SSE, AVX and later state components at once. Only the
+         * components that the kernel saved in the area may be requested.
+         */
+        "testq %[fp_xstate], %c[flags](%%rsi)\n"
+        "jz prs_pal_context_swap_restore_fxsave\n"
+        "mov %%rax, %%rbx\n"
+        "mov %c[xfeatures](%%rbx), %%eax\n"
+        "mov %c[xfeatures] + 4(%%rbx), %%edx\n"
+        "xrstor (%%rbx)\n"
+        "jmp prs_pal_context_swap_restore_gregs\n"
+        "prs_pal_context_swap_restore_fxsave:\n"
         "ldmxcsr %c[mxcsr](%%rax)\n"
         "movaps %c[xmm0](%%rax), %%xmm0\n"
         "movaps %c[xmm1](%%rax), %%xmm1\n"
@@ -372,7 +496,19 @@ void prs_pal_context_swap(struct prs_pal_context* save, struct prs_pal_context*
         "movaps %c[xmm15](%%rax), %%xmm15\n"
 
         :
-        : [fpstate] "e" (offsetof(ucontext_t, uc_mcontext.fpregs)),
+        : [flags] "e" (offsetof(ucontext_t, uc_flags)),
+          [voluntary] "e" (PRS_CONTEXT_FLAG_VOLUNTARY),
+          [fp_xstate] "e" (PRS_CONTEXT_FLAG_FP_XSTATE),
+          [xfeatures] "e" (PRS_CONTEXT_FPX_SW_BYTES_OFFSET + offsetof(struct prs_pal_context_fpx_sw_bytes, xfeatures)),
+          [rip] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_RIP])),
+          [rsp] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_RSP])),
+          [rbp] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_RBP])),
+          [rbx] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_RBX])),
+          [r12] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_R12])),
+          [r13] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_R13])),
+          [r14] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_R14])),
+          [r15] "e" (offsetof(ucontext_t, uc_mcontext.gregs[REG_R15])),
+          [fpstate] "e" (offsetof(ucontext_t, uc_mcontext.fpregs)),
           [mxcsr] "e" (offsetof(struct _libc_fpstate, mxcsr)),
           [xmm0] "e" (PRS_CONTEXT_XMM(0)),
           [xmm1] "e" (PRS_CONTEXT_XMM(1)),
@@ -394,6 +530,7 @@ void prs_pal_context_swap(struct prs_pal_context* save, struct prs_pal_context*
     );
 
     __asm__(
+        "prs_pal_context_swap_restore_gregs:\n"
         "mov %c[rbp](%%rsi), %%rbp\n"
         "mov %c[rdi](%%rsi), %%rdi\n"
         "mov %c[rcx](%%rsi), %%rcx\n"
@@ -470,3 +607,8 @@ void* prs_pal_context_get_ip(struct prs_pal_context* context)
 {
     return (void*)context->ucontext.uc_mcontext.gregs[REG_RIP];
 }
+
+void* prs_pal_context_get_sp(struct prs_pal_context* context)
+{
+    return (void*)context->ucontext.uc_mcontext.gregs[REG_RSP];
+}
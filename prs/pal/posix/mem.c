@@ -111,6 +111,13 @@ void prs_pal_mem_uncommit(void* ptr, prs_size_t size)
     PRS_ERROR_WHEN(error);
 }
 
+void prs_pal_mem_discard(void* ptr, prs_size_t size)
+{
+    PRS_ASSERT(ptr);
+    const int error = madvise(ptr, size, MADV_DONTNEED);
+    PRS_ERROR_WHEN(error);
+}
+
 void prs_pal_mem_lock(void* ptr, prs_size_t size)
 {
     PRS_ASSERT(ptr);
@@ -24,6 +24,9 @@
  * \file
  * \brief
  *  This file contains the POSIX programmable interrupt timer definitions.
+ *
+ *  Periodic PITs use the \p ITIMER_REAL interval timer, while one-shot PITs use a POSIX timer based on
+ *  \p CLOCK_MONOTONIC. Both deliver \p SIGALRM, which is only unblocked on the PIT thread.
  */
 
 #include <errno.h>
@@ -31,6 +34,7 @@
 #include <semaphore.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <prs/pal/atomic.h>
 #include <prs/pal/malloc.h>
@@ -55,6 +59,9 @@ struct prs_pal_pit {
     void                                (*callback)(void* userdata);
     prs_ticks_t                         period;
 
+    prs_bool_t                          one_shot;
+    timer_t                             posix_timer;
+
     prs_bool_t                          use_current_thread;
     struct prs_pal_thread*              thread;
     sem_t                               exit_sem;
@@ -86,6 +93,11 @@ static prs_result_t prs_pal_pit_init_timer(struct prs_pal_pit* pit)
         }
     }
 
+    if (pit->one_shot) {
+        /* The POSIX timer was created along with the PIT and will be armed through prs_pal_pit_arm() */
+        return PRS_OK;
+    }
+
     struct itimerval val = {
         .it_interval = {
             .tv_sec = 0,
@@ -106,18 +118,27 @@ static prs_result_t prs_pal_pit_init_timer(struct prs_pal_pit* pit)
 
 static prs_result_t prs_pal_pit_uninit_timer(struct prs_pal_pit* pit)
 {
-    struct itimerval val = {
-        .it_interval = {
-            .tv_sec = 0,
-            .tv_usec = 0
-        },
-        .it_value = {
-            .tv_sec = 0,
-            .tv_usec = 0
-        }
-    };
-
-    const int error = setitimer(ITIMER_REAL, &val, 0);
+    int error;
+    if (pit->one_shot) {
+        /* Only disarm the POSIX timer here, as it is deleted when the PIT is destroyed */
+        const struct itimerspec spec = {
+            .it_interval = { 0, 0 },
+            .it_value = { 0, 0 }
+        };
+        error = timer_settime(pit->posix_timer, 0, &spec, 0);
+    } else {
+        struct itimerval val = {
+            .it_interval = {
+                .tv_sec = 0,
+                .tv_usec = 0
+            },
+            .it_value = {
+                .tv_sec = 0,
+                .tv_usec = 0
+            }
+        };
+        error = setitimer(ITIMER_REAL, &val, 0);
+    }
     if (error) {
         return PRS_PLATFORM_ERROR;
     }
@@ -164,6 +185,7 @@ struct prs_pal_pit* prs_pal_pit_create(struct prs_pal_pit_create_params* params)
     pit->userdata = params->userdata;
     pit->callback = params->callback;
     pit->period = params->period;
+    pit->one_shot = params->one_shot;
     pit->use_current_thread = params->use_current_thread;
 
     if (!prs_pal_atomic_exchange(&s_prs_pal_pit_sigaction_done, PRS_TRUE)) {
@@ -177,6 +199,22 @@ struct prs_pal_pit* prs_pal_pit_create(struct prs_pal_pit_create_params* params)
         }
     }
 
+    if (pit->one_shot) {
+        /*
+         * The timer is created here rather than on the PIT thread so that it can be armed as soon as this function
+         * returns. Its signal stays pending until the PIT thread unblocks it.
+         */
+        struct sigevent sev = {
+            .sigev_notify = SIGEV_SIGNAL,
+            .sigev_signo = SIGALRM
+        };
+        const int error = timer_create(CLOCK_MONOTONIC, &sev, &pit->posix_timer);
+        if (error) {
+            pit->one_shot = PRS_FALSE;
+            goto cleanup;
+        }
+    }
+
     if (pit->use_current_thread) {
         s_prs_pal_pit = pit;
         const prs_result_t result = prs_pal_pit_init_timer(pit);
@@ -219,6 +257,9 @@ struct prs_pal_pit* prs_pal_pit_create(struct prs_pal_pit_create_params* params)
         if (pit->use_current_thread) {
             prs_pal_pit_uninit_timer(pit);
         }
+        if (pit->one_shot) {
+            timer_delete(pit->posix_timer);
+        }
         prs_pal_free(pit);
     }
 
@@ -234,6 +275,35 @@ void prs_pal_pit_destroy(struct prs_pal_pit* pit)
         prs_pal_thread_destroy(pit->thread);
         sem_close(&pit->exit_sem);
     }
+    if (pit->one_shot) {
+        timer_delete(pit->posix_timer);
+    }
     prs_pal_free(pit);
 }
 
+void prs_pal_pit_arm(struct prs_pal_pit* pit, prs_uint64_t expiry)
+{
+    PRS_PRECONDITION(pit->one_shot);
+
+    /* A zero it_value would disarm the timer */
+    if (!expiry) {
+        expiry = 1;
+    }
+    const struct itimerspec spec = {
+        .it_interval = { 0, 0 },
+        .it_value = {
+            .tv_sec = expiry / 1000000000,
+            .tv_nsec = expiry % 1000000000
+        }
+    };
+    const int error = timer_settime(pit->posix_timer, TIMER_ABSTIME, &spec, 0);
+    PRS_ERROR_WHEN(error);
+}
+
+prs_uint64_t prs_pal_pit_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (prs_uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
@@ -54,6 +54,17 @@ void prs_pal_context_free(struct prs_pal_context* context)
     prs_pal_free(context);
 }
 
+prs_size_t prs_pal_context_struct_size(void)
+{
+    return sizeof(struct prs_pal_context);
+}
+
+struct prs_pal_context* prs_pal_context_init(void* area)
+{
+    PRS_FATAL_WHEN((prs_uintptr_t)area & 0xF);
+    return area;
+}
+
 void prs_pal_context_copy(struct prs_pal_context* dst, struct prs_pal_context* src)
 {
     memcpy(&dst->wincontext, &src->wincontext, sizeof(dst->wincontext));
@@ -451,3 +462,8 @@ void* prs_pal_context_get_ip(struct prs_pal_context* context)
 {
     return (void*)context->wincontext.Rip;
 }
+
+void* prs_pal_context_get_sp(struct prs_pal_context* context)
+{
+    return (void*)context->wincontext.Rsp;
+}
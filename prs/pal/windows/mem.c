@@ -129,6 +129,13 @@ void prs_pal_mem_uncommit(void* ptr, prs_size_t size)
     PRS_ERROR_WHEN(!result);
 }
 
+void prs_pal_mem_discard(void* ptr, prs_size_t size)
+{
+    PRS_ASSERT(ptr);
+    const LPVOID result = VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE);
+    PRS_ERROR_WHEN(!result);
+}
+
 void prs_pal_mem_lock(void* ptr, prs_size_t size)
 {
     PRS_ASSERT(ptr);
@@ -24,6 +24,8 @@
  * \file
  * \brief
  *  This file contains the Windows programmable interrupt timer definitions.
+ *
+ *  One-shot PITs always use a timer queue timer, which can be safely re-armed from its own callback.
  */
 
 #include <windows.h>
@@ -45,6 +47,9 @@ struct prs_pal_pit {
     void                                (*callback)(void* userdata);
     prs_ticks_t                         period;
 
+    prs_bool_t                          one_shot;
+    HANDLE                              oneshot_timer;
+
 #if defined(PRS_USE_WINDOWS_MM_TIMER)
     /*
      * The multimedia timer may not be rescheduled if it takes more than the period to execute. Therefore, we use a
@@ -100,6 +105,14 @@ static VOID CALLBACK prs_pal_pit_windows_entry(PVOID lpParam, BOOLEAN TimerOfWai
 }
 #endif
 
+static VOID CALLBACK prs_pal_pit_windows_oneshot_entry(PVOID lpParam, BOOLEAN TimerOfWaitFired)
+{
+    PRS_PRECONDITION(lpParam);
+
+    struct prs_pal_pit* pit = lpParam;
+    pit->callback(pit->userdata);
+}
+
 struct prs_pal_pit* prs_pal_pit_create(struct prs_pal_pit_create_params* params)
 {
     struct prs_pal_pit* pit = prs_pal_malloc_zero(sizeof(*pit));
@@ -110,6 +123,17 @@ struct prs_pal_pit* prs_pal_pit_create(struct prs_pal_pit_create_params* params)
     pit->userdata = params->userdata;
     pit->callback = params->callback;
     pit->period = params->period;
+    pit->one_shot = params->one_shot;
+
+    if (pit->one_shot) {
+        /* Create the timer disarmed: it is armed by prs_pal_pit_arm() */
+        const BOOL success = CreateTimerQueueTimer(&pit->oneshot_timer, 0, prs_pal_pit_windows_oneshot_entry, pit,
+            INFINITE, 0, WT_EXECUTEINTIMERTHREAD);
+        PRS_ERROR_IF (!success) {
+            goto cleanup;
+        }
+        return pit;
+    }
 
 #if defined(PRS_USE_WINDOWS_MM_TIMER)
     /* Verify that the minimum period is short enough for our timer tick */
@@ -160,6 +184,12 @@ struct prs_pal_pit* prs_pal_pit_create(struct prs_pal_pit_create_params* params)
 
 void prs_pal_pit_destroy(struct prs_pal_pit* pit)
 {
+    if (pit->one_shot) {
+        DeleteTimerQueueTimer(0, pit->oneshot_timer, INVALID_HANDLE_VALUE);
+        prs_pal_free(pit);
+        return;
+    }
+
 #if defined(PRS_USE_WINDOWS_MM_TIMER)
     if (pit->wintimer_backup) {
         timeKillEvent(pit->wintimer_backup);
@@ -185,3 +215,26 @@ void prs_pal_pit_destroy(struct prs_pal_pit* pit)
     prs_pal_free(pit);
 }
 
+void prs_pal_pit_arm(struct prs_pal_pit* pit, prs_uint64_t expiry)
+{
+    PRS_PRECONDITION(pit->one_shot);
+
+    /* Timer queue timers have a millisecond resolution: round the delay up so that the timer never expires early */
+    const prs_uint64_t now = prs_pal_pit_get_time();
+    const DWORD delay = (expiry > now) ? (DWORD)((expiry - now + 999999) / 1000000) : 0;
+    const BOOL success = ChangeTimerQueueTimer(0, pit->oneshot_timer, delay, 0);
+    PRS_ERROR_WHEN(!success);
+}
+
+prs_uint64_t prs_pal_pit_get_time(void)
+{
+    static LARGE_INTEGER s_frequency;
+    if (!s_frequency.QuadPart) {
+        QueryPerformanceFrequency(&s_frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    const prs_uint64_t secs = counter.QuadPart / s_frequency.QuadPart;
+    const prs_uint64_t rem = counter.QuadPart % s_frequency.QuadPart;
+    return secs * 1000000000 + rem * 1000000000 / s_frequency.QuadPart;
+}
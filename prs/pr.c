@@ -29,22 +29,28 @@
 #include <stddef.h>
 #include <string.h>
 
+#include <prs/alloc/msgpool.h>
 #include <prs/pal/malloc.h>
 #include <prs/svc/proc.msg>
 #include <prs/assert.h>
 #include <prs/clock.h>
+#include <prs/cond.h>
 #include <prs/config.h>
 #include <prs/error.h>
+#include <prs/flags.h>
 #include <prs/god.h>
 #include <prs/init.h>
 #include <prs/log.h>
 #include <prs/msg.h>
+#include <prs/mutex.h>
 #include <prs/proc.h>
 #include <prs/rtc.h>
+#include <prs/rwlock.h>
 #include <prs/sched.h>
 #include <prs/sem.h>
 #include <prs/str.h>
 #include <prs/systeminfo.h>
+#include <prs/wait.h>
 #include <prs/worker.h>
 #include <pr.h>
 
@@ -53,7 +59,10 @@
 #define PR_INT_DISABLE()                \
     struct prs_worker* _pr_worker_current = prs_worker_current(); \
     const prs_bool_t _pr_int_disabled = (_pr_worker_current ? prs_worker_int_disable(_pr_worker_current) : PRS_FALSE);
-#define PR_INT_ENABLE()                 do { if (_pr_int_disabled) { prs_worker_int_enable(_pr_worker_current); } } while (0);
+#define PR_INT_ENABLE()                 do { if (_pr_int_disabled) { prs_worker_int_enable(prs_worker_current()); } } while (0);
+
+/* Number of messages converted at once by the batched message functions */
+#define PR_MSG_BATCH_CHUNK              32
 
 union pr_msg {
     pr_msg_id_t                         id;
@@ -75,6 +84,13 @@ static struct prs_task* pr_get_current_task(void)
     return task;
 }
 
+/* Must be called with interrupts disabled, so that the task stays on the worker that owns the pool */
+static struct prs_msgpool* pr_get_current_msgpool(void)
+{
+    struct prs_worker* worker = prs_worker_current();
+    return worker ? prs_worker_get_msgpool(worker) : 0;
+}
+
 PR_EXPORT pr_int_flag_t pr_int_disable(void)
 {
     return (pr_int_flag_t)prs_worker_int_disable(pr_get_current_worker());
@@ -85,6 +101,19 @@ PR_EXPORT void pr_int_enable(void)
     prs_worker_int_enable(pr_get_current_worker());
 }
 
+PR_EXPORT pr_safepoint_t pr_safepoint_get(void)
+{
+    /* The task's pointer to an atomic int has the same representation as the volatile one polled by the task */
+    return (pr_safepoint_t)&pr_get_current_task()->safepoint;
+}
+
+PR_EXPORT void pr_safepoint(void)
+{
+    PR_INT_DISABLE();
+    prs_worker_clear_safepoint(prs_worker_current());
+    PR_INT_ENABLE();
+}
+
 PR_EXPORT pr_ticks_t pr_ticks_get(void)
 {
     return prs_clock_get();
@@ -95,6 +124,14 @@ PR_EXPORT pr_ticks_t pr_ticks_per_second(void)
     return PRS_HZ;
 }
 
+PR_EXPORT prs_uint64_t pr_time_get_us(void)
+{
+    PR_INT_DISABLE();
+    const prs_uint64_t ns = prs_clock_get_ns();
+    PR_INT_ENABLE();
+    return ns / 1000;
+}
+
 PR_EXPORT void* pr_malloc(prs_size_t size)
 {
     PR_INT_DISABLE();
@@ -177,7 +214,7 @@ PR_EXPORT pr_result_t pr_task_set_prio(pr_task_id_t task_id, pr_task_prio_t prio
         PR_INT_ENABLE();
         return PR_NOT_FOUND;
     }
-    prs_task_set_prio(task, prio);
+    prs_task_set_base_prio(task, prio);
     prs_god_unlock(task_id);
     PR_INT_ENABLE();
     return PR_OK;
@@ -198,13 +235,70 @@ PR_EXPORT prs_size_t pr_task_get_stack_size(pr_task_id_t task_id)
     return stack_size;
 }
 
+PR_EXPORT pr_result_t pr_task_get_stack_usage(pr_task_id_t task_id, struct pr_task_stack_usage* usage)
+{
+    PR_INT_DISABLE();
+    struct prs_task* task = prs_god_lock(task_id);
+    if (!task) {
+        PRS_ERROR("Task not found");
+        PR_INT_ENABLE();
+        return PR_NOT_FOUND;
+    }
+    struct prs_task_stack_usage stack_usage;
+    prs_task_get_stack_usage(task, &stack_usage);
+    prs_god_unlock(task_id);
+    PR_INT_ENABLE();
+    usage->committed_size = stack_usage.committed_size;
+    usage->high_water = stack_usage.high_water;
+    usage->grows = stack_usage.grows;
+    return PR_OK;
+}
+
+PR_EXPORT pr_result_t pr_task_get_msgq_stats(pr_task_id_t task_id, struct pr_msgq_stats* stats)
+{
+    PR_INT_DISABLE();
+    struct prs_task* task = prs_god_lock(task_id);
+    if (!task) {
+        PR_INT_ENABLE();
+        return PR_NOT_FOUND;
+    }
+    struct prs_msgq_stats msgq_stats;
+    prs_task_get_msgq_stats(task, &msgq_stats);
+    prs_god_unlock(task_id);
+    PR_INT_ENABLE();
+    stats->depth = msgq_stats.depth;
+    stats->high_water = msgq_stats.high_water;
+    stats->capacity = msgq_stats.capacity;
+    stats->dropped = msgq_stats.dropped;
+    return PR_OK;
+}
+
+PR_EXPORT prs_uint_t pr_task_get_deadline_misses(pr_task_id_t task_id)
+{
+    PR_INT_DISABLE();
+    struct prs_task* task = prs_god_lock(task_id);
+    if (!task) {
+        PRS_ERROR("Task not found");
+        PR_INT_ENABLE();
+        return 0;
+    }
+    const prs_uint_t deadline_misses = prs_task_get_deadline_misses(task);
+    prs_god_unlock(task_id);
+    PR_INT_ENABLE();
+    return deadline_misses;
+}
+
 pr_task_id_t pr_task_create(struct pr_task_create_params* task_create_params)
 {
     struct prs_task_create_params params = {
         .userdata = task_create_params->userdata,
         .stack_size = task_create_params->stack_size,
         .prio = task_create_params->prio,
-        .entry = task_create_params->entry
+        .deadline = task_create_params->deadline,
+        .period = task_create_params->period,
+        .entry = task_create_params->entry,
+        .msgq_capacity = task_create_params->msgq_capacity,
+        .msgq_full_policy = (enum prs_msgq_full_policy)task_create_params->msgq_full_policy
     };
     prs_str_copy(params.name, task_create_params->name, sizeof(params.name));
     PR_INT_DISABLE();
@@ -218,6 +312,37 @@ pr_task_id_t pr_task_create(struct pr_task_create_params* task_create_params)
     return id;
 }
 
+prs_uint_t pr_task_create_batch(struct pr_task_create_params* task_create_params, void* const* userdata,
+    prs_uint_t count, pr_task_id_t* task_ids)
+{
+    struct prs_task_create_params params = {
+        .userdata = task_create_params->userdata,
+        .stack_size = task_create_params->stack_size,
+        .prio = task_create_params->prio,
+        .deadline = task_create_params->deadline,
+        .period = task_create_params->period,
+        .entry = task_create_params->entry,
+        .msgq_capacity = task_create_params->msgq_capacity,
+        .msgq_full_policy = (enum prs_msgq_full_policy)task_create_params->msgq_full_policy
+    };
+    prs_str_copy(params.name, task_create_params->name, sizeof(params.name));
+    prs_uint_t created = 0;
+    PR_INT_DISABLE();
+    for (; created < count; ++created) {
+        if (userdata) {
+            params.userdata = userdata[created];
+        }
+        struct prs_task* task = prs_task_create(&params);
+        if (!task) {
+            break;
+        }
+        prs_sched_add_task(task_create_params->sched_id, task->id);
+        task_ids[created] = task->id;
+    }
+    PR_INT_ENABLE();
+    return created;
+}
+
 PR_EXPORT pr_task_id_t pr_task_find(const char* name)
 {
     PR_INT_DISABLE();
@@ -232,7 +357,7 @@ PR_EXPORT union pr_msg* pr_msg_alloc(pr_msg_id_t msg_id, prs_size_t size)
 
     PR_INT_DISABLE();
 
-    struct prs_msg* pmsg = pr_malloc_global(PRS_MSG_OVERHEAD + size);
+    struct prs_msg* pmsg = prs_msgpool_alloc(pr_get_current_msgpool(), PRS_MSG_OVERHEAD + size);
     PRS_FATAL_WHEN(!pmsg);
 
     memset(&pmsg->node, 0, sizeof(pmsg->node));
@@ -250,7 +375,7 @@ PR_EXPORT union pr_msg* pr_msg_alloc(pr_msg_id_t msg_id, prs_size_t size)
 PR_EXPORT void pr_msg_free(union pr_msg* msg)
 {
     PR_INT_DISABLE();
-    pr_free_global(PRS_MSG_FROM_DATA(msg));
+    prs_msgpool_free(pr_get_current_msgpool(), PRS_MSG_FROM_DATA(msg));
     PR_INT_ENABLE();
 }
 
@@ -269,7 +394,66 @@ PR_EXPORT void pr_msg_send(pr_task_id_t task_id, union pr_msg* msg)
 
     pmsg->owner = task->id;
     pmsg->sender = pr_get_current_task()->id;
-    prs_msgq_send(task->msgq, pmsg);
+    const prs_result_t result = prs_msgq_send(task->msgq, pmsg);
+    prs_god_unlock(task_id);
+    if (result != PRS_OK) {
+        pr_msg_free(msg);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT pr_result_t pr_msg_try_send(pr_task_id_t task_id, union pr_msg* msg)
+{
+    struct prs_msg* pmsg = PRS_MSG_FROM_DATA(msg);
+    PR_INT_DISABLE();
+    struct prs_task* task = prs_god_lock(task_id);
+    if (!task) {
+        PR_INT_ENABLE();
+        return PR_NOT_FOUND;
+    }
+
+    pmsg->owner = task->id;
+    pmsg->sender = pr_get_current_task()->id;
+    const prs_result_t result = prs_msgq_try_send(task->msgq, pmsg);
+    prs_god_unlock(task_id);
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT void pr_msg_send_batch(pr_task_id_t task_id, union pr_msg* const* msgs, prs_uint_t count)
+{
+    struct prs_msg* pmsgs[PR_MSG_BATCH_CHUNK];
+    PR_INT_DISABLE();
+    struct prs_task* task = prs_god_lock(task_id);
+    if (!task) {
+        prs_log_print("pr_msg_send_batch(): task %u not found", task_id);
+        PRS_ERROR("Task not found");
+        for (prs_uint_t i = 0; i < count; ++i) {
+            pr_msg_free(msgs[i]);
+        }
+        PR_INT_ENABLE();
+        return;
+    }
+
+    const prs_task_id_t sender = pr_get_current_task()->id;
+    /* Once the receiver is signaled, its filter is cleared, so the following chunks do not signal it again */
+    for (prs_uint_t i = 0; i < count;) {
+        prs_uint_t chunk = 0;
+        for (; chunk < PR_MSG_BATCH_CHUNK && i < count; ++chunk, ++i) {
+            struct prs_msg* pmsg = PRS_MSG_FROM_DATA(msgs[i]);
+            pmsg->owner = task->id;
+            pmsg->sender = sender;
+            pmsgs[chunk] = pmsg;
+        }
+        const prs_uint_t sent = prs_msgq_send_batch(task->msgq, pmsgs, chunk);
+        if (sent < chunk) {
+            /* The queue is full and drops messages, or it was closed: free what was not sent */
+            for (prs_uint_t j = i - chunk + sent; j < count; ++j) {
+                pr_msg_free(msgs[j]);
+            }
+            break;
+        }
+    }
     prs_god_unlock(task_id);
     PR_INT_ENABLE();
 }
@@ -283,21 +467,33 @@ PR_EXPORT union pr_msg* pr_msg_recv(void)
     return (union pr_msg*)pmsg->data;
 }
 
-static prs_bool_t pr_msgq_filter_function(void* userdata, struct prs_msg* msg)
+PR_EXPORT prs_uint_t pr_msg_recv_batch(union pr_msg** msgs, prs_uint_t max_count, pr_ticks_t ticks)
 {
-    pr_msg_id_t* filter = userdata;
-    pr_msg_id_t* msg_id_ptr = (pr_msg_id_t*)msg->data;
-    const pr_msg_id_t msg_id = *msg_id_ptr; /* GCC complains if this is done in a single statement */
+    if (!max_count) {
+        return 0;
+    }
 
-    const pr_msg_id_t count = *filter;
-    PRS_ASSERT(count > 0);
-    PRS_ASSERT(count < 256);
-    for (pr_msg_id_t i = 1; i <= count; ++i) {
-        if (filter[i] == msg_id) {
-            return PRS_TRUE;
+    struct prs_task* task = pr_get_current_task();
+    PR_INT_DISABLE();
+    struct prs_msg* pmsg = (ticks == PR_TIMEOUT_INFINITE) ? prs_msgq_recv(task->msgq) :
+        prs_msgq_recv_timeout(task->msgq, ticks);
+    prs_uint_t count = 0;
+    if (pmsg) {
+        msgs[count++] = (union pr_msg*)pmsg->data;
+        struct prs_msg* pmsgs[PR_MSG_BATCH_CHUNK];
+        while (count < max_count) {
+            const prs_uint_t wanted = (max_count - count < PR_MSG_BATCH_CHUNK) ? max_count - count : PR_MSG_BATCH_CHUNK;
+            const prs_uint_t received = prs_msgq_recv_batch(task->msgq, pmsgs, wanted);
+            for (prs_uint_t i = 0; i < received; ++i) {
+                msgs[count++] = (union pr_msg*)pmsgs[i]->data;
+            }
+            if (received < wanted) {
+                break;
+            }
         }
     }
-    return PRS_FALSE;
+    PR_INT_ENABLE();
+    return count;
 }
 
 PR_EXPORT union pr_msg* pr_msg_recv_filter(pr_msg_id_t* filter)
@@ -306,7 +502,7 @@ PR_EXPORT union pr_msg* pr_msg_recv_filter(pr_msg_id_t* filter)
     PRS_KILL_TASK_WHEN(*filter > 16);
     struct prs_task* task = pr_get_current_task();
     PR_INT_DISABLE();
-    struct prs_msg* pmsg = prs_msgq_recv_filter(task->msgq, filter, (*filter + 1) * sizeof(*filter), pr_msgq_filter_function);
+    struct prs_msg* pmsg = prs_msgq_recv_ids(task->msgq, filter);
     PR_INT_ENABLE();
     return (union pr_msg*)pmsg->data;
 }
@@ -324,13 +520,41 @@ PR_EXPORT union pr_msg* pr_msg_recv_timeout(pr_ticks_t ticks)
     return msg;
 }
 
+PR_EXPORT union pr_msg* pr_msg_recv_timeout_us(int us)
+{
+    struct prs_task* task = pr_get_current_task();
+    PR_INT_DISABLE();
+    struct prs_msg* pmsg = prs_msgq_recv_timeout_ns(task->msgq, (prs_uint64_t)us * 1000);
+    union pr_msg* msg = 0;
+    if (pmsg) {
+        msg = (union pr_msg*)pmsg->data;
+    }
+    PR_INT_ENABLE();
+    return msg;
+}
+
 PR_EXPORT union pr_msg* pr_msg_recv_filter_timeout(pr_msg_id_t* filter, pr_ticks_t ticks)
 {
     PRS_KILL_TASK_WHEN(!filter);
     PRS_KILL_TASK_WHEN(*filter > 16);
     struct prs_task* task = pr_get_current_task();
     PR_INT_DISABLE();
-    struct prs_msg* pmsg = prs_msgq_recv_filter_timeout(task->msgq, filter, (*filter + 1) * sizeof(*filter), pr_msgq_filter_function, ticks);
+    struct prs_msg* pmsg = prs_msgq_recv_ids_timeout(task->msgq, filter, ticks);
+    union pr_msg* msg = 0;
+    if (pmsg) {
+        msg = (union pr_msg*)pmsg->data;
+    }
+    PR_INT_ENABLE();
+    return msg;
+}
+
+PR_EXPORT union pr_msg* pr_msg_recv_filter_timeout_us(pr_msg_id_t* filter, int us)
+{
+    PRS_KILL_TASK_WHEN(!filter);
+    PRS_KILL_TASK_WHEN(*filter > 16);
+    struct prs_task* task = pr_get_current_task();
+    PR_INT_DISABLE();
+    struct prs_msg* pmsg = prs_msgq_recv_ids_timeout_ns(task->msgq, filter, (prs_uint64_t)us * 1000);
     union pr_msg* msg = 0;
     if (pmsg) {
         msg = (union pr_msg*)pmsg->data;
@@ -393,6 +617,19 @@ PR_EXPORT pr_result_t pr_sem_wait_timeout(pr_sem_id_t sem_id, prs_ticks_t timeou
     return result;
 }
 
+PR_EXPORT pr_result_t pr_sem_wait_timeout_us(pr_sem_id_t sem_id, int us)
+{
+    PR_INT_DISABLE();
+    struct prs_sem* sem = prs_god_lock(sem_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (sem) {
+        result = prs_sem_wait_timeout_ns(sem, (prs_uint64_t)us * 1000);
+        prs_god_unlock(sem_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
 PR_EXPORT void pr_sem_signal(pr_sem_id_t sem_id)
 {
     PR_INT_DISABLE();
@@ -404,6 +641,379 @@ PR_EXPORT void pr_sem_signal(pr_sem_id_t sem_id)
     PR_INT_ENABLE();
 }
 
+PR_EXPORT pr_mutex_id_t pr_mutex_create(void)
+{
+    PR_INT_DISABLE();
+    struct prs_mutex* mutex = prs_mutex_create();
+    PR_INT_ENABLE();
+    return mutex ? *(pr_mutex_id_t*)mutex : PRS_OBJECT_ID_INVALID;
+}
+
+PR_EXPORT void pr_mutex_destroy(pr_mutex_id_t mutex_id)
+{
+    PR_INT_DISABLE();
+    struct prs_mutex* mutex = prs_god_lock(mutex_id);
+    if (mutex) {
+        prs_mutex_destroy(mutex);
+        prs_god_unlock(mutex_id);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT pr_result_t pr_mutex_lock(pr_mutex_id_t mutex_id)
+{
+    PR_INT_DISABLE();
+    struct prs_mutex* mutex = prs_god_lock(mutex_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (mutex) {
+        result = prs_mutex_lock(mutex);
+        prs_god_unlock(mutex_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_result_t pr_mutex_try_lock(pr_mutex_id_t mutex_id)
+{
+    PR_INT_DISABLE();
+    struct prs_mutex* mutex = prs_god_lock(mutex_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (mutex) {
+        result = prs_mutex_try_lock(mutex);
+        prs_god_unlock(mutex_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_result_t pr_mutex_unlock(pr_mutex_id_t mutex_id)
+{
+    PR_INT_DISABLE();
+    struct prs_mutex* mutex = prs_god_lock(mutex_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (mutex) {
+        result = prs_mutex_unlock(mutex);
+        prs_god_unlock(mutex_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_rwlock_id_t pr_rwlock_create(void)
+{
+    PR_INT_DISABLE();
+    struct prs_rwlock* rwlock = prs_rwlock_create();
+    PR_INT_ENABLE();
+    return rwlock ? *(pr_rwlock_id_t*)rwlock : PRS_OBJECT_ID_INVALID;
+}
+
+PR_EXPORT void pr_rwlock_destroy(pr_rwlock_id_t rwlock_id)
+{
+    PR_INT_DISABLE();
+    struct prs_rwlock* rwlock = prs_god_lock(rwlock_id);
+    if (rwlock) {
+        prs_rwlock_destroy(rwlock);
+        prs_god_unlock(rwlock_id);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT void pr_rwlock_read_lock(pr_rwlock_id_t rwlock_id)
+{
+    PR_INT_DISABLE();
+    struct prs_rwlock* rwlock = prs_god_lock(rwlock_id);
+    if (rwlock) {
+        prs_rwlock_read_lock(rwlock);
+        prs_god_unlock(rwlock_id);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT pr_result_t pr_rwlock_try_read_lock(pr_rwlock_id_t rwlock_id)
+{
+    PR_INT_DISABLE();
+    struct prs_rwlock* rwlock = prs_god_lock(rwlock_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (rwlock) {
+        result = prs_rwlock_try_read_lock(rwlock);
+        prs_god_unlock(rwlock_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT void pr_rwlock_read_unlock(pr_rwlock_id_t rwlock_id)
+{
+    PR_INT_DISABLE();
+    struct prs_rwlock* rwlock = prs_god_lock(rwlock_id);
+    if (rwlock) {
+        prs_rwlock_read_unlock(rwlock);
+        prs_god_unlock(rwlock_id);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT pr_result_t pr_rwlock_write_lock(pr_rwlock_id_t rwlock_id)
+{
+    PR_INT_DISABLE();
+    struct prs_rwlock* rwlock = prs_god_lock(rwlock_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (rwlock) {
+        result = prs_rwlock_write_lock(rwlock);
+        prs_god_unlock(rwlock_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_result_t pr_rwlock_try_write_lock(pr_rwlock_id_t rwlock_id)
+{
+    PR_INT_DISABLE();
+    struct prs_rwlock* rwlock = prs_god_lock(rwlock_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (rwlock) {
+        result = prs_rwlock_try_write_lock(rwlock);
+        prs_god_unlock(rwlock_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_result_t pr_rwlock_write_unlock(pr_rwlock_id_t rwlock_id)
+{
+    PR_INT_DISABLE();
+    struct prs_rwlock* rwlock = prs_god_lock(rwlock_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (rwlock) {
+        result = prs_rwlock_write_unlock(rwlock);
+        prs_god_unlock(rwlock_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_cond_id_t pr_cond_create(void)
+{
+    PR_INT_DISABLE();
+    struct prs_cond* cond = prs_cond_create();
+    PR_INT_ENABLE();
+    return cond ? *(pr_cond_id_t*)cond : PRS_OBJECT_ID_INVALID;
+}
+
+PR_EXPORT void pr_cond_destroy(pr_cond_id_t cond_id)
+{
+    PR_INT_DISABLE();
+    struct prs_cond* cond = prs_god_lock(cond_id);
+    if (cond) {
+        prs_cond_destroy(cond);
+        prs_god_unlock(cond_id);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT pr_result_t pr_cond_wait(pr_cond_id_t cond_id, pr_mutex_id_t mutex_id)
+{
+    PR_INT_DISABLE();
+    struct prs_cond* cond = prs_god_lock(cond_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (cond) {
+        struct prs_mutex* mutex = prs_god_lock(mutex_id);
+        if (mutex) {
+            result = prs_cond_wait(cond, mutex);
+            prs_god_unlock(mutex_id);
+        }
+        prs_god_unlock(cond_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_result_t pr_cond_wait_timeout(pr_cond_id_t cond_id, pr_mutex_id_t mutex_id, pr_ticks_t timeout)
+{
+    PR_INT_DISABLE();
+    struct prs_cond* cond = prs_god_lock(cond_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (cond) {
+        struct prs_mutex* mutex = prs_god_lock(mutex_id);
+        if (mutex) {
+            result = prs_cond_wait_timeout(cond, mutex, timeout);
+            prs_god_unlock(mutex_id);
+        }
+        prs_god_unlock(cond_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_result_t pr_cond_wait_timeout_us(pr_cond_id_t cond_id, pr_mutex_id_t mutex_id, int us)
+{
+    PR_INT_DISABLE();
+    struct prs_cond* cond = prs_god_lock(cond_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (cond) {
+        struct prs_mutex* mutex = prs_god_lock(mutex_id);
+        if (mutex) {
+            result = prs_cond_wait_timeout_ns(cond, mutex, (prs_uint64_t)us * 1000);
+            prs_god_unlock(mutex_id);
+        }
+        prs_god_unlock(cond_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT void pr_cond_signal(pr_cond_id_t cond_id)
+{
+    PR_INT_DISABLE();
+    struct prs_cond* cond = prs_god_lock(cond_id);
+    if (cond) {
+        prs_cond_signal(cond);
+        prs_god_unlock(cond_id);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT void pr_cond_broadcast(pr_cond_id_t cond_id)
+{
+    PR_INT_DISABLE();
+    struct prs_cond* cond = prs_god_lock(cond_id);
+    if (cond) {
+        prs_cond_broadcast(cond);
+        prs_god_unlock(cond_id);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT pr_flags_id_t pr_flags_create(pr_flags_t initial_value)
+{
+    PR_INT_DISABLE();
+    struct prs_flags* flags = prs_flags_create(initial_value);
+    PR_INT_ENABLE();
+    return flags ? *(pr_flags_id_t*)flags : PRS_OBJECT_ID_INVALID;
+}
+
+PR_EXPORT void pr_flags_destroy(pr_flags_id_t flags_id)
+{
+    PR_INT_DISABLE();
+    struct prs_flags* flags = prs_god_lock(flags_id);
+    if (flags) {
+        prs_flags_destroy(flags);
+        prs_god_unlock(flags_id);
+    }
+    PR_INT_ENABLE();
+}
+
+PR_EXPORT pr_result_t pr_flags_set(pr_flags_id_t flags_id, pr_flags_t mask)
+{
+    PR_INT_DISABLE();
+    struct prs_flags* flags = prs_god_lock(flags_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (flags) {
+        prs_flags_set(flags, mask);
+        prs_god_unlock(flags_id);
+        result = PR_OK;
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_result_t pr_flags_clear(pr_flags_id_t flags_id, pr_flags_t mask)
+{
+    PR_INT_DISABLE();
+    struct prs_flags* flags = prs_god_lock(flags_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (flags) {
+        prs_flags_clear(flags, mask);
+        prs_god_unlock(flags_id);
+        result = PR_OK;
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_flags_t pr_flags_get(pr_flags_id_t flags_id)
+{
+    PR_INT_DISABLE();
+    struct prs_flags* flags = prs_god_lock(flags_id);
+    pr_flags_t value = 0;
+    if (flags) {
+        value = prs_flags_get(flags);
+        prs_god_unlock(flags_id);
+    }
+    PR_INT_ENABLE();
+    return value;
+}
+
+PR_EXPORT pr_result_t pr_flags_wait(pr_flags_id_t flags_id, pr_flags_t mask, prs_uint32_t options, pr_ticks_t timeout,
+    pr_flags_t* value)
+{
+    PR_INT_DISABLE();
+    struct prs_flags* flags = prs_god_lock(flags_id);
+    prs_result_t result = PR_NOT_FOUND;
+    if (flags) {
+        result = (timeout == PR_TIMEOUT_INFINITE) ? prs_flags_wait(flags, mask, options, value) :
+            prs_flags_wait_timeout(flags, mask, options, timeout, value);
+        prs_god_unlock(flags_id);
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
+PR_EXPORT pr_result_t pr_wait_any(struct pr_wait_object* objects, prs_uint_t count, pr_ticks_t timeout,
+    prs_uint_t* index)
+{
+    PRS_KILL_TASK_WHEN(!objects);
+    PRS_KILL_TASK_WHEN(!index);
+    if (count == 0 || count > PRS_MAX_WAIT_OBJECTS) {
+        return PR_INVALID_STATE;
+    }
+
+    struct prs_task* task = pr_get_current_task();
+    struct prs_wait_object wait_objects[PRS_MAX_WAIT_OBJECTS];
+    prs_result_t result = PR_OK;
+    prs_uint_t msg_objects = 0;
+    PR_INT_DISABLE();
+    prs_uint_t locked;
+    for (locked = 0; locked < count; ++locked) {
+        struct prs_wait_object* wait_object = &wait_objects[locked];
+        wait_object->mask = objects[locked].mask;
+        wait_object->options = objects[locked].options;
+        wait_object->value = 0;
+        if (objects[locked].type == PR_WAIT_MSG) {
+            wait_object->type = PRS_WAIT_TYPE_MSGQ;
+            wait_object->object = task->msgq;
+            ++msg_objects;
+            continue;
+        }
+        wait_object->type = (objects[locked].type == PR_WAIT_SEM) ? PRS_WAIT_TYPE_SEM : PRS_WAIT_TYPE_FLAGS;
+        wait_object->object = prs_god_lock(objects[locked].id);
+        if (!wait_object->object) {
+            result = PR_NOT_FOUND;
+            break;
+        }
+    }
+
+    if (result == PRS_OK) {
+        /* The message queue has a single receive filter */
+        if (msg_objects > 1) {
+            result = PR_INVALID_STATE;
+        } else if (timeout == PR_TIMEOUT_INFINITE) {
+            result = prs_wait_any(wait_objects, count, index);
+        } else {
+            result = prs_wait_any_timeout(wait_objects, count, timeout, index);
+        }
+    }
+
+    for (prs_uint_t i = 0; i < locked; ++i) {
+        if (objects[i].type != PR_WAIT_MSG) {
+            objects[i].value = wait_objects[i].value;
+            prs_god_unlock(objects[i].id);
+        }
+    }
+    PR_INT_ENABLE();
+    return result;
+}
+
 PR_EXPORT void pr_yield(void)
 {
     PR_INT_DISABLE();
@@ -425,7 +1035,9 @@ PR_EXPORT void pr_sleep_ms(int ms)
 
 PR_EXPORT void pr_sleep_us(int us)
 {
-    pr_sleep_ticks(PRS_TICKS_FROM_US(us));
+    PR_INT_DISABLE();
+    prs_sched_sleep_ns((prs_uint64_t)us * 1000);
+    PR_INT_ENABLE();
 }
 
 PR_EXPORT void pr_sleep_ticks(pr_ticks_t ticks)
@@ -491,6 +1103,13 @@ PR_EXPORT void pr_system_exit(int status)
     PR_INT_ENABLE();
 }
 
+PR_EXPORT void pr_system_set_idle_spin(prs_uint64_t cycles)
+{
+    PR_INT_DISABLE();
+    prs_worker_set_idle_spin_cycles(cycles);
+    PR_INT_ENABLE();
+}
+
 PR_EXPORT struct prs_systeminfo* pr_systeminfo_get(void)
 {
     PR_INT_DISABLE();
@@ -70,7 +70,7 @@ struct prs_proc_range {
 
 struct prs_proc_data {
     struct prs_idllist*                 list;
-    struct prs_proc_range               range_table[PRS_MAX_OBJECTS];
+    struct prs_proc_range               range_table[PRS_MAX_GOD_ENTRIES];
     PRS_ATOMIC prs_proc_range_table_index_t
                                         range_table_count;
 };
@@ -100,7 +100,7 @@ static void prs_proc_range_table_add(struct prs_proc* proc)
         }
     }
     PRS_ASSERT(index >= 0);
-    PRS_FATAL_WHEN(index >= PRS_MAX_OBJECTS);
+    PRS_FATAL_WHEN(index >= PRS_MAX_GOD_ENTRIES);
 
     const prs_uintptr_t base = (prs_uintptr_t)prs_pal_proc_get_base(proc->pal_proc);
     PRS_ASSERT(base);
@@ -120,7 +120,7 @@ static void prs_proc_range_table_add(struct prs_proc* proc)
 static void prs_proc_range_table_del(struct prs_proc* proc)
 {
     const prs_proc_range_table_index_t index = proc->range_table_index;
-    PRS_FATAL_WHEN(index >= PRS_MAX_OBJECTS);
+    PRS_FATAL_WHEN(index >= PRS_MAX_GOD_ENTRIES);
 
     struct prs_proc_range* range = &s_prs_proc_data->range_table[index];
     prs_pal_atomic_store(&range->base, 0);
@@ -0,0 +1,442 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains reader-writer lock definitions.
+ *
+ *  Readers are counted in per-worker counters that sit on their own cache lines, so that readers running on different
+ *  workers do not write to the same memory. A reader increments the counter of its worker, then checks that no writer
+ *  holds or waits for the lock. A writer sets the writer word, then sums the counters to know if readers remain. Both
+ *  sides write before they read, so at least one of them sees the other. Since a task may resume on another worker,
+ *  a single counter may become negative, but the sum is always the number of readers.
+ *
+ *  Readers that find a writer, and writers that find another writer, are queued in arrival order through the wait
+ *  node embedded in their \ref prs_task. When a writer unlocks, the queued readers are all let in before the next
+ *  queued writer, which then waits for them to leave. This way, neither readers nor writers can starve.
+ */
+
+#include <stddef.h>
+
+#include <prs/pal/arch.h>
+#include <prs/pal/atomic.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/config.h>
+#include <prs/error.h>
+#include <prs/god.h>
+#include <prs/idllist.h>
+#include <prs/rtc.h>
+#include <prs/rwlock.h>
+#include <prs/sched.h>
+#include <prs/spinlock.h>
+#include <prs/worker.h>
+
+#include "task.h"
+
+#define PRS_RWLOCK_EVENT_TYPE_UNLOCK    1
+
+struct prs_rwlock_readers {
+    PRS_ATOMIC prs_int_t                count;
+    char                                padding[PRS_PAL_CACHE_LINE_SIZE - sizeof(prs_int_t)];
+};
+
+struct prs_rwlock {
+    prs_rwlock_id_t                     id;
+    /* Object ID of the task that holds or waits for the write lock, or zero */
+    PRS_ATOMIC prs_task_id_t            writer;
+
+    struct prs_spinlock*                lock;
+    struct prs_idllist*                 readq;
+    struct prs_idllist*                 writeq;
+    /* Writer that waits for the readers to leave */
+    struct prs_task*                    drain_task;
+
+    struct prs_rwlock_readers           readers[PRS_MAX_CPU];
+};
+
+static void prs_rwlock_object_destroy(void* object)
+{
+    prs_rwlock_destroy(object);
+}
+
+static void prs_rwlock_object_free(void* object)
+{
+    struct prs_rwlock* rwlock = object;
+
+    if (rwlock->readq) {
+        prs_idllist_destroy(rwlock->readq);
+    }
+    if (rwlock->writeq) {
+        prs_idllist_destroy(rwlock->writeq);
+    }
+    if (rwlock->lock) {
+        prs_spinlock_destroy(rwlock->lock);
+    }
+    prs_pal_free(rwlock);
+}
+
+static prs_int_t prs_rwlock_get_readers(struct prs_rwlock* rwlock)
+{
+    prs_int_t readers = 0;
+    for (prs_uint_t i = 0; i < PRS_MAX_CPU; ++i) {
+        readers += prs_pal_atomic_load(&rwlock->readers[i].count);
+    }
+    return readers;
+}
+
+static void prs_rwlock_object_print(void* object, void* userdata, void (*fct)(void*, const char*, ...))
+{
+    struct prs_rwlock* rwlock = object;
+
+    fct(userdata, "RWLock id=%u readers=%d writer=%u\n",
+        rwlock->id,
+        (int)prs_rwlock_get_readers(rwlock),
+        prs_pal_atomic_load(&rwlock->writer));
+}
+
+static struct prs_object_ops s_prs_rwlock_object_ops = {
+    .destroy = prs_rwlock_object_destroy,
+    .free = prs_rwlock_object_free,
+    .print = prs_rwlock_object_print
+};
+
+/**
+ * \brief
+ *  Creates a reader-writer lock.
+ */
+struct prs_rwlock* prs_rwlock_create(void)
+{
+    struct prs_rwlock* rwlock = prs_pal_malloc_zero(sizeof(*rwlock));
+    if (!rwlock) {
+        goto cleanup;
+    }
+
+    rwlock->lock = prs_spinlock_create();
+
+    struct prs_idllist_create_params idllist_params = {
+        .node_offset = offsetof(struct prs_task, wait_node.node)
+    };
+    rwlock->readq = prs_idllist_create(&idllist_params);
+    if (!rwlock->readq) {
+        goto cleanup;
+    }
+    rwlock->writeq = prs_idllist_create(&idllist_params);
+    if (!rwlock->writeq) {
+        goto cleanup;
+    }
+
+    rwlock->id = prs_god_alloc_and_lock(rwlock, &s_prs_rwlock_object_ops);
+    if (rwlock->id == PRS_OBJECT_ID_INVALID) {
+        goto cleanup;
+    }
+
+    return rwlock;
+
+cleanup:
+
+    if (rwlock) {
+        prs_rwlock_object_free(rwlock);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief
+ *  Destroys a reader-writer lock.
+ * \param rwlock
+ *  Reader-writer lock to destroy.
+ */
+void prs_rwlock_destroy(struct prs_rwlock* rwlock)
+{
+    prs_god_unlock(rwlock->id);
+}
+
+static struct prs_task* prs_rwlock_current_task(struct prs_worker** worker)
+{
+    *worker = prs_worker_current();
+    PRS_ASSERT(*worker);
+    struct prs_task* task = prs_worker_get_current_task(*worker);
+    PRS_ASSERT(task);
+    return task;
+}
+
+static PRS_ATOMIC prs_int_t* prs_rwlock_get_count(struct prs_rwlock* rwlock, struct prs_worker* worker)
+{
+    return &rwlock->readers[prs_worker_get_index(worker)].count;
+}
+
+/* Must be called with the lock held. The reference on the task is released by the task that unblocks it. */
+static void prs_rwlock_block(struct prs_idllist* waitq, struct prs_task* task)
+{
+    void* object = prs_god_lock(task->id);
+    PRS_ASSERT(object == task);
+
+    task->wait_node.token = prs_task_block(task);
+    if (waitq) {
+        task->wait_node.queued = PRS_TRUE;
+        prs_idllist_insert_before(waitq, 0, &task->wait_node.node);
+    }
+}
+
+static void prs_rwlock_unblock(struct prs_task* task)
+{
+    const prs_task_id_t task_id = task->id;
+    prs_task_unblock(task, task->wait_node.token, PRS_RWLOCK_EVENT_TYPE_UNLOCK);
+    prs_god_unlock(task_id);
+}
+
+static struct prs_task* prs_rwlock_pop(struct prs_idllist* waitq)
+{
+    struct prs_idllist_node* node = prs_idllist_begin(waitq);
+    if (!node) {
+        return 0;
+    }
+    struct prs_task* task = prs_idllist_get_data(waitq, node);
+    prs_idllist_remove(waitq, node);
+    task->wait_node.queued = PRS_FALSE;
+    return task;
+}
+
+/*
+ * Must be called with the lock held, by the writer that owns the writer word. Lets the queued readers in, and gives
+ * the writer word to the next queued writer. The readers and the writer that can proceed are unblocked before the
+ * lock is released, so that a new writer cannot take over in between.
+ */
+static void prs_rwlock_release_write(struct prs_rwlock* rwlock, struct prs_worker* worker)
+{
+    const prs_size_t readers = prs_idllist_size(rwlock->readq);
+    struct prs_task* next_writer = prs_rwlock_pop(rwlock->writeq);
+
+    if (readers) {
+        prs_pal_atomic_fetch_add(prs_rwlock_get_count(rwlock, worker), (prs_int_t)readers);
+    }
+    prs_pal_atomic_store(&rwlock->writer, next_writer ? next_writer->id : PRS_OBJECT_ID_INVALID);
+
+    struct prs_task* reader;
+    while ((reader = prs_rwlock_pop(rwlock->readq)) != 0) {
+        prs_rwlock_unblock(reader);
+    }
+
+    if (next_writer) {
+        if (readers) {
+            rwlock->drain_task = next_writer;
+        } else {
+            prs_rwlock_unblock(next_writer);
+        }
+    }
+}
+
+static void prs_rwlock_read_release(struct prs_rwlock* rwlock, struct prs_worker* worker)
+{
+    prs_pal_atomic_fetch_sub(prs_rwlock_get_count(rwlock, worker), 1);
+    if (!prs_pal_atomic_load(&rwlock->writer)) {
+        return;
+    }
+
+    /* A writer may be waiting for the last reader to leave */
+    prs_spinlock_lock(rwlock->lock);
+    struct prs_task* drain_task = rwlock->drain_task;
+    if (drain_task && prs_rwlock_get_readers(rwlock) == 0) {
+        rwlock->drain_task = 0;
+    } else {
+        drain_task = 0;
+    }
+    prs_spinlock_unlock(rwlock->lock);
+
+    if (drain_task) {
+        prs_rwlock_unblock(drain_task);
+    }
+}
+
+static prs_bool_t prs_rwlock_try_read_acquire(struct prs_rwlock* rwlock, struct prs_worker* worker)
+{
+    if (prs_pal_atomic_load(&rwlock->writer)) {
+        return PRS_FALSE;
+    }
+    prs_pal_atomic_fetch_add(prs_rwlock_get_count(rwlock, worker), 1);
+    if (prs_pal_atomic_load(&rwlock->writer)) {
+        prs_rwlock_read_release(rwlock, worker);
+        return PRS_FALSE;
+    }
+    return PRS_TRUE;
+}
+
+/**
+ * \brief
+ *  Locks the reader-writer lock for reading. If a writer holds or waits for the lock, wait until it unlocks it.
+ * \param rwlock
+ *  Reader-writer lock to lock.
+ */
+void prs_rwlock_read_lock(struct prs_rwlock* rwlock)
+{
+    struct prs_worker* worker;
+    struct prs_task* task = prs_rwlock_current_task(&worker);
+
+    if (prs_rwlock_try_read_acquire(rwlock, worker)) {
+        return;
+    }
+
+    prs_spinlock_lock(rwlock->lock);
+    if (!prs_pal_atomic_load(&rwlock->writer)) {
+        /* Writers only set the writer word with the lock held */
+        prs_pal_atomic_fetch_add(prs_rwlock_get_count(rwlock, worker), 1);
+        prs_spinlock_unlock(rwlock->lock);
+        return;
+    }
+    prs_rwlock_block(rwlock->readq, task);
+    prs_spinlock_unlock(rwlock->lock);
+
+    /* The writer counts the reader in before it unblocks it */
+    prs_sched_schedule();
+}
+
+/**
+ * \brief
+ *  Locks the reader-writer lock for reading if no writer holds or waits for it.
+ * \param rwlock
+ *  Reader-writer lock to lock.
+ * \return
+ *  \ref PRS_OK if the lock was locked for reading.
+ *  \ref PRS_LOCKED if a writer holds or waits for the lock.
+ */
+prs_result_t prs_rwlock_try_read_lock(struct prs_rwlock* rwlock)
+{
+    struct prs_worker* worker;
+    prs_rwlock_current_task(&worker);
+
+    return prs_rwlock_try_read_acquire(rwlock, worker) ? PRS_OK : PRS_LOCKED;
+}
+
+/**
+ * \brief
+ *  Unlocks the reader-writer lock that was locked for reading.
+ * \param rwlock
+ *  Reader-writer lock to unlock.
+ */
+void prs_rwlock_read_unlock(struct prs_rwlock* rwlock)
+{
+    struct prs_worker* worker;
+    prs_rwlock_current_task(&worker);
+
+    prs_rwlock_read_release(rwlock, worker);
+}
+
+/**
+ * \brief
+ *  Locks the reader-writer lock for writing. Wait until the other writers and all the readers unlock it.
+ * \param rwlock
+ *  Reader-writer lock to lock.
+ * \return
+ *  \ref PRS_OK if the lock was locked for writing.
+ *  \ref PRS_INVALID_STATE if the lock was already locked for writing by the current task.
+ */
+prs_result_t prs_rwlock_write_lock(struct prs_rwlock* rwlock)
+{
+    struct prs_worker* worker;
+    struct prs_task* task = prs_rwlock_current_task(&worker);
+
+    prs_spinlock_lock(rwlock->lock);
+    const prs_task_id_t writer = prs_pal_atomic_load(&rwlock->writer);
+    PRS_RTC_IF (writer == task->id) {
+        prs_spinlock_unlock(rwlock->lock);
+        return PRS_INVALID_STATE;
+    }
+    if (writer) {
+        /* The writer word is handed off to the task when it is unblocked */
+        prs_rwlock_block(rwlock->writeq, task);
+    } else {
+        prs_pal_atomic_store(&rwlock->writer, task->id);
+        if (prs_rwlock_get_readers(rwlock) == 0) {
+            prs_spinlock_unlock(rwlock->lock);
+            return PRS_OK;
+        }
+        /* The last reader to leave unblocks the task */
+        prs_rwlock_block(0, task);
+        rwlock->drain_task = task;
+    }
+    prs_spinlock_unlock(rwlock->lock);
+
+    prs_sched_schedule();
+
+    PRS_ASSERT(prs_pal_atomic_load(&rwlock->writer) == task->id);
+    return PRS_OK;
+}
+
+/**
+ * \brief
+ *  Locks the reader-writer lock for writing if no other task holds it.
+ * \param rwlock
+ *  Reader-writer lock to lock.
+ * \return
+ *  \ref PRS_OK if the lock was locked for writing.
+ *  \ref PRS_LOCKED if the lock is held by readers or by a writer.
+ */
+prs_result_t prs_rwlock_try_write_lock(struct prs_rwlock* rwlock)
+{
+    struct prs_worker* worker;
+    struct prs_task* task = prs_rwlock_current_task(&worker);
+
+    prs_result_t result = PRS_OK;
+    prs_spinlock_lock(rwlock->lock);
+    if (prs_pal_atomic_load(&rwlock->writer)) {
+        result = PRS_LOCKED;
+    } else {
+        prs_pal_atomic_store(&rwlock->writer, task->id);
+        if (prs_rwlock_get_readers(rwlock) != 0) {
+            /* Readers that saw the writer word in the meantime are waiting for it to be released */
+            prs_rwlock_release_write(rwlock, worker);
+            result = PRS_LOCKED;
+        }
+    }
+    prs_spinlock_unlock(rwlock->lock);
+
+    return result;
+}
+
+/**
+ * \brief
+ *  Unlocks the reader-writer lock that was locked for writing. The readers that are waiting get the lock first, then
+ *  the next writer.
+ * \param rwlock
+ *  Reader-writer lock to unlock.
+ * \return
+ *  \ref PRS_OK if the lock was unlocked.
+ *  \ref PRS_INVALID_STATE if the lock is not locked for writing by the current task.
+ */
+prs_result_t prs_rwlock_write_unlock(struct prs_rwlock* rwlock)
+{
+    struct prs_worker* worker;
+    struct prs_task* task = prs_rwlock_current_task(&worker);
+
+    prs_spinlock_lock(rwlock->lock);
+    PRS_RTC_IF (prs_pal_atomic_load(&rwlock->writer) != task->id || rwlock->drain_task == task) {
+        prs_spinlock_unlock(rwlock->lock);
+        return PRS_INVALID_STATE;
+    }
+    prs_rwlock_release_write(rwlock, worker);
+    prs_spinlock_unlock(rwlock->lock);
+
+    return PRS_OK;
+}
@@ -35,6 +35,7 @@
 
 #include <stddef.h>
 
+#include <prs/pal/atomic.h>
 #include <prs/pal/malloc.h>
 #include <prs/pal/thread.h>
 #include <prs/assert.h>
@@ -46,6 +47,7 @@
 #include <prs/name.h>
 #include <prs/object.h>
 #include <prs/sched.h>
+#include <prs/spinlock.h>
 #include <prs/str.h>
 #include <prs/timer.h>
 #include <prs/worker.h>
@@ -54,12 +56,24 @@
 
 static struct prs_name* s_prs_sched_name = 0;
 
+/*
+ * Schedulers that need their tick operation to be called on every system tick by the clock module, linked through
+ * their tick_next field. The clock only tries to lock the list, so that it never waits for a scheduler being created
+ * or destroyed.
+ */
+static struct prs_sched* s_prs_sched_tick_head = 0;
+static struct prs_spinlock* s_prs_sched_tick_lock = 0;
+
 struct prs_sched {
     prs_sched_id_t                      id;
     char                                name[PRS_MAX_SCHED_NAME];
 
     struct prs_sched_ops                ops;
 
+    /* Set while the scheduler is in the list of schedulers that are ticked */
+    prs_bool_t                          ticked;
+    struct prs_sched*                   tick_next;
+
     struct prs_sched_data               sched_data;
 };
 
@@ -92,6 +106,13 @@ static prs_bool_t prs_sched_get_next(void* userdata, struct prs_task* current_ta
     return sched->ops.get_next(sched_worker, current_task, next_task);
 }
 
+static prs_bool_t prs_sched_preempts(void* userdata, prs_task_prio_t prio)
+{
+    struct prs_sched_worker* sched_worker = userdata;
+    struct prs_sched* sched = sched_worker->sched;
+    return sched->ops.preempts ? sched->ops.preempts(&sched->sched_data, prio) : PRS_TRUE;
+}
+
 /**
  * \brief
  *  Creates a scheduler.
@@ -104,11 +125,14 @@ prs_result_t prs_sched_create(struct prs_sched_create_params* params, prs_sched_
 {
     if (!s_prs_sched_name) {
         struct prs_name_create_params name_params = {
-            .max_entries = PRS_MAX_OBJECTS * 4,
+            .max_entries = PRS_MAX_GOD_ENTRIES,
             .string_offset = offsetof(struct prs_sched, name)
         };
         s_prs_sched_name = prs_name_create(&name_params);
     }
+    if (!s_prs_sched_tick_lock) {
+        s_prs_sched_tick_lock = prs_spinlock_create();
+    }
 
     prs_result_t result = PRS_OK;
 
@@ -144,6 +168,14 @@ prs_result_t prs_sched_create(struct prs_sched_create_params* params, prs_sched_
         goto cleanup;
     }
 
+    if (sched->ops.tick && !sched->sched_data.no_tick) {
+        prs_spinlock_lock(s_prs_sched_tick_lock);
+        sched->tick_next = s_prs_sched_tick_head;
+        s_prs_sched_tick_head = sched;
+        sched->ticked = PRS_TRUE;
+        prs_spinlock_unlock(s_prs_sched_tick_lock);
+    }
+
     *id = sched->id;
 
     return result;
@@ -204,6 +236,17 @@ prs_result_t prs_sched_destroy(prs_sched_id_t id)
         return PRS_UNKNOWN;
     }
 
+    /* The clock ticks the scheduler under the lock, so once it is unlinked its workers are no longer interrupted */
+    if (sched->ticked) {
+        prs_spinlock_lock(s_prs_sched_tick_lock);
+        struct prs_sched** link = &s_prs_sched_tick_head;
+        while (*link != sched) {
+            link = &(*link)->tick_next;
+        }
+        *link = sched->tick_next;
+        prs_spinlock_unlock(s_prs_sched_tick_lock);
+    }
+
     prs_dllist_foreach(sched->sched_data.workers, node) {
         struct prs_sched_worker* sched_worker = prs_dllist_get_data(sched->sched_data.workers, node);
         prs_worker_destroy(sched_worker->worker);
@@ -233,9 +276,19 @@ prs_result_t prs_sched_start(prs_sched_id_t id)
         return PRS_UNKNOWN;
     }
 
+    /*
+     * The first worker that was added may run on the current thread, in which case starting it only returns once it
+     * stops: start the workers in the reverse order.
+     */
+    struct prs_worker* workers[PRS_MAX_CPU];
+    prs_uint_t worker_count = 0;
     prs_dllist_foreach(sched->sched_data.workers, node) {
         struct prs_sched_worker* sched_worker = prs_dllist_get_data(sched->sched_data.workers, node);
-        result = prs_worker_start(sched_worker->worker);
+        PRS_ASSERT(worker_count < PRS_MAX_CPU);
+        workers[worker_count++] = sched_worker->worker;
+    }
+    while (worker_count) {
+        result = prs_worker_start(workers[--worker_count]);
         if (result != PRS_OK) {
             goto end;
         }
@@ -276,12 +329,21 @@ prs_result_t prs_sched_add_thread(prs_sched_id_t id, struct prs_pal_thread* pal_
     }
 
     sched_worker->sched = sched;
+    sched_worker->sched_data = &sched->sched_data;
+
+    if (sched->ops.add_worker) {
+        result = sched->ops.add_worker(sched_worker);
+        if (result != PRS_OK) {
+            goto error;
+        }
+    }
 
     struct prs_worker_create_params params = {
         .pal_thread = pal_thread,
         .userdata = sched_worker,
         .ops = {
-            .get_next = prs_sched_get_next
+            .get_next = prs_sched_get_next,
+            .preempts = prs_sched_preempts
         }
     };
     prs_worker_id_t worker_id;
@@ -298,7 +360,6 @@ prs_result_t prs_sched_add_thread(prs_sched_id_t id, struct prs_pal_thread* pal_
     PRS_FATAL_WHEN(!worker);
 
     sched_worker->worker = worker;
-    sched_worker->sched_data = &sched->sched_data;
 
     goto cleanup;
 
@@ -448,6 +509,26 @@ prs_result_t prs_sched_ready(struct prs_task* task)
     return result;
 }
 
+/**
+ * \brief
+ *  Notifies the task's scheduler that its priority changed.
+ * \param task
+ *  Task that had its priority changed.
+ */
+prs_result_t prs_sched_set_prio(struct prs_task* task)
+{
+    struct prs_sched* sched = prs_god_lock(task->sched_id);
+    if (!sched) {
+        return PRS_NOT_FOUND;
+    }
+    prs_result_t result = PRS_OK;
+    if (sched->ops.set_prio) {
+        result = sched->ops.set_prio(&sched->sched_data, task);
+    }
+    prs_god_unlock(task->sched_id);
+    return result;
+}
+
 /**
  * \brief
  *  Yield the current task so that the scheduler can choose another one to execute (if need be).
@@ -472,10 +553,28 @@ void prs_sched_sleep(prs_ticks_t ticks)
     struct prs_task* task = prs_worker_get_current_task(worker);
     struct prs_event* event = prs_event_create(task, 1);
     PRS_FATAL_WHEN(!event);
-    struct prs_timer_entry* timer_entry = prs_timer_queue(prs_clock_timer(), event, 1, ticks);
+    struct prs_timer* timer = prs_worker_get_timer(worker);
+    struct prs_timer_entry* timer_entry = prs_timer_queue(timer, event, 1, ticks);
     PRS_ASSERT(timer_entry);
     prs_worker_schedule(worker);
-    prs_timer_cancel(prs_clock_timer(), timer_entry);
+    prs_timer_cancel(timer, timer_entry);
+}
+
+/**
+ * \brief
+ *  Stop the current task execution for the number of nanoseconds specified.
+ */
+void prs_sched_sleep_ns(prs_uint64_t ns)
+{
+    struct prs_worker* worker = prs_worker_current();
+    struct prs_task* task = prs_worker_get_current_task(worker);
+    struct prs_event* event = prs_event_create(task, 1);
+    PRS_FATAL_WHEN(!event);
+    struct prs_timer* timer = prs_worker_get_timer(worker);
+    struct prs_timer_entry* timer_entry = prs_timer_queue_ns(timer, event, 1, ns);
+    PRS_ASSERT(timer_entry);
+    prs_worker_schedule(worker);
+    prs_timer_cancel(timer, timer_entry);
 }
 
 /**
@@ -490,6 +589,40 @@ void prs_sched_block(void)
     prs_worker_schedule(worker);
 }
 
+/**
+ * \brief
+ *  Calls the tick operation of all the schedulers that need it.
+ * \param now
+ *  Current system tick.
+ * \return
+ *  The smallest number of ticks after which a scheduler needs its tick operation to be called again, or zero if none
+ *  of them does.
+ * \note
+ *  This function is called by the clock module at every system tick.
+ */
+prs_ticks_t prs_sched_tick(prs_ticks_t now)
+{
+    if (!s_prs_sched_tick_lock) {
+        return 0;
+    }
+    if (!prs_spinlock_try_lock(s_prs_sched_tick_lock)) {
+        /* A scheduler is being created or destroyed: try again at the next tick */
+        return 1;
+    }
+
+    prs_ticks_t next = 0;
+    for (struct prs_sched* sched = s_prs_sched_tick_head; sched; sched = sched->tick_next) {
+        const prs_ticks_t sched_next = sched->ops.tick(&sched->sched_data, now);
+        if (sched_next && (!next || sched_next < next)) {
+            next = sched_next;
+        }
+    }
+
+    prs_spinlock_unlock(s_prs_sched_tick_lock);
+
+    return next;
+}
+
 /**
  * \brief
  *  Find a scheduler by name.
@@ -0,0 +1,569 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains the definitions for a single worker earliest deadline first scheduler.
+ *
+ *  Each time a task transitions to the \ref PRS_TASK_STATE_READY state, a new job of that task is released. The
+ *  absolute deadline of the job is its release time plus the relative deadline of the task. For periodic tasks, a job
+ *  is never released before the previous release time plus the task's period: a task that is made ready earlier is
+ *  held in a release heap, ordered by release time, until the tick operation sees that its release time has come and
+ *  interrupts the worker. The ready task with the earliest
+ *  absolute deadline is always executed first, and the current task's execution is interrupted when a job with an
+ *  earlier deadline is released. Tasks without a deadline are executed only when no task with a deadline is ready.
+ *
+ *  Jobs that are still running or that complete after their deadline are counted as deadline misses in their task,
+ *  once per job.
+ *
+ *  Absolute deadlines are expressed in \ref prs_clock_get ticks and are compared so that the tick counter can safely
+ *  wrap around, as long as deadlines are less than half the tick range away.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <prs/pal/atomic.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/clock.h>
+#include <prs/config.h>
+#include <prs/dllist.h>
+#include <prs/error.h>
+#include <prs/god.h>
+#include <prs/log.h>
+#include <prs/mpsciq.h>
+#include <prs/rtc.h>
+#include <prs/task.h>
+#include <prs/ticks.h>
+#include <prs/worker.h>
+
+#include "../task.h"
+
+/* Initial number of tasks that the ready and release heaps can hold. They double each time they are full. */
+#define PRS_SCHED_EDF_HEAP_MIN_SIZE     64
+
+/* Value of heap_index when the task is in neither heap */
+#define PRS_SCHED_EDF_NOT_IN_HEAP       ((prs_uint_t)-1)
+
+/* Returns if the tick \p a is before the tick \p b, taking the wrap around of the tick counter into account */
+#define PRS_SCHED_EDF_BEFORE(a, b)      ((prs_ticks_t)((a) - (b)) > ((prs_ticks_t)-1 >> 1))
+
+struct prs_sched_task_userdata {
+    struct prs_task*                    task;
+    struct prs_mpsciq_node              ready_node;
+
+    struct prs_mpsciq_node              remove_node;
+
+    /* Release time and absolute deadline of the current job */
+    prs_ticks_t                         release;
+    prs_ticks_t                         abs_deadline;
+    /* Set when at least one job was released, so that the period can be enforced */
+    prs_bool_t                          released;
+    /* Set when the current job's deadline miss was counted */
+    prs_bool_t                          missed;
+
+    /* Index in the ready heap, or in the release heap while the job is held until its release time */
+    prs_uint_t                          heap_index;
+    prs_bool_t                          held;
+};
+
+struct prs_sched_edf_heap {
+    struct prs_sched_task_userdata**    items;
+    prs_uint_t                          size;
+    prs_uint_t                          capacity;
+    /* Returns if a must be taken out of the heap before b */
+    prs_bool_t                          (*before)(struct prs_sched_task_userdata* a, struct prs_sched_task_userdata* b);
+};
+
+struct prs_sched_edf {
+    /* Tasks that were made ready and that are not yet in the ready heap */
+    struct prs_mpsciq*                  readyq;
+    struct prs_mpsciq*                  removeq;
+
+    /*
+     * Ready tasks, ordered by absolute deadline, and tasks held until their release time, ordered by release time. Only
+     * accessed by the worker, which grows them as needed.
+     */
+    struct prs_sched_edf_heap           ready_heap;
+    struct prs_sched_edf_heap           release_heap;
+
+    /*
+     * Release time of the first held job, published by the worker for the tick operation. release_pending is false
+     * when no job is held, and is cleared by the tick operation when it interrupts the worker to release the job.
+     */
+    PRS_ATOMIC prs_bool_t               release_pending;
+    PRS_ATOMIC prs_ticks_t              next_release;
+
+    /*
+     * Absolute deadline of the task running on the worker, so that the ready operation can decide to preempt it
+     * without looking at the task itself. running_task is false while the worker is not running any task.
+     */
+    PRS_ATOMIC prs_bool_t               running_task;
+    PRS_ATOMIC prs_bool_t               running_has_deadline;
+    PRS_ATOMIC prs_ticks_t              running_deadline;
+};
+
+static prs_bool_t prs_sched_edf_earlier(struct prs_sched_task_userdata* a, struct prs_sched_task_userdata* b)
+{
+    if (!a->task->deadline) {
+        return PRS_FALSE;
+    } else if (!b->task->deadline) {
+        return PRS_TRUE;
+    } else {
+        return PRS_SCHED_EDF_BEFORE(a->abs_deadline, b->abs_deadline);
+    }
+}
+
+static prs_bool_t prs_sched_edf_released_before(struct prs_sched_task_userdata* a, struct prs_sched_task_userdata* b)
+{
+    return PRS_SCHED_EDF_BEFORE(a->release, b->release);
+}
+
+static prs_bool_t prs_sched_edf_heap_init(struct prs_sched_edf_heap* heap,
+    prs_bool_t (*before)(struct prs_sched_task_userdata* a, struct prs_sched_task_userdata* b))
+{
+    heap->items = prs_pal_malloc(sizeof(*heap->items) * PRS_SCHED_EDF_HEAP_MIN_SIZE);
+    heap->size = 0;
+    heap->capacity = PRS_SCHED_EDF_HEAP_MIN_SIZE;
+    heap->before = before;
+    return PRS_BOOL(heap->items);
+}
+
+static void prs_sched_edf_heap_set(struct prs_sched_edf_heap* heap, prs_uint_t index,
+    struct prs_sched_task_userdata* userdata)
+{
+    heap->items[index] = userdata;
+    userdata->heap_index = index;
+}
+
+static void prs_sched_edf_heap_sift_up(struct prs_sched_edf_heap* heap, prs_uint_t index)
+{
+    struct prs_sched_task_userdata* userdata = heap->items[index];
+    while (index > 0) {
+        const prs_uint_t parent = (index - 1) / 2;
+        if (!heap->before(userdata, heap->items[parent])) {
+            break;
+        }
+        prs_sched_edf_heap_set(heap, index, heap->items[parent]);
+        index = parent;
+    }
+    prs_sched_edf_heap_set(heap, index, userdata);
+}
+
+static void prs_sched_edf_heap_sift_down(struct prs_sched_edf_heap* heap, prs_uint_t index)
+{
+    struct prs_sched_task_userdata* userdata = heap->items[index];
+    for (;;) {
+        prs_uint_t child = index * 2 + 1;
+        if (child >= heap->size) {
+            break;
+        }
+        if (child + 1 < heap->size && heap->before(heap->items[child + 1], heap->items[child])) {
+            ++child;
+        }
+        if (!heap->before(heap->items[child], userdata)) {
+            break;
+        }
+        prs_sched_edf_heap_set(heap, index, heap->items[child]);
+        index = child;
+    }
+    prs_sched_edf_heap_set(heap, index, userdata);
+}
+
+static void prs_sched_edf_heap_push(struct prs_sched_edf_heap* heap, struct prs_sched_task_userdata* userdata)
+{
+    PRS_PRECONDITION(userdata->heap_index == PRS_SCHED_EDF_NOT_IN_HEAP);
+
+    if (heap->size == heap->capacity) {
+        const prs_uint_t capacity = heap->capacity * 2;
+        struct prs_sched_task_userdata** items = prs_pal_malloc(sizeof(*items) * capacity);
+        PRS_FATAL_WHEN(!items);
+        memcpy(items, heap->items, sizeof(*items) * heap->size);
+        prs_pal_free(heap->items);
+        heap->items = items;
+        heap->capacity = capacity;
+    }
+
+    const prs_uint_t index = heap->size++;
+    prs_sched_edf_heap_set(heap, index, userdata);
+    prs_sched_edf_heap_sift_up(heap, index);
+}
+
+static void prs_sched_edf_heap_remove(struct prs_sched_edf_heap* heap, struct prs_sched_task_userdata* userdata)
+{
+    const prs_uint_t index = userdata->heap_index;
+    PRS_PRECONDITION(index < heap->size && heap->items[index] == userdata);
+
+    userdata->heap_index = PRS_SCHED_EDF_NOT_IN_HEAP;
+    const prs_uint_t last = --heap->size;
+    if (index != last) {
+        struct prs_sched_task_userdata* moved = heap->items[last];
+        prs_sched_edf_heap_set(heap, index, moved);
+        prs_sched_edf_heap_sift_up(heap, index);
+        if (heap->items[index] == moved) {
+            prs_sched_edf_heap_sift_down(heap, index);
+        }
+    }
+}
+
+static void prs_sched_edf_check_deadline(struct prs_sched_task_userdata* userdata, prs_ticks_t now)
+{
+    struct prs_task* task = userdata->task;
+    if (task->deadline && !userdata->missed && PRS_SCHED_EDF_BEFORE(userdata->abs_deadline, now)) {
+        userdata->missed = PRS_TRUE;
+        prs_pal_atomic_fetch_add(&task->deadline_misses, 1);
+        PRS_FTRACE("task %s (%u) missed its deadline", task->name, task->id);
+    }
+}
+
+static prs_result_t prs_sched_edf_init(struct prs_sched_data* sched_data, void* userdata)
+{
+    prs_result_t result = PRS_OK;
+    struct prs_sched_edf* sched = prs_pal_malloc_zero(sizeof(*sched));
+    if (!sched) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    if (!prs_sched_edf_heap_init(&sched->ready_heap, prs_sched_edf_earlier) ||
+        !prs_sched_edf_heap_init(&sched->release_heap, prs_sched_edf_released_before)) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    struct prs_mpsciq_create_params readyq_params = {
+        .node_offset = offsetof(struct prs_sched_task_userdata, ready_node)
+    };
+    sched->readyq = prs_mpsciq_create(&readyq_params);
+    if (!sched->readyq) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    struct prs_mpsciq_create_params removeq_params = {
+        .node_offset = offsetof(struct prs_sched_task_userdata, remove_node)
+    };
+    sched->removeq = prs_mpsciq_create(&removeq_params);
+    PRS_FATAL_WHEN(!sched->removeq);
+
+    sched_data->userdata = sched;
+
+    return result;
+
+    cleanup:
+
+    if (sched) {
+        if (sched->release_heap.items) {
+            prs_pal_free(sched->release_heap.items);
+        }
+        if (sched->ready_heap.items) {
+            prs_pal_free(sched->ready_heap.items);
+        }
+        prs_pal_free(sched);
+    }
+
+    return result;
+}
+
+static prs_result_t prs_sched_edf_uninit(struct prs_sched_data* sched_data)
+{
+    struct prs_sched_edf* sched = sched_data->userdata;
+
+    prs_mpsciq_destroy(sched->removeq);
+    prs_mpsciq_destroy(sched->readyq);
+    prs_pal_free(sched->release_heap.items);
+    prs_pal_free(sched->ready_heap.items);
+    prs_pal_free(sched);
+
+    return PRS_OK;
+}
+
+/* Moves the held jobs whose release time has come to the ready heap, and publishes the release time of the next one */
+static void prs_sched_edf_release(struct prs_sched_edf* sched, prs_ticks_t now)
+{
+    while (sched->release_heap.size) {
+        struct prs_sched_task_userdata* userdata = sched->release_heap.items[0];
+        if (PRS_SCHED_EDF_BEFORE(now, userdata->release)) {
+            prs_pal_atomic_store(&sched->next_release, userdata->release);
+            prs_pal_atomic_store(&sched->release_pending, PRS_TRUE);
+            prs_clock_request(userdata->release - now);
+            return;
+        }
+        prs_sched_edf_heap_remove(&sched->release_heap, userdata);
+        userdata->held = PRS_FALSE;
+        prs_sched_edf_heap_push(&sched->ready_heap, userdata);
+    }
+
+    prs_pal_atomic_store(&sched->release_pending, PRS_FALSE);
+}
+
+static prs_bool_t prs_sched_edf_get_next(struct prs_sched_worker* sched_worker, struct prs_task* current_task,
+    struct prs_task** task)
+{
+    struct prs_sched_data* sched_data = sched_worker->sched_data;
+    struct prs_sched_edf* sched = sched_data->userdata;
+
+    /*
+     * While we compute the next task to schedule, the ready operation must consider that the worker is not running any
+     * task, so that a job released in the meantime always triggers another scheduling pass.
+     */
+    prs_pal_atomic_store(&sched->running_task, PRS_FALSE);
+
+    struct prs_mpsciq_node* remove_node = prs_mpsciq_begin(sched->removeq);
+    while (remove_node) {
+        struct prs_sched_task_userdata* task_userdata = prs_mpsciq_get_data(sched->removeq, remove_node);
+        struct prs_task* removed_task = task_userdata->task;
+        if (current_task == removed_task) {
+            /*
+             * We can't remove this task now, as we are running in its register context. Return now to ask the worker
+             * to change register contexts so we can safely unreference this task.
+             */
+            *task = 0;
+            PRS_FTRACE("request other stack because task %s (%u) is being deleted", current_task->name, current_task->id);
+            return PRS_FALSE;
+        }
+        /* Make sure the removed task is neither in the ready queue nor in one of the heaps */
+        if (prs_mpsciq_is_inserted(sched->readyq, &task_userdata->ready_node)) {
+            prs_mpsciq_remove(sched->readyq, &task_userdata->ready_node);
+        }
+        if (task_userdata->heap_index != PRS_SCHED_EDF_NOT_IN_HEAP) {
+            prs_sched_edf_heap_remove(task_userdata->held ? &sched->release_heap : &sched->ready_heap, task_userdata);
+        }
+
+        prs_task_change_state(removed_task, PRS_TASK_STATE_STOPPED, PRS_TASK_STATE_ZOMBIE);
+        removed_task->sched_userdata = 0;
+        prs_mpsciq_remove(sched->removeq, remove_node);
+        prs_pal_free(task_userdata);
+        prs_god_unlock(removed_task->id);
+        remove_node = prs_mpsciq_begin(sched->removeq);
+    }
+
+    const prs_ticks_t now = prs_clock_get();
+
+    struct prs_mpsciq_node* node = prs_mpsciq_begin(sched->readyq);
+    while (node) {
+        struct prs_sched_task_userdata* task_userdata = prs_mpsciq_get_data(sched->readyq, node);
+        prs_mpsciq_remove(sched->readyq, node);
+        task_userdata->held = PRS_SCHED_EDF_BEFORE(now, task_userdata->release);
+        prs_sched_edf_heap_push(task_userdata->held ? &sched->release_heap : &sched->ready_heap, task_userdata);
+        node = prs_mpsciq_begin(sched->readyq);
+    }
+
+    prs_sched_edf_release(sched, now);
+
+    prs_bool_t current_running = PRS_FALSE;
+    if (current_task) {
+        const enum prs_task_state current_task_state = prs_task_get_state(current_task);
+        if (current_task_state == PRS_TASK_STATE_RUNNING) {
+            current_running = PRS_TRUE;
+        } else if (current_task_state != PRS_TASK_STATE_STOPPED) {
+            /* The current job is complete: account for its deadline */
+            prs_sched_edf_check_deadline(current_task->sched_userdata, now);
+        }
+    }
+
+    if (!sched->ready_heap.size) {
+        *task = current_running ? current_task : 0;
+        goto end;
+    }
+
+    struct prs_sched_task_userdata* userdata = sched->ready_heap.items[0];
+
+    /*
+     * Special case when the current task is interrupted: if a job with an earlier deadline is ready, we must preempt
+     * the current task.
+     */
+    if (current_running) {
+        struct prs_sched_task_userdata* current_userdata = current_task->sched_userdata;
+        if (prs_sched_edf_earlier(userdata, current_userdata)) {
+            PRS_FTRACE("preempt task %s (%u)", current_task->name, current_task->id);
+            prs_task_change_state(current_task, PRS_TASK_STATE_RUNNING, PRS_TASK_STATE_READY);
+            prs_sched_edf_heap_push(&sched->ready_heap, current_userdata);
+        } else {
+            /* Same or later deadline - no need to switch tasks */
+            *task = current_task;
+            goto end;
+        }
+    }
+
+    prs_sched_edf_heap_remove(&sched->ready_heap, userdata);
+    struct prs_task* next_task = userdata->task;
+    prs_task_change_state(next_task, PRS_TASK_STATE_READY, PRS_TASK_STATE_RUNNING);
+    *task = next_task;
+
+    end:
+
+    if (*task) {
+        struct prs_sched_task_userdata* task_userdata = (*task)->sched_userdata;
+        prs_sched_edf_check_deadline(task_userdata, now);
+        prs_pal_atomic_store(&sched->running_deadline, task_userdata->abs_deadline);
+        prs_pal_atomic_store(&sched->running_has_deadline, !!(*task)->deadline);
+        prs_pal_atomic_store(&sched->running_task, PRS_TRUE);
+    }
+
+    PRS_POSTCONDITION(!*task || prs_task_get_state(*task) == PRS_TASK_STATE_RUNNING);
+
+    return PRS_TRUE;
+}
+
+static prs_result_t prs_sched_edf_ready(struct prs_sched_data* sched_data, struct prs_task* task)
+{
+    struct prs_sched_edf* sched = sched_data->userdata;
+    struct prs_sched_task_userdata* task_userdata = task->sched_userdata;
+
+    PRS_FTRACE("task %s (%u)", task->name, task->id);
+
+    /* Release a new job. The task is not queued yet, so the worker is not looking at its deadline. */
+    const prs_ticks_t now = prs_clock_get();
+    prs_ticks_t release = now;
+    if (task->period && task_userdata->released) {
+        const prs_ticks_t next_release = task_userdata->release + task->period;
+        if (PRS_SCHED_EDF_BEFORE(now, next_release)) {
+            release = next_release;
+        }
+    }
+    task_userdata->release = release;
+    task_userdata->released = PRS_TRUE;
+    task_userdata->abs_deadline = release + task->deadline;
+    task_userdata->missed = PRS_FALSE;
+
+    prs_mpsciq_push(sched->readyq, &task_userdata->ready_node);
+
+    /*
+     * Interrupt the worker if it is idle or if the released job has an earlier deadline than the running one. A job
+     * that is held until its release time always interrupts the worker, which must publish the new release time.
+     */
+    prs_bool_t interrupt = PRS_TRUE;
+    if (release == now && prs_pal_atomic_load(&sched->running_task)) {
+        if (!task->deadline) {
+            interrupt = PRS_FALSE;
+        } else if (prs_pal_atomic_load(&sched->running_has_deadline)) {
+            const prs_ticks_t running_deadline = prs_pal_atomic_load(&sched->running_deadline);
+            interrupt = PRS_SCHED_EDF_BEFORE(task_userdata->abs_deadline, running_deadline);
+        }
+    }
+
+    if (interrupt) {
+        prs_dllist_foreach(sched_data->workers, node) {
+            struct prs_sched_worker* sched_worker = prs_dllist_get_data(sched_data->workers, node);
+            prs_worker_interrupt(sched_worker->worker);
+            break;
+        }
+    }
+
+    return PRS_OK;
+}
+
+static prs_ticks_t prs_sched_edf_tick(struct prs_sched_data* sched_data, prs_ticks_t now)
+{
+    struct prs_sched_edf* sched = sched_data->userdata;
+
+    if (!prs_pal_atomic_load(&sched->release_pending)) {
+        return 0;
+    }
+
+    const prs_ticks_t next_release = prs_pal_atomic_load(&sched->next_release);
+    if (PRS_SCHED_EDF_BEFORE(now, next_release)) {
+        return next_release - now;
+    }
+
+    /* The worker publishes the next release time each time it schedules, so it only needs to be interrupted once */
+    prs_bool_t pending = PRS_TRUE;
+    if (prs_pal_atomic_compare_exchange_strong(&sched->release_pending, &pending, PRS_FALSE)) {
+        PRS_FTRACE("release held job");
+        prs_dllist_foreach(sched_data->workers, node) {
+            struct prs_sched_worker* sched_worker = prs_dllist_get_data(sched_data->workers, node);
+            prs_worker_interrupt(sched_worker->worker);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static prs_result_t prs_sched_edf_add(struct prs_sched_data* sched_data, struct prs_task* task)
+{
+    PRS_PRECONDITION(sched_data);
+    PRS_PRECONDITION(task);
+    PRS_PRECONDITION(!task->sched_userdata);
+
+    struct prs_sched_task_userdata* userdata = prs_pal_malloc_zero(sizeof(*userdata));
+    if (!userdata) {
+        return PRS_OUT_OF_MEMORY;
+    }
+    task->sched_userdata = userdata;
+    userdata->task = task;
+    userdata->heap_index = PRS_SCHED_EDF_NOT_IN_HEAP;
+
+    struct prs_task* god_task = prs_god_lock(task->id);
+    PRS_ASSERT(god_task == task);
+
+    prs_task_change_state(task, PRS_TASK_STATE_STOPPED, PRS_TASK_STATE_READY);
+
+    return prs_sched_edf_ready(sched_data, task);
+}
+
+static prs_result_t prs_sched_edf_remove(struct prs_sched_data* sched_data, struct prs_task* task)
+{
+    PRS_PRECONDITION(sched_data);
+    PRS_PRECONDITION(task);
+    PRS_PRECONDITION(task->sched_userdata);
+
+    PRS_FTRACE("%s (%u)", task->name, task->id);
+
+    const enum prs_task_state prev_state = prs_task_get_state(task);
+    if (prev_state != PRS_TASK_STATE_STOPPED) {
+        struct prs_sched_edf* sched = sched_data->userdata;
+        struct prs_sched_task_userdata* userdata = task->sched_userdata;
+        prs_task_change_state(task, prev_state, PRS_TASK_STATE_STOPPED);
+        prs_mpsciq_push(sched->removeq, &userdata->remove_node);
+
+        if (prev_state == PRS_TASK_STATE_RUNNING) {
+            prs_dllist_foreach(sched_data->workers, node) {
+                struct prs_sched_worker* sched_worker = prs_dllist_get_data(sched_data->workers, node);
+                const prs_task_id_t current_task_id = prs_worker_get_current_task_id(sched_worker->worker);
+                if (current_task_id == task->id) {
+                    prs_worker_interrupt(sched_worker->worker);
+                    break;
+                }
+            }
+        }
+    }
+
+    return PRS_OK;
+}
+
+struct prs_sched_ops* prs_sched_edf_ops(void)
+{
+    static struct prs_sched_ops s_sched_edf_ops = {
+        .init = prs_sched_edf_init,
+        .uninit = prs_sched_edf_uninit,
+        .add = prs_sched_edf_add,
+        .remove = prs_sched_edf_remove,
+        .get_next = prs_sched_edf_get_next,
+        .ready = prs_sched_edf_ready,
+        .tick = prs_sched_edf_tick
+    };
+    return &s_sched_edf_ops;
+}
@@ -183,6 +183,12 @@ static prs_result_t prs_sched_swcoop_ready(struct prs_sched_data* sched_data, st
     return prs_worker_signal(worker);
 }
 
+static prs_bool_t prs_sched_swcoop_preempts(struct prs_sched_data* sched_data, prs_task_prio_t prio)
+{
+    /* Running tasks are never preempted: the worker processes its timeouts when it is idle or at the next yield */
+    return PRS_FALSE;
+}
+
 static prs_result_t prs_sched_swcoop_add(struct prs_sched_data* sched_data, struct prs_task* task)
 {
     PRS_PRECONDITION(sched_data);
@@ -243,7 +249,8 @@ struct prs_sched_ops* prs_sched_swcoop_ops(void)
         .add = prs_sched_swcoop_add,
         .remove = prs_sched_swcoop_remove,
         .get_next = prs_sched_swcoop_get_next,
-        .ready = prs_sched_swcoop_ready
+        .ready = prs_sched_swcoop_ready,
+        .preempts = prs_sched_swcoop_preempts
     };
     return &s_sched_swcoop_ops;
 }
@@ -30,19 +30,31 @@
  *
  *  The scheduler supports up to \ref PRS_MAX_TASK_PRIO levels of priority. The lowest priority value has the highest
  *  priority, i.e. will be executed first when possible.
+ *
+ *  Optionally, tasks of the same priority can share a worker in a round robin fashion: when a time quantum is
+ *  specified through \ref prs_sched_swprio_params, a task that ran for the whole quantum while other tasks of its
+ *  priority are ready is interrupted by the clock and moved behind them.
+ *
+ *  When the priority of a ready task changes, e.g. when it inherits the priority of a task waiting for one of its
+ *  mutexes, the task is queued in a priority change queue. The next worker that schedules moves it to the ready queue
+ *  of its new priority.
  */
 
 #include <stddef.h>
 
+#include <prs/pal/atomic.h>
 #include <prs/pal/bitops.h>
 #include <prs/pal/malloc.h>
 #include <prs/assert.h>
+#include <prs/clock.h>
+#include <prs/config.h>
 #include <prs/dllist.h>
 #include <prs/error.h>
 #include <prs/god.h>
 #include <prs/log.h>
 #include <prs/mpsciq.h>
 #include <prs/rtc.h>
+#include <prs/sched/swprio.h>
 #include <prs/task.h>
 #include <prs/worker.h>
 
@@ -51,11 +63,37 @@
 #define prs_sched_swprio_for_each_prio(prio) \
     for (prs_task_prio_t prio = 0; prio < PRS_MAX_TASK_PRIO; ++prio)
 
+/* States of the priority change requests of a task */
+#define PRS_SCHED_SWPRIO_PRIO_IDLE      0
+#define PRS_SCHED_SWPRIO_PRIO_PENDING   1
+#define PRS_SCHED_SWPRIO_PRIO_REMOVED   2
+
 struct prs_sched_task_userdata {
     struct prs_task*                    task;
     struct prs_mpsciq_node              ready_node;
+    /* Priority of the ready queue in which ready_node was last pushed */
+    prs_task_prio_t                     ready_prio;
 
     struct prs_mpsciq_node              remove_node;
+
+    struct prs_mpsciq_node              prio_node;
+    /*
+     * Set to pending while prio_node is queued. When a task is removed with a pending priority change, the userdata is
+     * freed once the change is processed.
+     */
+    PRS_ATOMIC prs_uint_t               prio_state;
+};
+
+struct prs_sched_swprio_worker {
+    struct prs_sched_worker*            sched_worker;
+    prs_uint_t                          index;
+
+    /* Priority published in the running worker bitmaps, or PRS_MAX_TASK_PRIO when there is no task running */
+    PRS_ATOMIC prs_task_prio_t          running_prio;
+
+    /* Task that owns the current time slice, and the tick at which its time slice started */
+    struct prs_task*                    slice_task;
+    PRS_ATOMIC prs_ticks_t              slice_start;
 };
 
 struct prs_sched_swprio {
@@ -63,9 +101,27 @@ struct prs_sched_swprio {
     struct prs_mpsciq*                  readyq[PRS_MAX_TASK_PRIO];
 
     struct prs_mpsciq*                  removeq;
+    struct prs_mpsciq*                  prioq;
+
+    /*
+     * Bitmaps of the workers running a task at each priority level, so that the ready operation can find the worker
+     * running the lowest priority task without looking at the tasks themselves. The last level contains the workers
+     * that are not running any task. running_levels has a bit set for each non-empty level.
+     */
+    PRS_ATOMIC prs_uint32_t             running_workers[PRS_MAX_TASK_PRIO + 1];
+    PRS_ATOMIC prs_uint64_t             running_levels;
+
+    struct prs_sched_swprio_worker*     workers[PRS_MAX_CPU];
+    prs_uint_t                          worker_count;
+
+    /* Time slice length in ticks, or zero when time slicing is disabled */
+    prs_ticks_t                         quantum;
 };
 static prs_result_t prs_sched_swprio_init(struct prs_sched_data* sched_data, void* userdata)
 {
+    PRS_STATIC_ASSERT(PRS_MAX_CPU <= 32);
+    PRS_STATIC_ASSERT(PRS_MAX_TASK_PRIO < 64);
+
     prs_result_t result = PRS_OK;
     struct prs_sched_swprio* sched = prs_pal_malloc_zero(sizeof(*sched));
     if (!sched) {
@@ -73,6 +129,13 @@ struct prs_sched_swprio {
         goto cleanup;
     }
 
+    struct prs_sched_swprio_params* params = userdata;
+    if (params) {
+        sched->quantum = params->quantum;
+    }
+    /* The tick operation only enforces time slices */
+    sched_data->no_tick = !sched->quantum;
+
     prs_sched_swprio_for_each_prio(prio) {
         struct prs_mpsciq** readyq = &sched->readyq[prio];
 
@@ -92,6 +155,10 @@ struct prs_sched_swprio {
     sched->removeq = prs_mpsciq_create(&mpsciq_params);
     PRS_FATAL_WHEN(!sched->removeq);
 
+    mpsciq_params.node_offset = offsetof(struct prs_sched_task_userdata, prio_node);
+    sched->prioq = prs_mpsciq_create(&mpsciq_params);
+    PRS_FATAL_WHEN(!sched->prioq);
+
     sched_data->userdata = sched;
 
     return result;
@@ -115,7 +182,11 @@ static prs_result_t prs_sched_swprio_uninit(struct prs_sched_data* sched_data)
 {
     struct prs_sched_swprio* sched = sched_data->userdata;
 
+    for (prs_uint_t i = 0; i < sched->worker_count; ++i) {
+        prs_pal_free(sched->workers[i]);
+    }
     prs_mpsciq_destroy(sched->removeq);
+    prs_mpsciq_destroy(sched->prioq);
     prs_sched_swprio_for_each_prio(prio) {
         struct prs_mpsciq* readyq = sched->readyq[prio];
         if (readyq) {
@@ -127,11 +198,137 @@ static prs_result_t prs_sched_swprio_uninit(struct prs_sched_data* sched_data)
     return PRS_OK;
 }
 
+static prs_result_t prs_sched_swprio_add_worker(struct prs_sched_worker* sched_worker)
+{
+    struct prs_sched_swprio* sched = sched_worker->sched_data->userdata;
+
+    PRS_RTC_IF (sched->worker_count >= PRS_MAX_CPU) {
+        return PRS_INVALID_STATE;
+    }
+
+    struct prs_sched_swprio_worker* swprio_worker = prs_pal_malloc_zero(sizeof(*swprio_worker));
+    if (!swprio_worker) {
+        return PRS_OUT_OF_MEMORY;
+    }
+
+    swprio_worker->sched_worker = sched_worker;
+    swprio_worker->index = sched->worker_count;
+    swprio_worker->running_prio = PRS_MAX_TASK_PRIO;
+    prs_pal_atomic_fetch_or(&sched->running_workers[PRS_MAX_TASK_PRIO], ((prs_uint32_t)1 << swprio_worker->index));
+    prs_pal_atomic_fetch_or(&sched->running_levels, ((prs_uint64_t)1 << PRS_MAX_TASK_PRIO));
+
+    sched_worker->userdata = swprio_worker;
+    sched->workers[sched->worker_count++] = swprio_worker;
+
+    return PRS_OK;
+}
+
+static void prs_sched_swprio_set_running_prio(struct prs_sched_swprio* sched,
+    struct prs_sched_swprio_worker* swprio_worker, prs_task_prio_t prio)
+{
+    const prs_task_prio_t prev_prio = swprio_worker->running_prio;
+    if (prev_prio == prio) {
+        return;
+    }
+
+    /* Publish the new level before clearing the previous one so that the worker is always visible */
+    const prs_uint32_t worker_mask = ((prs_uint32_t)1 << swprio_worker->index);
+    prs_pal_atomic_fetch_or(&sched->running_workers[prio], worker_mask);
+    prs_pal_atomic_fetch_or(&sched->running_levels, ((prs_uint64_t)1 << prio));
+    prs_pal_atomic_store(&swprio_worker->running_prio, prio);
+
+    const prs_uint32_t prev_workers = prs_pal_atomic_fetch_and(&sched->running_workers[prev_prio], ~worker_mask);
+    if (prev_workers == worker_mask) {
+        const prs_uint64_t prev_level_mask = ((prs_uint64_t)1 << prev_prio);
+        prs_pal_atomic_fetch_and(&sched->running_levels, ~prev_level_mask);
+        if (prs_pal_atomic_load(&sched->running_workers[prev_prio])) {
+            prs_pal_atomic_fetch_or(&sched->running_levels, prev_level_mask);
+        }
+    }
+}
+
+static prs_bool_t prs_sched_swprio_slice_expired(struct prs_sched_swprio* sched,
+    struct prs_sched_swprio_worker* swprio_worker)
+{
+    if (!sched->quantum) {
+        return PRS_FALSE;
+    }
+    const prs_ticks_t elapsed = prs_clock_get() - prs_pal_atomic_load(&swprio_worker->slice_start);
+    return (elapsed >= sched->quantum);
+}
+
+static void prs_sched_swprio_push_ready(struct prs_sched_swprio* sched, struct prs_sched_task_userdata* task_userdata,
+    prs_task_prio_t prio)
+{
+    task_userdata->ready_prio = prio;
+    prs_mpsciq_push(sched->readyq[prio], &task_userdata->ready_node);
+    prs_pal_atomic_fetch_or(&sched->ready_mask, (1 << prio));
+}
+
+static void prs_sched_swprio_remove_ready(struct prs_sched_swprio* sched, struct prs_sched_task_userdata* task_userdata)
+{
+    const prs_task_prio_t prio = task_userdata->ready_prio;
+    struct prs_mpsciq* readyq = sched->readyq[prio];
+    prs_mpsciq_remove(readyq, &task_userdata->ready_node);
+    if (!prs_mpsciq_begin(readyq)) {
+        prs_pal_atomic_fetch_and(&sched->ready_mask, ~(1 << prio));
+        if (prs_mpsciq_begin(readyq)) {
+            prs_pal_atomic_fetch_or(&sched->ready_mask, (1 << prio));
+        }
+    }
+}
+
+static void prs_sched_swprio_preempt_lowest(struct prs_sched_swprio* sched, prs_task_prio_t prio)
+{
+    /* Find the worker running the lowest priority task */
+    const prs_uint64_t running_levels = prs_pal_atomic_load(&sched->running_levels);
+    if (running_levels) {
+        const prs_task_prio_t lowest_prio = prs_bitops_hsb_uint64(running_levels);
+        if (prio < lowest_prio) {
+            const prs_uint32_t running_workers = prs_pal_atomic_load(&sched->running_workers[lowest_prio]);
+            if (running_workers) {
+                struct prs_sched_swprio_worker* lowest_worker = sched->workers[prs_bitops_lsb_uint32(running_workers)];
+                prs_worker_interrupt(lowest_worker->sched_worker->worker);
+            }
+        }
+    }
+}
+
+static void prs_sched_swprio_process_prio_changes(struct prs_sched_swprio* sched)
+{
+    struct prs_mpsciq_node* prio_node = prs_mpsciq_begin(sched->prioq);
+    while (prio_node) {
+        struct prs_sched_task_userdata* task_userdata = prs_mpsciq_get_data(sched->prioq, prio_node);
+        prs_mpsciq_remove(sched->prioq, prio_node);
+        prs_uint_t prio_state = PRS_SCHED_SWPRIO_PRIO_PENDING;
+        if (!prs_pal_atomic_compare_exchange_strong(&task_userdata->prio_state, &prio_state,
+            PRS_SCHED_SWPRIO_PRIO_IDLE)) {
+            PRS_ASSERT(prio_state == PRS_SCHED_SWPRIO_PRIO_REMOVED);
+            prs_pal_free(task_userdata);
+        } else {
+            const prs_task_prio_t prio = task_userdata->task->prio;
+            if (prio != task_userdata->ready_prio &&
+                prs_mpsciq_is_inserted(sched->readyq[task_userdata->ready_prio], &task_userdata->ready_node)) {
+                prs_sched_swprio_remove_ready(sched, task_userdata);
+                prs_sched_swprio_push_ready(sched, task_userdata, prio);
+            }
+        }
+        prio_node = prs_mpsciq_begin(sched->prioq);
+    }
+}
+
 static prs_bool_t prs_sched_swprio_get_next(struct prs_sched_worker* sched_worker, struct prs_task* current_task,
     struct prs_task** task)
 {
     struct prs_sched_data* sched_data = sched_worker->sched_data;
     struct prs_sched_swprio* sched = sched_data->userdata;
+    struct prs_sched_swprio_worker* swprio_worker = sched_worker->userdata;
+
+    /*
+     * While we compute the next task to schedule, other workers must consider that this worker is not running any
+     * task. Otherwise, they would not be able to know the actual priority level of the current task.
+     */
+    prs_sched_swprio_set_running_prio(sched, swprio_worker, PRS_MAX_TASK_PRIO);
 
     struct prs_mpsciq_node* remove_node = prs_mpsciq_begin(sched->removeq);
     while (remove_node) {
@@ -147,25 +344,24 @@ static prs_bool_t prs_sched_swprio_get_next(struct prs_sched_worker* sched_worke
             return PRS_FALSE;
         }
         /* Make sure the removed task is not in a ready queue */
-        struct prs_mpsciq* readyq = sched->readyq[removed_task->prio];
-        if (prs_mpsciq_is_inserted(readyq, &task_userdata->ready_node)) {
-            prs_mpsciq_remove(readyq, &task_userdata->ready_node);
-            if (!prs_mpsciq_begin(readyq)) {
-                prs_pal_atomic_fetch_and(&sched->ready_mask, ~(1 << removed_task->prio));
-                if (prs_mpsciq_begin(readyq)) {
-                    prs_pal_atomic_fetch_or(&sched->ready_mask, (1 << removed_task->prio));
-                }
-            }
+        if (prs_mpsciq_is_inserted(sched->readyq[task_userdata->ready_prio], &task_userdata->ready_node)) {
+            prs_sched_swprio_remove_ready(sched, task_userdata);
         }
 
         prs_task_change_state(removed_task, PRS_TASK_STATE_STOPPED, PRS_TASK_STATE_ZOMBIE);
         removed_task->sched_userdata = 0;
         prs_mpsciq_remove(sched->removeq, remove_node);
-        prs_pal_free(task_userdata);
+        const prs_uint_t prio_state =
+            prs_pal_atomic_exchange(&task_userdata->prio_state, PRS_SCHED_SWPRIO_PRIO_REMOVED);
+        if (prio_state != PRS_SCHED_SWPRIO_PRIO_PENDING) {
+            prs_pal_free(task_userdata);
+        }
         prs_god_unlock(removed_task->id);
         remove_node = prs_mpsciq_begin(sched->removeq);
     }
 
+    prs_sched_swprio_process_prio_changes(sched);
+
     prs_task_prio_t next_prio = PRS_MAX_TASK_PRIO;
     struct prs_mpsciq_node* node = 0;
     struct prs_mpsciq* readyq = 0;
@@ -200,17 +396,18 @@ static prs_bool_t prs_sched_swprio_get_next(struct prs_sched_worker* sched_worke
     }
 
     /*
-     * Special case when the current task is interrupted: if another task with a higher priority is ready, we must
-     * preempt the current task.
+     * Special case when the current task is interrupted: if another task with a higher priority is ready, or if the
+     * current task's time slice expired while another task with the same priority is ready, we must preempt the
+     * current task.
      */
     if (current_task) {
         const enum prs_task_state current_task_state = prs_task_get_state(current_task);
         if (current_task_state == PRS_TASK_STATE_RUNNING) {
-            if (current_task->prio > next_prio) {
+            if (current_task->prio > next_prio ||
+                (current_task->prio == next_prio && prs_sched_swprio_slice_expired(sched, swprio_worker))) {
                 struct prs_sched_task_userdata* task_userdata = current_task->sched_userdata;
                 PRS_FTRACE("preempt task %s (%u)", current_task->name, current_task->id);
-                prs_mpsciq_push(sched->readyq[current_task->prio], &task_userdata->ready_node);
-                prs_pal_atomic_fetch_or(&sched->ready_mask, (1 << current_task->prio));
+                prs_sched_swprio_push_ready(sched, task_userdata, current_task->prio);
                 prs_task_change_state(current_task, current_task_state, PRS_TASK_STATE_READY);
             } else {
                 /* Same priority - no need to switch tasks yet */
@@ -230,6 +427,19 @@ static prs_bool_t prs_sched_swprio_get_next(struct prs_sched_worker* sched_worke
 
     end:
 
+    if (*task) {
+        if (*task != swprio_worker->slice_task) {
+            swprio_worker->slice_task = *task;
+            prs_pal_atomic_store(&swprio_worker->slice_start, prs_clock_get());
+            if (sched->quantum) {
+                prs_clock_request(sched->quantum);
+            }
+        }
+        prs_sched_swprio_set_running_prio(sched, swprio_worker, (*task)->prio);
+    } else {
+        swprio_worker->slice_task = 0;
+    }
+
     PRS_POSTCONDITION(!*task || prs_task_get_state(*task) == PRS_TASK_STATE_RUNNING);
 
     return PRS_TRUE;
@@ -242,29 +452,45 @@ static prs_result_t prs_sched_swprio_ready(struct prs_sched_data* sched_data, st
 
     PRS_FTRACE("task %s (%u)", task->name, task->id);
 
-    prs_mpsciq_push(sched->readyq[task->prio], &task_userdata->ready_node);
-    prs_pal_atomic_fetch_or(&sched->ready_mask, (1 << task->prio));
-
-    struct prs_worker* lowest_worker = 0;
-    prs_task_prio_t lowest_prio = 0;
-    prs_dllist_foreach(sched_data->workers, node) {
-        struct prs_sched_worker* sched_worker = prs_dllist_get_data(sched_data->workers, node);
-        const prs_task_id_t current_task_id = prs_worker_get_current_task_id(sched_worker->worker);
-        struct prs_task* current_task = 0;
-        if (current_task_id != PRS_OBJECT_ID_INVALID) {
-            current_task = prs_god_lock(current_task_id);
-        }
-        if (!current_task || current_task->prio > lowest_prio) {
-            lowest_prio = (current_task ? current_task->prio : PRS_MAX_TASK_PRIO);
-            lowest_worker = sched_worker->worker;
-        }
-        if (current_task) {
-            prs_god_unlock(current_task_id);
-        }
+    const prs_task_prio_t prio = task->prio;
+    prs_sched_swprio_push_ready(sched, task_userdata, prio);
+    prs_sched_swprio_preempt_lowest(sched, prio);
+
+    return PRS_OK;
+}
+
+static prs_result_t prs_sched_swprio_set_prio(struct prs_sched_data* sched_data, struct prs_task* task)
+{
+    struct prs_sched_swprio* sched = sched_data->userdata;
+    struct prs_sched_task_userdata* task_userdata = task->sched_userdata;
+    PRS_RTC_IF (!task_userdata) {
+        return PRS_INVALID_STATE;
     }
 
-    if (lowest_worker && task->prio < lowest_prio) {
-        prs_worker_interrupt(lowest_worker);
+    const prs_task_prio_t prio = task->prio;
+    PRS_RTC_IF (prio >= PRS_MAX_TASK_PRIO) {
+        return PRS_INVALID_STATE;
+    }
+    PRS_FTRACE("task %s (%u) prio %u", task->name, task->id, prio);
+
+    const enum prs_task_state state = prs_task_get_state(task);
+    if (state == PRS_TASK_STATE_RUNNING) {
+        /* The worker running the task publishes its new priority when it schedules */
+        prs_dllist_foreach(sched_data->workers, node) {
+            struct prs_sched_worker* sched_worker = prs_dllist_get_data(sched_data->workers, node);
+            if (prs_worker_get_current_task_id(sched_worker->worker) == task->id) {
+                prs_worker_interrupt(sched_worker->worker);
+                break;
+            }
+        }
+    } else if (state == PRS_TASK_STATE_READY) {
+        /* Only the scheduling workers can move the task between the ready queues */
+        prs_uint_t prio_state = PRS_SCHED_SWPRIO_PRIO_IDLE;
+        if (prs_pal_atomic_compare_exchange_strong(&task_userdata->prio_state, &prio_state,
+            PRS_SCHED_SWPRIO_PRIO_PENDING)) {
+            prs_mpsciq_push(sched->prioq, &task_userdata->prio_node);
+        }
+        prs_sched_swprio_preempt_lowest(sched, prio);
     }
 
     return PRS_OK;
@@ -322,15 +548,63 @@ static prs_result_t prs_sched_swprio_remove(struct prs_sched_data* sched_data, s
     return PRS_OK;
 }
 
+static prs_bool_t prs_sched_swprio_preempts(struct prs_sched_data* sched_data, prs_task_prio_t prio)
+{
+    struct prs_sched_swprio* sched = sched_data->userdata;
+
+    /* Same test as prs_sched_swprio_preempt_lowest(), where the workers without a task are on the last level */
+    const prs_uint64_t running_levels = prs_pal_atomic_load(&sched->running_levels);
+    return PRS_BOOL(!running_levels || prio < prs_bitops_hsb_uint64(running_levels));
+}
+
+static prs_ticks_t prs_sched_swprio_tick(struct prs_sched_data* sched_data, prs_ticks_t now)
+{
+    struct prs_sched_swprio* sched = sched_data->userdata;
+    if (!sched->quantum) {
+        return 0;
+    }
+
+    prs_ticks_t next = 0;
+    const prs_task_prio_t ready_mask = prs_pal_atomic_load(&sched->ready_mask);
+    for (prs_uint_t i = 0; i < sched->worker_count; ++i) {
+        struct prs_sched_swprio_worker* swprio_worker = sched->workers[i];
+        const prs_task_prio_t prio = prs_pal_atomic_load(&swprio_worker->running_prio);
+        if (prio >= PRS_MAX_TASK_PRIO) {
+            continue;
+        }
+        const prs_ticks_t elapsed = now - prs_pal_atomic_load(&swprio_worker->slice_start);
+        prs_ticks_t remaining;
+        if (elapsed < sched->quantum) {
+            remaining = sched->quantum - elapsed;
+        } else {
+            if (ready_mask & (1 << prio)) {
+                PRS_FTRACE("time slice expired on worker %u", swprio_worker->index);
+                prs_worker_interrupt(swprio_worker->sched_worker->worker);
+            }
+            /* Check again later in case a task of the same priority becomes ready in the meantime */
+            remaining = sched->quantum;
+        }
+        if (!next || remaining < next) {
+            next = remaining;
+        }
+    }
+
+    return next;
+}
+
 struct prs_sched_ops* prs_sched_swprio_ops(void)
 {
     static struct prs_sched_ops s_sched_swprio_ops = {
         .init = prs_sched_swprio_init,
         .uninit = prs_sched_swprio_uninit,
+        .add_worker = prs_sched_swprio_add_worker,
         .add = prs_sched_swprio_add,
         .remove = prs_sched_swprio_remove,
         .get_next = prs_sched_swprio_get_next,
-        .ready = prs_sched_swprio_ready
+        .ready = prs_sched_swprio_ready,
+        .set_prio = prs_sched_swprio_set_prio,
+        .tick = prs_sched_swprio_tick,
+        .preempts = prs_sched_swprio_preempts
     };
     return &s_sched_swprio_ops;
 }
@@ -0,0 +1,542 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains the definitions for a multi-worker work-stealing priority scheduler.
+ *
+ *  This scheduler follows the same priority rules as the single worker priority scheduler, but serves several workers
+ *  from the same scheduler instance. Each worker owns a set of ready queues (one per priority level). A task is always
+ *  pushed on the ready queues of the last worker that executed it, so that it keeps running on the same core when
+ *  possible.
+ *
+ *  When a worker has nothing left to run, or when another worker has a ready task with a higher priority than
+ *  anything it could run itself, it steals that task from the other worker's ready queues. Priority order is thus
+ *  maintained over the whole scheduler and not only within each worker.
+ *
+ *  The ready queues are multi-producer single-consumer queues: any worker can push into them, but only one worker at a
+ *  time can take tasks out of them. A spinlock per worker serializes the consumer side between the owner of the queues
+ *  and the workers stealing from it. The owner always locks its own queues while thieves only try to lock, so that no
+ *  worker ever waits on another worker while holding its own lock for long.
+ *
+ *  A task can only be stolen once its register context is entirely saved by the worker it last ran on. Removed tasks
+ *  are always processed by the worker that owns the task, which is the only one that may be running in its register
+ *  context.
+ */
+
+#include <stddef.h>
+
+#include <prs/pal/atomic.h>
+#include <prs/pal/bitops.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/config.h>
+#include <prs/error.h>
+#include <prs/god.h>
+#include <prs/log.h>
+#include <prs/mpsciq.h>
+#include <prs/rtc.h>
+#include <prs/spinlock.h>
+#include <prs/task.h>
+#include <prs/worker.h>
+
+#include "../task.h"
+
+#define prs_sched_swsteal_for_each_prio(prio) \
+    for (prs_task_prio_t prio = 0; prio < PRS_MAX_TASK_PRIO; ++prio)
+
+/* Set in the task owner when the task is being removed. The owner of the task cannot change after that. */
+#define PRS_SCHED_SWSTEAL_OWNER_REMOVED ((prs_uint_t)1 << (sizeof(prs_uint_t) * 8 - 1))
+
+struct prs_sched_task_userdata {
+    struct prs_task*                    task;
+    struct prs_mpsciq_node              ready_node;
+    /* Priority of the ready queue in which ready_node was last pushed */
+    prs_task_prio_t                     ready_prio;
+
+    struct prs_mpsciq_node              remove_node;
+
+    /* Index of the worker that owns the task, combined with PRS_SCHED_SWSTEAL_OWNER_REMOVED */
+    PRS_ATOMIC prs_uint_t               owner;
+};
+
+struct prs_sched_swsteal_worker {
+    struct prs_sched_worker*            sched_worker;
+    prs_uint_t                          index;
+
+    /* Protects the consumer side of the ready queues */
+    struct prs_spinlock*                lock;
+    PRS_ATOMIC prs_task_prio_t          ready_mask;
+    struct prs_mpsciq*                  readyq[PRS_MAX_TASK_PRIO];
+
+    struct prs_mpsciq*                  removeq;
+
+    /* Priority of the task currently running on the worker, or PRS_MAX_TASK_PRIO when there is none */
+    PRS_ATOMIC prs_task_prio_t          running_prio;
+};
+
+struct prs_sched_swsteal {
+    struct prs_sched_swsteal_worker*    workers[PRS_MAX_CPU];
+    PRS_ATOMIC prs_uint_t               worker_count;
+
+    PRS_ATOMIC prs_uint_t               next_worker;
+};
+
+static void prs_sched_swsteal_worker_destroy(struct prs_sched_swsteal_worker* sched_worker)
+{
+    if (sched_worker->removeq) {
+        prs_mpsciq_destroy(sched_worker->removeq);
+    }
+    prs_sched_swsteal_for_each_prio(prio) {
+        struct prs_mpsciq* readyq = sched_worker->readyq[prio];
+        if (readyq) {
+            prs_mpsciq_destroy(readyq);
+        }
+    }
+    if (sched_worker->lock) {
+        prs_spinlock_destroy(sched_worker->lock);
+    }
+    prs_pal_free(sched_worker);
+}
+
+static prs_result_t prs_sched_swsteal_init(struct prs_sched_data* sched_data, void* userdata)
+{
+    struct prs_sched_swsteal* sched = prs_pal_malloc_zero(sizeof(*sched));
+    if (!sched) {
+        return PRS_OUT_OF_MEMORY;
+    }
+
+    sched_data->userdata = sched;
+
+    return PRS_OK;
+}
+
+static prs_result_t prs_sched_swsteal_uninit(struct prs_sched_data* sched_data)
+{
+    struct prs_sched_swsteal* sched = sched_data->userdata;
+
+    const prs_uint_t worker_count = prs_pal_atomic_load(&sched->worker_count);
+    for (prs_uint_t i = 0; i < worker_count; ++i) {
+        prs_sched_swsteal_worker_destroy(sched->workers[i]);
+    }
+    prs_pal_free(sched);
+
+    return PRS_OK;
+}
+
+static prs_result_t prs_sched_swsteal_add_worker(struct prs_sched_worker* sched_worker)
+{
+    struct prs_sched_swsteal* sched = sched_worker->sched_data->userdata;
+
+    const prs_uint_t index = prs_pal_atomic_load(&sched->worker_count);
+    PRS_RTC_IF (index >= PRS_MAX_CPU) {
+        return PRS_INVALID_STATE;
+    }
+
+    prs_result_t result = PRS_OK;
+    struct prs_sched_swsteal_worker* swsteal_worker = prs_pal_malloc_zero(sizeof(*swsteal_worker));
+    if (!swsteal_worker) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    swsteal_worker->sched_worker = sched_worker;
+    swsteal_worker->index = index;
+    prs_pal_atomic_store(&swsteal_worker->running_prio, PRS_MAX_TASK_PRIO);
+
+    swsteal_worker->lock = prs_spinlock_create();
+    if (!swsteal_worker->lock) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    prs_sched_swsteal_for_each_prio(prio) {
+        struct prs_mpsciq_create_params mpsciq_params = {
+            .node_offset = offsetof(struct prs_sched_task_userdata, ready_node)
+        };
+        swsteal_worker->readyq[prio] = prs_mpsciq_create(&mpsciq_params);
+        if (!swsteal_worker->readyq[prio]) {
+            result = PRS_OUT_OF_MEMORY;
+            goto cleanup;
+        }
+    }
+
+    struct prs_mpsciq_create_params mpsciq_params = {
+        .node_offset = offsetof(struct prs_sched_task_userdata, remove_node)
+    };
+    swsteal_worker->removeq = prs_mpsciq_create(&mpsciq_params);
+    if (!swsteal_worker->removeq) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    sched_worker->userdata = swsteal_worker;
+    sched->workers[index] = swsteal_worker;
+    prs_pal_atomic_store(&sched->worker_count, index + 1);
+
+    return result;
+
+    cleanup:
+
+    if (swsteal_worker) {
+        prs_sched_swsteal_worker_destroy(swsteal_worker);
+    }
+
+    return result;
+}
+
+static void prs_sched_swsteal_update_mask(struct prs_sched_swsteal_worker* swsteal_worker, prs_task_prio_t prio)
+{
+    struct prs_mpsciq* readyq = swsteal_worker->readyq[prio];
+    if (!prs_mpsciq_begin(readyq)) {
+        const prs_task_prio_t prio_mask = (1 << prio);
+        prs_pal_atomic_fetch_and(&swsteal_worker->ready_mask, ~prio_mask);
+        if (prs_mpsciq_begin(readyq)) {
+            prs_pal_atomic_fetch_or(&swsteal_worker->ready_mask, prio_mask);
+        }
+    }
+}
+
+/*
+ * Takes the first task of the highest priority available in the ready queues of the victim worker, with a priority
+ * higher than the specified limit. The lock of the victim worker must be held.
+ */
+static struct prs_task* prs_sched_swsteal_take(struct prs_sched_swsteal_worker* swsteal_worker,
+    struct prs_sched_swsteal_worker* victim, prs_task_prio_t limit)
+{
+    prs_task_prio_t ready_mask = prs_pal_atomic_load(&victim->ready_mask);
+    while (ready_mask) {
+        const prs_int_t prio = prs_bitops_lsb_uint32(ready_mask);
+        PRS_ASSERT(prio >= 0 && prio < PRS_MAX_TASK_PRIO);
+        if (prio >= limit) {
+            break;
+        }
+        ready_mask &= ~(1 << prio);
+
+        struct prs_mpsciq* readyq = victim->readyq[prio];
+        struct prs_mpsciq_node* node = prs_mpsciq_begin(readyq);
+        if (!node) {
+            prs_sched_swsteal_update_mask(victim, prio);
+            node = prs_mpsciq_begin(readyq);
+        }
+        for (; node; node = prs_mpsciq_next(readyq, node)) {
+            struct prs_sched_task_userdata* task_userdata = prs_mpsciq_get_data(readyq, node);
+            if (victim == swsteal_worker) {
+                if (prs_pal_atomic_load(&task_userdata->owner) & PRS_SCHED_SWSTEAL_OWNER_REMOVED) {
+                    continue;
+                }
+            } else {
+                /* The task may still be switching out of the worker it was running on */
+                if (prs_pal_atomic_load(&task_userdata->task->context_loaded)) {
+                    continue;
+                }
+                /* This fails when the task is being removed */
+                prs_uint_t owner = victim->index;
+                if (!prs_pal_atomic_compare_exchange_strong(&task_userdata->owner, &owner, swsteal_worker->index)) {
+                    continue;
+                }
+                PRS_FTRACE("steal task %s (%u) from worker %u", task_userdata->task->name, task_userdata->task->id,
+                    victim->index);
+            }
+            prs_mpsciq_remove(readyq, node);
+            PRS_ASSERT(!node->next);
+            PRS_ASSERT(!node->prev);
+            prs_sched_swsteal_update_mask(victim, prio);
+            return task_userdata->task;
+        }
+    }
+
+    return 0;
+}
+
+static prs_bool_t prs_sched_swsteal_process_removeq(struct prs_sched_swsteal_worker* swsteal_worker,
+    struct prs_task* current_task)
+{
+    struct prs_mpsciq* removeq = swsteal_worker->removeq;
+    struct prs_mpsciq_node* remove_node = prs_mpsciq_begin(removeq);
+    while (remove_node) {
+        struct prs_sched_task_userdata* task_userdata = prs_mpsciq_get_data(removeq, remove_node);
+        struct prs_task* removed_task = task_userdata->task;
+        if (current_task == removed_task) {
+            /*
+             * We can't remove this task now, as we are running in its register context. Return now to ask the worker
+             * to change register contexts so we can safely unreference this task.
+             */
+            PRS_FTRACE("request other stack because task %s (%u) is being deleted", current_task->name, current_task->id);
+            return PRS_FALSE;
+        }
+        /*
+         * Make sure the removed task is not in a ready queue. Only the owner of the task can push it there. The
+         * priority of the task may have changed since it was pushed.
+         */
+        const prs_task_prio_t ready_prio = task_userdata->ready_prio;
+        struct prs_mpsciq* readyq = swsteal_worker->readyq[ready_prio];
+        if (prs_mpsciq_is_inserted(readyq, &task_userdata->ready_node)) {
+            prs_mpsciq_remove(readyq, &task_userdata->ready_node);
+            prs_sched_swsteal_update_mask(swsteal_worker, ready_prio);
+        }
+
+        prs_task_change_state(removed_task, PRS_TASK_STATE_STOPPED, PRS_TASK_STATE_ZOMBIE);
+        removed_task->sched_userdata = 0;
+        prs_mpsciq_remove(removeq, remove_node);
+        prs_pal_free(task_userdata);
+        prs_god_unlock(removed_task->id);
+        remove_node = prs_mpsciq_begin(removeq);
+    }
+
+    return PRS_TRUE;
+}
+
+static prs_bool_t prs_sched_swsteal_get_next(struct prs_sched_worker* sched_worker, struct prs_task* current_task,
+    struct prs_task** task)
+{
+    struct prs_sched_swsteal* sched = sched_worker->sched_data->userdata;
+    struct prs_sched_swsteal_worker* swsteal_worker = sched_worker->userdata;
+    const prs_uint_t worker_count = prs_pal_atomic_load(&sched->worker_count);
+
+    /* While we are re-scheduling, other workers must consider that this worker runs nothing */
+    prs_pal_atomic_store(&swsteal_worker->running_prio, PRS_MAX_TASK_PRIO);
+
+    prs_spinlock_lock(swsteal_worker->lock);
+
+    if (!prs_sched_swsteal_process_removeq(swsteal_worker, current_task)) {
+        prs_spinlock_unlock(swsteal_worker->lock);
+        *task = 0;
+        return PRS_FALSE;
+    }
+
+    prs_task_prio_t current_prio = PRS_MAX_TASK_PRIO;
+    if (current_task && prs_task_get_state(current_task) == PRS_TASK_STATE_RUNNING) {
+        current_prio = current_task->prio;
+    }
+
+    /* Look for a worker having a ready task with a higher priority than anything that this worker could run */
+    const prs_task_prio_t local_mask = prs_pal_atomic_load(&swsteal_worker->ready_mask);
+    const prs_task_prio_t local_prio = local_mask ? prs_bitops_lsb_uint32(local_mask) : PRS_MAX_TASK_PRIO;
+    const prs_task_prio_t limit = (local_prio < current_prio) ? local_prio : current_prio;
+    struct prs_sched_swsteal_worker* victim = 0;
+    prs_task_prio_t victim_prio = limit;
+    for (prs_uint_t i = 1; i < worker_count; ++i) {
+        struct prs_sched_swsteal_worker* other = sched->workers[(swsteal_worker->index + i) % worker_count];
+        const prs_task_prio_t other_mask = prs_pal_atomic_load(&other->ready_mask);
+        if (other_mask) {
+            const prs_task_prio_t other_prio = prs_bitops_lsb_uint32(other_mask);
+            if (other_prio < victim_prio) {
+                victim = other;
+                victim_prio = other_prio;
+            }
+        }
+    }
+
+    /* Set when a worker that may have a task for this worker could not be locked */
+    prs_bool_t contended = PRS_FALSE;
+    struct prs_task* next_task = 0;
+    if (victim) {
+        if (prs_spinlock_try_lock(victim->lock)) {
+            next_task = prs_sched_swsteal_take(swsteal_worker, victim, limit);
+            prs_spinlock_unlock(victim->lock);
+        } else {
+            contended = PRS_TRUE;
+        }
+    }
+
+    if (!next_task) {
+        next_task = prs_sched_swsteal_take(swsteal_worker, swsteal_worker, current_prio);
+    }
+
+    if (!next_task && current_prio == PRS_MAX_TASK_PRIO) {
+        /* Nothing to run on this worker: steal anything that is ready from the other workers */
+        for (prs_uint_t i = 1; i < worker_count && !next_task; ++i) {
+            struct prs_sched_swsteal_worker* other = sched->workers[(swsteal_worker->index + i) % worker_count];
+            if (prs_pal_atomic_load(&other->ready_mask)) {
+                if (prs_spinlock_try_lock(other->lock)) {
+                    next_task = prs_sched_swsteal_take(swsteal_worker, other, PRS_MAX_TASK_PRIO);
+                    prs_spinlock_unlock(other->lock);
+                } else {
+                    contended = PRS_TRUE;
+                }
+            }
+        }
+    }
+
+    if (next_task) {
+        /*
+         * Special case when the current task is interrupted: if another task with a higher priority is ready, we must
+         * preempt the current task.
+         */
+        if (current_prio != PRS_MAX_TASK_PRIO) {
+            struct prs_sched_task_userdata* task_userdata = current_task->sched_userdata;
+            PRS_FTRACE("preempt task %s (%u)", current_task->name, current_task->id);
+            task_userdata->ready_prio = current_prio;
+            prs_mpsciq_push(swsteal_worker->readyq[current_prio], &task_userdata->ready_node);
+            prs_pal_atomic_fetch_or(&swsteal_worker->ready_mask, (1 << current_prio));
+            prs_task_change_state(current_task, PRS_TASK_STATE_RUNNING, PRS_TASK_STATE_READY);
+        }
+        prs_task_change_state(next_task, PRS_TASK_STATE_READY, PRS_TASK_STATE_RUNNING);
+        *task = next_task;
+    } else if (current_prio != PRS_MAX_TASK_PRIO) {
+        /* Same or higher priority - no need to switch tasks yet */
+        *task = current_task;
+    } else {
+        *task = 0;
+        if (contended) {
+            /*
+             * A ready task may be waiting on a worker that was busy: signal this worker so that it scans again instead
+             * of parking, once its own lock is released.
+             */
+            prs_worker_signal(sched_worker->worker);
+        }
+    }
+
+    prs_pal_atomic_store(&swsteal_worker->running_prio, *task ? (*task)->prio : PRS_MAX_TASK_PRIO);
+
+    prs_spinlock_unlock(swsteal_worker->lock);
+
+    PRS_POSTCONDITION(!*task || prs_task_get_state(*task) == PRS_TASK_STATE_RUNNING);
+
+    return PRS_TRUE;
+}
+
+static prs_result_t prs_sched_swsteal_ready(struct prs_sched_data* sched_data, struct prs_task* task)
+{
+    struct prs_sched_swsteal* sched = sched_data->userdata;
+    struct prs_sched_task_userdata* task_userdata = task->sched_userdata;
+
+    PRS_FTRACE("task %s (%u)", task->name, task->id);
+
+    const prs_uint_t owner = prs_pal_atomic_load(&task_userdata->owner) & ~PRS_SCHED_SWSTEAL_OWNER_REMOVED;
+    struct prs_sched_swsteal_worker* owner_worker = sched->workers[owner];
+    task_userdata->ready_prio = task->prio;
+    prs_mpsciq_push(owner_worker->readyq[task->prio], &task_userdata->ready_node);
+    prs_pal_atomic_fetch_or(&owner_worker->ready_mask, (1 << task->prio));
+
+    /*
+     * Notify the worker running the lowest priority task, which will steal the task if it is not its owner. The
+     * search starts at a different worker each time so that bursts of ready tasks are spread over idle workers.
+     */
+    struct prs_sched_swsteal_worker* lowest_worker = owner_worker;
+    prs_task_prio_t lowest_prio = prs_pal_atomic_load(&owner_worker->running_prio);
+    const prs_uint_t worker_count = prs_pal_atomic_load(&sched->worker_count);
+    const prs_uint_t start = prs_pal_atomic_fetch_add(&sched->next_worker, 1);
+    for (prs_uint_t i = 0; i < worker_count && lowest_prio < PRS_MAX_TASK_PRIO; ++i) {
+        struct prs_sched_swsteal_worker* swsteal_worker = sched->workers[(start + i) % worker_count];
+        const prs_task_prio_t running_prio = prs_pal_atomic_load(&swsteal_worker->running_prio);
+        if (running_prio > lowest_prio) {
+            lowest_prio = running_prio;
+            lowest_worker = swsteal_worker;
+        }
+    }
+
+    if (task->prio < lowest_prio) {
+        prs_worker_interrupt(lowest_worker->sched_worker->worker);
+    }
+
+    return PRS_OK;
+}
+
+static prs_bool_t prs_sched_swsteal_preempts(struct prs_sched_data* sched_data, prs_task_prio_t prio)
+{
+    struct prs_sched_swsteal* sched = sched_data->userdata;
+
+    /* Same test as prs_sched_swsteal_ready(), on the worker running the lowest priority task */
+    const prs_uint_t worker_count = prs_pal_atomic_load(&sched->worker_count);
+    for (prs_uint_t i = 0; i < worker_count; ++i) {
+        if (prio < prs_pal_atomic_load(&sched->workers[i]->running_prio)) {
+            return PRS_TRUE;
+        }
+    }
+    return PRS_FALSE;
+}
+
+static prs_result_t prs_sched_swsteal_add(struct prs_sched_data* sched_data, struct prs_task* task)
+{
+    PRS_PRECONDITION(sched_data);
+    PRS_PRECONDITION(task);
+    PRS_PRECONDITION(task->prio < PRS_MAX_TASK_PRIO);
+    PRS_PRECONDITION(!task->sched_userdata);
+
+    struct prs_sched_swsteal* sched = sched_data->userdata;
+    const prs_uint_t worker_count = prs_pal_atomic_load(&sched->worker_count);
+    PRS_RTC_IF (!worker_count) {
+        return PRS_INVALID_STATE;
+    }
+
+    struct prs_sched_task_userdata* userdata = prs_pal_malloc_zero(sizeof(*userdata));
+    if (!userdata) {
+        return PRS_OUT_OF_MEMORY;
+    }
+    task->sched_userdata = userdata;
+    userdata->task = task;
+    /* New tasks are distributed to the workers in a round-robin fashion */
+    prs_pal_atomic_store(&userdata->owner, prs_pal_atomic_fetch_add(&sched->next_worker, 1) % worker_count);
+
+    struct prs_task* god_task = prs_god_lock(task->id);
+    PRS_ASSERT(god_task == task);
+
+    prs_task_change_state(task, PRS_TASK_STATE_STOPPED, PRS_TASK_STATE_READY);
+
+    return prs_sched_swsteal_ready(sched_data, task);
+}
+
+static prs_result_t prs_sched_swsteal_remove(struct prs_sched_data* sched_data, struct prs_task* task)
+{
+    PRS_PRECONDITION(sched_data);
+    PRS_PRECONDITION(task);
+    PRS_PRECONDITION(task->sched_userdata);
+
+    PRS_FTRACE("%s (%u)", task->name, task->id);
+
+    const enum prs_task_state prev_state = prs_task_get_state(task);
+    if (prev_state != PRS_TASK_STATE_STOPPED) {
+        struct prs_sched_swsteal* sched = sched_data->userdata;
+        struct prs_sched_task_userdata* userdata = task->sched_userdata;
+        prs_task_change_state(task, prev_state, PRS_TASK_STATE_STOPPED);
+        const prs_uint_t owner = prs_pal_atomic_fetch_or(&userdata->owner, PRS_SCHED_SWSTEAL_OWNER_REMOVED);
+        if (owner & PRS_SCHED_SWSTEAL_OWNER_REMOVED) {
+            return PRS_OK;
+        }
+        struct prs_sched_swsteal_worker* owner_worker = sched->workers[owner];
+        prs_mpsciq_push(owner_worker->removeq, &userdata->remove_node);
+
+        if (prev_state == PRS_TASK_STATE_RUNNING) {
+            prs_worker_interrupt(owner_worker->sched_worker->worker);
+        }
+    }
+
+    return PRS_OK;
+}
+
+struct prs_sched_ops* prs_sched_swsteal_ops(void)
+{
+    static struct prs_sched_ops s_sched_swsteal_ops = {
+        .init = prs_sched_swsteal_init,
+        .uninit = prs_sched_swsteal_uninit,
+        .add_worker = prs_sched_swsteal_add_worker,
+        .add = prs_sched_swsteal_add,
+        .remove = prs_sched_swsteal_remove,
+        .get_next = prs_sched_swsteal_get_next,
+        .ready = prs_sched_swsteal_ready,
+        .preempts = prs_sched_swsteal_preempts
+    };
+    return &s_sched_swsteal_ops;
+}
@@ -24,19 +24,27 @@
  * \file
  * \brief
  *  This file contains semaphore definitions.
+ *
+ *  When the count is positive, a wait only decrements it with a compare-and-swap and does not touch the wait queue.
+ *  Otherwise, the task is queued through the wait node embedded in its \ref prs_task, so waiting does not allocate
+ *  anything, except for the event that is given to the timer by the timed waits. A queued task holds a reference on
+ *  its own object, which keeps the node valid until it is removed from the queue.
  */
 
+#include <stddef.h>
+
 #include <prs/pal/atomic.h>
 #include <prs/pal/malloc.h>
 #include <prs/clock.h>
 #include <prs/error.h>
 #include <prs/event.h>
 #include <prs/god.h>
-#include <prs/gpd.h>
-#include <prs/mpmcq.h>
+#include <prs/idllist.h>
 #include <prs/rtc.h>
 #include <prs/sem.h>
+#include <prs/spinlock.h>
 #include <prs/timer.h>
+#include <prs/wait.h>
 #include <prs/worker.h>
 
 #include "task.h"
@@ -48,7 +56,10 @@ struct prs_sem {
     prs_sem_id_t                        id;
     prs_int_t                           max_count;
     PRS_ATOMIC prs_int_t                count;
-    struct prs_mpmcq*                   waitq;
+    struct prs_spinlock*                lock;
+    struct prs_idllist*                 waitq;
+    /* Tasks that wait for the semaphore among other objects, see prs_wait_any() */
+    struct prs_wait_list*               watchers;
 };
 
 static void prs_sem_object_destroy(void* object)
@@ -60,8 +71,14 @@ static void prs_sem_object_free(void* object)
 {
     struct prs_sem* sem = object;
 
+    if (sem->watchers) {
+        prs_wait_list_destroy(sem->watchers);
+    }
     if (sem->waitq) {
-        prs_mpmcq_destroy(sem->waitq);
+        prs_idllist_destroy(sem->waitq);
+    }
+    if (sem->lock) {
+        prs_spinlock_destroy(sem->lock);
     }
     prs_pal_free(sem);
 }
@@ -95,16 +112,21 @@ struct prs_sem* prs_sem_create(struct prs_sem_create_params* params)
         goto cleanup;
     }
 
-    struct prs_mpmcq_create_params mpmcq_params = {
-        .area = 0,
-        .pd = prs_gpd_get(),
-        .pd_params = 0
+    sem->lock = prs_spinlock_create();
+
+    struct prs_idllist_create_params idllist_params = {
+        .node_offset = offsetof(struct prs_task, wait_node.node)
     };
-    sem->waitq = prs_mpmcq_create(&mpmcq_params);
+    sem->waitq = prs_idllist_create(&idllist_params);
     if (!sem->waitq) {
         goto cleanup;
     }
 
+    sem->watchers = prs_wait_list_create();
+    if (!sem->watchers) {
+        goto cleanup;
+    }
+
     sem->id = prs_god_alloc_and_lock(sem, &s_prs_sem_object_ops);
     if (sem->id == PRS_OBJECT_ID_INVALID) {
         goto cleanup;
@@ -121,7 +143,7 @@ cleanup:
         if (sem->id) {
             prs_god_unlock(sem->id);
         } else {
-            prs_pal_free(sem);
+            prs_sem_object_free(sem);
         }
     }
 
@@ -139,41 +161,77 @@ void prs_sem_destroy(struct prs_sem* sem)
     prs_god_unlock(sem->id);
 }
 
-static prs_bool_t prs_sem_signal_once(struct prs_sem* sem, struct prs_event* self_event)
+static prs_bool_t prs_sem_try_acquire(struct prs_sem* sem)
 {
-    for (;;) {
-        struct prs_event* pop_event = 0;
-        const prs_result_t result = prs_mpmcq_pop(sem->waitq, &pop_event);
-        if (result != PRS_OK || !pop_event) {
-            /*
-             * If self_event wasn't null, this means that the event was popped from the wait queue by another worker
-             * before we could get here.
-             */
-            return PRS_FALSE;
+    prs_int_t count = prs_pal_atomic_load(&sem->count);
+    while (count > 0) {
+        if (prs_pal_atomic_compare_exchange_weak(&sem->count, &count, count - 1)) {
+            return PRS_TRUE;
         }
+    }
+    return PRS_FALSE;
+}
 
-        const prs_event_state_t event_state = prs_event_signal(pop_event, PRS_SEM_EVENT_TYPE_SIGNAL);
-        if (!(event_state & PRS_EVENT_STATE_SIGNALED)) {
-            if (pop_event == self_event) {
-                /* Cancel the remaining references if they exist */
-                if (!(event_state & PRS_EVENT_STATE_FREED)) {
-                    prs_event_cancel(self_event);
-                }
-
-                /*
-                 * We successfully signaled (and possibly canceled) our own event, which means that we can return
-                 * immediately from the wait() function call.
-                 */
-                return PRS_TRUE;
-            }
-
-            /*
-             * We signaled the event or another worker, so if we were called from a wait() function, we must call the
-             * scheduler.
-             */
-            return PRS_FALSE;
-        }
+static void prs_sem_enqueue(struct prs_sem* sem, struct prs_task* task, prs_task_token_t token)
+{
+    /* The reference is released by whoever removes the task from the wait queue */
+    void* object = prs_god_lock(task->id);
+    PRS_ASSERT(object == task);
+
+    prs_spinlock_lock(sem->lock);
+    task->wait_node.token = token;
+    task->wait_node.queued = PRS_TRUE;
+    prs_idllist_insert_before(sem->waitq, 0, &task->wait_node.node);
+    prs_spinlock_unlock(sem->lock);
+}
+
+static prs_bool_t prs_sem_dequeue(struct prs_sem* sem, struct prs_task* task)
+{
+    prs_spinlock_lock(sem->lock);
+    const prs_bool_t queued = task->wait_node.queued;
+    if (queued) {
+        prs_idllist_remove(sem->waitq, &task->wait_node.node);
+        task->wait_node.queued = PRS_FALSE;
     }
+    prs_spinlock_unlock(sem->lock);
+
+    if (queued) {
+        prs_god_unlock(task->id);
+    }
+    return queued;
+}
+
+static prs_bool_t prs_sem_signal_once(struct prs_sem* sem, struct prs_task* self_task)
+{
+    prs_spinlock_lock(sem->lock);
+    struct prs_idllist_node* node = prs_idllist_begin(sem->waitq);
+    if (!node) {
+        /*
+         * If self_task wasn't null, this means that it was removed from the wait queue by another worker before we
+         * could get here.
+         */
+        prs_spinlock_unlock(sem->lock);
+        return PRS_FALSE;
+    }
+    struct prs_task* task = prs_idllist_get_data(sem->waitq, node);
+    prs_idllist_remove(sem->waitq, node);
+    task->wait_node.queued = PRS_FALSE;
+    const prs_task_token_t token = task->wait_node.token;
+    prs_spinlock_unlock(sem->lock);
+
+    /*
+     * The task may already have been unblocked by its timeout, in which case it will find out that it was removed
+     * from the queue and that it owns the count.
+     */
+    const prs_task_id_t task_id = task->id;
+    prs_task_unblock(task, token, PRS_SEM_EVENT_TYPE_SIGNAL);
+    prs_god_unlock(task_id);
+
+    /*
+     * If we unblocked our own task, we can return immediately from the wait() function call. Otherwise, we signaled
+     * another task and we must call the scheduler.
+     */
+    return PRS_BOOL(task == self_task);
 }
 
 /**
@@ -184,20 +242,20 @@ static prs_bool_t prs_sem_signal_once(struct prs_sem* sem, struct prs_event* sel
  */
 void prs_sem_wait(struct prs_sem* sem)
 {
+    if (prs_sem_try_acquire(sem)) {
+        return;
+    }
+
     struct prs_worker* worker = prs_worker_current();
     PRS_ASSERT(worker);
     struct prs_task* task = prs_worker_get_current_task(worker);
     PRS_ASSERT(task);
 
-    struct prs_event* push_event = prs_event_create(task, 1);
-    PRS_FATAL_WHEN(!push_event);
-
-    const prs_result_t result = prs_mpmcq_push(sem->waitq, push_event);
-    PRS_KILL_TASK_WHEN(result != PRS_OK);
+    prs_sem_enqueue(sem, task, prs_task_block(task));
 
     prs_int_t value = prs_pal_atomic_fetch_sub(&sem->count, 1);
     if (value > 0) {
-        const prs_result_t signaled = prs_sem_signal_once(sem, push_event);
+        const prs_bool_t signaled = prs_sem_signal_once(sem, task);
         if (signaled) {
             return;
         }
@@ -206,51 +264,82 @@ void prs_sem_wait(struct prs_sem* sem)
     prs_sched_schedule();
 }
 
-/**
- * \brief
- *  Decrements the semaphore. If the semaphore count is below zero, wait in queue for the count to increment or for
- *  the specified timeout to occur.
- * \param sem
- *  Semaphore to wait for.
- * \param timeout
- *  Time to wait, in ticks.
- * \return
- *  \ref PRS_TIMEOUT if the timeout occurred.
- *  \ref PRS_OK if the semaphore was signaled before the timeout.
- */
-prs_result_t prs_sem_wait_timeout(struct prs_sem* sem, prs_ticks_t timeout)
+static prs_result_t prs_sem_wait_timeout_internal(struct prs_sem* sem, prs_uint64_t timeout, prs_bool_t high_res)
 {
+    if (prs_sem_try_acquire(sem)) {
+        return PRS_OK;
+    }
+
     struct prs_worker* worker = prs_worker_current();
     PRS_ASSERT(worker);
     struct prs_task* task = prs_worker_get_current_task(worker);
     PRS_ASSERT(task);
 
-    struct prs_event* push_event = prs_event_create(task, 2);
-    PRS_FATAL_WHEN(!push_event);
-
-    const prs_result_t push_result = prs_mpmcq_push(sem->waitq, push_event);
-    PRS_KILL_TASK_WHEN(push_result != PRS_OK);
+    /* The event is only referenced by the timer, the semaphore unblocks the task directly */
+    struct prs_event* timer_event = prs_event_create(task, 1);
+    PRS_FATAL_WHEN(!timer_event);
+    prs_sem_enqueue(sem, task, prs_pal_atomic_load(&task->state));
 
     prs_int_t value = prs_pal_atomic_fetch_sub(&sem->count, 1);
     if (value > 0) {
-        const prs_result_t signaled = prs_sem_signal_once(sem, push_event);
+        const prs_bool_t signaled = prs_sem_signal_once(sem, task);
         if (signaled) {
+            prs_event_cancel(timer_event);
             return PRS_OK;
         }
     }
 
-    struct prs_timer_entry* timer_entry = prs_timer_queue(prs_clock_timer(), push_event, PRS_SEM_EVENT_TYPE_TIMEOUT, timeout);
+    struct prs_timer* timer = prs_worker_get_timer(prs_worker_current());
+    struct prs_timer_entry* timer_entry = high_res ?
+        prs_timer_queue_ns(timer, timer_event, PRS_SEM_EVENT_TYPE_TIMEOUT, timeout) :
+        prs_timer_queue(timer, timer_event, PRS_SEM_EVENT_TYPE_TIMEOUT, (prs_ticks_t)timeout);
     PRS_ASSERT(timer_entry);
     prs_sched_schedule();
-    prs_timer_cancel(prs_clock_timer(), timer_entry);
-
-    const prs_event_type_t event_type = (prs_event_type_t)prs_task_get_last_unblock_cause(task);
-    if (event_type == PRS_SEM_EVENT_TYPE_SIGNAL) {
-        return PRS_OK;
-    } else {
-        PRS_ASSERT(event_type == PRS_SEM_EVENT_TYPE_TIMEOUT);
+    prs_timer_cancel(timer, timer_entry);
+
+    /*
+     * Whatever unblocked the task, it was signaled if a signaling task removed it from the wait queue. Otherwise, it
+     * gives back the count that it took when it was queued.
+     */
+    if (prs_sem_dequeue(sem, task)) {
+        prs_pal_atomic_fetch_add(&sem->count, 1);
         return PRS_TIMEOUT;
     }
+    return PRS_OK;
+}
+
+/**
+ * \brief
+ *  Decrements the semaphore. If the semaphore count is below zero, wait in queue for the count to increment or for
+ *  the specified timeout to occur.
+ * \param sem
+ *  Semaphore to wait for.
+ * \param timeout
+ *  Time to wait, in ticks.
+ * \return
+ *  \ref PRS_TIMEOUT if the timeout occurred.
+ *  \ref PRS_OK if the semaphore was signaled before the timeout.
+ */
+prs_result_t prs_sem_wait_timeout(struct prs_sem* sem, prs_ticks_t timeout)
+{
+    return prs_sem_wait_timeout_internal(sem, timeout, PRS_FALSE);
+}
+
+/**
+ * \brief
+ *  Decrements the semaphore. If the semaphore count is below zero, wait in queue for the count to increment or for
+ *  the specified high resolution timeout to occur.
+ * \param sem
+ *  Semaphore to wait for.
+ * \param timeout_ns
+ *  Time to wait, in nanoseconds.
+ * \return
+ *  \ref PRS_TIMEOUT if the timeout occurred.
+ *  \ref PRS_OK if the semaphore was signaled before the timeout.
+ */
+prs_result_t prs_sem_wait_timeout_ns(struct prs_sem* sem, prs_uint64_t timeout_ns)
+{
+    return prs_sem_wait_timeout_internal(sem, timeout_ns, PRS_TRUE);
 }
 
 /**
@@ -264,5 +353,31 @@ void prs_sem_signal(struct prs_sem* sem)
     prs_int_t value = prs_pal_atomic_fetch_add(&sem->count, 1);
     if (value < 0) {
         prs_sem_signal_once(sem, 0);
+    } else {
+        prs_wait_list_notify(sem->watchers);
     }
 }
+
+/**
+ * \brief
+ *  Decrements the semaphore if its count is positive, without waiting.
+ * \param sem
+ *  Semaphore to decrement.
+ * \return
+ *  \p true if the semaphore was decremented.
+ */
+prs_bool_t prs_sem_try_wait(struct prs_sem* sem)
+{
+    return prs_sem_try_acquire(sem);
+}
+
+/**
+ * \brief
+ *  Returns the wait list of the semaphore, which is notified when the semaphore is signaled and no task is queued.
+ * \param sem
+ *  Semaphore.
+ */
+struct prs_wait_list* prs_sem_get_wait_list(struct prs_sem* sem)
+{
+    return sem->watchers;
+}
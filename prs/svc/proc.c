@@ -67,6 +67,16 @@ static void prs_svc_proc_task(void* userdata)
         const prs_ticks_t now = prs_clock_get();
         if (now - last_gc_ticks >= PRS_TICKS_FROM_SECS(1)) {
             prs_proc_gc();
+#if defined(PRS_STACK_RECLAIM)
+            struct prs_task_stack_reclaim_stats reclaim_stats;
+            prs_worker_int_disable(worker);
+            prs_task_reclaim_stacks(&reclaim_stats);
+            if (reclaim_stats.reclaims) {
+                prs_log_print(PRS_PROC_LOG_PREFIX "reclaimed %llu bytes from %u task stacks",
+                    (unsigned long long)reclaim_stats.reclaimed_size, reclaim_stats.reclaims);
+            }
+            prs_worker_int_enable(worker);
+#endif /* PRS_STACK_RECLAIM */
             last_gc_ticks = now;
         }
 
@@ -28,6 +28,10 @@
  *  The task implements a user-space fiber meant to be executed by a scheduler. It owns its own stack and register
  *  context. It also has a dedicated message queue.
  *
+ *  The task structure, register context and message queue are carved together from a single object of the task slab.
+ *  Along with its stack, this object is recycled through the caches of the worker that creates or frees the task, so
+ *  that creating a task does not go through the general purpose allocator nor map memory in the common case.
+ *
  *  The task's stack has a fixed size that is decided by the user application. When the stack overflows, an exception
  *  is raised. The default exception handler will increase the stack size by a multiple of the system's page size.
  *
@@ -51,9 +55,12 @@
  */
 
 #include <stddef.h>
+#include <string.h>
 
+#include <prs/alloc/slab.h>
 #include <prs/alloc/stack.h>
 #include <prs/pal/atomic.h>
+#include <prs/pal/bitops.h>
 #include <prs/pal/context.h>
 #include <prs/pal/os.h>
 #include <prs/pal/malloc.h>
@@ -62,6 +69,7 @@
 #include <prs/god.h>
 #include <prs/gpd.h>
 #include <prs/log.h>
+#include <prs/mutex.h>
 #include <prs/name.h>
 #include <prs/object.h>
 #include <prs/pd.h>
@@ -91,11 +99,85 @@
 
 static struct prs_name* s_prs_task_name = 0;
 
+/*
+ * Each task is a single object of the task slab: the task structure, followed by its register context and its message
+ * queue.
+ */
+#define PRS_TASK_SLAB_ALIGN             16
+
+/* Area below the stack pointer that is never reclaimed */
+#define PRS_TASK_STACK_RED_ZONE         128
+static struct prs_slab* s_prs_task_slab = 0;
+static prs_size_t s_prs_task_context_offset = 0;
+static prs_size_t s_prs_task_msgq_offset = 0;
+
 static void prs_task_object_destroy(void* object)
 {
     prs_task_destroy(object);
 }
 
+static void prs_task_init_slab(void)
+{
+    if (s_prs_task_slab) {
+        return;
+    }
+
+    s_prs_task_context_offset = prs_bitops_align_size(sizeof(struct prs_task), PRS_TASK_SLAB_ALIGN);
+    s_prs_task_msgq_offset = prs_bitops_align_size(s_prs_task_context_offset + prs_pal_context_struct_size(),
+        PRS_TASK_SLAB_ALIGN);
+
+    struct prs_slab_create_params slab_params = {
+        .object_size = s_prs_task_msgq_offset + prs_msgq_struct_size(),
+        .object_align = PRS_TASK_SLAB_ALIGN,
+        .chunk_objects = PRS_TASK_SLAB_CHUNK_TASKS
+    };
+    s_prs_task_slab = prs_slab_create(&slab_params);
+    PRS_FATAL_WHEN(!s_prs_task_slab);
+}
+
+/*
+ * Stacks and task objects are recycled through the caches of the current worker, which are only safe to use from its
+ * thread with interrupts disabled.
+ */
+static struct prs_worker* prs_task_cache_owner(void)
+{
+    struct prs_worker* worker = prs_worker_current();
+    if (worker && !prs_worker_int_enabled(worker)) {
+        return worker;
+    }
+    return 0;
+}
+
+static struct prs_task* prs_task_alloc(void)
+{
+    struct prs_worker* worker = prs_task_cache_owner();
+    struct prs_task* task = worker ? prs_slab_cache_alloc(prs_worker_get_task_cache(worker)) :
+        prs_slab_alloc(s_prs_task_slab);
+    if (task) {
+        memset(task, 0, prs_slab_get_object_size(s_prs_task_slab));
+    }
+    return task;
+}
+
+static void prs_task_free(struct prs_task* task)
+{
+    struct prs_worker* worker = prs_task_cache_owner();
+
+    if (task->stack) {
+        if (worker) {
+            prs_stack_cache_free(prs_worker_get_stack_cache(worker), task->stack, task->stack_size);
+        } else {
+            prs_stack_destroy(task->stack);
+        }
+    }
+
+    if (worker) {
+        prs_slab_cache_free(prs_worker_get_task_cache(worker), task);
+    } else {
+        prs_slab_free(s_prs_task_slab, task);
+    }
+}
+
 static void prs_task_object_free(void* object)
 {
     struct prs_task* task = object;
@@ -103,25 +185,34 @@ static void prs_task_object_free(void* object)
     if (task->msgq) {
         prs_msgq_destroy(task->msgq);
     }
-    if (task->context) {
-        prs_pal_context_free(task->context);
-    }
-    if (task->stack) {
-        prs_stack_destroy(task->stack);
-    }
-    prs_pal_free(task);
+    prs_task_free(task);
 }
 
 static void prs_task_object_print(void* object, void* userdata, void (*fct)(void*, const char*, ...))
 {
     struct prs_task* task = object;
+    struct prs_task_stack_usage stack_usage;
+    prs_task_get_stack_usage(task, &stack_usage);
+    struct prs_msgq_stats msgq_stats;
+    prs_task_get_msgq_stats(task, &msgq_stats);
 
-    fct(userdata, "Task %s id=%u prio=%u state=%d sched_id=%u\n",
+    fct(userdata, "Task %s id=%u prio=%u state=%d sched_id=%u deadline=%u period=%u deadline_misses=%u "
+        "stack=%llu/%llu stack_grows=%u msgq=%u/%u msgq_high_water=%u msgq_dropped=%llu\n",
         task->name,
         task->id,
         task->prio,
         prs_task_get_state(task),
-        task->sched_id);
+        task->sched_id,
+        task->deadline,
+        task->period,
+        prs_pal_atomic_load(&task->deadline_misses),
+        (unsigned long long)stack_usage.high_water,
+        (unsigned long long)stack_usage.committed_size,
+        (unsigned)stack_usage.grows,
+        (unsigned)msgq_stats.depth,
+        (unsigned)msgq_stats.capacity,
+        (unsigned)msgq_stats.high_water,
+        (unsigned long long)msgq_stats.dropped);
 }
 
 static struct prs_object_ops s_prs_task_object_ops = {
@@ -141,6 +232,8 @@ static void prs_task_entry(void* userdata)
 
     prs_worker_int_enable(worker);
     task->entry(task->userdata);
+    /* The task may have been moved to another worker of its scheduler */
+    worker = prs_worker_current();
     prs_worker_int_disable(worker);
 
     prs_task_destroy(task);
@@ -148,6 +241,22 @@ static void prs_task_entry(void* userdata)
     prs_worker_schedule(worker);
 }
 
+/**
+ * \brief
+ *  Creates a cache of task objects, meant to be owned by a worker so that tasks can be created and freed without
+ *  taking the task slab lock.
+ */
+struct prs_slab_cache* prs_task_cache_create(void)
+{
+    prs_task_init_slab();
+
+    struct prs_slab_cache_create_params cache_params = {
+        .slab = s_prs_task_slab,
+        .max_objects = PRS_TASK_CACHE_MAX_TASKS
+    };
+    return prs_slab_cache_create(&cache_params);
+}
+
 /**
  * \brief
  *  Creates a task.
@@ -158,13 +267,14 @@ struct prs_task* prs_task_create(struct prs_task_create_params* params)
 {
     if (!s_prs_task_name) {
         struct prs_name_create_params name_params = {
-            .max_entries = PRS_MAX_OBJECTS * 4,
+            .max_entries = PRS_MAX_GOD_ENTRIES,
             .string_offset = offsetof(struct prs_task, name)
         };
         s_prs_task_name = prs_name_create(&name_params);
     }
+    prs_task_init_slab();
 
-    struct prs_task* task = prs_pal_malloc_zero(sizeof(*task));
+    struct prs_task* task = prs_task_alloc();
     PRS_ERROR_IF (!task) {
         goto cleanup;
     }
@@ -176,20 +286,28 @@ struct prs_task* prs_task_create(struct prs_task_create_params* params)
 
     const prs_size_t stack_size = (params->stack_size ? params->stack_size : prs_pal_os_get_page_size());
 
-    task->stack = prs_stack_create(stack_size, &task->stack_size);
+    struct prs_worker* cache_owner = prs_task_cache_owner();
+    if (cache_owner) {
+        task->stack = prs_stack_cache_alloc(prs_worker_get_stack_cache(cache_owner), stack_size, &task->stack_size);
+    } else {
+        task->stack = prs_stack_create(stack_size, &task->stack_size);
+    }
     PRS_ERROR_IF (!task->stack) {
         goto cleanup;
     }
 
-    task->context = prs_pal_context_alloc();
-    PRS_ERROR_IF (!task->context) {
-        goto cleanup;
-    }
+    task->context = prs_pal_context_init((void*)((prs_uintptr_t)task + s_prs_task_context_offset));
 
     struct prs_msgq_create_params msgq_params = {
-        .pd = prs_gpd_get()
+        .pd = prs_gpd_get(),
+        .area = (void*)((prs_uintptr_t)task + s_prs_task_msgq_offset),
+        .capacity = params->msgq_capacity,
+        .full_policy = params->msgq_full_policy
     };
     task->msgq = prs_msgq_create(&msgq_params);
+    PRS_ERROR_IF (!task->msgq) {
+        goto cleanup;
+    }
 
     /* Inherit the process pointer. If there is no worker, this is probably the first task, ever. */
     struct prs_worker* worker = prs_worker_current();
@@ -206,15 +324,21 @@ struct prs_task* prs_task_create(struct prs_task_create_params* params)
 
     prs_str_copy(task->name, params->name, sizeof(task->name));
     task->prio = params->prio;
+    task->base_prio = params->prio;
+    task->deadline = params->deadline;
+    task->period = params->period;
     task->userdata = params->userdata;
     task->entry = params->entry;
     prs_task_change_state(task, 0, PRS_TASK_STATE_STOPPED);
 
     prs_pal_context_make(task->context, task->stack, prs_task_entry, 1, task);
 
-    prs_result_t result = prs_name_alloc(s_prs_task_name, task->id);
-    if (result != PRS_OK) {
-        goto cleanup;
+    /* Anonymous tasks cannot be found by name, and skip the name registration */
+    if (task->name[0]) {
+        const prs_result_t result = prs_name_alloc(s_prs_task_name, task->id);
+        if (result != PRS_OK) {
+            goto cleanup;
+        }
     }
 
     return task;
@@ -225,7 +349,7 @@ struct prs_task* prs_task_create(struct prs_task_create_params* params)
         if (task->id) {
             prs_god_unlock(task->id);
         } else {
-            prs_pal_free(task);
+            prs_task_free(task);
         }
     }
 
@@ -264,9 +388,12 @@ struct prs_task* prs_task_current(void)
  */
 void prs_task_destroy(struct prs_task* task)
 {
-    /* Use the name hash free result to find out if the task was already destroyed. */
-    const prs_result_t result = prs_name_free(s_prs_task_name, task->id);
-    if (result == PRS_OK) {
+    if (!prs_pal_atomic_exchange(&task->destroyed, PRS_TRUE)) {
+        if (task->name[0]) {
+            prs_name_free(s_prs_task_name, task->id);
+        }
+        /* Senders waiting for room in the message queue would wait forever */
+        prs_msgq_close(task->msgq);
         PRS_FTRACE("%s (%u)", task->name, task->id);
         if (task->sched_id) {
             prs_sched_remove_task(task->sched_id, task->id);
@@ -301,6 +428,136 @@ prs_task_prio_t prs_task_get_prio(struct prs_task* task)
     return task->prio;
 }
 
+/**
+ * \brief
+ *  Returns the number of deadline misses of a task.
+ * \param task
+ *  Task to get the deadline misses from.
+ * \note
+ *  Only deadline schedulers count deadline misses. For other schedulers, the returned value is always zero.
+ */
+prs_uint_t prs_task_get_deadline_misses(struct prs_task* task)
+{
+    return prs_pal_atomic_load(&task->deadline_misses);
+}
+
+/**
+ * \brief
+ *  Returns the stack usage of a task.
+ * \param task
+ *  Task to get the stack usage from.
+ * \param usage
+ *  Receives the stack usage.
+ * \note
+ *  The high-water mark is a lower bound of the actual stack usage: it is sampled when the task is switched out and
+ *  when its stack grows. When \ref PRS_STACK_SCAN is defined, it is exact as it also comes from a scan of the stack.
+ */
+void prs_task_get_stack_usage(struct prs_task* task, struct prs_task_stack_usage* usage)
+{
+    usage->committed_size = task->stack_size;
+    usage->high_water = prs_pal_atomic_load(&task->stack_high_water);
+    usage->grows = prs_pal_atomic_load(&task->stack_grows);
+#if defined(PRS_STACK_SCAN)
+    const prs_size_t scanned = prs_stack_scan_usage(task->stack, usage->committed_size);
+    if (scanned > usage->high_water) {
+        usage->high_water = scanned;
+    }
+#endif /* PRS_STACK_SCAN */
+}
+
+/**
+ * \brief
+ *  Returns the statistics of the message queue of a task.
+ * \param task
+ *  Task to get the message queue statistics from.
+ * \param stats
+ *  Receives the statistics.
+ */
+void prs_task_get_msgq_stats(struct prs_task* task, struct prs_msgq_stats* stats)
+{
+    prs_msgq_get_stats(task->msgq, stats);
+}
+
+static void prs_task_reclaim_stack(void* userdata, void* object)
+{
+    struct prs_task_stack_reclaim_stats* stats = userdata;
+    struct prs_task* task = object;
+
+    if (prs_task_get_state(task) != PRS_TASK_STATE_BLOCKED || task->stack_size <= PRS_STACK_RECLAIM_MIN_SIZE) {
+        return;
+    }
+
+    prs_bool_t reclaiming = PRS_FALSE;
+    if (!prs_pal_atomic_compare_exchange_strong(&task->stack_reclaiming, &reclaiming, PRS_TRUE)) {
+        return;
+    }
+
+    /*
+     * Workers set the context loaded flag before checking the reclaiming flag, and we do the opposite: either the task
+     * is seen as loaded here, or the worker that loads it waits until we are done.
+     */
+    if (!prs_pal_atomic_load(&task->context_loaded) && prs_task_get_state(task) == PRS_TASK_STATE_BLOCKED) {
+        /* Keep the area below the stack pointer that the ABI allows leaf functions to use */
+        const prs_uintptr_t keep_ptr = (prs_uintptr_t)prs_pal_context_get_sp(task->context) - PRS_TASK_STACK_RED_ZONE;
+        const prs_size_t old_size = task->stack_size;
+        if ((prs_uintptr_t)task->stack - keep_ptr + PRS_STACK_RECLAIM_MIN_SIZE <= old_size) {
+            task->stack_size = prs_stack_shrink(task->stack, old_size, (void*)keep_ptr);
+            if (task->stack_size < old_size) {
+                stats->reclaims++;
+                stats->reclaimed_size += old_size - task->stack_size;
+            }
+        }
+    }
+
+    prs_pal_atomic_store(&task->stack_reclaiming, PRS_FALSE);
+}
+
+/**
+ * \brief
+ *  Shrinks the stacks of the blocked tasks by uncommitting the pages that are below their stack pointer.
+ * \param stats
+ *  Receives the results of the pass.
+ * \note
+ *  Only the stacks that would shrink by at least \ref PRS_STACK_RECLAIM_MIN_SIZE bytes are shrunk. A task that later
+ *  needs the uncommitted pages grows its stack again through the stack overflow exception handler.
+ */
+void prs_task_reclaim_stacks(struct prs_task_stack_reclaim_stats* stats)
+{
+    stats->reclaims = 0;
+    stats->reclaimed_size = 0;
+    prs_god_foreach(&s_prs_task_object_ops, prs_task_reclaim_stack, stats);
+}
+
+/**
+ * \brief
+ *  Records the stack usage of a task at an address of its stack.
+ * \param task
+ *  Task whose stack is sampled. The task must be the one running on the current worker.
+ * \param address
+ *  Address in the stack of the task, typically the address of a local variable.
+ */
+void prs_task_sample_stack(struct prs_task* task, void* address)
+{
+    const prs_size_t depth = (prs_uintptr_t)task->stack - (prs_uintptr_t)address;
+    if (depth > prs_pal_atomic_load(&task->stack_high_water) && depth <= task->stack_size) {
+        prs_pal_atomic_store(&task->stack_high_water, depth);
+    }
+}
+
+/**
+ * \brief
+ *  Records that the stack of a task was grown to make an address accessible.
+ * \param task
+ *  Task whose stack was grown. The task must be the one running on the current worker.
+ * \param address
+ *  Address that overflowed the stack.
+ */
+void prs_task_grew_stack(struct prs_task* task, void* address)
+{
+    prs_pal_atomic_store(&task->stack_grows, prs_pal_atomic_load(&task->stack_grows) + 1);
+    prs_task_sample_stack(task, address);
+}
+
 /**
  * \brief
  *  Changes the priority of a task.
@@ -309,8 +566,9 @@ prs_task_prio_t prs_task_get_prio(struct prs_task* task)
  * \param prio
  *  Priority to set.
  * \note
- *  Has no effect if the scheduler for the task does not support priorities. Only works if \p task is the current
- *  running task.
+ *  Has no effect if the scheduler for the task does not support priorities. When \p task is not the current running
+ *  task, its scheduler is notified through \ref prs_sched_set_prio, and schedulers that do not implement it only take
+ *  the new priority into account the next time the task is made ready.
  */
 void prs_task_set_prio(struct prs_task* task, prs_task_prio_t prio)
 {
@@ -328,12 +586,28 @@ void prs_task_set_prio(struct prs_task* task, prs_task_prio_t prio)
          * re-schedule tasks according to the priority change above.
          */
         prs_worker_signal(worker);
-    } else {
-        /*
-         * There is no mechanism at this point to change the priority of a task that is currently running on another
-         * worker.
-         */
-        PRS_ERROR("ERROR: prs_task_set_prio() can only be called from the target task");
+    } else if (task->sched_id) {
+        prs_sched_set_prio(task);
+    }
+}
+
+/**
+ * \brief
+ *  Changes the base priority of a task, which is the priority it returns to when it releases its last mutex.
+ * \param task
+ *  Task to set the base priority to.
+ * \param prio
+ *  Base priority to set.
+ * \note
+ *  While the task holds mutexes, a priority it inherited from the tasks waiting for them is kept if it is higher.
+ *  When the task is waiting for a mutex, it is moved to its place in the wait queue of the mutex.
+ */
+void prs_task_set_base_prio(struct prs_task* task, prs_task_prio_t prio)
+{
+    task->base_prio = prio;
+    if (!task->mutexes_held || prio < task->prio) {
+        prs_task_set_prio(task, prio);
+        prs_mutex_requeue(task);
     }
 }
 
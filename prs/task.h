@@ -32,8 +32,10 @@
 #include <prs/pal/atomic.h>
 #include <prs/config.h>
 #include <prs/event.h>
+#include <prs/idllist.h>
 #include <prs/msgq.h>
 #include <prs/sched.h>
+#include <prs/ticks.h>
 #include <prs/types.h>
 
 /**
@@ -60,6 +62,20 @@ enum prs_task_state {
  */
 typedef prs_uint_t prs_task_token_t;
 
+/**
+ * \brief
+ *  Node used to queue a task on a synchronization object while it is blocked. A task waits for at most one object at
+ *  a time, so the node is embedded in the task and no allocation is needed to wait.
+ */
+struct prs_task_wait_node {
+    /** \brief Node in the wait queue of the object, protected by the lock of the object. */
+    struct prs_idllist_node             node;
+    /** \brief Token returned by \ref prs_task_block, used to unblock the task. */
+    prs_task_token_t                    token;
+    /** \brief Set while the node is in a wait queue, protected by the lock of the object. */
+    prs_bool_t                          queued;
+};
+
 struct prs_task {
     prs_task_id_t                       id;
 
@@ -68,8 +84,26 @@ struct prs_task {
 
     void*                               stack;
     prs_size_t                          stack_size;
+    /* Deepest stack usage sampled so far, and number of times the stack was grown */
+    PRS_ATOMIC prs_size_t               stack_high_water;
+    PRS_ATOMIC prs_uint_t               stack_grows;
+    /* Set while the stack is being shrunk, which prevents workers from loading the task */
+    PRS_ATOMIC prs_bool_t               stack_reclaiming;
 
     prs_task_prio_t                     prio;
+    /* Priority set for the task, which prio may temporarily exceed while the task holds mutexes */
+    prs_task_prio_t                     base_prio;
+    /* Number of mutexes held by the task, and list of these mutexes, only accessed by the task itself */
+    prs_uint_t                          mutexes_held;
+    struct prs_mutex*                   held_mutexes;
+    /* Mutex that the task is waiting for, protected by the lock of that mutex */
+    PRS_ATOMIC prs_mutex_id_t           blocked_mutex_id;
+
+    /* Relative deadline and period of the task's jobs, in ticks, used by deadline schedulers */
+    prs_ticks_t                         deadline;
+    prs_ticks_t                         period;
+    /* Number of jobs that completed or were still running past their deadline */
+    PRS_ATOMIC prs_uint_t               deadline_misses;
 
     prs_proc_id_t                       proc_id;
     prs_sched_id_t                      sched_id;
@@ -79,12 +113,30 @@ struct prs_task {
     PRS_ATOMIC prs_task_token_t         state;
 
     struct prs_pal_context*             context;
+    /*
+     * Set while the register context is loaded on a worker, up until it is completely saved by a context switch. A
+     * task must not be resumed on another worker while this flag is set.
+     */
+    PRS_ATOMIC prs_bool_t               context_loaded;
+    /*
+     * Preemption request word of the worker currently running the task, polled by the task at its safepoints. It is
+     * updated by the worker whenever the task is switched in, so that it follows the task across workers.
+     */
+    PRS_ATOMIC int*                     safepoint;
 
     void                                (*entry)(void* userdata);
 
     struct prs_msgq*                    msgq;
+
+    /* Queues the task on a semaphore or a mutex while it waits for it */
+    struct prs_task_wait_node           wait_node;
+
+    /* Set by the first call to prs_task_destroy */
+    PRS_ATOMIC prs_bool_t               destroyed;
 };
 
+struct prs_slab_cache* prs_task_cache_create(void);
+
 enum prs_task_state prs_task_get_state(struct prs_task* task);
 void prs_task_change_state(struct prs_task* task, enum prs_task_state expected_state, enum prs_task_state new_state);
 
@@ -95,4 +147,7 @@ prs_uint8_t prs_task_get_last_unblock_cause(struct prs_task* task);
 
 prs_result_t prs_task_set_proc(struct prs_task* task, prs_proc_id_t proc_id);
 
+void prs_task_sample_stack(struct prs_task* task, void* address);
+void prs_task_grew_stack(struct prs_task* task, void* address);
+
 #endif /* _PRSP_TASK_H */
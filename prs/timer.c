@@ -20,6 +20,7 @@
  *  portableruntimesystem@gmail.com
  */
 
+
 /**
  * \file
  * \brief
@@ -31,11 +32,34 @@
  *  Tasks request to be unblocked after a delay using the \ref prs_timer_queue function. They must end the request
  *  using the \ref prs_timer_cancel function after the timeout has expired or another unblocking event has occurred.
  *
- *  The clock module calls \ref prs_timer_tick at every system tick.
+ *  Each worker owns a timer, so that expiries are processed on the core of the tasks that requested them. The owner
+ *  calls \ref prs_timer_tick from its own context, and only the owner may do so. The clock module calls
+ *  \ref prs_timer_poll at every system tick (or, when the clock is tickless, at the requested expiries). Polling only
+ *  compares the current time against the next expiry published by the owner, and notifies the owner through the
+ *  \ref prs_timer_create_params::notify callback when it must call \ref prs_timer_tick. All the ticks that elapsed
+ *  since the previous call are then processed at once. The callback is also given the highest priority among the
+ *  tasks waiting for a timeout, so that the owner does not need to interrupt a running task that none of them could
+ *  preempt.
+ *
+ *  Timeouts queued with \ref prs_timer_queue_ns are expressed in nanoseconds. Rather than in the timing wheels, they
+ *  are kept in a min-heap ordered by expiry time, which \ref prs_timer_tick pops once their expiry is reached. The
+ *  clock is asked to poll the timer at that exact time through \ref prs_clock_request_ns.
+ *
+ *  Timeouts are usually canceled long before they expire, so arming and canceling them is kept cheap. Requests are
+ *  made from the owner, in a non-interruptible section, which cannot run concurrently with \ref prs_timer_tick. The
+ *  entries are therefore taken from a free list that belongs to the owner and are directly inserted in the wheels or
+ *  in the heap. The free list is refilled from a slab that belongs to the timer, so that its memory grows with the
+ *  number of timeouts that are armed at the same time rather than being reserved up front; the heap doubles in size
+ *  when it is full. When the owner cancels an entry that did not expire, it simply unlinks it and puts it back in its free
+ *  list. Only a task that resumed on another worker cancels its entry through an atomic state change, in which case
+ *  the owner reclaims the entry when it would have expired.
  */
 
 #include <stddef.h>
+#include <string.h>
 
+#include <prs/alloc/slab.h>
+#include <prs/pal/atomic.h>
 #include <prs/pal/bitops.h>
 #include <prs/pal/cycles.h>
 #include <prs/pal/inline.h>
@@ -49,8 +73,8 @@
 #include <prs/task.h>
 #include <prs/clock.h>
 #include <prs/mpsciq.h>
-#include <prs/pool.h>
 #include <prs/timer.h>
+#include <prs/worker.h>
 
 #include "task.h"
 
@@ -58,24 +82,67 @@
 #define PRS_MAX_TIMER_BITS_PER_WHEEL    ((sizeof(prs_ticks_t) * 8) / PRS_MAX_TIMER_WHEELS)
 #define PRS_MAX_TIMER_SLOTS_PER_WHEEL   (1 << PRS_MAX_TIMER_BITS_PER_WHEEL)
 #define PRS_TIMER_TICKS_MASK            (PRS_MAX_TIMER_WHEELS * PRS_MAX_TIMER_BITS_PER_WHEEL)
+/* Number of entries allocated at once by the slab of a timer */
+#define PRS_TIMER_ENTRIES_PER_CHUNK     64
+/* Initial number of entries that the high resolution heap can hold */
+#define PRS_TIMER_HEAP_MIN_SIZE         16
+
+/* The entry is in the wheels or in the heap, and the task still waits for it */
+#define PRS_TIMER_ENTRY_STATE_ARMED     0
+/* The event was signaled: the entry is freed when it is canceled */
+#define PRS_TIMER_ENTRY_STATE_FIRED     1
+/* The entry was canceled by another worker: the owner frees it when it would have expired */
+#define PRS_TIMER_ENTRY_STATE_CANCELED  2
 
 struct prs_timer {
     struct prs_idllist*                 lists[PRS_MAX_TIMER_WHEELS][PRS_MAX_TIMER_SLOTS_PER_WHEEL];
     struct prs_idllist*                 tmp_list;
 
-    struct prs_pool*                    pool;
+    /* Storage of all the entries, which are never returned to it until the timer is destroyed */
+    struct prs_slab*                    slab;
+    /* Entries that were freed by the owner */
+    struct prs_timer_entry*             free_list;
+    /* Entries that were freed by other workers, which the owner moves to its free list */
+    struct prs_mpsciq*                  freed;
 
-    struct prs_mpsciq*                  queued;
+    /* Min-heap of high resolution entries, ordered by expiry time */
+    struct prs_timer_entry**            heap;
+    prs_size_t                          heap_count;
+    prs_size_t                          heap_capacity;
 
     prs_ticks_t                         now;
+    prs_uint64_t                        now_ns;
+
+    void*                               userdata;
+    void                                (*notify)(void* userdata, prs_task_prio_t prio);
+
+    /* Number of armed entries for each priority of their task, and bitmap of the non-empty ones for prs_timer_poll() */
+    prs_uint_t                          prio_counts[PRS_MAX_TASK_PRIO];
+    PRS_ATOMIC prs_uint64_t             prio_mask;
+
+    /* Set when the owner must call prs_timer_tick() because an expiry elapsed */
+    PRS_ATOMIC prs_bool_t               signaled;
+    /* Tick of the next expiry plus one, or zero when there is none. Published by the owner for prs_timer_poll() */
+    PRS_ATOMIC prs_uint64_t             due;
+    /* Time of the next high resolution expiry, or zero when there is none. Published by the owner */
+    PRS_ATOMIC prs_uint64_t             due_ns;
 };
 
 struct prs_timer_entry {
-    /* The following two nodes cannot be in a union because prs_mpsciq_node uses atomic fields */
     struct prs_idllist_node             idllist;
     struct prs_mpsciq_node              mpsciq;
+    struct prs_timer_entry*             next_free;
+    /* Wheel list containing the entry, or null when the entry is in the heap */
+    struct prs_idllist*                 list;
+    prs_size_t                          heap_index;
+    PRS_ATOMIC prs_uint_t               state;
     prs_ticks_t                         start;
     prs_ticks_t                         end;
+    prs_bool_t                          high_res;
+    /* Priority of the task that queued the entry */
+    prs_task_prio_t                     prio;
+    prs_uint64_t                        start_ns;
+    prs_uint64_t                        end_ns;
     struct prs_event*                   event;
     prs_event_type_t                    event_type;
 };
@@ -83,10 +150,18 @@ struct prs_timer_entry {
 /**
  * \brief
  *  Creates a timer.
+ * \param params
+ *  Timer parameters.
+ * \see
+ *  prs_timer_create_params
  */
-struct prs_timer* prs_timer_create(void)
+struct prs_timer* prs_timer_create(struct prs_timer_create_params* params)
 {
-    struct prs_timer* timer = prs_pal_malloc(sizeof(*timer));
+    PRS_STATIC_ASSERT(PRS_MAX_TASK_PRIO <= 64);
+    PRS_PRECONDITION(params);
+    PRS_PRECONDITION(params->notify);
+
+    struct prs_timer* timer = prs_pal_malloc_zero(sizeof(*timer));
     if (!timer) {
         return 0;
     }
@@ -109,40 +184,52 @@ struct prs_timer* prs_timer_create(void)
         goto cleanup;
     }
 
-    struct prs_pool_create_params pool_params = {
-        /*
-         * There won't be more than PRS_MAX_OBJECT tasks, but a single task could start a few timers before the tick is
-         * called.
-         */
-        .max_entries = PRS_MAX_OBJECTS * 16,
-        .data_size = sizeof(struct prs_timer_entry),
-        .area = 0
+    struct prs_slab_create_params slab_params = {
+        .object_size = sizeof(struct prs_timer_entry),
+        .object_align = sizeof(void*),
+        .chunk_objects = PRS_TIMER_ENTRIES_PER_CHUNK
     };
-    timer->pool = prs_pool_create(&pool_params);
-    if (!timer->pool) {
+    timer->slab = prs_slab_create(&slab_params);
+    if (!timer->slab) {
         goto cleanup;
     }
 
     struct prs_mpsciq_create_params mpsciq_params = {
         .node_offset = offsetof(struct prs_timer_entry, mpsciq)
     };
-    timer->queued = prs_mpsciq_create(&mpsciq_params);
-    if (!timer->queued) {
+    timer->freed = prs_mpsciq_create(&mpsciq_params);
+    if (!timer->freed) {
+        goto cleanup;
+    }
+
+    timer->heap = prs_pal_malloc(sizeof(*timer->heap) * PRS_TIMER_HEAP_MIN_SIZE);
+    if (!timer->heap) {
         goto cleanup;
     }
+    timer->heap_capacity = PRS_TIMER_HEAP_MIN_SIZE;
 
     timer->now = prs_clock_get();
+    timer->now_ns = prs_clock_get_ns();
+    timer->userdata = params->userdata;
+    timer->notify = params->notify;
+    prs_pal_atomic_store(&timer->signaled, PRS_FALSE);
+    prs_pal_atomic_store(&timer->due, 0);
+    prs_pal_atomic_store(&timer->due_ns, 0);
+    prs_pal_atomic_store(&timer->prio_mask, 0);
 
     return timer;
 
     cleanup:
 
     if (timer) {
-        if (timer->queued) {
-            prs_mpsciq_destroy(timer->queued);
+        if (timer->heap) {
+            prs_pal_free(timer->heap);
         }
-        if (timer->pool) {
-            prs_pool_destroy(timer->pool);
+        if (timer->freed) {
+            prs_mpsciq_destroy(timer->freed);
+        }
+        if (timer->slab) {
+            prs_slab_destroy(timer->slab);
         }
         if (timer->tmp_list) {
             prs_idllist_destroy(timer->tmp_list);
@@ -167,24 +254,245 @@ struct prs_timer* prs_timer_create(void)
  */
 void prs_timer_destroy(struct prs_timer* timer)
 {
-    prs_mpsciq_destroy(timer->queued);
+    prs_pal_free(timer->heap);
+    prs_mpsciq_destroy(timer->freed);
     prs_idllist_destroy(timer->tmp_list);
     for (int wheel = 0; wheel < PRS_MAX_TIMER_WHEELS; ++wheel) {
         for (int slot = 0; slot < PRS_MAX_TIMER_SLOTS_PER_WHEEL; ++slot) {
-            /* Note: elements in each list are part of the pool, so there is nothing to free there */
+            /* Note: elements in each list are part of the entries, so there is nothing to free there */
             struct prs_idllist* idllist = timer->lists[wheel][slot];
             prs_idllist_destroy(idllist);
         }
     }
-    prs_pool_destroy(timer->pool);
+    prs_slab_destroy(timer->slab);
     prs_pal_free(timer);
 }
 
+/*
+ * Returns if the caller may access the timer's internal lists. Only the owner can, while it is in a non-interruptible
+ * section, since prs_timer_tick() cannot run at the same time.
+ */
+static prs_bool_t prs_timer_is_owner(struct prs_timer* timer)
+{
+    struct prs_worker* worker = prs_worker_current();
+    return PRS_BOOL(worker && prs_worker_get_timer(worker) == timer && !prs_worker_int_enabled(worker));
+}
+
+static void prs_timer_arm(struct prs_timer* timer, struct prs_timer_entry* entry)
+{
+    if (!timer->prio_counts[entry->prio]++) {
+        prs_pal_atomic_store(&timer->prio_mask, prs_pal_atomic_load(&timer->prio_mask) | (1ull << entry->prio));
+    }
+}
+
+static void prs_timer_disarm(struct prs_timer* timer, struct prs_timer_entry* entry)
+{
+    PRS_ASSERT(timer->prio_counts[entry->prio]);
+    if (!--timer->prio_counts[entry->prio]) {
+        prs_pal_atomic_store(&timer->prio_mask, prs_pal_atomic_load(&timer->prio_mask) & ~(1ull << entry->prio));
+    }
+}
+
+static void prs_timer_free(struct prs_timer* timer, struct prs_timer_entry* entry)
+{
+    entry->next_free = timer->free_list;
+    timer->free_list = entry;
+}
+
+static struct prs_timer_entry* prs_timer_alloc(struct prs_timer* timer, struct prs_event* event,
+    prs_event_type_t event_type)
+{
+    struct prs_timer_entry* entry = timer->free_list;
+    if (!entry) {
+        /* Take back the entries that were freed by other workers */
+        struct prs_mpsciq_node* node;
+        while ((node = prs_mpsciq_begin(timer->freed)) != 0) {
+            struct prs_timer_entry* freed_entry = prs_mpsciq_get_data(timer->freed, node);
+            prs_mpsciq_remove(timer->freed, node);
+            prs_timer_free(timer, freed_entry);
+        }
+        entry = timer->free_list;
+    }
+
+    if (entry) {
+        timer->free_list = entry->next_free;
+    } else {
+        entry = prs_slab_alloc(timer->slab);
+        PRS_FATAL_WHEN(!entry);
+        memset(entry, 0, sizeof(*entry));
+    }
+
+    entry->event = event;
+    entry->event_type = event_type;
+    entry->start = prs_clock_get();
+    struct prs_task* task = prs_worker_get_current_task(prs_worker_current());
+    entry->prio = task && task->prio < PRS_MAX_TASK_PRIO ? task->prio : 0;
+    prs_pal_atomic_store(&entry->state, PRS_TIMER_ENTRY_STATE_ARMED);
+    prs_timer_arm(timer, entry);
+
+    return entry;
+}
+
+static PRS_INLINE int prs_timer_hsb(prs_ticks_t ticks)
+{
+    if (sizeof(ticks) == 4) {
+        return prs_bitops_hsb_uint32(ticks);
+    } else if (sizeof(ticks) == 8) {
+        return prs_bitops_hsb_uint64(ticks);
+    } else {
+        PRS_ASSERT(PRS_FALSE);
+        return 0;
+    }
+}
+
+static void prs_timer_heap_set(struct prs_timer* timer, prs_size_t index, struct prs_timer_entry* entry)
+{
+    timer->heap[index] = entry;
+    entry->heap_index = index;
+}
+
+static void prs_timer_heap_sift_up(struct prs_timer* timer, prs_size_t index, struct prs_timer_entry* entry)
+{
+    struct prs_timer_entry** heap = timer->heap;
+    while (index > 0) {
+        const prs_size_t parent = (index - 1) / 2;
+        if (heap[parent]->end_ns <= entry->end_ns) {
+            break;
+        }
+        prs_timer_heap_set(timer, index, heap[parent]);
+        index = parent;
+    }
+    prs_timer_heap_set(timer, index, entry);
+}
+
+static void prs_timer_heap_sift_down(struct prs_timer* timer, prs_size_t index, struct prs_timer_entry* entry)
+{
+    struct prs_timer_entry** heap = timer->heap;
+    const prs_size_t count = timer->heap_count;
+    for (;;) {
+        prs_size_t child = index * 2 + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && heap[child + 1]->end_ns < heap[child]->end_ns) {
+            ++child;
+        }
+        if (entry->end_ns <= heap[child]->end_ns) {
+            break;
+        }
+        prs_timer_heap_set(timer, index, heap[child]);
+        index = child;
+    }
+    prs_timer_heap_set(timer, index, entry);
+}
+
+static void prs_timer_heap_push(struct prs_timer* timer, struct prs_timer_entry* entry)
+{
+    if (timer->heap_count == timer->heap_capacity) {
+        const prs_size_t capacity = timer->heap_capacity * 2;
+        struct prs_timer_entry** heap = prs_pal_malloc(sizeof(*heap) * capacity);
+        PRS_FATAL_WHEN(!heap);
+        memcpy(heap, timer->heap, sizeof(*heap) * timer->heap_count);
+        prs_pal_free(timer->heap);
+        timer->heap = heap;
+        timer->heap_capacity = capacity;
+    }
+    prs_timer_heap_sift_up(timer, timer->heap_count++, entry);
+}
+
+static void prs_timer_heap_remove(struct prs_timer* timer, struct prs_timer_entry* entry)
+{
+    PRS_ASSERT(timer->heap_count > 0);
+    const prs_size_t index = entry->heap_index;
+    PRS_ASSERT(timer->heap[index] == entry);
+    struct prs_timer_entry* last = timer->heap[--timer->heap_count];
+    if (last == entry) {
+        return;
+    }
+    if (index > 0 && last->end_ns < timer->heap[(index - 1) / 2]->end_ns) {
+        prs_timer_heap_sift_up(timer, index, last);
+    } else {
+        prs_timer_heap_sift_down(timer, index, last);
+    }
+}
+
+static struct prs_timer_entry* prs_timer_heap_pop(struct prs_timer* timer)
+{
+    struct prs_timer_entry* top = timer->heap[0];
+    prs_timer_heap_remove(timer, top);
+    return top;
+}
+
+/*
+ * Signals the event of an entry that expired, unless the entry was canceled by another worker in the meantime, in
+ * which case it is freed.
+ */
+static void prs_timer_expire(struct prs_timer* timer, struct prs_timer_entry* entry)
+{
+    /* Once the entry is fired, the task may free it at any time */
+    struct prs_event* event = entry->event;
+    const prs_event_type_t event_type = entry->event_type;
+    prs_timer_disarm(timer, entry);
+    prs_uint_t state = PRS_TIMER_ENTRY_STATE_ARMED;
+    if (prs_pal_atomic_compare_exchange_strong(&entry->state, &state, PRS_TIMER_ENTRY_STATE_FIRED)) {
+        prs_event_signal(event, event_type);
+    } else {
+        PRS_ASSERT(state == PRS_TIMER_ENTRY_STATE_CANCELED);
+        prs_event_unref(event);
+        prs_timer_free(timer, entry);
+    }
+}
+
+static void prs_timer_queue_internal(struct prs_timer* timer, struct prs_timer_entry* entry)
+{
+    if (entry->high_res) {
+        if (entry->end_ns <= timer->now_ns) {
+            prs_timer_expire(timer, entry);
+            return;
+        }
+
+        entry->list = 0;
+        prs_timer_heap_push(timer, entry);
+        return;
+    }
+
+    /* Ticks wrap around: a delay in the upper half of the range is a negative delay */
+    const prs_ticks_t delay = entry->end - timer->now;
+    if (!delay || delay > ((prs_ticks_t)-1 >> 1)) {
+        /*
+         * Here, the delay should be zero, but sometimes it can be a negative number because the clock tick can be read
+         * just before it is incremented, and then sent as the delay in the timer queuing request. When the clock is
+         * tickless, the entry can also be queued internally a few ticks after it expired.
+         * PRS_ASSERT(delay == 0);
+         */
+        prs_timer_expire(timer, entry);
+        return;
+    }
+
+    /* An entry canceled by another worker is freed as soon as the owner comes across it */
+    if (prs_pal_atomic_load(&entry->state) == PRS_TIMER_ENTRY_STATE_CANCELED) {
+        prs_timer_expire(timer, entry);
+        return;
+    }
+
+    const prs_int_t hsb = prs_timer_hsb(delay);
+    PRS_ASSERT(hsb >= 0);
+    const prs_int_t wheel = hsb / PRS_MAX_TIMER_BITS_PER_WHEEL;
+    PRS_ASSERT(wheel < PRS_MAX_TIMER_WHEELS);
+    const prs_int_t wheel_shift = wheel * PRS_MAX_TIMER_BITS_PER_WHEEL;
+    const prs_uint_t slot = ((entry->end >> wheel_shift) - !!wheel) & (PRS_MAX_TIMER_SLOTS_PER_WHEEL - 1);
+    PRS_ASSERT(slot < PRS_MAX_TIMER_SLOTS_PER_WHEEL);
+
+    struct prs_idllist* list = timer->lists[wheel][slot];
+    entry->list = list;
+    prs_idllist_insert_before(list, 0, &entry->idllist);
+}
+
 /**
  * \brief
  *  Queues a timeout request.
  * \param timer
- *  Timer for which the timeout request must be queued.
+ *  Timer for which the timeout request must be queued. It must be the timer of the current worker.
  * \param event
  *  Event that will be signaled through \ref prs_event_signal when the timeout occurs. If the request is canceled,
  *  the event will be unreferenced through \ref prs_event_unref.
@@ -194,29 +502,69 @@ void prs_timer_destroy(struct prs_timer* timer)
  *  Timeout in ticks.
  * \return
  *  The timeout entry that must be passed as a parameter to \ref prs_timer_cancel after the task is unblocked.
+ * \note
+ *  This function must be called in a non-interruptible section.
  */
 struct prs_timer_entry* prs_timer_queue(struct prs_timer* timer, struct prs_event* event, prs_event_type_t event_type,
     prs_ticks_t timeout)
 {
-    prs_pool_id_t entry_id = PRS_POOL_ID_INVALID;
-    struct prs_timer_entry* entry = prs_pool_alloc(timer->pool, &entry_id);
-    PRS_FATAL_WHEN(!entry || entry_id == PRS_POOL_ID_INVALID);
+    PRS_PRECONDITION(prs_timer_is_owner(timer));
 
-    entry->event = event;
-    entry->event_type = event_type;
-    entry->start = prs_clock_get();
+    struct prs_timer_entry* entry = prs_timer_alloc(timer, event, event_type);
     entry->end = entry->start + timeout;
+    entry->high_res = PRS_FALSE;
 
-    prs_pool_lock_first(timer->pool, entry_id);
+    prs_timer_queue_internal(timer, entry);
 
     /*
-     * Here, we lock the entry a second time. One reference belongs to the caller while one reference will be handled
-     * by the timer tick.
+     * The entry expires when the tick following its end is reached. Keep the published expiry if it comes first, or if
+     * it is already reached but not processed yet.
      */
-    struct prs_timer_entry* locked_entry = prs_pool_lock(timer->pool, entry_id);
-    PRS_ASSERT(locked_entry == entry);
+    const prs_uint64_t published = prs_pal_atomic_load(&timer->due);
+    const prs_ticks_t published_delay = (prs_ticks_t)(published - 1) - entry->start;
+    if (!published || (published_delay && published_delay <= ((prs_ticks_t)-1 >> 1) &&
+        published_delay > timeout + 1)) {
+        prs_pal_atomic_store(&timer->due, (prs_uint64_t)(prs_ticks_t)(entry->end + 1) + 1);
+    }
+    prs_clock_request(timeout + 1);
+
+    return entry;
+}
+
+/**
+ * \brief
+ *  Queues a high resolution timeout request.
+ * \param timer
+ *  Timer for which the timeout request must be queued. It must be the timer of the current worker.
+ * \param event
+ *  Event that will be signaled through \ref prs_event_signal when the timeout occurs. If the request is canceled,
+ *  the event will be unreferenced through \ref prs_event_unref.
+ * \param event_type
+ *  Event type that will be passed to \ref prs_event_signal when the timeout occurs.
+ * \param timeout_ns
+ *  Timeout in nanoseconds.
+ * \return
+ *  The timeout entry that must be passed as a parameter to \ref prs_timer_cancel after the task is unblocked.
+ * \note
+ *  This function must be called in a non-interruptible section.
+ */
+struct prs_timer_entry* prs_timer_queue_ns(struct prs_timer* timer, struct prs_event* event,
+    prs_event_type_t event_type, prs_uint64_t timeout_ns)
+{
+    PRS_PRECONDITION(prs_timer_is_owner(timer));
+
+    struct prs_timer_entry* entry = prs_timer_alloc(timer, event, event_type);
+    entry->start_ns = prs_clock_get_ns();
+    entry->end_ns = entry->start_ns + timeout_ns;
+    entry->high_res = PRS_TRUE;
 
-    prs_mpsciq_push(timer->queued, &entry->mpsciq);
+    prs_timer_queue_internal(timer, entry);
+
+    const prs_uint64_t published_ns = prs_pal_atomic_load(&timer->due_ns);
+    if (!published_ns || entry->end_ns < published_ns) {
+        prs_pal_atomic_store(&timer->due_ns, entry->end_ns);
+    }
+    prs_clock_request_ns(entry->end_ns);
 
     return entry;
 }
@@ -234,71 +582,158 @@ prs_ticks_t prs_timer_get_start(struct prs_timer_entry* entry)
 
 /**
  * \brief
- *  Cancels the timer request. This must be called after every \ref prs_timer_queue call.
+ *  Returns the time, in nanoseconds, that was recorded when \ref prs_timer_queue_ns created the timer entry.
+ * \param
+ *  Timer entry returned by \ref prs_timer_queue_ns.
+ */
+prs_uint64_t prs_timer_get_start_ns(struct prs_timer_entry* entry)
+{
+    return entry->start_ns;
+}
+
+/**
+ * \brief
+ *  Cancels the timer request. This must be called after every \ref prs_timer_queue or \ref prs_timer_queue_ns call.
  * \param timer
  *  Timer module for which to cancel the timer entry.
  * \param entry
- *  Timer entry returned by \ref prs_timer_queue.
+ *  Timer entry returned by \ref prs_timer_queue or \ref prs_timer_queue_ns.
+ * \note
+ *  The task may have resumed on another worker than the owner of the timer, in which case the entry is freed by the
+ *  owner later on.
  */
 void prs_timer_cancel(struct prs_timer* timer, struct prs_timer_entry* entry)
 {
-    prs_pool_unlock(timer->pool, prs_pool_get_id(timer->pool, entry));
+    if (prs_timer_is_owner(timer)) {
+        if (prs_pal_atomic_load(&entry->state) == PRS_TIMER_ENTRY_STATE_ARMED) {
+            if (entry->list) {
+                prs_idllist_remove(entry->list, &entry->idllist);
+            } else {
+                prs_timer_heap_remove(timer, entry);
+            }
+            prs_timer_disarm(timer, entry);
+            prs_event_unref(entry->event);
+        }
+        prs_timer_free(timer, entry);
+        return;
+    }
+
+    prs_uint_t state = PRS_TIMER_ENTRY_STATE_ARMED;
+    if (!prs_pal_atomic_compare_exchange_strong(&entry->state, &state, PRS_TIMER_ENTRY_STATE_CANCELED)) {
+        PRS_ASSERT(state == PRS_TIMER_ENTRY_STATE_FIRED);
+        prs_mpsciq_push(timer->freed, &entry->mpsciq);
+    }
 }
 
-static PRS_INLINE int prs_timer_hsb(prs_ticks_t ticks)
+
+/*
+ * Advances the timer by a single tick. Going from tick T-1 to tick T, the slot of T-1 is processed in the first wheel,
+ * and the slot of T-1 is processed in each of the following wheels for which T is the beginning of a new slot. The
+ * entries of the processed slots are queued again, which either signals them or moves them to a lower wheel.
+ */
+static void prs_timer_step(struct prs_timer* timer)
 {
-    if (sizeof(ticks) == 4) {
-        return prs_bitops_hsb_uint32(ticks);
-    } else if (sizeof(ticks) == 8) {
-        return prs_bitops_hsb_uint64(ticks);
-    } else {
-        PRS_ASSERT(PRS_FALSE);
-        return 0;
+    const prs_ticks_t now = timer->now + 1;
+    const prs_ticks_t changed = now ^ timer->now;
+    const int max_wheel = prs_timer_hsb(changed) / PRS_MAX_TIMER_BITS_PER_WHEEL + 1;
+    for (int wheel = 0; wheel < max_wheel; ++wheel) {
+        PRS_ASSERT(wheel < PRS_MAX_TIMER_WHEELS);
+        const int slot_mask = PRS_MAX_TIMER_SLOTS_PER_WHEEL - 1;
+        const int slot = (timer->now >> (wheel * PRS_MAX_TIMER_BITS_PER_WHEEL)) & slot_mask;
+        struct prs_idllist* list = timer->lists[wheel][slot];
+        struct prs_idllist_node* idllist_node;
+        while ((idllist_node = prs_idllist_begin(list)) != 0) {
+            prs_idllist_remove(list, idllist_node);
+            prs_idllist_insert_before(timer->tmp_list, 0, idllist_node);
+        }
+        PRS_ASSERT(prs_idllist_empty(list));
+    }
+    struct prs_idllist_node* tmp_entry;
+    while ((tmp_entry = prs_idllist_begin(timer->tmp_list)) != 0) {
+        struct prs_timer_entry* entry = prs_idllist_get_data(timer->tmp_list, tmp_entry);
+        prs_idllist_remove(timer->tmp_list, tmp_entry);
+        prs_timer_queue_internal(timer, entry);
     }
+    PRS_ASSERT(prs_idllist_empty(timer->tmp_list));
+    timer->now = now;
 }
 
-static void prs_timer_event_destructor(void* userdata, void* data)
+/*
+ * Returns the number of ticks, from the timer's current tick, until the next call to prs_timer_step() that has a
+ * non-empty slot to process.
+ */
+static prs_bool_t prs_timer_next_step(struct prs_timer* timer, prs_uint64_t* ticks)
 {
-    struct prs_timer* timer = userdata;
-    PRS_ASSERT(timer);
-
-    struct prs_timer_entry* entry = data;
-    PRS_ASSERT(entry);
-
-    prs_event_unref(entry->event);
+    const int slot_mask = PRS_MAX_TIMER_SLOTS_PER_WHEEL - 1;
+    prs_bool_t found = PRS_FALSE;
+    for (int wheel = 0; wheel < PRS_MAX_TIMER_WHEELS; ++wheel) {
+        const int wheel_shift = wheel * PRS_MAX_TIMER_BITS_PER_WHEEL;
+        const prs_uint64_t base = (prs_uint64_t)(timer->now >> wheel_shift);
+        for (int i = 0; i < PRS_MAX_TIMER_SLOTS_PER_WHEEL; ++i) {
+            if (prs_idllist_empty(timer->lists[wheel][(base + i) & slot_mask])) {
+                continue;
+            }
+            /* The first wheel's slot is processed on the next tick, the others at the beginning of the next slot */
+            const prs_uint64_t step = wheel ?
+                ((base + i + 1) << wheel_shift) - (prs_uint64_t)timer->now :
+                (prs_uint64_t)i + 1;
+            if (!found || step < *ticks) {
+                *ticks = step;
+                found = PRS_TRUE;
+            }
+            /* Following slots of this wheel are processed later */
+            break;
+        }
+    }
+    return found;
 }
 
-static void prs_timer_queue_internal(struct prs_timer* timer, struct prs_timer_entry* entry)
+/*
+ * Returns the number of ticks, from the current system tick, after which prs_timer_tick() must be called to process
+ * the next expiry.
+ */
+static prs_bool_t prs_timer_next_expiry(struct prs_timer* timer, prs_ticks_t* ticks)
 {
-    const prs_pool_id_t entry_id = prs_pool_get_id(timer->pool, entry);
-    const prs_int_t delay = entry->end - timer->now;
-    if (delay <= 0) {
-        /*
-         * Here, the delay should be zero, but sometimes it can be a negative number because the clock tick can be read
-         * just before it is incremented, and then sent as the delay in the timer queuing request.
-         * PRS_ASSERT(delay == 0);
-         */
-        prs_event_signal(entry->event, entry->event_type);
-        prs_pool_unlock(timer->pool, entry_id);
-        return;
+    prs_uint64_t next_step = 0;
+    if (!prs_timer_next_step(timer, &next_step)) {
+        return PRS_FALSE;
     }
 
-    /* If we can free the entry, it means it was canceled. */
-    const prs_bool_t canceled = prs_pool_try_unlock_final_dest(timer->pool, entry_id, prs_timer_event_destructor, timer);
-    if (canceled) {
-        return;
+    /* The timer may lag behind the system tick by a few ticks */
+    const prs_ticks_t lag = prs_clock_get() - timer->now;
+    const prs_uint64_t max_ticks = ((prs_ticks_t)-1) >> 1;
+    if (next_step <= lag) {
+        *ticks = 1;
+    } else if (next_step - lag > max_ticks) {
+        *ticks = (prs_ticks_t)max_ticks;
+    } else {
+        *ticks = (prs_ticks_t)(next_step - lag);
     }
+    return PRS_TRUE;
+}
 
-    const prs_int_t hsb = prs_timer_hsb((prs_ticks_t)delay); /* Cast to remove signed and avoid GCC warning */
-    PRS_ASSERT(hsb >= 0);
-    const prs_int_t wheel = hsb / PRS_MAX_TIMER_BITS_PER_WHEEL;
-    PRS_ASSERT(wheel < PRS_MAX_TIMER_WHEELS);
-    const prs_int_t wheel_shift = wheel * PRS_MAX_TIMER_BITS_PER_WHEEL;
-    const prs_uint_t slot = ((entry->end >> wheel_shift) - !!wheel) & (PRS_MAX_TIMER_SLOTS_PER_WHEEL - 1);
-    PRS_ASSERT(slot < PRS_MAX_TIMER_SLOTS_PER_WHEEL);
+/*
+ * Publishes the next expiries so that prs_timer_poll() can tell, from the clock's context, when the owner must call
+ * prs_timer_tick() again.
+ */
+static void prs_timer_publish(struct prs_timer* timer)
+{
+    prs_ticks_t ticks;
+    if (prs_timer_next_expiry(timer, &ticks)) {
+        const prs_ticks_t due = prs_clock_get() + ticks;
+        prs_pal_atomic_store(&timer->due, (prs_uint64_t)due + 1);
+        prs_clock_request(ticks);
+    } else {
+        prs_pal_atomic_store(&timer->due, 0);
+    }
 
-    struct prs_idllist* list = timer->lists[wheel][slot];
-    prs_idllist_insert_before(list, 0, &entry->idllist);
+    if (timer->heap_count) {
+        const prs_uint64_t due_ns = timer->heap[0]->end_ns;
+        prs_pal_atomic_store(&timer->due_ns, due_ns);
+        prs_clock_request_ns(due_ns);
+    } else {
+        prs_pal_atomic_store(&timer->due_ns, 0);
+    }
 }
 
 /**
@@ -306,46 +741,88 @@ static void prs_timer_queue_internal(struct prs_timer* timer, struct prs_timer_e
  *  Process elapsed time and signal events if timeouts occurred.
  * \param timer
  *  Timer module.
+ * \note
+ *  This function must only be called by the owner of the timer, in a non-interruptible section. It returns
+ *  immediately unless the owner was notified of an expiry since the last call. Multiple ticks
+ *  may have elapsed since the last call, in which case the ticks without any expiry are skipped.
  */
 void prs_timer_tick(struct prs_timer* timer)
 {
+    if (!prs_pal_atomic_exchange(&timer->signaled, PRS_FALSE)) {
+        return;
+    }
+
     const prs_ticks_t now = prs_clock_get();
-    const prs_ticks_t elapsed = now - timer->now;
-    const prs_ticks_t changed = now ^ timer->now;
-    const int max_wheel = prs_timer_hsb(changed) / PRS_MAX_TIMER_BITS_PER_WHEEL + 1;
-    for (int wheel = 0; wheel < max_wheel; ++wheel) {
-        const int slot_mask = PRS_MAX_TIMER_SLOTS_PER_WHEEL - 1;
-        const int first_slot = (timer->now >> (wheel * PRS_MAX_TIMER_BITS_PER_WHEEL)) & slot_mask;
-        int elapsed_slots = (elapsed >> (wheel * PRS_MAX_TIMER_SLOTS_PER_WHEEL));
-        if (elapsed_slots > PRS_MAX_TIMER_SLOTS_PER_WHEEL) {
-            elapsed_slots = PRS_MAX_TIMER_SLOTS_PER_WHEEL;
-        }
-        for (int i = 0; i < elapsed_slots; ++i) {
-            const int slot = first_slot + i;
-            PRS_ASSERT(wheel < PRS_MAX_TIMER_WHEELS);
-            PRS_ASSERT(slot < PRS_MAX_TIMER_SLOTS_PER_WHEEL);
-            struct prs_idllist* list = timer->lists[wheel][slot];
-            struct prs_idllist_node* idllist_node;
-            while ((idllist_node = prs_idllist_begin(list)) != 0) {
-                prs_idllist_remove(list, idllist_node);
-                prs_idllist_insert_before(timer->tmp_list, 0, idllist_node);
+    timer->now_ns = prs_clock_get_ns();
+    while (timer->now != now) {
+        const prs_ticks_t elapsed = now - timer->now;
+        if (elapsed > 1) {
+            prs_uint64_t next_step = 0;
+            if (!prs_timer_next_step(timer, &next_step) || next_step > elapsed) {
+                timer->now = now;
+                break;
             }
-            PRS_ASSERT(prs_idllist_empty(list));
+            timer->now += (prs_ticks_t)next_step - 1;
         }
+        prs_timer_step(timer);
     }
-    struct prs_idllist_node* tmp_entry;
-    while ((tmp_entry = prs_idllist_begin(timer->tmp_list)) != 0) {
-        struct prs_timer_entry* entry = prs_idllist_get_data(timer->tmp_list, tmp_entry);
-        prs_idllist_remove(timer->tmp_list, tmp_entry);
-        prs_timer_queue_internal(timer, entry);
+
+    while (timer->heap_count && timer->heap[0]->end_ns <= timer->now_ns) {
+        struct prs_timer_entry* entry = prs_timer_heap_pop(timer);
+        prs_timer_expire(timer, entry);
     }
-    PRS_ASSERT(prs_idllist_empty(timer->tmp_list));
-    timer->now = now;
 
-    struct prs_mpsciq_node* node;
-    while ((node = prs_mpsciq_begin(timer->queued)) != 0) {
-        struct prs_timer_entry* entry = prs_mpsciq_get_data(timer->queued, node);
-        prs_mpsciq_remove(timer->queued, node);
-        prs_timer_queue_internal(timer, entry);
+    prs_timer_publish(timer);
+}
+
+/**
+ * \brief
+ *  Notifies the owner of the timer if it must call \ref prs_timer_tick.
+ * \param timer
+ *  Timer module.
+ * \param now
+ *  Current system tick, as returned by \ref prs_clock_get.
+ * \param now_ns
+ *  Current time, as returned by \ref prs_clock_get_ns.
+ * \return
+ *  \ref PRS_TRUE if the owner was notified.
+ *  \ref PRS_FALSE if the timer has nothing to process yet.
+ * \note
+ *  This function is called by the clock module and is safe to be called from any thread. The owner is notified again
+ *  at every call until it processes the timer.
+ */
+prs_bool_t prs_timer_poll(struct prs_timer* timer, prs_ticks_t now, prs_uint64_t now_ns)
+{
+    prs_bool_t expired = PRS_FALSE;
+
+    /* Expiries that are not reached yet are requested again, as the clock forgets them when it calls this function */
+    const prs_uint64_t due = prs_pal_atomic_load(&timer->due);
+    if (due) {
+        /* Ticks wrap around: the expiry is reached when it is not in the upper half of the range */
+        const prs_ticks_t delay = (prs_ticks_t)(due - 1) - now;
+        if (!delay || delay > ((prs_ticks_t)-1 >> 1)) {
+            expired = PRS_TRUE;
+        } else {
+            prs_clock_request(delay);
+        }
+    }
+
+    const prs_uint64_t due_ns = prs_pal_atomic_load(&timer->due_ns);
+    if (due_ns) {
+        if (due_ns <= now_ns) {
+            expired = PRS_TRUE;
+        } else {
+            prs_clock_request_ns(due_ns);
+        }
     }
+
+    if (expired) {
+        prs_pal_atomic_store(&timer->signaled, PRS_TRUE);
+    } else if (!prs_pal_atomic_load(&timer->signaled)) {
+        return PRS_FALSE;
+    }
+
+    const prs_uint64_t prio_mask = prs_pal_atomic_load(&timer->prio_mask);
+    timer->notify(timer->userdata, prio_mask ? prs_bitops_lsb_uint64(prio_mask) : PRS_MAX_TASK_PRIO);
+    return PRS_TRUE;
 }
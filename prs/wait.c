@@ -0,0 +1,396 @@
+/*
+ *  Portable Runtime System (PRS)
+ *  Copyright (C) 2016  Alexandre Tremblay
+ *  
+ *  This file is part of PRS.
+ *  
+ *  PRS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *  
+ *  portableruntimesystem@gmail.com
+ */
+
+/**
+ * \file
+ * \brief
+ *  This file contains the definitions of the waits on multiple objects.
+ *
+ *  A task that waits for any of many objects creates a single \ref prs_event, and holds it with one reference per
+ *  object, one for the timer when the wait is timed, and one for itself. Semaphores and event flags keep a wait list
+ *  of the events to signal when they may have become ready, and message queues signal the event through the filter of
+ *  their receiver. Whichever object signals the event first unblocks the task, which then checks all the objects
+ *  again, in order, and removes its event from the objects that did not signal it.
+ *
+ *  Objects only tell the waiting tasks that they may be ready: another task can take the semaphore count or clear the
+ *  flags in the meantime, in which case the waiting task simply waits again.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <prs/pal/atomic.h>
+#include <prs/pal/malloc.h>
+#include <prs/assert.h>
+#include <prs/clock.h>
+#include <prs/config.h>
+#include <prs/error.h>
+#include <prs/event.h>
+#include <prs/flags.h>
+#include <prs/idllist.h>
+#include <prs/msgq.h>
+#include <prs/rtc.h>
+#include <prs/sched.h>
+#include <prs/sem.h>
+#include <prs/spinlock.h>
+#include <prs/timer.h>
+#include <prs/wait.h>
+#include <prs/worker.h>
+
+#include "task.h"
+
+#define PRS_WAIT_EVENT_TYPE_NOTIFY      1
+#define PRS_WAIT_EVENT_TYPE_TIMEOUT     2
+#define PRS_WAIT_EVENT_TYPE_FREE        3
+
+struct prs_wait_list {
+    struct prs_spinlock*                lock;
+    struct prs_idllist*                 watches;
+    /* Number of watches in the list, read without the lock by the objects that notify it */
+    PRS_ATOMIC prs_uint_t               count;
+};
+
+/* What the waiting task registered in one of the objects */
+struct prs_wait_slot {
+    struct prs_wait_watch               watch;
+    struct prs_msgq_filter*             filter;
+};
+
+/**
+ * \brief
+ *  Creates a wait list.
+ */
+struct prs_wait_list* prs_wait_list_create(void)
+{
+    struct prs_wait_list* list = prs_pal_malloc_zero(sizeof(*list));
+    if (!list) {
+        goto cleanup;
+    }
+
+    list->lock = prs_spinlock_create();
+
+    struct prs_idllist_create_params idllist_params = {
+        .node_offset = offsetof(struct prs_wait_watch, node)
+    };
+    list->watches = prs_idllist_create(&idllist_params);
+    if (!list->watches) {
+        goto cleanup;
+    }
+
+    return list;
+
+cleanup:
+
+    if (list) {
+        prs_wait_list_destroy(list);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief
+ *  Destroys a wait list. No task can be waiting in it.
+ * \param list
+ *  Wait list to destroy.
+ */
+void prs_wait_list_destroy(struct prs_wait_list* list)
+{
+    PRS_PRECONDITION(list);
+    PRS_PRECONDITION(prs_pal_atomic_load(&list->count) == 0);
+
+    if (list->watches) {
+        prs_idllist_destroy(list->watches);
+    }
+    if (list->lock) {
+        prs_spinlock_destroy(list->lock);
+    }
+    prs_pal_free(list);
+}
+
+/**
+ * \brief
+ *  Adds a watch to the wait list. The event will be signaled by the next call to \ref prs_wait_list_notify.
+ * \param list
+ *  Wait list to add the watch to.
+ * \param watch
+ *  Watch to add, which must stay valid until it is removed.
+ * \param event
+ *  Event to signal. The wait list holds one reference on it until it signals it or until the watch is removed.
+ * \note
+ *  Once the watch is added, the object can be checked without missing a notification: the objects change their state
+ *  before they read the number of watches.
+ */
+void prs_wait_list_add(struct prs_wait_list* list, struct prs_wait_watch* watch, struct prs_event* event)
+{
+    PRS_PRECONDITION(list);
+    PRS_PRECONDITION(watch);
+    PRS_PRECONDITION(event);
+
+    prs_pal_atomic_store(&watch->event, event);
+
+    prs_spinlock_lock(list->lock);
+    prs_idllist_insert_before(list->watches, 0, &watch->node);
+    prs_pal_atomic_fetch_add(&list->count, 1);
+    prs_spinlock_unlock(list->lock);
+}
+
+/**
+ * \brief
+ *  Removes a watch from the wait list. The reference on the event is released if it was not signaled.
+ * \param list
+ *  Wait list to remove the watch from.
+ * \param watch
+ *  Watch to remove.
+ */
+void prs_wait_list_remove(struct prs_wait_list* list, struct prs_wait_watch* watch)
+{
+    PRS_PRECONDITION(list);
+    PRS_PRECONDITION(watch);
+
+    prs_spinlock_lock(list->lock);
+    prs_idllist_remove(list->watches, &watch->node);
+    prs_pal_atomic_fetch_sub(&list->count, 1);
+    prs_spinlock_unlock(list->lock);
+
+    struct prs_event* event = prs_pal_atomic_exchange(&watch->event, 0);
+    if (event) {
+        prs_event_unref(event);
+    }
+}
+
+/**
+ * \brief
+ *  Signals the events of all the watches of the wait list that were not already signaled.
+ * \param list
+ *  Wait list to notify.
+ */
+void prs_wait_list_notify(struct prs_wait_list* list)
+{
+    PRS_PRECONDITION(list);
+
+    if (!prs_pal_atomic_load(&list->count)) {
+        return;
+    }
+
+    prs_spinlock_lock(list->lock);
+    prs_idllist_foreach(list->watches, node) {
+        struct prs_wait_watch* watch = prs_idllist_get_data(list->watches, node);
+        struct prs_event* event = prs_pal_atomic_exchange(&watch->event, 0);
+        if (event) {
+            prs_event_signal(event, PRS_WAIT_EVENT_TYPE_NOTIFY);
+        }
+    }
+    prs_spinlock_unlock(list->lock);
+}
+
+static prs_bool_t prs_wait_try(struct prs_wait_object* object)
+{
+    switch (object->type) {
+        case PRS_WAIT_TYPE_MSGQ:
+            return PRS_BOOL(!prs_msgq_empty(object->object));
+        case PRS_WAIT_TYPE_SEM:
+            return prs_sem_try_wait(object->object);
+        case PRS_WAIT_TYPE_FLAGS:
+            return prs_flags_try_wait(object->object, object->mask, object->options, &object->value);
+        default:
+            PRS_ASSERT(0);
+            return PRS_FALSE;
+    }
+}
+
+/* Returns the index of the first object that is ready, or count if none is */
+static prs_uint_t prs_wait_try_all(struct prs_wait_object* objects, prs_uint_t count)
+{
+    for (prs_uint_t i = 0; i < count; ++i) {
+        if (prs_wait_try(&objects[i])) {
+            return i;
+        }
+    }
+    return count;
+}
+
+static struct prs_wait_list* prs_wait_get_list(struct prs_wait_object* object)
+{
+    switch (object->type) {
+        case PRS_WAIT_TYPE_SEM:
+            return prs_sem_get_wait_list(object->object);
+        case PRS_WAIT_TYPE_FLAGS:
+            return prs_flags_get_wait_list(object->object);
+        default:
+            PRS_ASSERT(0);
+            return 0;
+    }
+}
+
+static void prs_wait_arm(struct prs_wait_object* object, struct prs_wait_slot* slot, struct prs_event* event)
+{
+    if (object->type == PRS_WAIT_TYPE_MSGQ) {
+        slot->filter = prs_msgq_watch(object->object, event);
+    } else {
+        prs_wait_list_add(prs_wait_get_list(object), &slot->watch, event);
+    }
+}
+
+static void prs_wait_disarm(struct prs_wait_object* object, struct prs_wait_slot* slot)
+{
+    if (object->type == PRS_WAIT_TYPE_MSGQ) {
+        prs_msgq_unwatch(object->object, slot->filter);
+    } else {
+        prs_wait_list_remove(prs_wait_get_list(object), &slot->watch);
+    }
+}
+
+static prs_result_t prs_wait_any_internal(struct prs_wait_object* objects, prs_uint_t count, prs_uint64_t timeout,
+    prs_bool_t use_timeout, prs_bool_t high_res, prs_uint_t* index)
+{
+    PRS_PRECONDITION(objects);
+    PRS_PRECONDITION(index);
+    PRS_RTC_IF (count == 0 || count > PRS_MAX_WAIT_OBJECTS) {
+        return PRS_INVALID_STATE;
+    }
+
+    /* The nodes must not look inserted the first time they are added to a wait list */
+    struct prs_wait_slot slots[PRS_MAX_WAIT_OBJECTS];
+    memset(slots, 0, count * sizeof(slots[0]));
+
+    /* Either in ticks or in nanoseconds, depending on high_res */
+    prs_uint64_t wait_left = timeout;
+    for (;;) {
+        prs_uint_t ready = prs_wait_try_all(objects, count);
+        if (ready < count) {
+            *index = ready;
+            return PRS_OK;
+        }
+        if (use_timeout && wait_left == 0) {
+            return PRS_TIMEOUT;
+        }
+
+        struct prs_task* task = prs_task_current();
+        PRS_ASSERT(task);
+        /* One reference for each object, one for the timer, and one that the task releases after the wait */
+        struct prs_event* event = prs_event_create(task, count + (use_timeout ? 1 : 0) + 1);
+        for (prs_uint_t i = 0; i < count; ++i) {
+            prs_wait_arm(&objects[i], &slots[i], event);
+        }
+
+        /* An object may have become ready before the task was registered in it */
+        ready = prs_wait_try_all(objects, count);
+        if (ready < count) {
+            for (prs_uint_t i = 0; i < count; ++i) {
+                prs_wait_disarm(&objects[i], &slots[i]);
+            }
+            /* This will change the task's state from blocked to ready if no object signaled the event */
+            const prs_event_state_t event_state = prs_event_signal(event, PRS_WAIT_EVENT_TYPE_FREE);
+            if (event_state & PRS_EVENT_STATE_SIGNALED) {
+                prs_sched_schedule();
+            }
+            *index = ready;
+            return PRS_OK;
+        }
+
+        struct prs_timer* timer = 0;
+        struct prs_timer_entry* timer_entry = 0;
+        if (use_timeout) {
+            timer = prs_worker_get_timer(prs_worker_current());
+            timer_entry = high_res ?
+                prs_timer_queue_ns(timer, event, PRS_WAIT_EVENT_TYPE_TIMEOUT, wait_left) :
+                prs_timer_queue(timer, event, PRS_WAIT_EVENT_TYPE_TIMEOUT, (prs_ticks_t)wait_left);
+            PRS_ASSERT(timer_entry);
+        }
+        prs_sched_schedule();
+        if (use_timeout) {
+            const prs_uint64_t diff = high_res ?
+                prs_clock_get_ns() - prs_timer_get_start_ns(timer_entry) :
+                (prs_ticks_t)(prs_clock_get() - prs_timer_get_start(timer_entry));
+            wait_left = (diff >= wait_left) ? 0 : wait_left - diff;
+            prs_timer_cancel(timer, timer_entry);
+        }
+
+        for (prs_uint_t i = 0; i < count; ++i) {
+            prs_wait_disarm(&objects[i], &slots[i]);
+        }
+        prs_event_signal(event, PRS_WAIT_EVENT_TYPE_FREE);
+    }
+}
+
+/**
+ * \brief
+ *  Waits until any of the objects is ready.
+ * \param objects
+ *  Objects to wait for. When many objects are ready, the first one in the array is chosen.
+ * \param count
+ *  Number of objects, up to \ref PRS_MAX_WAIT_OBJECTS.
+ * \param index
+ *  Receives the index of the object that is ready.
+ * \return
+ *  \ref PRS_OK if an object is ready.
+ *  \ref PRS_INVALID_STATE if there are no objects or too many objects.
+ */
+prs_result_t prs_wait_any(struct prs_wait_object* objects, prs_uint_t count, prs_uint_t* index)
+{
+    return prs_wait_any_internal(objects, count, 0, PRS_FALSE, PRS_FALSE, index);
+}
+
+/**
+ * \brief
+ *  Waits until any of the objects is ready or until the timeout occurs.
+ * \param objects
+ *  Objects to wait for. When many objects are ready, the first one in the array is chosen.
+ * \param count
+ *  Number of objects, up to \ref PRS_MAX_WAIT_OBJECTS.
+ * \param timeout
+ *  Time to wait, in ticks.
+ * \param index
+ *  Receives the index of the object that is ready.
+ * \return
+ *  \ref PRS_OK if an object is ready.
+ *  \ref PRS_TIMEOUT if the timeout occurred.
+ *  \ref PRS_INVALID_STATE if there are no objects or too many objects.
+ */
+prs_result_t prs_wait_any_timeout(struct prs_wait_object* objects, prs_uint_t count, prs_ticks_t timeout,
+    prs_uint_t* index)
+{
+    return prs_wait_any_internal(objects, count, timeout, PRS_TRUE, PRS_FALSE, index);
+}
+
+/**
+ * \brief
+ *  Waits until any of the objects is ready or until the high resolution timeout occurs.
+ * \param objects
+ *  Objects to wait for. When many objects are ready, the first one in the array is chosen.
+ * \param count
+ *  Number of objects, up to \ref PRS_MAX_WAIT_OBJECTS.
+ * \param timeout_ns
+ *  Time to wait, in nanoseconds.
+ * \param index
+ *  Receives the index of the object that is ready.
+ * \return
+ *  \ref PRS_OK if an object is ready.
+ *  \ref PRS_TIMEOUT if the timeout occurred.
+ *  \ref PRS_INVALID_STATE if there are no objects or too many objects.
+ */
+prs_result_t prs_wait_any_timeout_ns(struct prs_wait_object* objects, prs_uint_t count, prs_uint64_t timeout_ns,
+    prs_uint_t* index)
+{
+    return prs_wait_any_internal(objects, count, timeout_ns, PRS_TRUE, PRS_TRUE, index);
+}
@@ -37,11 +37,13 @@
  *    - When the worker exits idle mode.
  *    - When interruptible mode is to be enabled but the interrupt pending flag is raised.
  *
- *  When the scheduler is out of tasks to run, the worker goes into idle mode. In idle mode, an operating system
- *  primitive (for example, a POSIX semaphore on Linux) is used to stop the PAL thread from executing. When an event
- *  occurs on another worker (for example, a message sent to the message queue on one of the scheduler's tasks), it
- *  calls the ready callback on the scheduler which in turn, instead of interrupting the worker, wakes it up from idle
- *  mode.
+ *  When the scheduler is out of tasks to run, the worker goes into idle mode. In idle mode, the worker first spins for
+ *  a number of cycles (\ref PRS_WORKER_IDLE_SPIN_CYCLES by default, see \ref prs_worker_set_idle_spin_cycles), then
+ *  parks: it sets its parked flag and sleeps on a futex (\ref prs_pal_futex_wait) on its flags word until the flag is
+ *  cleared. When an event occurs on another worker (for example, a message sent to the message queue on one of the
+ *  scheduler's tasks), it calls the ready callback on the scheduler which in turn, instead of interrupting the worker,
+ *  wakes it up from idle mode. Waking up a worker that is still spinning only clears its idle flag, so that short idle
+ *  periods do not cost any system call; a parked worker costs a single futex wake.
  *
  *  When the worker is already busy executing other tasks and an event occurs on a task belonging to the same
  *  scheduler, the worker can be interrupted when in interruptible mode. Interrupting the worker stops its execution in
@@ -49,6 +51,13 @@
  *  code. This new stack frame contains the information necessary for the running task to invoke the scheduler and
  *  return to interruptible mode. Once in interruptible mode, the task may resume its execution.
  *
+ *  When \ref PRS_SAFEPOINT is defined, the worker is not interrupted right away. A preemption request is rather posted
+ *  in a word that the running task polls at its safepoints: every PR API call re-enables interrupts, which invokes the
+ *  scheduler when the interrupt pending flag is raised, and long running loops can poll the word through
+ *  \ref PR_SAFEPOINT. The clock polls the worker through \ref prs_worker_poll and only interrupts it when the request
+ *  is still pending after \ref PRS_SAFEPOINT_GRACE_NS, which saves the cost of a signal delivery for tasks that
+ *  reach their safepoints often enough.
+ *
  *  Non-interruptible mode has three uses:
  *    -# Protect PRS code from being interrupted within the same worker. As such, it acts like a critical section.
  *    -# Lets the application define critical sections within the same worker that cannot be interrupted by PRS (but
@@ -57,22 +66,34 @@
  *       would prevent other workers from calling the same code without blocking. Also, it's usually not possible to
  *       add a stack frame on top of syscalls as they are executing in kernel mode.
  *
+ *  Each worker owns a timer (\ref prs_timer) on which the tasks it runs queue their timeouts. The clock notifies the
+ *  worker by interrupting it when the timer has expiries to process, and the worker processes them in a batch from
+ *  its own context, right before invoking the scheduler. This way, timeout events are signaled on the core that runs
+ *  the tasks that requested them.
+ *
  *  Using thread-local storage, the worker currently executing code is accessible from anywhere by calling
  *  \ref prs_worker_current.
  */
 
+#include <prs/alloc/msgpool.h>
+#include <prs/alloc/slab.h>
+#include <prs/alloc/stack.h>
 #include <prs/pal/atomic.h>
 #include <prs/pal/context.h>
 #include <prs/pal/cycles.h>
 #include <prs/pal/excp.h>
+#include <prs/pal/futex.h>
 #include <prs/pal/malloc.h>
 #include <prs/pal/wls.h>
 #include <prs/assert.h>
+#include <prs/clock.h>
 #include <prs/error.h>
 #include <prs/god.h>
 #include <prs/log.h>
 #include <prs/proc.h>
 #include <prs/rtc.h>
+#include <prs/systeminfo.h>
+#include <prs/timer.h>
 #include <prs/worker.h>
 
 #include "task.h"
@@ -82,11 +103,14 @@
                                         ((prs_worker_flags_t)0x00000002)
 #define PRS_WORKER_FLAG_IDLE            ((prs_worker_flags_t)0x00000004)
 #define PRS_WORKER_FLAG_STOP            ((prs_worker_flags_t)0x00000008)
+#define PRS_WORKER_FLAG_PARKED          ((prs_worker_flags_t)0x00000010)
 
 typedef prs_uint32_t prs_worker_flags_t;
 
 struct prs_worker {
     prs_worker_id_t                     id;
+    /* Index of the worker's slot in per-worker data, below PRS_MAX_CPU */
+    prs_uint_t                          index;
 
     struct prs_pal_thread*              pal_thread;
 
@@ -97,23 +121,70 @@ struct prs_worker {
 
     PRS_ATOMIC prs_task_id_t            current_task_id;
     struct prs_task*                    current_task;
+    struct prs_task*                    switched_task;
 
     struct prs_pal_context*             exit_context;
+
+    struct prs_timer*                   timer;
+
+    /* Recycle the stacks and objects of the tasks that are created and freed by this worker */
+    struct prs_stack_cache*             stack_cache;
+    struct prs_slab_cache*              task_cache;
+    /* Messages allocated by the tasks running on this worker */
+    struct prs_msgpool*                 msgpool;
+
+    PRS_ATOMIC prs_uint64_t             spin_hits;
+    PRS_ATOMIC prs_uint64_t             parks;
+    PRS_ATOMIC prs_uint64_t             signals;
+
+    /* Set when the running task must reach a safepoint, and time at which the worker must be interrupted instead */
+    PRS_ATOMIC int                      safepoint;
+    PRS_ATOMIC prs_uint64_t             safepoint_deadline;
 };
 
+static PRS_ATOMIC prs_uint_t s_prs_worker_next_index;
+
+/* Number of cycles during which idle workers spin before they park */
+static PRS_ATOMIC prs_uint64_t s_prs_worker_idle_spin_cycles = PRS_WORKER_IDLE_SPIN_CYCLES;
+
 static void prs_worker_object_free(void* object)
 {
     struct prs_worker* worker = object;
 
+    if (worker->msgpool) {
+        prs_msgpool_destroy(worker->msgpool);
+    }
+    if (worker->task_cache) {
+        prs_slab_cache_destroy(worker->task_cache);
+    }
+    if (worker->stack_cache) {
+        prs_stack_cache_destroy(worker->stack_cache);
+    }
     prs_pal_free(worker);
 }
 
 static void prs_worker_object_print(void* object, void* userdata, void (*fct)(void*, const char*, ...))
 {
     struct prs_worker* worker = object;
-
-    fct(userdata, "Worker id=%u\n",
-        worker->id);
+    struct prs_stack_cache_stats stack_stats;
+    prs_stack_cache_get_stats(worker->stack_cache, &stack_stats);
+    struct prs_msgpool_stats msgpool_stats;
+    prs_msgpool_get_stats(worker->msgpool, &msgpool_stats);
+
+    fct(userdata, "Worker id=%u spin_hits=%llu parks=%llu signals=%llu stacks=%u stack_hits=%llu stack_misses=%llu "
+        "msgs=%llu large_msgs=%llu remote_msg_frees=%llu msg_reclaims=%llu msg_refills=%llu\n",
+        worker->id,
+        (unsigned long long)prs_pal_atomic_load(&worker->spin_hits),
+        (unsigned long long)prs_pal_atomic_load(&worker->parks),
+        (unsigned long long)prs_pal_atomic_load(&worker->signals),
+        stack_stats.count,
+        (unsigned long long)stack_stats.hits,
+        (unsigned long long)stack_stats.misses,
+        (unsigned long long)msgpool_stats.allocs,
+        (unsigned long long)msgpool_stats.large_allocs,
+        (unsigned long long)msgpool_stats.remote_frees,
+        (unsigned long long)msgpool_stats.reclaims,
+        (unsigned long long)msgpool_stats.refills);
 }
 
 static struct prs_object_ops s_prs_worker_object_ops = {
@@ -126,22 +197,63 @@ static void prs_worker_idle(struct prs_worker* worker)
 {
     prs_worker_flags_t flags = 0;
     const prs_worker_flags_t new_flags = PRS_WORKER_FLAG_IDLE | PRS_WORKER_FLAG_INTERRUPT_PENDING;
-    if (prs_pal_atomic_compare_exchange_strong(&worker->flags, &flags, new_flags)) {
-        PRS_FTRACE("(%u) suspend thread", worker->id);
-        prs_pal_thread_suspend(worker->pal_thread);
-        PRS_FTRACE("(%u) back from suspend thread", worker->id);
-        PRS_ASSERT(!(prs_pal_atomic_load(&worker->flags) & PRS_WORKER_FLAG_IDLE));
+    if (!prs_pal_atomic_compare_exchange_strong(&worker->flags, &flags, new_flags)) {
+        return;
+    }
+
+    /* Wakers clear the idle flag, and only wake up the thread if it is parked. Spinning would only delay them. */
+    const prs_cycles_t spin_cycles = prs_systeminfo_get()->core_count > 1 ?
+        prs_pal_atomic_load(&s_prs_worker_idle_spin_cycles) : 0;
+    const prs_cycles_t start = prs_cycles_now();
+    while (prs_cycles_now() - start < spin_cycles) {
+        if (!(prs_pal_atomic_load(&worker->flags) & PRS_WORKER_FLAG_IDLE)) {
+            prs_pal_atomic_store(&worker->spin_hits, prs_pal_atomic_load(&worker->spin_hits) + 1);
+            return;
+        }
+        prs_cycles_pause();
     }
+
+    flags = prs_pal_atomic_load(&worker->flags);
+    do {
+        if (!(flags & PRS_WORKER_FLAG_IDLE)) {
+            prs_pal_atomic_store(&worker->spin_hits, prs_pal_atomic_load(&worker->spin_hits) + 1);
+            return;
+        }
+    } while (!prs_pal_atomic_compare_exchange_weak(&worker->flags, &flags, flags | PRS_WORKER_FLAG_PARKED));
+
+    prs_pal_atomic_store(&worker->parks, prs_pal_atomic_load(&worker->parks) + 1);
+    PRS_FTRACE("(%u) park thread", worker->id);
+    /* Other bits of the flags may change while the worker is parked, which only makes it check the parked flag again */
+    flags |= PRS_WORKER_FLAG_PARKED;
+    do {
+        prs_pal_futex_wait(&worker->flags, flags);
+        flags = prs_pal_atomic_load(&worker->flags);
+    } while (flags & PRS_WORKER_FLAG_PARKED);
+    PRS_FTRACE("(%u) back from park", worker->id);
+    PRS_ASSERT(!(prs_pal_atomic_load(&worker->flags) & (PRS_WORKER_FLAG_IDLE | PRS_WORKER_FLAG_PARKED)));
 }
 
 static struct prs_task* prs_worker_set_current_task(struct prs_worker* worker, struct prs_task* task)
 {
     struct prs_task* prev_task = worker->current_task;
     worker->current_task = task;
+    if (task) {
+        task->safepoint = &worker->safepoint;
+    }
     prs_pal_atomic_store(&worker->current_task_id, task ? task->id : PRS_OBJECT_ID_INVALID);
     return prev_task;
 }
 
+static void prs_worker_switch_complete(struct prs_worker* worker)
+{
+    /* The register context of the task we switched from is now entirely saved: it can be resumed anywhere */
+    struct prs_task* switched_task = worker->switched_task;
+    if (switched_task) {
+        worker->switched_task = 0;
+        prs_pal_atomic_store(&switched_task->context_loaded, PRS_FALSE);
+    }
+}
+
 static void prs_worker_schedule_internal(struct prs_worker* worker, prs_bool_t check_flags,
     struct prs_pal_context* exit_context)
 {
@@ -168,9 +280,14 @@ static void prs_worker_schedule_internal(struct prs_worker* worker, prs_bool_t c
              * level of the current task (which is none while we are re-scheduling).
              */
             struct prs_task* prev_task = prs_worker_set_current_task(worker, 0);
+            prs_pal_atomic_store(&worker->safepoint, 0);
             if (prev_task) {
                 prev_context = prev_task->context;
+                /* We are still running on the stack of the previous task, along with the scheduler's frames */
+                prs_task_sample_stack(prev_task, &prev_context);
             }
+            /* Expired timeouts make their tasks ready before the scheduler chooses the next task */
+            prs_timer_tick(worker->timer);
             struct prs_task* next_task = 0;
             const prs_bool_t switch_to_next = worker->ops.get_next(worker->userdata, prev_task, &next_task);
             if (next_task) {
@@ -185,7 +302,19 @@ static void prs_worker_schedule_internal(struct prs_worker* worker, prs_bool_t c
                     if (save_context == exit_context) {
                         PRS_FTRACE("(%u) save to exit context", worker->id);
                     }
+                    prs_pal_atomic_store(&next_task->context_loaded, PRS_TRUE);
+                    /* The stack of the task may be being shrunk, see prs_task_reclaim_stacks */
+                    while (prs_pal_atomic_load(&next_task->stack_reclaiming)) {
+                        prs_cycles_pause();
+                    }
+                    worker->switched_task = prev_task;
                     prs_pal_context_swap(save_context, next_task->context);
+                    /*
+                     * The task may have been resumed by another worker of the same scheduler while it was switched
+                     * out.
+                     */
+                    worker = prs_worker_current();
+                    prs_worker_switch_complete(worker);
                     if (save_context == exit_context) {
                         PRS_FTRACE("(%u) back from exit context", worker->id);
                     }
@@ -196,6 +325,7 @@ static void prs_worker_schedule_internal(struct prs_worker* worker, prs_bool_t c
                     continue;
                 } else {
                     PRS_FTRACE("(%u) switch to worker thread stack as requested by scheduler", worker->id);
+                    worker->switched_task = prev_task;
                     prs_pal_context_swap(0, worker->exit_context);
                     PRS_ASSERT(PRS_FALSE);
                 }
@@ -227,6 +357,8 @@ static void prs_worker_entry(void* userdata)
 
     PRS_FTRACE("(%u) exit", worker->id);
 
+    prs_clock_remove_worker(worker);
+
     prs_pal_context_free(worker->exit_context);
     worker->exit_context = 0;
 
@@ -239,8 +371,12 @@ static void prs_worker_task_prologue(struct prs_worker* worker)
     PRS_PRECONDITION(worker);
     PRS_PRECONDITION(!(prs_pal_atomic_load(&worker->flags) & PRS_WORKER_FLAG_INTERRUPTIBLE));
 
+    /* Tasks executed for the first time start here, right after the context switch */
+    prs_worker_switch_complete(worker);
+
     for (;;) {
         prs_worker_schedule_internal(worker, PRS_TRUE, 0);
+        worker = prs_worker_current();
         prs_worker_flags_t flags = 0;
         const prs_bool_t result = prs_pal_atomic_compare_exchange_strong(&worker->flags, &flags, PRS_WORKER_FLAG_INTERRUPTIBLE);
         if (result) {
@@ -310,6 +446,22 @@ static prs_bool_t prs_worker_interruptible(void* userdata, struct prs_pal_contex
     return result;
 }
 
+static void prs_worker_timer_notify(void* userdata, prs_task_prio_t prio)
+{
+    struct prs_worker* worker = userdata;
+    PRS_ASSERT(worker);
+
+    /*
+     * An idle worker is woken up either way. A running task is only interrupted when one of the tasks waiting for a
+     * timeout could take its place, or the place of a task running on another worker of the scheduler.
+     */
+    if (worker->ops.preempts(worker->userdata, prio)) {
+        prs_worker_interrupt(worker);
+    } else {
+        prs_worker_signal(worker);
+    }
+}
+
 /**
  * \brief
  *  Creates a worker.
@@ -331,6 +483,47 @@ prs_result_t prs_worker_create(struct prs_worker_create_params* params, prs_work
     worker->userdata = params->userdata;
     worker->ops = params->ops;
     worker->pal_thread = params->pal_thread;
+    worker->index = prs_pal_atomic_fetch_add(&s_prs_worker_next_index, 1) % PRS_MAX_CPU;
+
+    struct prs_timer_create_params timer_params = {
+        .userdata = worker,
+        .notify = prs_worker_timer_notify
+    };
+    worker->timer = prs_timer_create(&timer_params);
+    if (!worker->timer) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    struct prs_stack_cache_create_params stack_cache_params = {
+        .max_stacks = PRS_STACK_CACHE_MAX_STACKS,
+        .resident_stacks = PRS_STACK_CACHE_RESIDENT_STACKS,
+#if defined(PRS_STACK_CACHE_PREFAULT)
+        .prefault = PRS_TRUE
+#else
+        .prefault = PRS_FALSE
+#endif
+    };
+    worker->stack_cache = prs_stack_cache_create(&stack_cache_params);
+    if (!worker->stack_cache) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    worker->task_cache = prs_task_cache_create();
+    if (!worker->task_cache) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
+
+    struct prs_msgpool_create_params msgpool_params = {
+        .max_blocks = PRS_MSGPOOL_MAX_BLOCKS
+    };
+    worker->msgpool = prs_msgpool_create(&msgpool_params);
+    if (!worker->msgpool) {
+        result = PRS_OUT_OF_MEMORY;
+        goto cleanup;
+    }
 
     worker->id = prs_god_alloc_and_lock(worker, &s_prs_worker_object_ops);
     if (worker->id == PRS_OBJECT_ID_INVALID) {
@@ -345,6 +538,18 @@ prs_result_t prs_worker_create(struct prs_worker_create_params* params, prs_work
     cleanup:
 
     if (worker) {
+        if (worker->msgpool) {
+            prs_msgpool_destroy(worker->msgpool);
+        }
+        if (worker->task_cache) {
+            prs_slab_cache_destroy(worker->task_cache);
+        }
+        if (worker->stack_cache) {
+            prs_stack_cache_destroy(worker->stack_cache);
+        }
+        if (worker->timer) {
+            prs_timer_destroy(worker->timer);
+        }
         prs_pal_free(worker);
     }
 
@@ -381,7 +586,15 @@ prs_result_t prs_worker_start(struct prs_worker* worker)
 
     prs_pal_atomic_store(&worker->flags, 0);
 
+    result = prs_clock_add_worker(worker);
+    if (result != PRS_OK) {
+        goto cleanup;
+    }
+
     result = prs_pal_thread_start(worker->pal_thread);
+    if (result != PRS_OK) {
+        prs_clock_remove_worker(worker);
+    }
 
     cleanup:
 
@@ -435,10 +648,16 @@ static prs_result_t prs_worker_post(struct prs_worker* worker, prs_bool_t interr
 
     prs_worker_flags_t flags = prs_pal_atomic_fetch_or(&worker->flags, PRS_WORKER_FLAG_INTERRUPT_PENDING);
     if (flags & PRS_WORKER_FLAG_IDLE) {
-        flags = prs_pal_atomic_fetch_and(&worker->flags, ~PRS_WORKER_FLAG_IDLE);
+        flags = prs_pal_atomic_fetch_and(&worker->flags, ~(PRS_WORKER_FLAG_IDLE | PRS_WORKER_FLAG_PARKED));
         if (flags & PRS_WORKER_FLAG_IDLE) {
-            PRS_FTRACE("(%u) resume thread", worker->id);
-            return prs_pal_thread_resume(worker->pal_thread);
+            if (flags & PRS_WORKER_FLAG_PARKED) {
+                PRS_FTRACE("(%u) wake up parked thread", worker->id);
+                prs_pal_futex_wake(&worker->flags);
+                return PRS_OK;
+            }
+            /* The worker is still spinning and will notice that its idle flag was cleared */
+            PRS_FTRACE("(%u) wake up spinning thread", worker->id);
+            return PRS_OK;
         }
     }
 
@@ -453,8 +672,19 @@ static prs_result_t prs_worker_post(struct prs_worker* worker, prs_bool_t interr
                  */
                 //PRS_ASSERT(worker != prs_worker_current());
 
+#if defined(PRS_SAFEPOINT)
+                /* Let the running task reach a safepoint; the clock interrupts the worker if it takes too long */
+                PRS_FTRACE("(%u) request safepoint", worker->id);
+                const prs_uint64_t deadline = prs_clock_get_ns() + PRS_SAFEPOINT_GRACE_NS;
+                prs_pal_atomic_store(&worker->safepoint_deadline, deadline);
+                prs_pal_atomic_store(&worker->safepoint, 1);
+                prs_clock_request_ns(deadline);
+                return PRS_OK;
+#else
                 PRS_FTRACE("(%u) interrupt thread", worker->id);
+                prs_pal_atomic_fetch_add(&worker->signals, 1);
                 return prs_pal_thread_interrupt(worker->pal_thread);
+#endif /* PRS_SAFEPOINT */
             }
         }
         PRS_FTRACE("(%u) not interrupting - %s", worker->id,
@@ -492,6 +722,64 @@ prs_result_t prs_worker_signal(struct prs_worker* worker)
     return prs_worker_post(worker, PRS_FALSE);
 }
 
+/**
+ * \brief
+ *  Polls a worker from the clock's context.
+ *
+ *  The worker's timer is polled, and when \ref PRS_SAFEPOINT is defined, the worker is interrupted if its running
+ *  task did not reach a safepoint within the grace period.
+ * \param worker
+ *  Worker to poll.
+ * \param now
+ *  Current tick.
+ * \param now_ns
+ *  Current time, as returned by \ref prs_clock_get_ns.
+ */
+void prs_worker_poll(struct prs_worker* worker, prs_ticks_t now, prs_uint64_t now_ns)
+{
+    PRS_PRECONDITION(worker);
+
+    prs_timer_poll(worker->timer, now, now_ns);
+
+#if defined(PRS_SAFEPOINT)
+    if (!prs_pal_atomic_load(&worker->safepoint)) {
+        return;
+    }
+
+    const prs_uint64_t deadline = prs_pal_atomic_load(&worker->safepoint_deadline);
+    if (now_ns < deadline) {
+        prs_clock_request_ns(deadline);
+        return;
+    }
+
+    if (prs_pal_atomic_exchange(&worker->safepoint, 0)) {
+        /* The request may have been served in between, in which case interrupting the worker is not needed anymore */
+        const prs_worker_flags_t flags = prs_pal_atomic_load(&worker->flags);
+        const prs_worker_flags_t mask = PRS_WORKER_FLAG_INTERRUPTIBLE | PRS_WORKER_FLAG_INTERRUPT_PENDING;
+        if ((flags & mask) == mask) {
+            PRS_FTRACE("(%u) safepoint not reached, interrupt thread", worker->id);
+            prs_pal_atomic_fetch_add(&worker->signals, 1);
+            prs_pal_thread_interrupt(worker->pal_thread);
+        }
+    }
+#endif /* PRS_SAFEPOINT */
+}
+
+/**
+ * \brief
+ *  Clears the preemption request of a worker, when its running task reaches a safepoint.
+ *
+ *  The request is then served by re-enabling interrupts, which invokes the scheduler when the interrupt pending flag
+ *  is raised.
+ * \param worker
+ *  Worker to clear the request of. Must be the current worker, in a non-interruptible section.
+ */
+void prs_worker_clear_safepoint(struct prs_worker* worker)
+{
+    PRS_PRECONDITION(worker);
+    prs_pal_atomic_store(&worker->safepoint, 0);
+}
+
 /**
  * \brief
  *  Disables interrupts (sets non-interruptible mode).
@@ -522,7 +810,7 @@ void prs_worker_int_enable(struct prs_worker* worker)
     PRS_PRECONDITION(worker);
     PRS_ASSERT(!(prs_pal_atomic_load(&worker->flags) & PRS_WORKER_FLAG_INTERRUPTIBLE));
     prs_worker_task_prologue(worker);
-    PRS_ASSERT(prs_pal_atomic_load(&worker->flags) & PRS_WORKER_FLAG_INTERRUPTIBLE);
+    PRS_ASSERT(prs_pal_atomic_load(&prs_worker_current()->flags) & PRS_WORKER_FLAG_INTERRUPTIBLE);
 }
 
 /**
@@ -585,6 +873,102 @@ prs_task_id_t prs_worker_get_current_task_id(struct prs_worker* worker)
     return prs_pal_atomic_load(&worker->current_task_id);
 }
 
+/**
+ * \brief
+ *  Returns the timer owned by the worker.
+ * \param worker
+ *  Worker to get the timer from.
+ * \note
+ *  Tasks may resume their execution on another worker of the same scheduler. A timer entry must therefore be
+ *  canceled on the timer that was returned when it was queued, rather than on the timer of the current worker.
+ */
+struct prs_timer* prs_worker_get_timer(struct prs_worker* worker)
+{
+    return worker->timer;
+}
+
+/**
+ * \brief
+ *  Returns the stack cache of a worker.
+ * \param worker
+ *  Worker to get the stack cache from.
+ * \note
+ *  The stack cache is not thread-safe: it must only be used on the worker's thread, with interrupts disabled.
+ */
+struct prs_stack_cache* prs_worker_get_stack_cache(struct prs_worker* worker)
+{
+    return worker->stack_cache;
+}
+
+/**
+ * \brief
+ *  Returns the task object cache of a worker.
+ * \param worker
+ *  Worker to get the task object cache from.
+ * \note
+ *  The task object cache is not thread-safe: it must only be used on the worker's thread, with interrupts disabled.
+ */
+struct prs_slab_cache* prs_worker_get_task_cache(struct prs_worker* worker)
+{
+    return worker->task_cache;
+}
+
+/**
+ * \brief
+ *  Returns the message pool of a worker.
+ * \param worker
+ *  Worker to get the message pool from.
+ * \note
+ *  The message pool must only be used on the worker's thread, with interrupts disabled. Messages allocated from it can
+ *  be freed to the message pool of any worker.
+ */
+struct prs_msgpool* prs_worker_get_msgpool(struct prs_worker* worker)
+{
+    return worker->msgpool;
+}
+
+/**
+ * \brief
+ *  Sets the number of cycles during which idle workers spin before they park, for all the workers.
+ * \param cycles
+ *  Number of cycles, as measured by \ref prs_cycles_now. Zero makes idle workers park right away.
+ * \note
+ *  Workers that are already idle keep the previous value until they go idle again. On single core systems, workers
+ *  never spin.
+ */
+void prs_worker_set_idle_spin_cycles(prs_uint64_t cycles)
+{
+    prs_pal_atomic_store(&s_prs_worker_idle_spin_cycles, cycles);
+}
+
+/**
+ * \brief
+ *  Returns the statistics of a worker.
+ * \param worker
+ *  Worker to get the statistics from.
+ * \param stats
+ *  Receives the statistics.
+ */
+void prs_worker_get_stats(struct prs_worker* worker, struct prs_worker_stats* stats)
+{
+    stats->spin_hits = prs_pal_atomic_load(&worker->spin_hits);
+    stats->parks = prs_pal_atomic_load(&worker->parks);
+    stats->signals = prs_pal_atomic_load(&worker->signals);
+}
+
+/**
+ * \brief
+ *  Returns the index of the worker, which is below \ref PRS_MAX_CPU. Data that is replicated for each worker can be
+ *  indexed with it.
+ * \note
+ *  Indexes are assigned in creation order, so workers only share an index once more than \ref PRS_MAX_CPU workers
+ *  were created.
+ */
+prs_uint_t prs_worker_get_index(struct prs_worker* worker)
+{
+    return worker->index;
+}
+
 /**
  * \brief
  *  Returns userdata that was set in the \ref prs_worker_create parameters.